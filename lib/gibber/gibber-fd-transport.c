@@ -29,12 +29,25 @@
 # include <unistd.h>
 #endif
 
+#if defined(HAVE_SYS_UIO_H) && !defined(G_OS_WIN32)
+# include <sys/uio.h>
+# define USE_WRITEV 1
+#endif
+
+#if defined(HAVE_SPLICE) && defined(__linux__)
+# include <fcntl.h>
+# define USE_SPLICE 1
+#endif
+
 #include "gibber-sockets.h"
 #include "gibber-fd-transport.h"
 
 #define DEBUG_FLAG DEBUG_NET
 #include "gibber-debug.h"
 
+static gboolean _channel_io_in (GIOChannel *source,
+    GIOCondition condition, gpointer data);
+
 static gboolean _channel_io_out (GIOChannel *source,
     GIOCondition condition, gpointer data);
 
@@ -56,6 +69,9 @@ static void _do_disconnect (GibberFdTransport *self);
 static gboolean gibber_fd_transport_buffer_is_empty (
     GibberTransport *transport);
 
+static gsize gibber_fd_transport_get_buffered_size (
+    GibberTransport *transport);
+
 static void gibber_fd_transport_block_receiving (GibberTransport *transport,
     gboolean block);
 
@@ -72,6 +88,37 @@ gibber_fd_transport_error_quark (void)
   return quark;
 }
 
+/* A chunk of the output queue. Data is only ever appended at the end of the
+ * last chunk and consumed from the front of the first one, so queued bytes
+ * are never moved around. */
+typedef struct
+{
+  gsize size;
+  /* number of valid bytes in data */
+  gsize len;
+  /* number of bytes of data which have already been written out */
+  gsize offset;
+  guint8 data[1];
+} OutputChunk;
+
+/* Small writes are coalesced into chunks of at least that size */
+#define OUTPUT_CHUNK_MIN_SIZE 4096
+/* Maximum number of chunks flushed by a single writev () call */
+#define OUTPUT_MAX_IOV 64
+
+static OutputChunk *
+output_chunk_new (gsize size)
+{
+  OutputChunk *chunk;
+
+  chunk = g_malloc (G_STRUCT_OFFSET (OutputChunk, data) + size);
+  chunk->size = size;
+  chunk->len = 0;
+  chunk->offset = 0;
+
+  return chunk;
+}
+
 /* private structure */
 typedef struct _GibberFdTransportPrivate GibberFdTransportPrivate;
 
@@ -82,8 +129,36 @@ struct _GibberFdTransportPrivate
   guint watch_in;
   guint watch_out;
   guint watch_err;
-  GString *output_buffer;
+  /* queue of OutputChunk, see _writeout () */
+  GQueue output_queue;
+  /* total number of bytes waiting in output_queue */
+  gsize output_queued;
   gboolean receiving_blocked;
+
+  /* Adaptive read buffer. It doubles each time a wakeup fills it completely
+   * (up to max_read_size) and is halved again after a run of wakeups which
+   * used less than a quarter of it. */
+  guint8 *read_buffer;
+  gsize read_buffer_size;
+  gsize max_read_size;
+  guint read_underused;
+
+  /* statistics, see gibber_fd_transport_get_read_stats () */
+  guint64 read_wakeups;
+  guint64 read_bytes;
+
+  /* splice () relay, see gibber_fd_transport_splice_to () */
+  GibberFdTransport *splice_target;
+  GibberFdTransportSpliceCb splice_cb;
+  gpointer splice_user_data;
+  int splice_pipe[2];
+  /* number of bytes sitting in the pipe */
+  gsize splice_pending;
+  /* G_IO_OUT watch on the target while it can't take more data */
+  guint splice_watch_out;
+  /* "buffer-empty" handler on the target while it flushes its own output
+   * queue */
+  gulong splice_buffer_empty_id;
 };
 
 #define GIBBER_FD_TRANSPORT_GET_PRIVATE(o)  \
@@ -97,10 +172,16 @@ gibber_fd_transport_init (GibberFdTransport *self)
   GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
   self->fd = -1;
   priv->channel = NULL;
-  priv->output_buffer = NULL;
+  g_queue_init (&priv->output_queue);
+  priv->output_queued = 0;
   priv->watch_in = 0;
   priv->watch_out = 0;
   priv->watch_err = 0;
+  priv->read_buffer = NULL;
+  priv->read_buffer_size = 0;
+  priv->max_read_size = GIBBER_FD_TRANSPORT_DEFAULT_MAX_READ_SIZE;
+  priv->splice_pipe[0] = -1;
+  priv->splice_pipe[1] = -1;
 }
 
 static void gibber_fd_transport_dispose (GObject *object);
@@ -128,6 +209,7 @@ gibber_fd_transport_class_init (
   transport_class->get_peeraddr = gibber_fd_transport_get_peeraddr;
   transport_class->get_sockaddr = gibber_fd_transport_get_sockaddr;
   transport_class->buffer_is_empty = gibber_fd_transport_buffer_is_empty;
+  transport_class->get_buffered_size = gibber_fd_transport_get_buffered_size;
   transport_class->block_receiving = gibber_fd_transport_block_receiving;
 
   gibber_fd_transport_class->read = gibber_fd_transport_read;
@@ -154,6 +236,16 @@ gibber_fd_transport_dispose (GObject *object)
 void
 gibber_fd_transport_finalize (GObject *object)
 {
+  GibberFdTransport *self = GIBBER_FD_TRANSPORT (object);
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->read_wakeups > 0)
+    DEBUG ("Read %" G_GUINT64_FORMAT " bytes in %" G_GUINT64_FORMAT
+        " wakeups (%" G_GUINT64_FORMAT " bytes per wakeup)", priv->read_bytes,
+        priv->read_wakeups, priv->read_bytes / priv->read_wakeups);
+
+  g_free (priv->read_buffer);
+
   G_OBJECT_CLASS (gibber_fd_transport_parent_class)->finalize (object);
 }
 
@@ -169,6 +261,8 @@ _do_disconnect (GibberFdTransport *self)
 
   DEBUG ("Closing the fd transport");
 
+  gibber_fd_transport_stop_splice (self);
+
   if (priv->channel != NULL)
     {
       if (priv->watch_in != 0)
@@ -190,11 +284,9 @@ _do_disconnect (GibberFdTransport *self)
     }
   self->fd = -1;
 
-  if (priv->output_buffer)
-    {
-      g_string_free (priv->output_buffer, TRUE);
-      priv->output_buffer = NULL;
-    }
+  g_queue_foreach (&priv->output_queue, (GFunc) g_free, NULL);
+  g_queue_clear (&priv->output_queue);
+  priv->output_queued = 0;
 
   if (!priv->dispose_has_run)
     /* If we are disposing we don't care about the state anymore */
@@ -233,6 +325,141 @@ _try_write (GibberFdTransport *self, const guint8 *data, int len,
     return TRUE;
 }
 
+static void
+_queue_output (GibberFdTransport *self, const guint8 *data, gsize len)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  OutputChunk *tail = g_queue_peek_tail (&priv->output_queue);
+
+  priv->output_queued += len;
+
+  if (tail != NULL && tail->size - tail->len >= len)
+    {
+      /* there is still room at the end of the last chunk */
+      memcpy (tail->data + tail->len, data, len);
+      tail->len += len;
+      return;
+    }
+
+  tail = output_chunk_new (MAX (len, OUTPUT_CHUNK_MIN_SIZE));
+  memcpy (tail->data, data, len);
+  tail->len = len;
+  g_queue_push_tail (&priv->output_queue, tail);
+}
+
+/* Drop @written bytes from the front of the output queue */
+static void
+_consume_output (GibberFdTransport *self, gsize written)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  g_assert (written <= priv->output_queued);
+  priv->output_queued -= written;
+
+  while (written > 0)
+    {
+      OutputChunk *head = g_queue_peek_head (&priv->output_queue);
+      gsize remaining = head->len - head->offset;
+
+      if (written < remaining)
+        {
+          head->offset += written;
+          return;
+        }
+
+      written -= remaining;
+      g_free (g_queue_pop_head (&priv->output_queue));
+    }
+}
+
+#ifdef USE_WRITEV
+static GibberFdIOResult
+_writev_output (GibberFdTransport *self, gsize *written, GError **error)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  struct iovec iov[OUTPUT_MAX_IOV];
+  GList *l;
+  int n = 0;
+  ssize_t ret;
+
+  for (l = priv->output_queue.head; l != NULL && n < OUTPUT_MAX_IOV;
+      l = g_list_next (l))
+    {
+      OutputChunk *chunk = l->data;
+
+      iov[n].iov_base = chunk->data + chunk->offset;
+      iov[n].iov_len = chunk->len - chunk->offset;
+      n++;
+    }
+
+  *written = 0;
+
+  do
+    ret = writev (self->fd, iov, n);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return GIBBER_FD_IO_RESULT_AGAIN;
+
+      g_set_error (error, G_IO_CHANNEL_ERROR,
+          g_io_channel_error_from_errno (errno), "writev failed: %s",
+          g_strerror (errno));
+      return GIBBER_FD_IO_RESULT_ERROR;
+    }
+
+  *written = ret;
+  return GIBBER_FD_IO_RESULT_SUCCESS;
+}
+#endif
+
+/* Write out as much of the output queue as the fd accepts */
+static gboolean
+_flush_output (GibberFdTransport *self, GError **err)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  OutputChunk *head;
+  gsize written = 0;
+
+#ifdef USE_WRITEV
+  /* Subclasses overriding write () want to see every byte going through it,
+   * so only use writev () with our default implementation */
+  if (GIBBER_FD_TRANSPORT_GET_CLASS (self)->write == gibber_fd_transport_write)
+    {
+      GError *error = NULL;
+
+      switch (_writev_output (self, &written, &error))
+        {
+          case GIBBER_FD_IO_RESULT_SUCCESS:
+          case GIBBER_FD_IO_RESULT_AGAIN:
+            break;
+          case GIBBER_FD_IO_RESULT_ERROR:
+            gibber_transport_emit_error (GIBBER_TRANSPORT (self), error);
+            /* fallthrough */
+          case GIBBER_FD_IO_RESULT_EOF:
+            DEBUG ("Writing data failed, closing the transport");
+            _do_disconnect (self);
+
+            g_propagate_error (err, error);
+            return FALSE;
+        }
+
+      _consume_output (self, written);
+      return TRUE;
+    }
+#endif
+
+  head = g_queue_peek_head (&priv->output_queue);
+
+  if (!_try_write (self, head->data + head->offset, head->len - head->offset,
+        &written, err))
+    return FALSE;
+
+  _consume_output (self, written);
+  return TRUE;
+}
+
 static gboolean
 _writeout (GibberFdTransport *self, const guint8 *data, gsize len,
     GError **error)
@@ -241,7 +468,7 @@ _writeout (GibberFdTransport *self, const guint8 *data, gsize len,
   gsize written = 0;
 
   DEBUG ("Writing out %" G_GSIZE_FORMAT " bytes", len);
-  if (priv->output_buffer == NULL || priv->output_buffer->len == 0)
+  if (priv->output_queued == 0)
     {
       /* We've got nothing buffer yet so try to write out directly */
       if (!_try_write (self, data, len, &written, error))
@@ -256,26 +483,243 @@ _writeout (GibberFdTransport *self, const guint8 *data, gsize len,
       return TRUE;
     }
 
-  if (priv->output_buffer)
+  _queue_output (self, data + written, len - written);
+
+  if (!priv->watch_out)
     {
-      g_string_append_len (priv->output_buffer, (gchar *) data + written,
-        len - written);
+      priv->watch_out =
+        g_io_add_watch (priv->channel, G_IO_OUT, _channel_io_out, self);
     }
-  else
+
+  return TRUE;
+}
+
+#ifdef USE_SPLICE
+
+/* How much we ask the kernel to move per splice () call */
+#define SPLICE_CHUNK_SIZE (64 * 1024)
+
+static gboolean _splice_target_writable_cb (GIOChannel *source,
+    GIOCondition condition, gpointer data);
+static void _splice_target_buffer_empty_cb (GibberTransport *target,
+    GibberFdTransport *self);
+
+static void
+_splice_wait_target (GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdTransportPrivate *tpriv =
+      GIBBER_FD_TRANSPORT_GET_PRIVATE (priv->splice_target);
+
+  /* Stop reading until the target drained what it already has */
+  if (priv->watch_in != 0)
     {
-      priv->output_buffer = g_string_new_len ((gchar *) data + written,
-          len - written);
+      g_source_remove (priv->watch_in);
+      priv->watch_in = 0;
     }
 
-  if (!priv->watch_out)
+  /* The target's socket may well be writable while its own output queue
+   * is being flushed, so watching it would spin: wait for the queue to be
+   * empty instead */
+  if (tpriv->output_queued > 0)
     {
-      priv->watch_out =
-        g_io_add_watch (priv->channel, G_IO_OUT, _channel_io_out, self);
+      if (priv->splice_buffer_empty_id == 0)
+        priv->splice_buffer_empty_id = g_signal_connect (priv->splice_target,
+            "buffer-empty", G_CALLBACK (_splice_target_buffer_empty_cb),
+            self);
+
+      return;
     }
 
+  if (priv->splice_watch_out == 0)
+    priv->splice_watch_out = g_io_add_watch (tpriv->channel, G_IO_OUT,
+        _splice_target_writable_cb, self);
+}
+
+/* Move what is in the pipe to the target. Returns FALSE if the target
+ * failed, in which case it has been disconnected. */
+static gboolean
+_splice_flush (GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdTransport *target = priv->splice_target;
+  GError *error;
+  gsize moved = 0;
+
+  while (priv->splice_pending > 0)
+    {
+      ssize_t ret;
+
+      ret = splice (priv->splice_pipe[0], NULL, target->fd, NULL,
+          priv->splice_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (ret > 0)
+        {
+          priv->splice_pending -= ret;
+          moved += ret;
+          continue;
+        }
+
+      if (ret == -1 && errno == EINTR)
+        continue;
+
+      if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+
+      error = g_error_new (G_IO_CHANNEL_ERROR,
+          g_io_channel_error_from_errno (errno),
+          "splice to the target failed: %s", g_strerror (errno));
+      DEBUG ("%s", error->message);
+      gibber_transport_emit_error (GIBBER_TRANSPORT (target), error);
+      g_error_free (error);
+
+      /* the target is gone, so is what was still in the pipe */
+      priv->splice_pending = 0;
+
+      g_object_ref (target);
+      gibber_fd_transport_stop_splice (self);
+      _do_disconnect (target);
+      g_object_unref (target);
+      return FALSE;
+    }
+
+  if (moved > 0 && priv->splice_cb != NULL)
+    priv->splice_cb (self, moved, priv->splice_user_data);
+
   return TRUE;
 }
 
+/* The target may be able to take more data: move what is in the pipe and
+ * start reading again once it is empty. Returns TRUE if we still have to
+ * wait for the target. */
+static gboolean
+_splice_target_ready (GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  if (!_splice_flush (self))
+    /* the relay has been stopped */
+    return FALSE;
+
+  if (priv->splice_target != NULL && priv->splice_pending > 0)
+    return TRUE;
+
+  if (!priv->receiving_blocked && priv->watch_in == 0 &&
+      priv->channel != NULL)
+    priv->watch_in = g_io_add_watch (priv->channel, G_IO_IN,
+        _channel_io_in, self);
+
+  return FALSE;
+}
+
+static gboolean
+_splice_target_writable_cb (GIOChannel *source,
+    GIOCondition condition,
+    gpointer data)
+{
+  GibberFdTransport *self = GIBBER_FD_TRANSPORT (data);
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdTransportPrivate *tpriv;
+  gboolean keep_waiting;
+
+  g_assert (priv->splice_target != NULL);
+  tpriv = GIBBER_FD_TRANSPORT_GET_PRIVATE (priv->splice_target);
+
+  if (tpriv->output_queued > 0)
+    {
+      /* Something has been queued on the target meanwhile */
+      priv->splice_watch_out = 0;
+      _splice_wait_target (self);
+      return FALSE;
+    }
+
+  g_object_ref (self);
+
+  keep_waiting = _splice_target_ready (self);
+
+  if (!keep_waiting)
+    priv->splice_watch_out = 0;
+
+  g_object_unref (self);
+  return keep_waiting;
+}
+
+static void
+_splice_target_buffer_empty_cb (GibberTransport *target,
+    GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  g_signal_handler_disconnect (target, priv->splice_buffer_empty_id);
+  priv->splice_buffer_empty_id = 0;
+
+  g_object_ref (self);
+
+  if (_splice_target_ready (self))
+    _splice_wait_target (self);
+
+  g_object_unref (self);
+}
+
+static GibberFdIOResult
+_splice_read (GibberFdTransport *self,
+    GError **error)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdTransportPrivate *tpriv =
+      GIBBER_FD_TRANSPORT_GET_PRIVATE (priv->splice_target);
+  ssize_t ret;
+
+  if (priv->splice_pending > 0 || tpriv->output_queued > 0)
+    {
+      /* Preserve ordering: whatever is waiting for the target goes first */
+      _splice_wait_target (self);
+      return GIBBER_FD_IO_RESULT_AGAIN;
+    }
+
+  do
+    ret = splice (self->fd, NULL, priv->splice_pipe[1], NULL,
+        SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == 0)
+    return GIBBER_FD_IO_RESULT_EOF;
+
+  if (ret == -1)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return GIBBER_FD_IO_RESULT_AGAIN;
+
+      g_set_error (error, G_IO_CHANNEL_ERROR,
+          g_io_channel_error_from_errno (errno), "splice failed: %s",
+          g_strerror (errno));
+      return GIBBER_FD_IO_RESULT_ERROR;
+    }
+
+  priv->read_wakeups++;
+  priv->read_bytes += ret;
+  priv->splice_pending += ret;
+
+  g_object_ref (self);
+
+  if (_splice_flush (self) && priv->splice_target != NULL &&
+      priv->splice_pending > 0)
+    _splice_wait_target (self);
+
+  g_object_unref (self);
+  return GIBBER_FD_IO_RESULT_SUCCESS;
+}
+
+static void
+_splice_target_disconnected_cb (GibberTransport *target,
+    GibberFdTransport *self)
+{
+  DEBUG ("splice target has been disconnected");
+  gibber_fd_transport_stop_splice (self);
+}
+
+#endif /* USE_SPLICE */
+
 static gboolean
 _channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
 {
@@ -285,8 +729,18 @@ _channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
   GibberFdIOResult result;
   GError *error = NULL;
   GibberFdTransportClass *cls = GIBBER_FD_TRANSPORT_GET_CLASS(self);
+  gboolean ret = TRUE;
 
-  result = cls->read (self, priv->channel, &error);
+  /* The data handler may well drop the last reference to the transport,
+   * typically when the data it got is followed by an EOF */
+  g_object_ref (self);
+
+#ifdef USE_SPLICE
+  if (priv->splice_target != NULL)
+    result = _splice_read (self, &error);
+  else
+#endif
+    result = cls->read (self, priv->channel, &error);
 
   switch (result)
     {
@@ -299,10 +753,12 @@ _channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
       case GIBBER_FD_IO_RESULT_EOF:
         DEBUG("Failed to read from the transport, closing..");
         _do_disconnect (self);
-        return FALSE;
+        ret = FALSE;
+        break;
     }
 
-  return TRUE;
+  g_object_unref (self);
+  return ret;
 }
 
 static gboolean
@@ -311,21 +767,14 @@ _channel_io_out (GIOChannel *source, GIOCondition condition, gpointer data)
   GibberFdTransport *self = GIBBER_FD_TRANSPORT (data);
   GibberFdTransportPrivate *priv =
      GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
-  gsize written;
 
-  g_assert (priv->output_buffer);
-  if (!_try_write (self, (guint8 *) priv->output_buffer->str,
-                   priv->output_buffer->len, &written, NULL))
+  g_assert (priv->output_queued > 0);
+  if (!_flush_output (self, NULL))
     {
       return FALSE;
     }
 
-  if (written > 0 )
-    {
-      priv->output_buffer = g_string_erase (priv->output_buffer, 0, written);
-    }
-
-  if (priv->output_buffer->len == 0)
+  if (priv->output_queued == 0)
     {
       priv->watch_out = 0;
       gibber_transport_emit_buffer_empty (GIBBER_TRANSPORT (self));
@@ -411,38 +860,160 @@ gibber_fd_transport_write (GibberFdTransport *fd_transport,
     g_assert_not_reached ();
 }
 
-#define BUFSIZE 1024
+#define MIN_READ_SIZE 4096
+/* Number of consecutive under-used wakeups before the buffer shrinks */
+#define READ_SHRINK_THRESHOLD 8
+
+static void
+resize_read_buffer (GibberFdTransportPrivate *priv,
+    gsize size)
+{
+  if (size == priv->read_buffer_size)
+    return;
+
+  /* keep room for a trailing NUL */
+  priv->read_buffer = g_realloc (priv->read_buffer, size + 1);
+  priv->read_buffer_size = size;
+}
+
+static void
+adapt_read_buffer (GibberFdTransportPrivate *priv,
+    gsize used)
+{
+  if (used == priv->read_buffer_size)
+    {
+      priv->read_underused = 0;
+      return;
+    }
+
+  if (used >= priv->read_buffer_size / 4)
+    {
+      priv->read_underused = 0;
+      return;
+    }
+
+  priv->read_underused++;
+
+  if (priv->read_underused >= READ_SHRINK_THRESHOLD &&
+      priv->read_buffer_size > MIN_READ_SIZE)
+    {
+      resize_read_buffer (priv, MAX (priv->read_buffer_size / 2,
+            MIN_READ_SIZE));
+      priv->read_underused = 0;
+    }
+}
 
 GibberFdIOResult
 gibber_fd_transport_read (GibberFdTransport *transport,
     GIOChannel *channel, GError **error)
 {
-  guint8  buf[BUFSIZE + 1];
+  GibberFdTransportPrivate *priv =
+     GIBBER_FD_TRANSPORT_GET_PRIVATE (transport);
+  GibberFdIOResult result = GIBBER_FD_IO_RESULT_SUCCESS;
   GIOStatus status;
-  gsize bytes_read;
+  gsize total = 0;
 
-  status = g_io_channel_read_chars (channel, (gchar *) buf, BUFSIZE,
-    &bytes_read, error);
+  if (priv->read_buffer == NULL)
+    resize_read_buffer (priv, MIN (MIN_READ_SIZE, priv->max_read_size));
 
-  switch (status)
+  /* Drain as much as we can in one go so the data is handed over in a single
+   * GibberBuffer rather than one small buffer per main loop iteration. */
+  while (TRUE)
     {
-      case G_IO_STATUS_NORMAL:
-        buf[bytes_read] = '\0';
-        DEBUG ("Received %" G_GSIZE_FORMAT " bytes", bytes_read);
-        gibber_transport_received_data (GIBBER_TRANSPORT (transport),
-            buf, bytes_read);
-        return GIBBER_FD_IO_RESULT_SUCCESS;
-      case G_IO_STATUS_ERROR:
-        return GIBBER_FD_IO_RESULT_ERROR;
-      case G_IO_STATUS_EOF:
-        return GIBBER_FD_IO_RESULT_EOF;
-      case G_IO_STATUS_AGAIN:
-        return GIBBER_FD_IO_RESULT_AGAIN;
+      gsize bytes_read = 0;
+      gsize wanted = priv->read_buffer_size - total;
+
+      status = g_io_channel_read_chars (channel,
+          (gchar *) priv->read_buffer + total, wanted, &bytes_read, error);
+
+      if (status != G_IO_STATUS_NORMAL)
+        {
+          switch (status)
+            {
+              case G_IO_STATUS_ERROR:
+                result = GIBBER_FD_IO_RESULT_ERROR;
+                break;
+              case G_IO_STATUS_EOF:
+                result = GIBBER_FD_IO_RESULT_EOF;
+                break;
+              case G_IO_STATUS_AGAIN:
+                result = GIBBER_FD_IO_RESULT_AGAIN;
+                break;
+              default:
+                g_assert_not_reached ();
+            }
+
+          break;
+        }
+
+      total += bytes_read;
+
+      if (bytes_read < wanted)
+        /* socket is drained */
+        break;
+
+      if (priv->read_buffer_size >= priv->max_read_size)
+        /* buffer is full and can't grow, the rest will be read on the next
+         * wakeup */
+        break;
+
+      resize_read_buffer (priv, MIN (priv->read_buffer_size * 2,
+            priv->max_read_size));
     }
 
-  g_assert_not_reached ();
+  if (total == 0)
+    return result;
+
+  adapt_read_buffer (priv, total);
+
+  priv->read_wakeups++;
+  priv->read_bytes += total;
+
+  priv->read_buffer[total] = '\0';
+  DEBUG ("Received %" G_GSIZE_FORMAT " bytes (buffer size %" G_GSIZE_FORMAT
+      ")", total, priv->read_buffer_size);
+  gibber_transport_received_data (GIBBER_TRANSPORT (transport),
+      priv->read_buffer, total);
+
+  /* Data read before hitting EOF or an error has been delivered, now let the
+   * caller handle the EOF or error itself */
+  if (result == GIBBER_FD_IO_RESULT_AGAIN)
+    return GIBBER_FD_IO_RESULT_SUCCESS;
+
+  return result;
 }
 
+void
+gibber_fd_transport_set_max_read_size (GibberFdTransport *self,
+    gsize max_read_size)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  g_return_if_fail (max_read_size > 0);
+
+  priv->max_read_size = max_read_size;
+
+  if (priv->read_buffer_size > max_read_size)
+    resize_read_buffer (priv, max_read_size);
+}
+
+void
+gibber_fd_transport_get_read_stats (GibberFdTransport *self,
+    guint64 *wakeups,
+    guint64 *bytes,
+    gsize *buffer_size)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  if (wakeups != NULL)
+    *wakeups = priv->read_wakeups;
+
+  if (bytes != NULL)
+    *bytes = priv->read_bytes;
+
+  if (buffer_size != NULL)
+    *buffer_size = priv->read_buffer_size;
+}
 
 void
 gibber_fd_transport_set_fd (GibberFdTransport *self, int fd,
@@ -554,7 +1125,17 @@ gibber_fd_transport_buffer_is_empty (GibberTransport *transport)
   GibberFdTransportPrivate *priv =
      GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
 
-  return (priv->output_buffer == NULL || priv->output_buffer->len == 0);
+  return (priv->output_queued == 0);
+}
+
+static gsize
+gibber_fd_transport_get_buffered_size (GibberTransport *transport)
+{
+  GibberFdTransport *self = GIBBER_FD_TRANSPORT (transport);
+  GibberFdTransportPrivate *priv =
+     GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  return priv->output_queued;
 }
 
 static void
@@ -570,7 +1151,7 @@ gibber_fd_transport_block_receiving (GibberTransport *transport,
       g_source_remove (priv->watch_in);
       priv->watch_in = 0;
     }
-  else if (!block && priv->watch_in == 0)
+  else if (!block && priv->watch_in == 0 && priv->splice_watch_out == 0)
     {
       DEBUG ("unblock receiving from the transport");
       if (priv->channel != NULL)
@@ -595,3 +1176,165 @@ gibber_fd_transport_block_receiving (GibberTransport *transport,
 
   priv->receiving_blocked = block;
 }
+
+gboolean
+gibber_fd_transport_splice_supported (void)
+{
+#ifdef USE_SPLICE
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+#ifdef USE_SPLICE
+/* A non-blocking pipe which isn't inherited by our children */
+static gboolean
+make_splice_pipe (int fds[2])
+{
+#ifdef HAVE_PIPE2
+  return (pipe2 (fds, O_NONBLOCK | O_CLOEXEC) == 0);
+#else
+  int i;
+
+  if (pipe (fds) == -1)
+    return FALSE;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (fcntl (fds[i], F_SETFL, O_NONBLOCK) == -1 ||
+          fcntl (fds[i], F_SETFD, FD_CLOEXEC) == -1)
+        {
+          int saved_errno = errno;
+
+          close (fds[0]);
+          close (fds[1]);
+          errno = saved_errno;
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+#endif
+}
+#endif
+
+/**
+ * gibber_fd_transport_splice_to:
+ * @self: the transport data is read from
+ * @target: the transport data is written to
+ * @callback: called with the number of bytes written to @target
+ * @user_data: user data for @callback
+ *
+ * Relay everything read from @self to @target with splice (), through a pipe,
+ * without copying it to userspace. The handler of @self isn't called anymore
+ * until the relay is stopped. Data queued in @target before the relay starts
+ * is written first. Blocking receiving on @self keeps working as usual.
+ *
+ * Returns: %FALSE if splice () is not available or the pipe can't be created,
+ *  in which case the caller should keep using the handler.
+ */
+gboolean
+gibber_fd_transport_splice_to (GibberFdTransport *self,
+    GibberFdTransport *target,
+    GibberFdTransportSpliceCb callback,
+    gpointer user_data)
+{
+#ifdef USE_SPLICE
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  g_return_val_if_fail (GIBBER_IS_FD_TRANSPORT (target), FALSE);
+  g_return_val_if_fail (priv->splice_target == NULL, FALSE);
+
+  if (self->fd == -1 || target->fd == -1)
+    return FALSE;
+
+  if (!make_splice_pipe (priv->splice_pipe))
+    {
+      DEBUG ("can't create pipe: %s", g_strerror (errno));
+      priv->splice_pipe[0] = -1;
+      priv->splice_pipe[1] = -1;
+      return FALSE;
+    }
+
+  DEBUG ("relaying fd %d to fd %d with splice ()", self->fd, target->fd);
+
+  priv->splice_target = g_object_ref (target);
+  priv->splice_cb = callback;
+  priv->splice_user_data = user_data;
+  priv->splice_pending = 0;
+
+  g_signal_connect (target, "disconnected",
+      G_CALLBACK (_splice_target_disconnected_cb), self);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+void
+gibber_fd_transport_stop_splice (GibberFdTransport *self)
+{
+#ifdef USE_SPLICE
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdTransport *target = priv->splice_target;
+
+  if (target == NULL)
+    return;
+
+  priv->splice_target = NULL;
+
+  g_signal_handlers_disconnect_by_func (target,
+      G_CALLBACK (_splice_target_disconnected_cb), self);
+
+  if (priv->splice_watch_out != 0)
+    {
+      g_source_remove (priv->splice_watch_out);
+      priv->splice_watch_out = 0;
+    }
+
+  if (priv->splice_buffer_empty_id != 0)
+    {
+      g_signal_handler_disconnect (target, priv->splice_buffer_empty_id);
+      priv->splice_buffer_empty_id = 0;
+    }
+
+  /* Hand over what is left in the pipe to the target's own output queue.
+   * That's at most one pipe worth of data so copying it is fine. */
+  while (priv->splice_pending > 0 &&
+      GIBBER_TRANSPORT (target)->state == GIBBER_TRANSPORT_CONNECTED)
+    {
+      guint8 buf[4096];
+      ssize_t ret;
+
+      ret = read (priv->splice_pipe[0], buf,
+          MIN (sizeof (buf), priv->splice_pending));
+      if (ret <= 0)
+        break;
+
+      priv->splice_pending -= ret;
+
+      if (!_writeout (target, buf, ret, NULL))
+        break;
+
+      if (priv->splice_cb != NULL)
+        priv->splice_cb (self, ret, priv->splice_user_data);
+    }
+
+  close (priv->splice_pipe[0]);
+  close (priv->splice_pipe[1]);
+  priv->splice_pipe[0] = -1;
+  priv->splice_pipe[1] = -1;
+  priv->splice_pending = 0;
+  priv->splice_cb = NULL;
+  priv->splice_user_data = NULL;
+
+  if (!priv->receiving_blocked && priv->watch_in == 0 &&
+      priv->channel != NULL)
+    priv->watch_in = g_io_add_watch (priv->channel, G_IO_IN,
+        _channel_io_in, self);
+
+  g_object_unref (target);
+#endif
+}
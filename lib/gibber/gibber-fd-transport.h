@@ -91,6 +91,31 @@ GibberFdIOResult gibber_fd_transport_read (GibberFdTransport *transport,
     GIOChannel *channel,
     GError **error);
 
+/* Upper bound of the adaptive read buffer, i.e. the biggest GibberBuffer
+ * which will be passed to the handler in one go */
+#define GIBBER_FD_TRANSPORT_DEFAULT_MAX_READ_SIZE (128 * 1024)
+
+void gibber_fd_transport_set_max_read_size (GibberFdTransport *transport,
+    gsize max_read_size);
+
+void gibber_fd_transport_get_read_stats (GibberFdTransport *transport,
+    guint64 *wakeups,
+    guint64 *bytes,
+    gsize *buffer_size);
+
+typedef void (*GibberFdTransportSpliceCb) (GibberFdTransport *transport,
+    gsize written,
+    gpointer user_data);
+
+gboolean gibber_fd_transport_splice_supported (void);
+
+gboolean gibber_fd_transport_splice_to (GibberFdTransport *transport,
+    GibberFdTransport *target,
+    GibberFdTransportSpliceCb callback,
+    gpointer user_data);
+
+void gibber_fd_transport_stop_splice (GibberFdTransport *transport);
+
 G_END_DECLS
 
 #endif /* #ifndef __GIBBER_FD_TRANSPORT_H__*/
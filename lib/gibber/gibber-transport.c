@@ -279,6 +279,30 @@ gibber_transport_buffer_is_empty (GibberTransport *transport)
   return cls->buffer_is_empty (transport);
 }
 
+gsize
+gibber_transport_get_buffered_size (GibberTransport *transport)
+{
+  GibberTransportClass *cls = GIBBER_TRANSPORT_GET_CLASS (transport);
+
+  if (cls->get_buffered_size != NULL)
+    return cls->get_buffered_size (transport);
+
+  /* We don't know how much is queued, only whether something is */
+  return gibber_transport_buffer_is_empty (transport) ? 0 : 1;
+}
+
+gboolean
+gibber_transport_buffer_is_full (GibberTransport *transport)
+{
+  GibberTransportClass *cls = GIBBER_TRANSPORT_GET_CLASS (transport);
+
+  if (cls->get_buffered_size == NULL)
+    return !gibber_transport_buffer_is_empty (transport);
+
+  return cls->get_buffered_size (transport) >=
+      GIBBER_TRANSPORT_BUFFER_HIGH_WATERMARK;
+}
+
 void
 gibber_transport_emit_buffer_empty (GibberTransport *transport)
 {
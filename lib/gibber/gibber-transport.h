@@ -57,6 +57,7 @@ struct _GibberTransportClass {
     gboolean (*get_sockaddr) (GibberTransport *transport,
         struct sockaddr_storage *addr, socklen_t *len);
     gboolean (*buffer_is_empty) (GibberTransport *transport);
+    gsize (*get_buffered_size) (GibberTransport *transport);
     void (*block_receiving) (GibberTransport *transport, gboolean block);
 };
 
@@ -121,6 +122,14 @@ gboolean gibber_transport_get_sockaddr (GibberTransport *transport,
 
 gboolean gibber_transport_buffer_is_empty (GibberTransport *transport);
 
+gsize gibber_transport_get_buffered_size (GibberTransport *transport);
+
+/* Users feeding a transport faster than it can drain should stop once that
+ * many bytes are queued, and resume on "buffer-empty" */
+#define GIBBER_TRANSPORT_BUFFER_HIGH_WATERMARK (256 * 1024)
+
+gboolean gibber_transport_buffer_is_full (GibberTransport *transport);
+
 void gibber_transport_emit_buffer_empty (GibberTransport *transport);
 
 void gibber_transport_block_receiving (GibberTransport *transport,
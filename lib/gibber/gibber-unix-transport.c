@@ -67,6 +67,9 @@ struct _GibberUnixTransportPrivate
   GibberUnixTransportRecvCredentialsCb recv_creds_cb;
   gpointer recv_creds_data;
 
+  GibberUnixTransportRecvFdCb recv_fd_cb;
+  gpointer recv_fd_data;
+
   gboolean dispose_has_run;
 };
 
@@ -120,6 +123,8 @@ gibber_unix_transport_dispose (GObject *object)
 
   priv->recv_creds_cb = NULL;
   priv->recv_creds_data = NULL;
+  priv->recv_fd_cb = NULL;
+  priv->recv_fd_data = NULL;
 
   if (G_OBJECT_CLASS (gibber_unix_transport_parent_class)->dispose)
     G_OBJECT_CLASS (gibber_unix_transport_parent_class)->dispose (object);
@@ -199,6 +204,119 @@ gibber_unix_transport_new_from_fd (int fd)
   return transport;
 }
 
+gboolean
+gibber_unix_transport_supports_fd_passing (void)
+{
+  return TRUE;
+}
+
+#define FD_BUFSIZE 1024
+
+static GibberFdIOResult
+gibber_unix_transport_read_fd (GibberUnixTransport *self,
+    GError **error)
+{
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+  GibberUnixTransportRecvFdCb callback = priv->recv_fd_cb;
+  gpointer user_data = priv->recv_fd_data;
+  guint8 buffer[FD_BUFSIZE];
+  union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (sizeof (int))];
+  } control;
+  ssize_t bytes_read;
+  GibberBuffer buf;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *ch;
+  int fd = -1;
+
+  /* only one fd is expected */
+  priv->recv_fd_cb = NULL;
+  priv->recv_fd_data = NULL;
+
+  memset (&iov, 0, sizeof (iov));
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof (buffer);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  bytes_read = recvmsg (GIBBER_FD_TRANSPORT (self)->fd, &msg, 0);
+
+  if (bytes_read <= 0)
+    {
+      GError *err = NULL;
+
+      if (bytes_read == 0)
+        g_set_error_literal (&err, GIBBER_UNIX_TRANSPORT_ERROR,
+            GIBBER_UNIX_TRANSPORT_ERROR_NO_FD,
+            "connection closed before receiving a file descriptor");
+      else
+        g_set_error_literal (&err, G_IO_CHANNEL_ERROR,
+            g_io_channel_error_from_errno (errno), "recvmsg failed");
+
+      callback (self, NULL, -1, err, user_data);
+      g_propagate_error (error, err);
+
+      return GIBBER_FD_IO_RESULT_ERROR;
+    }
+
+  buf.data = buffer;
+  buf.length = bytes_read;
+
+  for (ch = CMSG_FIRSTHDR (&msg); ch != NULL; ch = CMSG_NXTHDR (&msg, ch))
+    {
+      if (ch->cmsg_level == SOL_SOCKET && ch->cmsg_type == SCM_RIGHTS)
+        {
+          memcpy (&fd, CMSG_DATA (ch), sizeof (int));
+          break;
+        }
+    }
+
+  if (fd == -1)
+    {
+      GError *err = NULL;
+
+      DEBUG ("Message doesn't contain a file descriptor");
+
+      g_set_error_literal (&err, GIBBER_UNIX_TRANSPORT_ERROR,
+          GIBBER_UNIX_TRANSPORT_ERROR_NO_FD,
+          "no file descriptor received");
+
+      callback (self, &buf, -1, err, user_data);
+      g_error_free (err);
+    }
+  else
+    {
+      DEBUG ("received fd %d", fd);
+      callback (self, &buf, fd, NULL, user_data);
+    }
+
+  return GIBBER_FD_IO_RESULT_SUCCESS;
+}
+
+gboolean
+gibber_unix_transport_recv_fd (GibberUnixTransport *self,
+    GibberUnixTransportRecvFdCb callback,
+    gpointer user_data)
+{
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->recv_fd_cb != NULL || priv->recv_creds_cb != NULL)
+    {
+      DEBUG ("already waiting for a fd or credentials");
+      return FALSE;
+    }
+
+  priv->recv_fd_cb = callback;
+  priv->recv_fd_data = user_data;
+  return TRUE;
+}
+
 /* Patches that reimplement these functions for non-Linux would be welcome
  * (please file a bug) */
 
@@ -278,6 +396,9 @@ gibber_unix_transport_read (GibberFdTransport *transport,
   struct ucred *cred;
   int opt;
 
+  if (priv->recv_fd_cb != NULL)
+    return gibber_unix_transport_read_fd (self, error);
+
   if (priv->recv_creds_cb == NULL)
     return gibber_fd_transport_read (transport, channel, error);
 
@@ -405,6 +526,12 @@ gibber_unix_transport_read (GibberFdTransport *transport,
     GIOChannel *channel,
     GError **error)
 {
+  GibberUnixTransport *self = GIBBER_UNIX_TRANSPORT (transport);
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->recv_fd_cb != NULL)
+    return gibber_unix_transport_read_fd (self, error);
+
   return gibber_fd_transport_read (transport, channel, error);
 }
 
@@ -48,6 +48,7 @@ typedef enum
   GIBBER_UNIX_TRANSPORT_ERROR_CONNECT_FAILED,
   GIBBER_UNIX_TRANSPORT_ERROR_FAILED,
   GIBBER_UNIX_TRANSPORT_ERROR_NO_CREDENTIALS,
+  GIBBER_UNIX_TRANSPORT_ERROR_NO_FD,
 } GibberUnixTransportError;
 
 typedef struct _GibberUnixTransport GibberUnixTransport;
@@ -110,6 +111,20 @@ gboolean gibber_unix_transport_recv_credentials (GibberUnixTransport *transport,
     GibberUnixTransportRecvCredentialsCb callback,
     gpointer user_data);
 
+gboolean gibber_unix_transport_supports_fd_passing (void);
+
+/* @fd is owned by the callback, -1 on error */
+typedef void (*GibberUnixTransportRecvFdCb) (
+    GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data);
+
+gboolean gibber_unix_transport_recv_fd (GibberUnixTransport *transport,
+    GibberUnixTransportRecvFdCb callback,
+    gpointer user_data);
+
 G_END_DECLS
 
 #endif /* G_OS_UNIX */
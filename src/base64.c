@@ -0,0 +1,540 @@
+/*
+ * base64.c - Source for Gabble's base64 codec
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "base64.h"
+
+#include <string.h>
+
+/* The vector kernels are built with per-function target attributes, so the
+ * rest of Gabble doesn't need to be compiled for a particular CPU. SSSE3 is
+ * the baseline rather than SSE2 as both directions rely on pshufb. */
+#if (defined (__x86_64__) || defined (__i386__)) && \
+    (defined (__clang__) || \
+     (defined (__GNUC__) && \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+# define USE_X86_SIMD
+# include <immintrin.h>
+# define TARGET(isa) __attribute__ ((target (isa)))
+#endif
+
+#define INVALID 0xff
+#define PADDING 0xfe
+
+static const gchar encode_table[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const guint8 decode_table[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+  0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+  0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+  0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+  0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+  0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* A kernel handles as many whole blocks from the start of its input as it
+ * can and returns the number of input bytes it used; the scalar code takes
+ * care of the rest, and of everything if the kernels are NULL. */
+typedef gsize (*EncodeKernel) (const guchar *in, gsize len, gchar *out);
+/* Decode kernels stop at the first block containing anything but base64
+ * alphabet characters. */
+typedef gsize (*DecodeKernel) (const gchar *in, gsize len, guchar *out);
+
+typedef struct {
+    const gchar *name;
+    EncodeKernel encode;
+    DecodeKernel decode;
+} Implementation;
+
+#ifdef USE_X86_SIMD
+
+/* The vector code follows the approach described by Wojciech Muła and
+ * Daniel Lemire in "Faster Base64 Encoding and Decoding Using AVX2
+ * Instructions" (ACM Transactions on the Web, 2018). */
+
+/* 12 input bytes in the low part of @in -> 16 6-bit indices */
+static inline TARGET ("ssse3") __m128i
+enc_reshuffle_ssse3 (__m128i in)
+{
+  __m128i t0, t1, t2, t3;
+
+  in = _mm_shuffle_epi8 (in, _mm_set_epi8 (
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+  t0 = _mm_and_si128 (in, _mm_set1_epi32 (0x0fc0fc00));
+  t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+  t2 = _mm_and_si128 (in, _mm_set1_epi32 (0x003f03f0));
+  t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+
+  return _mm_or_si128 (t1, t3);
+}
+
+/* 6-bit indices -> ASCII */
+static inline TARGET ("ssse3") __m128i
+enc_translate_ssse3 (__m128i in)
+{
+  __m128i result, less;
+  const __m128i shift_lut = _mm_setr_epi8 (
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0);
+
+  /* 0..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+  result = _mm_subs_epu8 (in, _mm_set1_epi8 (51));
+  /* 0..25 -> 13 */
+  less = _mm_cmpgt_epi8 (_mm_set1_epi8 (26), in);
+  result = _mm_or_si128 (result, _mm_and_si128 (less, _mm_set1_epi8 (13)));
+
+  return _mm_add_epi8 (_mm_shuffle_epi8 (shift_lut, result), in);
+}
+
+static TARGET ("ssse3") gsize
+encode_ssse3 (const guchar *in,
+              gsize len,
+              gchar *out)
+{
+  gsize done = 0;
+
+  /* Each iteration loads 16 bytes and uses 12 of them */
+  while (len - done >= 16)
+    {
+      __m128i str = _mm_loadu_si128 ((const __m128i *) (in + done));
+
+      str = enc_translate_ssse3 (enc_reshuffle_ssse3 (str));
+      _mm_storeu_si128 ((__m128i *) out, str);
+
+      done += 12;
+      out += 16;
+    }
+
+  return done;
+}
+
+static inline TARGET ("ssse3") __m128i
+dec_reshuffle_ssse3 (__m128i in)
+{
+  const __m128i merge_ab_and_bc = _mm_maddubs_epi16 (in,
+      _mm_set1_epi32 (0x01400140));
+  const __m128i out = _mm_madd_epi16 (merge_ab_and_bc,
+      _mm_set1_epi32 (0x00011000));
+
+  return _mm_shuffle_epi8 (out, _mm_setr_epi8 (
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+/* Returns FALSE if @str contains anything else than base64 alphabet
+ * characters; otherwise, turns it into 6-bit values */
+static inline TARGET ("ssse3") gboolean
+dec_translate_ssse3 (__m128i *str)
+{
+  const __m128i lut_lo = _mm_setr_epi8 (
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8 (
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (
+      0, 16, 19, 4, -65, -65, -71, -71,
+      0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  __m128i hi_nibbles, lo_nibbles, hi, lo, eq_2f, roll;
+
+  hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+  lo_nibbles = _mm_and_si128 (*str, mask_2f);
+  hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+
+  if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi),
+          _mm_setzero_si128 ())) != 0)
+    return FALSE;
+
+  eq_2f = _mm_cmpeq_epi8 (*str, mask_2f);
+  roll = _mm_shuffle_epi8 (lut_roll, _mm_add_epi8 (eq_2f, hi_nibbles));
+  *str = _mm_add_epi8 (*str, roll);
+
+  return TRUE;
+}
+
+static TARGET ("ssse3") gsize
+decode_ssse3 (const gchar *in,
+              gsize len,
+              guchar *out)
+{
+  gsize done = 0;
+
+  /* Each iteration produces 12 bytes but stores 16; keeping 8 more input
+   * bytes ensures the output buffer has room for that */
+  while (len - done >= 24)
+    {
+      __m128i str = _mm_loadu_si128 ((const __m128i *) (in + done));
+
+      if (!dec_translate_ssse3 (&str))
+        break;
+
+      _mm_storeu_si128 ((__m128i *) out, dec_reshuffle_ssse3 (str));
+
+      done += 16;
+      out += 12;
+    }
+
+  return done;
+}
+
+static TARGET ("avx2") gsize
+encode_avx2 (const guchar *in,
+             gsize len,
+             gchar *out)
+{
+  const __m256i shuffle = _mm256_setr_epi8 (
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+      1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m256i shift_lut = _mm256_setr_epi8 (
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+      '/' - 63, 'A', 0, 0);
+  gsize done = 0;
+
+  /* 24 bytes per iteration: 12 in each 128 bits lane, loaded with two
+   * overlapping 16 bytes loads */
+  while (len - done >= 28)
+    {
+      __m256i str, t0, t1, t2, t3, result, less;
+
+      str = _mm256_inserti128_si256 (_mm256_castsi128_si256 (
+            _mm_loadu_si128 ((const __m128i *) (in + done))),
+          _mm_loadu_si128 ((const __m128i *) (in + done + 12)), 1);
+
+      str = _mm256_shuffle_epi8 (str, shuffle);
+      t0 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x0fc0fc00));
+      t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+      t2 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x003f03f0));
+      t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+      str = _mm256_or_si256 (t1, t3);
+
+      result = _mm256_subs_epu8 (str, _mm256_set1_epi8 (51));
+      less = _mm256_cmpgt_epi8 (_mm256_set1_epi8 (26), str);
+      result = _mm256_or_si256 (result,
+          _mm256_and_si256 (less, _mm256_set1_epi8 (13)));
+      str = _mm256_add_epi8 (_mm256_shuffle_epi8 (shift_lut, result), str);
+
+      _mm256_storeu_si256 ((__m256i *) out, str);
+
+      done += 24;
+      out += 32;
+    }
+
+  /* finish with the 128 bits code */
+  return done + encode_ssse3 (in + done, len - done, out);
+}
+
+static TARGET ("avx2") gsize
+decode_avx2 (const gchar *in,
+             gsize len,
+             guchar *out)
+{
+  const __m256i lut_lo = _mm256_setr_epi8 (
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8 (
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8 (
+      0, 16, 19, 4, -65, -65, -71, -71,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 16, 19, 4, -65, -65, -71, -71,
+      0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+  const __m256i pack = _mm256_setr_epi8 (
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  gsize done = 0;
+
+  /* 24 bytes produced, 32 stored: see decode_ssse3 () */
+  while (len - done >= 48)
+    {
+      __m256i str, hi_nibbles, lo_nibbles, hi, lo, eq_2f, roll;
+
+      str = _mm256_loadu_si256 ((const __m256i *) (in + done));
+
+      hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (str, 4), mask_2f);
+      lo_nibbles = _mm256_and_si256 (str, mask_2f);
+      hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+      lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+
+      if (!_mm256_testz_si256 (lo, hi))
+        break;
+
+      eq_2f = _mm256_cmpeq_epi8 (str, mask_2f);
+      roll = _mm256_shuffle_epi8 (lut_roll,
+          _mm256_add_epi8 (eq_2f, hi_nibbles));
+      str = _mm256_add_epi8 (str, roll);
+
+      str = _mm256_maddubs_epi16 (str, _mm256_set1_epi32 (0x01400140));
+      str = _mm256_madd_epi16 (str, _mm256_set1_epi32 (0x00011000));
+      str = _mm256_shuffle_epi8 (str, pack);
+      str = _mm256_permutevar8x32_epi32 (str,
+          _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, -1, -1));
+
+      _mm256_storeu_si256 ((__m256i *) out, str);
+
+      done += 32;
+      out += 24;
+    }
+
+  return done + decode_ssse3 (in + done, len - done, out);
+}
+
+#endif /* USE_X86_SIMD */
+
+static const Implementation implementations[] = {
+#ifdef USE_X86_SIMD
+    { "avx2", encode_avx2, decode_avx2 },
+    { "ssse3", encode_ssse3, decode_ssse3 },
+#endif
+    { "scalar", NULL, NULL },
+};
+
+static const Implementation *impl = NULL;
+
+static gboolean
+implementation_supported (const Implementation *i)
+{
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init ();
+
+  if (!strcmp (i->name, "avx2"))
+    return __builtin_cpu_supports ("avx2");
+
+  if (!strcmp (i->name, "ssse3"))
+    return __builtin_cpu_supports ("ssse3");
+#endif
+
+  return TRUE;
+}
+
+static const Implementation *
+get_implementation (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      guint i;
+
+      /* The first one is the fastest */
+      for (i = 0; i < G_N_ELEMENTS (implementations); i++)
+        {
+          if (implementation_supported (&implementations[i]))
+            break;
+        }
+
+      impl = &implementations[i];
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return impl;
+}
+
+const gchar *
+gabble_base64_get_implementation (void)
+{
+  return get_implementation ()->name;
+}
+
+gboolean
+gabble_base64_set_implementation (const gchar *name)
+{
+  guint i;
+
+  get_implementation ();
+
+  for (i = 0; i < G_N_ELEMENTS (implementations); i++)
+    {
+      if (!strcmp (implementations[i].name, name))
+        {
+          if (!implementation_supported (&implementations[i]))
+            return FALSE;
+
+          impl = &implementations[i];
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+gsize
+gabble_base64_encode_into (const guchar *data,
+                           gsize len,
+                           gchar *out)
+{
+  EncodeKernel encode = get_implementation ()->encode;
+  gsize done = 0;
+  gchar *o;
+
+  if (encode != NULL)
+    done = encode (data, len, out);
+
+  o = out + (done / 3) * 4;
+
+  for (; len - done >= 3; done += 3)
+    {
+      guint32 v = (data[done] << 16) | (data[done + 1] << 8) | data[done + 2];
+
+      *o++ = encode_table[(v >> 18) & 0x3f];
+      *o++ = encode_table[(v >> 12) & 0x3f];
+      *o++ = encode_table[(v >> 6) & 0x3f];
+      *o++ = encode_table[v & 0x3f];
+    }
+
+  if (len - done == 1)
+    {
+      *o++ = encode_table[data[done] >> 2];
+      *o++ = encode_table[(data[done] & 0x03) << 4];
+      *o++ = '=';
+      *o++ = '=';
+    }
+  else if (len - done == 2)
+    {
+      *o++ = encode_table[data[done] >> 2];
+      *o++ = encode_table[((data[done] & 0x03) << 4) | (data[done + 1] >> 4)];
+      *o++ = encode_table[(data[done + 1] & 0x0f) << 2];
+      *o++ = '=';
+    }
+
+  *o = '\0';
+  return o - out;
+}
+
+gchar *
+gabble_base64_encode (const guchar *data,
+                      gsize len)
+{
+  gchar *out = g_malloc (GABBLE_BASE64_ENCODED_LEN (len) + 1);
+
+  gabble_base64_encode_into (data, len, out);
+  return out;
+}
+
+void
+gabble_base64_encode_to_node (WockyNode *node,
+                              const guchar *data,
+                              gsize len)
+{
+  g_free (node->content);
+  node->content = gabble_base64_encode (data, len);
+}
+
+guchar *
+gabble_base64_decode (const gchar *text,
+                      gsize *out_len)
+{
+  DecodeKernel decode = get_implementation ()->decode;
+  gsize len = strlen (text);
+  /* same size as g_base64_decode () */
+  guchar *out = g_malloc ((len / 4) * 3 + 3);
+  guchar *o = out;
+  guint32 acc = 0;
+  guint n = 0;
+  gsize i = 0;
+
+  while (i < len)
+    {
+      guint8 v;
+
+      /* Let the kernel have a go whenever we are at a quantum boundary; it
+       * gives up on line breaks, which we then skip here */
+      if (n == 0 && decode != NULL)
+        {
+          gsize done = decode (text + i, len - i, o);
+
+          i += done;
+          o += (done / 4) * 3;
+
+          if (i == len)
+            break;
+        }
+
+      v = decode_table[(guchar) text[i++]];
+
+      if (v == PADDING)
+        break;
+
+      if (v == INVALID)
+        continue;
+
+      acc = (acc << 6) | v;
+
+      if (++n == 4)
+        {
+          *o++ = acc >> 16;
+          *o++ = acc >> 8;
+          *o++ = acc;
+          acc = 0;
+          n = 0;
+        }
+    }
+
+  if (n == 2)
+    {
+      *o++ = acc >> 4;
+    }
+  else if (n == 3)
+    {
+      *o++ = acc >> 10;
+      *o++ = acc >> 2;
+    }
+
+  *out_len = o - out;
+  return out;
+}
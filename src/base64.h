@@ -0,0 +1,55 @@
+/*
+ * base64.h - Headers for Gabble's base64 codec
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_BASE64_H__
+#define __GABBLE_BASE64_H__
+
+#include <glib.h>
+#include <wocky/wocky.h>
+
+G_BEGIN_DECLS
+
+/* Drop-in replacements for g_base64_encode () and g_base64_decode () used on
+ * the in-band data paths. The SIMD implementation best suited to the CPU is
+ * picked the first time one of them is called. Like GLib, the decoder skips
+ * characters which are not part of the base64 alphabet, such as the line
+ * breaks of a vCard BINVAL; it stops at the first '='. */
+gchar *gabble_base64_encode (const guchar *data, gsize len);
+guchar *gabble_base64_decode (const gchar *text, gsize *out_len);
+
+/* Length of the encoding of @len bytes, not counting the trailing NUL */
+#define GABBLE_BASE64_ENCODED_LEN(len) ((((len) + 2) / 3) * 4)
+
+/* Encode into @out, which must have room for
+ * GABBLE_BASE64_ENCODED_LEN (@len) + 1 bytes. Returns the length of the
+ * NUL-terminated encoding. */
+gsize gabble_base64_encode_into (const guchar *data, gsize len, gchar *out);
+
+/* Replace the content of @node with the encoding of @data, without copying
+ * the encoded text again */
+void gabble_base64_encode_to_node (WockyNode *node, const guchar *data,
+    gsize len);
+
+/* For tests and benchmarks: "scalar", "ssse3" or "avx2" */
+const gchar *gabble_base64_get_implementation (void);
+gboolean gabble_base64_set_implementation (const gchar *name);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_BASE64_H__ */
@@ -29,6 +29,9 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include <gibber/gibber-sockets.h>
+#include <gibber/gibber-listener.h>
+
 #define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
 
 #include "bytestream-ibb.h"
@@ -59,6 +62,20 @@ G_DEFINE_TYPE (GabbleBytestreamFactory, gabble_bytestream_factory,
 /* 6 hours */
 #define PROXIES_LIST_LIFE_TIME 6 * 60 * 60
 
+/* The on-disk proxy cache remembers the fallback proxies we used and how
+ * well they performed so they can be offered straight away, best first, on
+ * the next connection. */
+#define PROXY_CACHE_SERVICE_GROUP "Service"
+#define PROXY_CACHE_PROXY_GROUP_PREFIX "Proxy "
+/* The life time (in seconds) of the cached proxies which have not been
+ * seen since */
+/* 1 week */
+#define PROXY_CACHE_LIFE_TIME 7 * 24 * 60 * 60
+/* Delay (in seconds) before writing the proxy cache once it changed */
+#define PROXY_CACHE_SAVE_DELAY 5
+/* The latency (in ms) we assume for proxies that we never used */
+#define UNKNOWN_PROXY_LATENCY 1000
+
 /* properties */
 enum
 {
@@ -126,7 +143,7 @@ gabble_socks5_proxy_new (const gchar *jid,
 {
   GabbleSocks5Proxy *proxy;
 
-  proxy = g_slice_new (GabbleSocks5Proxy);
+  proxy = g_slice_new0 (GabbleSocks5Proxy);
   proxy->jid = g_strdup (jid);
   proxy->host = g_strdup (host);
   proxy->port = port;
@@ -169,6 +186,9 @@ struct _GabbleBytestreamFactoryPrivate
    * BytestreamIdentifier -> GabbleBytestreamMultiple */
   GHashTable *multiple_bytestreams;
 
+  /* Shares the bandwidth between the transfers */
+  GabbleTransferScheduler *scheduler;
+
   /* List of GabbleSocks5Proxy discovered on the connection */
   GSList *socks5_proxies;
   /* List of GabbleSocks5Proxy found using the fallback-socks5-proxies param */
@@ -181,6 +201,19 @@ struct _GabbleBytestreamFactoryPrivate
   /* Time stamp of the proxies list received from TELEPATHY_PROXIES_SERVICE */
   GTimeVal proxies_list_stamp;
 
+  /* Path of the on-disk proxy cache, NULL if it's disabled */
+  gchar *proxy_cache_path;
+  guint save_proxy_cache_id;
+
+  /* Listener shared by all the SOCKS5 bytestreams we initiate, created the
+   * first time one of them needs it */
+  GibberListener *socks5_listener;
+  /* Destination domain (SHA-1 of sid + initiator + target) of the
+   * connections the SOCKS5 bytestreams are waiting for.
+   *
+   * owned gchar * -> borrowed GabbleBytestreamSocks5 */
+  GHashTable *socks5_domains;
+
   gboolean dispose_has_run;
 };
 
@@ -211,6 +244,8 @@ static void query_proxies (GabbleBytestreamFactory *self,
 
 static GSList * randomize_g_slist (GSList *list);
 
+static void schedule_proxy_cache_save (GabbleBytestreamFactory *self);
+
 static void
 gabble_bytestream_factory_init (GabbleBytestreamFactory *self)
 {
@@ -231,6 +266,9 @@ gabble_bytestream_factory_init (GabbleBytestreamFactory *self)
   priv->multiple_bytestreams = g_hash_table_new_full (bytestream_id_hash,
       bytestream_id_equal, bytestream_id_free, g_object_unref);
 
+  priv->socks5_domains = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+
   memset (&priv->proxies_list_stamp, 0, sizeof (GTimeVal));
 }
 
@@ -245,6 +283,51 @@ cmp_proxy (gconstpointer a,
   return strcmp (proxy_a->jid, proxy_b->jid);
 }
 
+/* The lower the better */
+static gdouble
+proxy_rank (GabbleSocks5Proxy *proxy)
+{
+  guint latency = proxy->latency > 0 ? proxy->latency : UNKNOWN_PROXY_LATENCY;
+
+  /* Divide by the estimated success rate so fast but unreliable proxies
+   * don't come first */
+  return latency * (gdouble) (proxy->successes + proxy->failures + 2) /
+      (proxy->successes + 1);
+}
+
+static gint
+cmp_proxy_rank (gconstpointer a,
+    gconstpointer b)
+{
+  gdouble rank_a = proxy_rank ((GabbleSocks5Proxy *) a);
+  gdouble rank_b = proxy_rank ((GabbleSocks5Proxy *) b);
+
+  if (rank_a < rank_b)
+    return -1;
+
+  if (rank_a > rank_b)
+    return 1;
+
+  return 0;
+}
+
+static GabbleSocks5Proxy *
+find_proxy (GSList *list,
+    const gchar *jid)
+{
+  GSList *l;
+
+  for (l = list; l != NULL; l = g_slist_next (l))
+    {
+      GabbleSocks5Proxy *proxy = l->data;
+
+      if (!tp_strdiff (proxy->jid, jid))
+        return proxy;
+    }
+
+  return NULL;
+}
+
 static void
 add_proxy_to_list (GabbleBytestreamFactory *self,
     GabbleSocks5Proxy *proxy,
@@ -267,12 +350,20 @@ add_proxy_to_list (GabbleBytestreamFactory *self,
   found = g_slist_find_custom (*list, proxy, cmp_proxy);
   if (found != NULL)
     {
+      GabbleSocks5Proxy *known = found->data;
+
       DEBUG ("%s SOCKS5 proxy (%s %s:%d) is already known; "
           "move it to the head of the list",
           fallback ? "Fallback": "Discovered",
           proxy->jid, proxy->host, proxy->port);
 
+      /* Keep what we learnt about it */
+      proxy->latency = known->latency;
+      proxy->successes = known->successes;
+      proxy->failures = known->failures;
+
       *list = g_slist_delete_link (*list, found);
+      gabble_socks5_proxy_free (known);
     }
   else
     {
@@ -282,21 +373,30 @@ add_proxy_to_list (GabbleBytestreamFactory *self,
 
       if (fallback && g_slist_length (*list) >= FALLBACK_PROXY_CACHE_SIZE)
         {
-          GSList *last;
-          GabbleSocks5Proxy *oldest;
+          GSList *l, *worst = NULL;
+          GabbleSocks5Proxy *evicted;
 
-          last = g_slist_last (*list);
-          oldest = last->data;
+          /* Among equally ranked proxies, the oldest one is removed */
+          for (l = *list; l != NULL; l = g_slist_next (l))
+            {
+              if (worst == NULL || cmp_proxy_rank (l->data, worst->data) >= 0)
+                worst = l;
+            }
 
-          DEBUG ("Proxy cache is full, remove the oldest entry (%s)",
-              oldest->jid);
+          evicted = worst->data;
 
-          *list = g_slist_delete_link (*list, last);
-          gabble_socks5_proxy_free (oldest);
+          DEBUG ("Proxy cache is full, remove the worst entry (%s)",
+              evicted->jid);
+
+          *list = g_slist_delete_link (*list, worst);
+          gabble_socks5_proxy_free (evicted);
         }
     }
 
   *list = g_slist_prepend (*list, proxy);
+
+  if (fallback)
+    schedule_proxy_cache_save (self);
 }
 
 static void
@@ -474,6 +574,8 @@ proxies_disco_cb (GabbleDisco *disco,
   if (new_list == NULL)
     return;
 
+  schedule_proxy_cache_save (self);
+
   /* replace the old list by the new one */
   g_slist_foreach (priv->socks5_potential_proxies, (GFunc) g_free, NULL);
   g_slist_free (priv->socks5_potential_proxies);
@@ -570,6 +672,255 @@ randomize_g_slist (GSList *list)
   return g_slist_concat (new_head, list);
 }
 
+static GKeyFile *
+proxy_cache_open (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+  GKeyFile *cache = g_key_file_new ();
+  GError *error = NULL;
+
+  if (!g_key_file_load_from_file (cache, priv->proxy_cache_path,
+        G_KEY_FILE_NONE, &error))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        DEBUG ("Failed to load SOCKS5 proxy cache %s: %s",
+            priv->proxy_cache_path, error->message);
+
+      g_error_free (error);
+    }
+
+  return cache;
+}
+
+static void
+load_proxy_cache (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+  GKeyFile *cache;
+  GTimeVal now;
+  gchar **groups;
+  GSList *loaded = NULL;
+  guint i;
+
+  if (priv->proxy_cache_path == NULL)
+    return;
+
+  cache = proxy_cache_open (self);
+  g_get_current_time (&now);
+
+  if (priv->socks5_potential_proxies == NULL)
+    {
+      /* No fallback proxies are configured; reuse the list we got from
+       * TELEPATHY_PROXIES_SERVICE if it has not expired yet */
+      gint64 stamp;
+      gchar **jids;
+
+      stamp = g_key_file_get_int64 (cache, PROXY_CACHE_SERVICE_GROUP,
+          "timestamp", NULL);
+      jids = g_key_file_get_string_list (cache, PROXY_CACHE_SERVICE_GROUP,
+          "proxies", NULL, NULL);
+
+      if (jids != NULL && now.tv_sec - stamp <= PROXIES_LIST_LIFE_TIME)
+        {
+          DEBUG ("Use cached %s proxies list", TELEPATHY_PROXIES_SERVICE);
+
+          for (i = 0; jids[i] != NULL; i++)
+            priv->socks5_potential_proxies = g_slist_prepend (
+                priv->socks5_potential_proxies, g_strdup (jids[i]));
+
+          priv->socks5_potential_proxies = randomize_g_slist (
+              priv->socks5_potential_proxies);
+          priv->next_query = priv->socks5_potential_proxies;
+          priv->proxies_list_stamp.tv_sec = stamp;
+        }
+
+      g_strfreev (jids);
+    }
+
+  groups = g_key_file_get_groups (cache, NULL);
+
+  for (i = 0; groups[i] != NULL; i++)
+    {
+      const gchar *jid;
+      gchar *host;
+      gint port;
+      GabbleSocks5Proxy *proxy;
+
+      if (!g_str_has_prefix (groups[i], PROXY_CACHE_PROXY_GROUP_PREFIX))
+        continue;
+
+      jid = groups[i] + strlen (PROXY_CACHE_PROXY_GROUP_PREFIX);
+
+      /* Only use the proxies this connection would have queried */
+      if (g_slist_find_custom (priv->socks5_potential_proxies, jid,
+            (GCompareFunc) strcmp) == NULL)
+        continue;
+
+      if (now.tv_sec - g_key_file_get_int64 (cache, groups[i], "timestamp",
+            NULL) > PROXY_CACHE_LIFE_TIME)
+        continue;
+
+      host = g_key_file_get_string (cache, groups[i], "host", NULL);
+      port = g_key_file_get_integer (cache, groups[i], "port", NULL);
+
+      if (host == NULL || port <= 0 || port > G_MAXUINT16)
+        {
+          DEBUG ("Ignore invalid cached proxy %s", jid);
+          g_free (host);
+          continue;
+        }
+
+      proxy = gabble_socks5_proxy_new (jid, host, port);
+      proxy->latency = MAX (0, g_key_file_get_integer (cache, groups[i],
+            "latency", NULL));
+      proxy->successes = MAX (0, g_key_file_get_integer (cache, groups[i],
+            "successes", NULL));
+      proxy->failures = MAX (0, g_key_file_get_integer (cache, groups[i],
+            "failures", NULL));
+      g_free (host);
+
+      DEBUG ("Use cached SOCKS5 proxy: %s %s:%d (latency: %u ms, "
+          "successes: %u, failures: %u)", proxy->jid, proxy->host,
+          proxy->port, proxy->latency, proxy->successes, proxy->failures);
+
+      loaded = g_slist_prepend (loaded, proxy);
+    }
+
+  g_strfreev (groups);
+  g_key_file_free (cache);
+
+  /* Keep the best ones */
+  loaded = g_slist_sort (loaded, cmp_proxy_rank);
+
+  while (g_slist_length (loaded) > FALLBACK_PROXY_CACHE_SIZE)
+    {
+      GSList *last = g_slist_last (loaded);
+
+      gabble_socks5_proxy_free (last->data);
+      loaded = g_slist_delete_link (loaded, last);
+    }
+
+  priv->socks5_fallback_proxies = g_slist_concat (
+      priv->socks5_fallback_proxies, loaded);
+}
+
+static void
+save_proxy_cache (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+  GKeyFile *cache;
+  GTimeVal now;
+  gchar **groups;
+  gchar *data;
+  gchar *dir;
+  gsize len;
+  GSList *l;
+  guint i;
+  GError *error = NULL;
+
+  if (priv->proxy_cache_path == NULL)
+    return;
+
+  /* Other connections may share the cache, so update it rather than
+   * overwriting it */
+  cache = proxy_cache_open (self);
+  g_get_current_time (&now);
+
+  groups = g_key_file_get_groups (cache, NULL);
+
+  for (i = 0; groups[i] != NULL; i++)
+    {
+      if (g_str_has_prefix (groups[i], PROXY_CACHE_PROXY_GROUP_PREFIX) &&
+          now.tv_sec - g_key_file_get_int64 (cache, groups[i], "timestamp",
+            NULL) > PROXY_CACHE_LIFE_TIME)
+        g_key_file_remove_group (cache, groups[i], NULL);
+    }
+
+  g_strfreev (groups);
+
+  if (priv->proxies_list_stamp.tv_sec != 0 &&
+      priv->socks5_potential_proxies != NULL)
+    {
+      gchar **jids;
+
+      jids = g_new0 (gchar *,
+          g_slist_length (priv->socks5_potential_proxies) + 1);
+
+      for (l = priv->socks5_potential_proxies, i = 0; l != NULL;
+          l = g_slist_next (l), i++)
+        jids[i] = l->data;
+
+      g_key_file_set_string_list (cache, PROXY_CACHE_SERVICE_GROUP, "proxies",
+          (const gchar * const *) jids, i);
+      g_key_file_set_int64 (cache, PROXY_CACHE_SERVICE_GROUP, "timestamp",
+          priv->proxies_list_stamp.tv_sec);
+
+      g_free (jids);
+    }
+
+  for (l = priv->socks5_fallback_proxies; l != NULL; l = g_slist_next (l))
+    {
+      GabbleSocks5Proxy *proxy = l->data;
+      gchar *group;
+
+      group = g_strconcat (PROXY_CACHE_PROXY_GROUP_PREFIX, proxy->jid, NULL);
+      g_key_file_set_string (cache, group, "host", proxy->host);
+      g_key_file_set_integer (cache, group, "port", proxy->port);
+      g_key_file_set_integer (cache, group, "latency", proxy->latency);
+      g_key_file_set_integer (cache, group, "successes", proxy->successes);
+      g_key_file_set_integer (cache, group, "failures", proxy->failures);
+      g_key_file_set_int64 (cache, group, "timestamp", now.tv_sec);
+      g_free (group);
+    }
+
+  data = g_key_file_to_data (cache, &len, NULL);
+  g_key_file_free (cache);
+
+  dir = g_path_get_dirname (priv->proxy_cache_path);
+  g_mkdir_with_parents (dir, 0700);
+  g_free (dir);
+
+  if (!g_file_set_contents (priv->proxy_cache_path, data, len, &error))
+    {
+      DEBUG ("Failed to save SOCKS5 proxy cache: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      DEBUG ("SOCKS5 proxy cache saved to %s", priv->proxy_cache_path);
+    }
+
+  g_free (data);
+}
+
+static gboolean
+save_proxy_cache_cb (gpointer user_data)
+{
+  GabbleBytestreamFactory *self = GABBLE_BYTESTREAM_FACTORY (user_data);
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  priv->save_proxy_cache_id = 0;
+  save_proxy_cache (self);
+  return FALSE;
+}
+
+static void
+schedule_proxy_cache_save (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  if (priv->proxy_cache_path == NULL || priv->save_proxy_cache_id != 0)
+    return;
+
+  priv->save_proxy_cache_id = g_timeout_add_seconds (PROXY_CACHE_SAVE_DELAY,
+      save_proxy_cache_cb, self);
+}
+
 static void
 porter_available_cb (
     GabbleConnection *conn,
@@ -639,6 +990,8 @@ conn_status_changed_cb (GabbleConnection *conn,
       priv->next_query = priv->socks5_potential_proxies;
 
       g_strfreev (jids);
+
+      load_proxy_cache (self);
     }
 }
 
@@ -650,6 +1003,8 @@ gabble_bytestream_factory_constructor (GType type,
   GObject *obj;
   GabbleBytestreamFactory *self;
   GabbleBytestreamFactoryPrivate *priv;
+  const gchar *cache_path;
+  guint rate_limit, channel_rate_limit;
 
   obj = G_OBJECT_CLASS (gabble_bytestream_factory_parent_class)->
            constructor (type, n_props, props);
@@ -657,6 +1012,21 @@ gabble_bytestream_factory_constructor (GType type,
   self = GABBLE_BYTESTREAM_FACTORY (obj);
   priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (self);
 
+  g_object_get (priv->conn,
+      "transfer-rate-limit", &rate_limit,
+      "transfer-channel-rate-limit", &channel_rate_limit,
+      NULL);
+  priv->scheduler = gabble_transfer_scheduler_new (rate_limit,
+      channel_rate_limit);
+
+  cache_path = g_getenv ("GABBLE_SOCKS5_PROXY_CACHE");
+
+  if (cache_path == NULL)
+    priv->proxy_cache_path = g_build_filename (g_get_user_cache_dir (),
+        "telepathy", "gabble", "socks5-proxies", NULL);
+  else if (tp_strdiff (cache_path, ":memory:"))
+    priv->proxy_cache_path = g_strdup (cache_path);
+
   /* Track SOCKS5 proxy available on the connection */
   gabble_signal_connect_weak (priv->conn->disco, "item-found",
       G_CALLBACK (disco_item_found_cb), G_OBJECT (self));
@@ -705,6 +1075,23 @@ gabble_bytestream_factory_dispose (GObject *object)
   g_hash_table_unref (priv->multiple_bytestreams);
   priv->multiple_bytestreams = NULL;
 
+  /* Bytestreams unregister their domain when they are disposed so this has
+   * to be done after dropping them */
+  g_hash_table_unref (priv->socks5_domains);
+  priv->socks5_domains = NULL;
+
+  tp_clear_object (&priv->socks5_listener);
+  tp_clear_object (&priv->scheduler);
+
+  if (priv->save_proxy_cache_id != 0)
+    {
+      g_source_remove (priv->save_proxy_cache_id);
+      priv->save_proxy_cache_id = 0;
+      save_proxy_cache (self);
+    }
+
+  tp_clear_pointer (&priv->proxy_cache_path, g_free);
+
   proxies = g_slist_concat (priv->socks5_proxies,
       priv->socks5_fallback_proxies);
 
@@ -853,7 +1240,8 @@ streaminit_parse_request (WockyStanza *message,
                           const gchar **stream_init_id,
                           const gchar **mime_type,
                           GSList **stream_methods,
-                          gboolean *multiple)
+                          gboolean *multiple,
+                          gboolean *race)
 {
   WockyNode *iq = wocky_stanza_get_top_node (message);
   WockyNode *feature, *x, *si_multiple, *field;
@@ -963,6 +1351,10 @@ streaminit_parse_request (WockyStanza *message,
   else
     *multiple = TRUE;
 
+  /* Can we use all the stream methods at the same time? */
+  *race = (si_multiple != NULL && !tp_strdiff (
+        wocky_node_get_attribute (si_multiple, "race"), "true"));
+
   return TRUE;
 }
 
@@ -1010,6 +1402,7 @@ gabble_bytestream_factory_make_stream_init_iq (const gchar *full_jid,
         ')',
         '(', "si-multiple",
           ':', NS_SI_MULTIPLE,
+          '@', "race", "true",
         ')',
       ')', NULL);
 }
@@ -1132,7 +1525,7 @@ bytestream_factory_iq_si_cb (
   GSList *l;
   const gchar *profile, *from, *stream_id, *stream_init_id, *mime_type;
   GSList *stream_methods = NULL;
-  gboolean multiple;
+  gboolean multiple, race;
   gchar *peer_resource = NULL;
   gchar *self_jid = NULL;
 
@@ -1144,7 +1537,8 @@ bytestream_factory_iq_si_cb (
    * it or send an error reply */
 
   if (!streaminit_parse_request (msg, si, &profile, &from, &stream_id,
-        &stream_init_id, &mime_type, &stream_methods, &multiple))
+        &stream_init_id, &mime_type, &stream_methods, &multiple,
+        &race))
     {
       wocky_porter_send_iq_error (porter, msg,
           WOCKY_XMPP_ERROR_BAD_REQUEST, "failed to parse SI request");
@@ -1213,6 +1607,10 @@ bytestream_factory_iq_si_cb (
           gabble_bytestream_factory_create_multiple (self, peer_handle,
             stream_id, stream_init_id, peer_resource, self_jid,
             GABBLE_BYTESTREAM_STATE_LOCAL_PENDING);
+
+      if (race)
+        gabble_bytestream_multiple_enable_race (
+            GABBLE_BYTESTREAM_MULTIPLE (bytestream));
     }
 
   /* check stream method */
@@ -1372,6 +1770,15 @@ handle_ibb_open_iq (GabbleBytestreamFactory *self,
     {
       guint block_size = strtoul (tmp, NULL, 10);
 
+      if (block_size > GABBLE_BYTESTREAM_IBB_MAX_BLOCK_SIZE)
+        {
+          /* Ask the initiator to try again with a smaller block size */
+          DEBUG ("block size %u is too big", block_size);
+          wocky_porter_send_iq_error (porter, msg,
+              WOCKY_XMPP_ERROR_RESOURCE_CONSTRAINT, NULL);
+          return TRUE;
+        }
+
       if (block_size > 0)
         g_object_set (bytestream, "block-size", block_size, NULL);
     }
@@ -1908,6 +2315,10 @@ streaminit_get_multiple_bytestream (GabbleBytestreamFactory *self,
       stream_id, NULL, peer_resource, self_jid,
       GABBLE_BYTESTREAM_STATE_INITIATING);
 
+  /* The receiver accepted to use all the methods at the same time */
+  if (!tp_strdiff (wocky_node_get_attribute (si_multi, "race"), "true"))
+    gabble_bytestream_multiple_enable_race (bytestream);
+
   wocky_node_iter_init (&i, si_multi, "value", NULL);
   while (wocky_node_iter_next (&i, &value))
     {
@@ -2259,6 +2670,160 @@ gabble_bytestream_factory_get_socks5_proxies (GabbleBytestreamFactory *self)
   GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
       self);
 
-  return g_slist_concat (g_slist_copy (priv->socks5_proxies),
-      g_slist_copy (priv->socks5_fallback_proxies));
+  /* Best proxies first. The sort is stable so, for equally ranked proxies,
+   * discovered ones still come before fallback ones */
+  return g_slist_sort (g_slist_concat (g_slist_copy (priv->socks5_proxies),
+      g_slist_copy (priv->socks5_fallback_proxies)), cmp_proxy_rank);
+}
+
+/* Record the outcome of a bytestream using the proxy @jid. @latency is the
+ * time (in ms) it took to connect to the proxy and use it. */
+void
+gabble_bytestream_factory_record_socks5_proxy (GabbleBytestreamFactory *self,
+    const gchar *jid,
+    gboolean success,
+    guint latency)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+  GabbleSocks5Proxy *proxy;
+  gboolean fallback = FALSE;
+
+  proxy = find_proxy (priv->socks5_proxies, jid);
+  if (proxy == NULL)
+    {
+      proxy = find_proxy (priv->socks5_fallback_proxies, jid);
+      fallback = TRUE;
+    }
+
+  if (proxy == NULL)
+    /* Not a proxy we know about */
+    return;
+
+  if (success)
+    {
+      proxy->successes++;
+
+      /* Give more weight to the last measures */
+      if (proxy->latency == 0)
+        proxy->latency = MAX (latency, 1);
+      else
+        proxy->latency = (3 * proxy->latency + latency) / 4;
+    }
+  else
+    {
+      proxy->failures++;
+    }
+
+  DEBUG ("SOCKS5 proxy %s %s after %u ms (latency: %u ms, successes: %u, "
+      "failures: %u)", jid, success ? "succeeded" : "failed", latency,
+      proxy->latency, proxy->successes, proxy->failures);
+
+  if (fallback)
+    schedule_proxy_cache_save (self);
+}
+
+static void
+socks5_new_connection_cb (GibberListener *listener,
+                          GibberTransport *transport,
+                          struct sockaddr *addr,
+                          guint size,
+                          gpointer user_data)
+{
+  GabbleBytestreamFactory *self = GABBLE_BYTESTREAM_FACTORY (user_data);
+
+  DEBUG ("New SOCKS5 connection...");
+
+  /* We'll know which bytestream it is for once we get its CONNECT command */
+  gabble_bytestream_socks5_handle_incoming (self, transport);
+}
+
+/*
+ * gabble_bytestream_factory_get_socks5_port
+ *
+ * Returns the port of the listener shared by all the SOCKS5 bytestreams
+ * we initiate, or 0 if we can't listen for incoming connections.
+ */
+guint16
+gabble_bytestream_factory_get_socks5_port (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  if (priv->socks5_listener == NULL)
+    {
+      priv->socks5_listener = gibber_listener_new ();
+
+      g_signal_connect (priv->socks5_listener, "new-connection",
+          G_CALLBACK (socks5_new_connection_cb), self);
+
+      if (!gibber_listener_listen_tcp (priv->socks5_listener, 0, NULL))
+        {
+          DEBUG ("can't listen for incoming SOCKS5 connections");
+          tp_clear_object (&priv->socks5_listener);
+          return 0;
+        }
+
+      DEBUG ("listening for incoming SOCKS5 connections on port %d",
+          gibber_listener_get_port (priv->socks5_listener));
+    }
+
+  return gibber_listener_get_port (priv->socks5_listener);
+}
+
+/*
+ * gabble_bytestream_factory_add_socks5_domain
+ *
+ * Route the incoming SOCKS5 connection to @domain to @bytestream. Returns
+ * FALSE if another bytestream is already waiting for this domain.
+ */
+gboolean
+gabble_bytestream_factory_add_socks5_domain (GabbleBytestreamFactory *self,
+    const gchar *domain,
+    GabbleBytestreamSocks5 *bytestream)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  if (priv->socks5_domains == NULL ||
+      g_hash_table_lookup (priv->socks5_domains, domain) != NULL)
+    return FALSE;
+
+  g_hash_table_insert (priv->socks5_domains, g_strdup (domain), bytestream);
+  return TRUE;
+}
+
+void
+gabble_bytestream_factory_remove_socks5_domain (GabbleBytestreamFactory *self,
+    const gchar *domain)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  if (priv->socks5_domains == NULL)
+    return;
+
+  g_hash_table_remove (priv->socks5_domains, domain);
+}
+
+GabbleBytestreamSocks5 *
+gabble_bytestream_factory_find_socks5_domain (GabbleBytestreamFactory *self,
+    const gchar *domain)
+{
+  GabbleBytestreamFactoryPrivate *priv = GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (
+      self);
+
+  if (priv->socks5_domains == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (priv->socks5_domains, domain);
+}
+
+GabbleTransferScheduler *
+gabble_bytestream_factory_get_scheduler (GabbleBytestreamFactory *self)
+{
+  GabbleBytestreamFactoryPrivate *priv =
+    GABBLE_BYTESTREAM_FACTORY_GET_PRIVATE (self);
+
+  return priv->scheduler;
 }
@@ -29,6 +29,7 @@
 #include "bytestream-multiple.h"
 #include "bytestream-socks5.h"
 #include "connection.h"
+#include "transfer-scheduler.h"
 
 G_BEGIN_DECLS
 
@@ -68,6 +69,11 @@ typedef struct {
     gchar *jid;
     gchar *host;
     guint16 port;
+    /* running average of the time (in ms) it took to connect to the proxy
+     * and use it, 0 if it has never been used */
+    guint latency;
+    guint successes;
+    guint failures;
 } GabbleSocks5Proxy;
 
 typedef void (* GabbleBytestreamFactoryNegotiateReplyFunc) (
@@ -110,6 +116,26 @@ GSList *gabble_bytestream_factory_get_socks5_proxies (
 void gabble_bytestream_factory_query_socks5_proxies (
     GabbleBytestreamFactory *self);
 
+void gabble_bytestream_factory_record_socks5_proxy (
+    GabbleBytestreamFactory *self, const gchar *jid, gboolean success,
+    guint latency);
+
+guint16 gabble_bytestream_factory_get_socks5_port (
+    GabbleBytestreamFactory *self);
+
+gboolean gabble_bytestream_factory_add_socks5_domain (
+    GabbleBytestreamFactory *self, const gchar *domain,
+    GabbleBytestreamSocks5 *bytestream);
+
+void gabble_bytestream_factory_remove_socks5_domain (
+    GabbleBytestreamFactory *self, const gchar *domain);
+
+GabbleBytestreamSocks5 *gabble_bytestream_factory_find_socks5_domain (
+    GabbleBytestreamFactory *self, const gchar *domain);
+
+GabbleTransferScheduler *gabble_bytestream_factory_get_scheduler (
+    GabbleBytestreamFactory *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __BYTESTREAM_FACTORY_H__ */
@@ -29,6 +29,7 @@
 
 #define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
 
+#include "base64.h"
 #include "bytestream-factory.h"
 #include "bytestream-iface.h"
 #include "connection.h"
@@ -59,14 +60,79 @@ enum
   PROP_STATE,
   PROP_PROTOCOL,
   PROP_BLOCK_SIZE,
+  PROP_WINDOW,
+  PROP_MAX_WINDOW,
+  PROP_SRTT,
+  PROP_BYTES_ACKED,
   LAST_PROPERTY
 };
 
-#define READ_BUFFER_MAX_SIZE (512 * 1024)
+/* signals */
+enum
+{
+  FLUSHED,
+  LAST_SIGNAL
+};
 
-/* the number of not acked stanzas allowed. Once this number reached, we stop
- * sending and wait for acks. */
-#define WINDOW_SIZE 10
+static guint signals[LAST_SIGNAL] = {0};
+
+/* While reading is blocked, received stanzas are not acked so the sender
+ * stops once its window is full; this only bounds the memory a sender with
+ * a huge window can make us use. Beyond that, stanzas are refused with a
+ * 'wait' error and will be sent again. */
+#define READ_BUFFER_MAX_SIZE (4 * 1024 * 1024)
+
+/* Number of stanzas received ahead of the expected seq which are held until
+ * the missing ones arrive */
+#define REORDER_WINDOW 64
+
+/* We never put more than MAX_SEND_BLOCK_SIZE bytes in a stanza, whatever the
+ * peer proposes: base64 makes 64 KiB of data about 87 KB, more than many
+ * servers accept in one stanza. That's the block size we propose, halving it
+ * each time the peer replies with <resource-constraint/>, down to
+ * MIN_BLOCK_SIZE. */
+#define MAX_SEND_BLOCK_SIZE (32 * 1024)
+#define MIN_BLOCK_SIZE 1024
+
+/* The number of not acked stanzas allowed. Once this number reached, we stop
+ * sending and wait for acks. The window grows while acks come back quickly
+ * and is halved when they are late or the peer asks us to wait. */
+#define INITIAL_WINDOW_SIZE 10
+#define MIN_WINDOW_SIZE 2
+#define MAX_WINDOW_SIZE 64
+
+/* Number of times a stanza refused with a 'wait' error is sent again */
+#define MAX_RETRIES 5
+/* ms */
+#define MIN_RETRY_DELAY 200
+
+typedef struct {
+    WockyStanza *iq;
+    guint len;
+    gint64 sent_at;
+    guint retries;
+} SentBlock;
+
+typedef struct {
+    GBytes *data;
+    /* NULL if the data came in a <message/> */
+    WockyStanza *iq;
+} ReceivedBlock;
+
+static void
+sent_block_free (SentBlock *block)
+{
+  g_object_unref (block->iq);
+  g_slice_free (SentBlock, block);
+}
+
+static void
+received_block_free (ReceivedBlock *block)
+{
+  g_bytes_unref (block->data);
+  tp_clear_object (&block->iq);
+  g_slice_free (ReceivedBlock, block);
+}
 
 struct _GabbleBytestreamIBBPrivate
 {
@@ -80,23 +146,44 @@ struct _GabbleBytestreamIBBPrivate
   guint block_size;
 
   guint16 seq;
-  guint16 last_seq_recv;
+  guint16 next_seq_recv;
   WockyStanza *close_iq_to_ack;
 
   /* We can't stop receving IBB data so if user wants to block the bytestream
-   * we buffer them until he unblocks it. */
+   * we buffer them until he unblocks it. Their stanzas are acked once the
+   * data has been delivered, which throttles the sender. */
   gboolean read_blocked;
-  GString *read_buffer;
-  /* list of reffed (WockyStanza *) */
-  GSList *received_stanzas_not_acked;
-
-  /* (WockyStanza *) -> TRUE
-   * We don't keep a ref on the WockyStanza as we just use this table to track
-   * stanzas waiting for reply. The stanza is never used (and so deferenced). */
+  /* owned (ReceivedBlock *), in order */
+  GQueue read_queue;
+  /* owned (ReceivedBlock *) received ahead of next_seq_recv, indexed by
+   * seq % REORDER_WINDOW */
+  ReceivedBlock *reorder_buffer[REORDER_WINDOW];
+  /* bytes in read_queue and reorder_buffer */
+  gsize read_queued;
+
+  /* (WockyStanza *) -> owned (SentBlock *)
+   * The stanza is kept so it can be sent again if the peer asks us to wait */
   GHashTable *sent_stanzas_not_acked;
+  /* owned (SentBlock *) refused with a 'wait' error */
+  GQueue retry_queue;
+  guint retry_source;
   GString *write_buffer;
   gboolean write_blocked;
 
+  /* congestion control, times are in microseconds */
+  guint window;
+  guint ssthresh;
+  guint acks_since_growth;
+  gint64 srtt;
+  gint64 rttvar;
+  gint64 min_rtt;
+  gint64 last_backoff;
+
+  /* stats */
+  gint64 first_send_time;
+  guint64 bytes_acked;
+  guint max_window;
+
   gboolean dispose_has_run;
 };
 
@@ -110,15 +197,59 @@ gabble_bytestream_ibb_init (GabbleBytestreamIBB *self)
 
   self->priv = priv;
 
-  priv->read_buffer = NULL;
-  priv->received_stanzas_not_acked = NULL;
+  g_queue_init (&priv->read_queue);
+  priv->read_queued = 0;
 
-  priv->sent_stanzas_not_acked = g_hash_table_new (g_direct_hash,
-      g_direct_equal);
+  priv->sent_stanzas_not_acked = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, NULL, (GDestroyNotify) sent_block_free);
+  g_queue_init (&priv->retry_queue);
+
+  priv->window = INITIAL_WINDOW_SIZE;
+  priv->ssthresh = MAX_WINDOW_SIZE;
+  priv->max_window = priv->window;
   priv->write_buffer = NULL;
   priv->write_blocked = FALSE;
 }
 
+/* Drop the received data which hasn't been delivered yet, and refuse their
+ * stanzas if @refuse */
+static void
+free_received_blocks (GabbleBytestreamIBB *self,
+                      gboolean refuse)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+  ReceivedBlock *block;
+  guint i;
+
+  while ((block = g_queue_pop_head (&priv->read_queue)) != NULL)
+    {
+      if (refuse && block->iq != NULL)
+        wocky_porter_send_iq_error (
+            wocky_session_get_porter (priv->conn->session), block->iq,
+            WOCKY_XMPP_ERROR_ITEM_NOT_FOUND, NULL);
+
+      received_block_free (block);
+    }
+
+  for (i = 0; i < REORDER_WINDOW; i++)
+    {
+      block = priv->reorder_buffer[i];
+
+      if (block == NULL)
+        continue;
+
+      if (refuse && block->iq != NULL)
+        wocky_porter_send_iq_error (
+            wocky_session_get_porter (priv->conn->session), block->iq,
+            WOCKY_XMPP_ERROR_ITEM_NOT_FOUND, NULL);
+
+      received_block_free (block);
+      priv->reorder_buffer[i] = NULL;
+    }
+
+  priv->read_queued = 0;
+}
+
 static void
 gabble_bytestream_ibb_dispose (GObject *object)
 {
@@ -142,6 +273,12 @@ gabble_bytestream_ibb_dispose (GObject *object)
       priv->close_iq_to_ack = NULL;
     }
 
+  if (priv->retry_source != 0)
+    {
+      g_source_remove (priv->retry_source);
+      priv->retry_source = 0;
+    }
+
   G_OBJECT_CLASS (gabble_bytestream_ibb_parent_class)->dispose (object);
 }
 
@@ -156,13 +293,14 @@ gabble_bytestream_ibb_finalize (GObject *object)
   g_free (priv->peer_resource);
   g_free (priv->peer_jid);
 
-  if (priv->read_buffer != NULL)
-    g_string_free (priv->read_buffer, TRUE);
+  free_received_blocks (self, FALSE);
 
   if (priv->write_buffer != NULL)
     g_string_free (priv->write_buffer, TRUE);
 
   g_hash_table_unref (priv->sent_stanzas_not_acked);
+  g_queue_foreach (&priv->retry_queue, (GFunc) sent_block_free, NULL);
+  g_queue_clear (&priv->retry_queue);
 
   G_OBJECT_CLASS (gabble_bytestream_ibb_parent_class)->finalize (object);
 }
@@ -208,6 +346,18 @@ gabble_bytestream_ibb_get_property (GObject *object,
       case PROP_BLOCK_SIZE:
         g_value_set_uint (value, priv->block_size);
         break;
+      case PROP_WINDOW:
+        g_value_set_uint (value, priv->window);
+        break;
+      case PROP_MAX_WINDOW:
+        g_value_set_uint (value, priv->max_window);
+        break;
+      case PROP_SRTT:
+        g_value_set_uint (value, priv->srtt / 1000);
+        break;
+      case PROP_BYTES_ACKED:
+        g_value_set_uint64 (value, priv->bytes_acked);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -345,10 +495,55 @@ gabble_bytestream_ibb_class_init (
       "block-size",
       "block size",
       "Maximum data sent using one stanza as described in XEP-0047",
-      0, G_MAXUINT32, 4096,
+      0, G_MAXUINT32, MAX_SEND_BLOCK_SIZE,
       G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
   g_object_class_install_property (object_class, PROP_BLOCK_SIZE,
       param_spec);
+
+  param_spec = g_param_spec_uint (
+      "window",
+      "window",
+      "The number of data stanzas which can currently be sent without "
+      "waiting for their ack",
+      0, G_MAXUINT32, INITIAL_WINDOW_SIZE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_WINDOW, param_spec);
+
+  param_spec = g_param_spec_uint (
+      "max-window",
+      "max window",
+      "The largest window used since the bytestream was created",
+      0, G_MAXUINT32, INITIAL_WINDOW_SIZE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_MAX_WINDOW,
+      param_spec);
+
+  param_spec = g_param_spec_uint (
+      "srtt",
+      "smoothed RTT",
+      "The smoothed round-trip time of data stanzas, in milliseconds",
+      0, G_MAXUINT32, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_SRTT, param_spec);
+
+  param_spec = g_param_spec_uint64 (
+      "bytes-acked",
+      "bytes acked",
+      "The number of bytes sent and acked by the peer",
+      0, G_MAXUINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTES_ACKED,
+      param_spec);
+
+  /* Emitted when all the data sent has been acked by the peer */
+  signals[FLUSHED] =
+    g_signal_new ("flushed",
+                  G_OBJECT_CLASS_TYPE (gabble_bytestream_ibb_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
 }
 
 static void
@@ -399,41 +594,136 @@ send_close_stanza (GabbleBytestreamIBB *self)
 static guint
 send_data (GabbleBytestreamIBB *self, const gchar *str, guint len);
 
+static void iq_reply_cb (GObject *source, GAsyncResult *result,
+    gpointer user_data);
+
 static void
-iq_reply_cb (
-    GObject *source,
-    GAsyncResult *result,
-    gpointer user_data)
+log_stats (GabbleBytestreamIBB *self)
 {
-  TpWeakRef *weak_ref = user_data;
-  GabbleBytestreamIBB *self = tp_weak_ref_dup_object (weak_ref);
-  /* We don't hold a ref to the outgoing stanza; we just use its address as a
-   * key */
-  gpointer sent_msg = tp_weak_ref_get_user_data (weak_ref);
-  GabbleBytestreamIBBPrivate *priv;
-  GError *error = NULL;
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+  gint64 elapsed;
 
-  tp_weak_ref_destroy (weak_ref);
+  if (priv->first_send_time == 0)
+    return;
 
-  /* If the channel is already dead, never mind! */
-  if (self == NULL)
+  elapsed = g_get_monotonic_time () - priv->first_send_time;
+
+  DEBUG ("%s: %" G_GUINT64_FORMAT " bytes acked in %" G_GINT64_FORMAT
+      " ms (%" G_GUINT64_FORMAT " bytes/s); window %u (max %u, ssthresh %u), "
+      "block size %u, srtt %" G_GINT64_FORMAT " ms, min rtt %"
+      G_GINT64_FORMAT " ms", priv->stream_id, priv->bytes_acked,
+      elapsed / 1000,
+      elapsed > 0 ? priv->bytes_acked * G_USEC_PER_SEC / elapsed : 0,
+      priv->window, priv->max_window, priv->ssthresh, priv->block_size,
+      priv->srtt / 1000, priv->min_rtt / 1000);
+}
+
+static void
+send_block (GabbleBytestreamIBB *self,
+            SentBlock *block)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  block->sent_at = g_get_monotonic_time ();
+
+  if (priv->first_send_time == 0)
+    priv->first_send_time = block->sent_at;
+
+  conn_util_send_bulk_iq_async (priv->conn, block->iq, NULL,
+      iq_reply_cb, tp_weak_ref_new (self, block->iq, NULL));
+
+  g_hash_table_insert (priv->sent_stanzas_not_acked, block->iq, block);
+}
+
+static guint
+stanzas_in_flight (GabbleBytestreamIBB *self)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  return g_hash_table_size (priv->sent_stanzas_not_acked) +
+      g_queue_get_length (&priv->retry_queue);
+}
+
+static void
+congestion_detected (GabbleBytestreamIBB *self,
+                     const gchar *reason)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+  gint64 now = g_get_monotonic_time ();
+
+  /* Only back off once per round-trip: the other stanzas of the window
+   * are likely to hit the same congestion */
+  if (priv->last_backoff != 0 && now - priv->last_backoff < priv->srtt)
     return;
 
-  priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
-  g_hash_table_remove (priv->sent_stanzas_not_acked, sent_msg);
+  priv->last_backoff = now;
+  priv->ssthresh = MAX (priv->window / 2, MIN_WINDOW_SIZE);
+  priv->window = priv->ssthresh;
+  priv->acks_since_growth = 0;
 
-  if (!conn_util_send_iq_finish (GABBLE_CONNECTION (source), result, NULL, &error))
+  DEBUG ("%s; window shrunk to %u", reason, priv->window);
+}
+
+static void
+ack_received (GabbleBytestreamIBB *self,
+              gint64 rtt)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  if (priv->min_rtt == 0 || rtt < priv->min_rtt)
+    priv->min_rtt = rtt;
+
+  if (priv->srtt == 0)
     {
-      DEBUG ("error sending IBB stanza: %s #%u '%s'. Closing the bytestream",
-          g_quark_to_string (error->domain), error->code, error->message);
-      g_clear_error (&error);
-      /* FIXME: we should be able to feed this up to the application somehow. */
-      gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
+      priv->srtt = rtt;
+      priv->rttvar = rtt / 2;
+      return;
     }
-  else if (priv->write_buffer != NULL)
+
+  /* An ack later than the retransmission timeout TCP would compute means
+   * that stanzas are piling up somewhere */
+  if (rtt > priv->srtt + 4 * priv->rttvar && rtt > 2 * priv->min_rtt)
+    congestion_detected (self, "late ack");
+  else if (rtt <= 2 * priv->min_rtt && priv->window < MAX_WINDOW_SIZE)
     {
-      guint sent;
+      /* slow start up to ssthresh, then one more stanza per window */
+      if (priv->window < priv->ssthresh ||
+          ++priv->acks_since_growth >= priv->window)
+        {
+          priv->window++;
+          priv->acks_since_growth = 0;
+          priv->max_window = MAX (priv->max_window, priv->window);
+        }
+    }
+
+  priv->rttvar = (3 * priv->rttvar + ABS (priv->srtt - rtt)) / 4;
+  priv->srtt = (7 * priv->srtt + rtt) / 8;
+}
+
+/*
+ * gabble_bytestream_ibb_is_flushed
+ *
+ * Returns TRUE if the bytestream is open and all the data sent through it
+ * has been acked. As received data is acked once it has been delivered,
+ * the peer has then received everything we sent.
+ */
+gboolean
+gabble_bytestream_ibb_is_flushed (GabbleBytestreamIBB *self)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  return priv->state == GABBLE_BYTESTREAM_STATE_OPEN &&
+      priv->write_buffer == NULL && stanzas_in_flight (self) == 0;
+}
 
+static void
+flush_write_buffer (GabbleBytestreamIBB *self)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+  guint sent;
+
+  if (priv->write_buffer != NULL)
+    {
       DEBUG ("A stanza has been acked. Try to flush the buffer");
 
       sent = send_data (self, priv->write_buffer->str, priv->write_buffer->len);
@@ -444,14 +734,6 @@ iq_reply_cb (
           priv->write_buffer = NULL;
 
           change_write_blocked_state (self, FALSE);
-
-          if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSING)
-            {
-              DEBUG ("Can close the bystream now the buffer is flushed");
-              send_close_stanza (self);
-              g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED,
-                  NULL);
-            }
         }
       else
         {
@@ -463,6 +745,118 @@ iq_reply_cb (
         }
     }
 
+  if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSING &&
+      priv->write_buffer == NULL && g_queue_is_empty (&priv->retry_queue))
+    {
+      DEBUG ("Can close the bystream now the buffer is flushed");
+      send_close_stanza (self);
+      g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED,
+          NULL);
+    }
+  else if (gabble_bytestream_ibb_is_flushed (self))
+    {
+      g_signal_emit (self, signals[FLUSHED], 0);
+    }
+}
+
+static gboolean
+retry_timeout_cb (gpointer user_data)
+{
+  GabbleBytestreamIBB *self = GABBLE_BYTESTREAM_IBB (user_data);
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  priv->retry_source = 0;
+
+  if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    return FALSE;
+
+  /* The retried stanzas are already accounted for in the window */
+  while (!g_queue_is_empty (&priv->retry_queue))
+    {
+      SentBlock *block = g_queue_pop_head (&priv->retry_queue);
+
+      DEBUG ("sending again %u bytes (attempt %u)", block->len,
+          block->retries + 1);
+      send_block (self, block);
+    }
+
+  return FALSE;
+}
+
+static void
+iq_reply_cb (
+    GObject *source,
+    GAsyncResult *result,
+    gpointer user_data)
+{
+  TpWeakRef *weak_ref = user_data;
+  GabbleBytestreamIBB *self = tp_weak_ref_dup_object (weak_ref);
+  /* We just use the address of the outgoing stanza as a key */
+  gpointer sent_msg = tp_weak_ref_get_user_data (weak_ref);
+  GabbleBytestreamIBBPrivate *priv;
+  WockyStanza *reply;
+  WockyXmppErrorType error_type;
+  SentBlock *block;
+  GError *error = NULL;
+
+  tp_weak_ref_destroy (weak_ref);
+
+  /* If the channel is already dead, never mind! */
+  if (self == NULL)
+    return;
+
+  priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  block = g_hash_table_lookup (priv->sent_stanzas_not_acked, sent_msg);
+  g_assert (block != NULL);
+  g_hash_table_steal (priv->sent_stanzas_not_acked, sent_msg);
+
+  reply = conn_util_send_iq_finish_reply (GABBLE_CONNECTION (source), result,
+      &error);
+
+  if (reply != NULL &&
+      wocky_stanza_extract_errors (reply, &error_type, &error, NULL, NULL))
+    {
+      if (error_type == WOCKY_XMPP_ERROR_TYPE_WAIT &&
+          block->retries < MAX_RETRIES &&
+          priv->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+        {
+          DEBUG ("peer asked us to wait: %s", error->message);
+          g_clear_error (&error);
+
+          congestion_detected (self, "'wait' error");
+
+          block->retries++;
+          g_queue_push_tail (&priv->retry_queue, block);
+          block = NULL;
+
+          if (priv->retry_source == 0)
+            priv->retry_source = g_timeout_add (
+                MAX (MIN_RETRY_DELAY, 2 * priv->srtt / 1000),
+                retry_timeout_cb, self);
+        }
+    }
+
+  if (error != NULL)
+    {
+      DEBUG ("error sending IBB stanza: %s #%u '%s'. Closing the bytestream",
+          g_quark_to_string (error->domain), error->code, error->message);
+      g_clear_error (&error);
+      /* FIXME: we should be able to feed this up to the application somehow. */
+      gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
+    }
+  else if (block != NULL)
+    {
+      ack_received (self, g_get_monotonic_time () - block->sent_at);
+      priv->bytes_acked += block->len;
+
+      flush_write_buffer (self);
+    }
+
+  if (block != NULL)
+    sent_block_free (block);
+
+  tp_clear_object (&reply);
   g_object_unref (self);
 }
 
@@ -472,21 +866,23 @@ send_data (GabbleBytestreamIBB *self,
            guint len)
 {
   GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+  guint block_size = MIN (priv->block_size, MAX_SEND_BLOCK_SIZE);
   guint sent, stanza_count;
 
   sent = 0;
   stanza_count = 0;
   while (sent < len)
     {
-      WockyStanza *iq;
+      SentBlock *block;
       guint send_now, remaining;
-      gchar *seq, *encoded;
+      WockyNode *data = NULL;
+      gchar *seq;
       guint nb_stanzas_waiting;
 
       remaining = (len - sent);
 
-      nb_stanzas_waiting = g_hash_table_size (priv->sent_stanzas_not_acked);
-      if (nb_stanzas_waiting >= WINDOW_SIZE)
+      nb_stanzas_waiting = stanzas_in_flight (self);
+      if (nb_stanzas_waiting >= priv->window)
         {
           DEBUG ("Window is full (%u). Stop sending stanzas",
               nb_stanzas_waiting);
@@ -494,10 +890,10 @@ send_data (GabbleBytestreamIBB *self,
         }
 
       /* We can send stanzas */
-      if (remaining > priv->block_size)
+      if (remaining > block_size)
         {
           /* We can't send all the remaining data in one stanza */
-          send_now = priv->block_size;
+          send_now = block_size;
         }
       else
         {
@@ -505,30 +901,28 @@ send_data (GabbleBytestreamIBB *self,
           send_now = remaining;
         }
 
-      encoded = g_base64_encode ((const guchar *) str + sent, send_now);
       seq = g_strdup_printf ("%u", priv->seq++);
 
-      iq = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ, WOCKY_STANZA_SUB_TYPE_SET,
-          NULL, priv->peer_jid,
+      block = g_slice_new0 (SentBlock);
+      block->len = send_now;
+      block->iq = wocky_stanza_build (WOCKY_STANZA_TYPE_IQ,
+          WOCKY_STANZA_SUB_TYPE_SET, NULL, priv->peer_jid,
           '(', "data",
-            '$', encoded,
+            '*', &data,
             ':', NS_IBB,
             '@', "sid", priv->stream_id,
             '@', "seq", seq,
           ')', NULL);
 
-      conn_util_send_iq_async (priv->conn, iq, NULL,
-          iq_reply_cb, tp_weak_ref_new (self, iq, NULL));
+      gabble_base64_encode_to_node (data, (const guchar *) str + sent,
+          send_now);
 
-      g_free (encoded);
-      g_free (seq);
-      g_object_unref (iq);
+      send_block (self, block);
 
-      g_hash_table_insert (priv->sent_stanzas_not_acked, iq,
-          GUINT_TO_POINTER (TRUE));
+      g_free (seq);
 
-      DEBUG ("send %d bytes (window size: %u)", send_now,
-          nb_stanzas_waiting + 1);
+      DEBUG ("send %d bytes (window: %u/%u)", send_now,
+          nb_stanzas_waiting + 1, priv->window);
 
       sent += send_now;
       stanza_count++;
@@ -599,6 +993,57 @@ gabble_bytestream_ibb_send (GabbleBytestreamIface *iface,
   return TRUE;
 }
 
+/* Hand @block to the user, or queue it if reading is blocked. Returns FALSE
+ * if the bytestream has been closed meanwhile. */
+static gboolean
+deliver_block (GabbleBytestreamIBB *self,
+               ReceivedBlock *block)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  if (priv->read_blocked || !g_queue_is_empty (&priv->read_queue))
+    {
+      DEBUG ("Bytestream is blocked. Buffering data");
+      g_queue_push_tail (&priv->read_queue, block);
+      priv->read_queued += g_bytes_get_size (block->data);
+      return TRUE;
+    }
+
+  g_signal_emit_by_name (G_OBJECT (self), "data-received", priv->peer_handle,
+      block->data);
+
+  if (block->iq != NULL)
+    _gabble_connection_acknowledge_set_iq (priv->conn, block->iq);
+
+  received_block_free (block);
+
+  return priv->state == GABBLE_BYTESTREAM_STATE_OPEN;
+}
+
+static void
+refuse_stanza (GabbleBytestreamIBB *self,
+               WockyStanza *msg,
+               gboolean is_iq,
+               const gchar *reason)
+{
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
+
+  if (is_iq)
+    {
+      /* The sender will try again later */
+      DEBUG ("%s; asking the sender to wait", reason);
+      wocky_porter_send_iq_error (
+          wocky_session_get_porter (priv->conn->session), msg,
+          WOCKY_XMPP_ERROR_RESOURCE_CONSTRAINT, reason);
+    }
+  else
+    {
+      /* We have no way to slow down data sent with messages */
+      DEBUG ("%s. Closing the bytestream", reason);
+      gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
+    }
+}
+
 void
 gabble_bytestream_ibb_receive (GabbleBytestreamIBB *self,
                                WockyStanza *msg,
@@ -606,10 +1051,11 @@ gabble_bytestream_ibb_receive (GabbleBytestreamIBB *self,
 {
   GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
   WockyNode *data;
-  GString *str;
+  ReceivedBlock *block;
+  const gchar *seq_str;
+  guint16 seq, offset;
   guchar *st;
   gsize outlen;
-  TpHandle sender;
 
   /* caller must have checked for this in order to know which bytestream to
    * route this packet to */
@@ -628,73 +1074,106 @@ gabble_bytestream_ibb_receive (GabbleBytestreamIBB *self,
       return;
     }
 
-  /* Private stream using SI - the bytestream factory has already checked
-   * the sender in order to dispatch to us */
-  sender = priv->peer_handle;
-
-  /* FIXME: check sequence number */
-
-  st = g_base64_decode (data->content, &outlen);
-  str = g_string_new_len ((gchar *) st, outlen);
-  g_free (st);
-  if (str == NULL)
+  seq_str = wocky_node_get_attribute (data, "seq");
+  if (seq_str == NULL)
     {
-      DEBUG ("base64 decoding failed");
-      if (is_iq)
-        wocky_porter_send_iq_error (
-            wocky_session_get_porter (priv->conn->session), msg,
-            WOCKY_XMPP_ERROR_BAD_REQUEST, "base64 decoding failed");
-      return;
+      /* seq is mandatory but be lenient with peers that don't set it */
+      seq = priv->next_seq_recv;
     }
-
-  if (priv->read_blocked)
+  else
     {
-      gsize current_buffer_len = 0;
-
-      DEBUG ("Bytestream is blocked. Buffering data");
-      if (priv->read_buffer != NULL)
-        current_buffer_len = priv->read_buffer->len;
+      gchar *end;
+      guint64 tmp = g_ascii_strtoull (seq_str, &end, 10);
 
-      if (current_buffer_len + str->len > READ_BUFFER_MAX_SIZE)
+      if (*end != '\0' || tmp > G_MAXUINT16)
         {
-          DEBUG ("Buffer is full. Closing the bytestream");
-
+          DEBUG ("invalid seq: %s", seq_str);
           if (is_iq)
             wocky_porter_send_iq_error (
                 wocky_session_get_porter (priv->conn->session), msg,
-                WOCKY_XMPP_ERROR_NOT_ACCEPTABLE, "buffer is full");
-
-          gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
-          g_string_free (str, TRUE);
+                WOCKY_XMPP_ERROR_BAD_REQUEST, "invalid seq");
           return;
         }
 
-      if (priv->read_buffer == NULL)
-        {
-          priv->read_buffer = str;
-        }
-      else
-        {
-          g_string_append_len (priv->read_buffer, str->str, str->len);
-          g_string_free (str, TRUE);
-        }
+      seq = tmp;
+    }
 
+  /* seq wraps around at 65535 */
+  offset = seq - priv->next_seq_recv;
+
+  if (offset >= G_MAXUINT16 / 2 ||
+      (offset < REORDER_WINDOW &&
+       priv->reorder_buffer[seq % REORDER_WINDOW] != NULL))
+    {
+      /* We already have this one */
+      DEBUG ("ignoring duplicated stanza %u (expecting %u)", seq,
+          priv->next_seq_recv);
       if (is_iq)
-        {
-          priv->received_stanzas_not_acked = g_slist_prepend (
-              priv->received_stanzas_not_acked, g_object_ref (msg));
-        }
+        _gabble_connection_acknowledge_set_iq (priv->conn, msg);
+      return;
+    }
+
+  if (offset >= REORDER_WINDOW)
+    {
+      refuse_stanza (self, msg, is_iq, "stanza too far ahead");
+      return;
+    }
 
+  /* Nothing will be buffered if the data can be delivered right away */
+  if ((offset != 0 || priv->read_blocked ||
+        !g_queue_is_empty (&priv->read_queue)) &&
+      priv->read_queued + (strlen (data->content) / 4) * 3 >
+      READ_BUFFER_MAX_SIZE)
+    {
+      refuse_stanza (self, msg, is_iq, "buffer is full");
       return;
     }
 
-  g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, str);
-  g_string_free (str, TRUE);
+  st = gabble_base64_decode (data->content, &outlen);
+  if (st == NULL)
+    {
+      DEBUG ("base64 decoding failed");
+      if (is_iq)
+        wocky_porter_send_iq_error (
+            wocky_session_get_porter (priv->conn->session), msg,
+            WOCKY_XMPP_ERROR_BAD_REQUEST, "base64 decoding failed");
+      return;
+    }
 
+  block = g_slice_new0 (ReceivedBlock);
+  /* The decoded block is handed over as is to every layer above */
+  block->data = g_bytes_new_take (st, outlen);
   if (is_iq)
-    _gabble_connection_acknowledge_set_iq (priv->conn, msg);
+    block->iq = g_object_ref (msg);
+
+  if (offset != 0)
+    {
+      DEBUG ("received stanza %u while expecting %u; holding it", seq,
+          priv->next_seq_recv);
+      priv->reorder_buffer[seq % REORDER_WINDOW] = block;
+      priv->read_queued += outlen;
+      return;
+    }
+
+  g_object_ref (self);
+
+  /* Deliver this block and the ones it was holding back */
+  while (block != NULL)
+    {
+      priv->next_seq_recv++;
+
+      if (!deliver_block (self, block))
+        break;
 
-  return;
+      block = priv->reorder_buffer[priv->next_seq_recv % REORDER_WINDOW];
+      if (block != NULL)
+        {
+          priv->reorder_buffer[priv->next_seq_recv % REORDER_WINDOW] = NULL;
+          priv->read_queued -= g_bytes_get_size (block->data);
+        }
+    }
+
+  g_object_unref (self);
 }
 
 /*
@@ -783,23 +1262,13 @@ gabble_bytestream_ibb_close (GabbleBytestreamIface *iface,
 {
   GabbleBytestreamIBB *self = GABBLE_BYTESTREAM_IBB (iface);
   GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
-  WockyPorter *porter = wocky_session_get_porter (priv->conn->session);
-  GSList *l;
 
   if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSED)
      /* bytestream already closed, do nothing */
      return;
 
   /* Send error for pending IQ's */
-  priv->received_stanzas_not_acked = g_slist_reverse (
-      priv->received_stanzas_not_acked);
-
-  for (l = priv->received_stanzas_not_acked; l != NULL; l = g_slist_next (l))
-    wocky_porter_send_iq_error (porter, l->data,
-        WOCKY_XMPP_ERROR_ITEM_NOT_FOUND, NULL);
-
-  g_slist_free (priv->received_stanzas_not_acked);
-  priv->received_stanzas_not_acked = NULL;
+  free_received_blocks (self, TRUE);
 
   if (priv->state == GABBLE_BYTESTREAM_STATE_LOCAL_PENDING)
     {
@@ -808,7 +1277,9 @@ gabble_bytestream_ibb_close (GabbleBytestreamIface *iface,
     }
   else
     {
-      if (priv->write_buffer != NULL)
+      log_stats (self);
+
+      if (priv->write_buffer != NULL || !g_queue_is_empty (&priv->retry_queue))
         {
           DEBUG ("write buffer is not empty. Wait before sending close stanza");
           g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSING, NULL);
@@ -829,14 +1300,27 @@ ibb_init_reply_cb (GabbleConnection *conn,
                    gpointer user_data)
 {
   GabbleBytestreamIBB *self = GABBLE_BYTESTREAM_IBB (obj);
+  GabbleBytestreamIBBPrivate *priv = GABBLE_BYTESTREAM_IBB_GET_PRIVATE (self);
   GError *error = NULL;
 
   if (!wocky_stanza_extract_errors (reply_msg, NULL, &error, NULL, NULL))
     {
       /* yeah, stream initiated */
-      DEBUG ("IBB stream initiated");
+      DEBUG ("IBB stream initiated with block size %u", priv->block_size);
       g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_OPEN, NULL);
     }
+  else if (g_error_matches (error, WOCKY_XMPP_ERROR,
+        WOCKY_XMPP_ERROR_RESOURCE_CONSTRAINT) &&
+      priv->block_size > MIN_BLOCK_SIZE)
+    {
+      /* The peer wants smaller blocks */
+      g_clear_error (&error);
+      priv->block_size = MAX (priv->block_size / 2, MIN_BLOCK_SIZE);
+      DEBUG ("block size refused; trying again with %u", priv->block_size);
+
+      if (!gabble_bytestream_iface_initiate (GABBLE_BYTESTREAM_IFACE (self)))
+        g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED, NULL);
+    }
   else
     {
       DEBUG ("error during IBB initiation: %s", error->message);
@@ -904,34 +1388,29 @@ gabble_bytestream_ibb_block_reading (GabbleBytestreamIface *iface,
 
   DEBUG ("%s the transport bytestream", block ? "block": "unblock");
 
-  if (priv->read_buffer != NULL && !block)
+  if (!g_queue_is_empty (&priv->read_queue) && !block)
     {
-      GSList *l;
-
       DEBUG ("Bytestream unblocked, flushing the buffer");
 
-      g_signal_emit_by_name (G_OBJECT (self), "data-received",
-          priv->peer_handle, priv->read_buffer);
-
-      g_string_free (priv->read_buffer, TRUE);
-      priv->read_buffer = NULL;
+      g_object_ref (self);
 
-      /* ack pending stanzas */
-      priv->received_stanzas_not_acked = g_slist_reverse (
-          priv->received_stanzas_not_acked);
-
-      for (l = priv->received_stanzas_not_acked; l != NULL;
-          l = g_slist_next (l))
+      /* A receiver may block us again; keep the rest queued then. Each
+       * stanza is acked once its data has been delivered. */
+      while (!priv->read_blocked && !g_queue_is_empty (&priv->read_queue))
         {
-          WockyStanza *iq = (WockyStanza *) l->data;
+          ReceivedBlock *received = g_queue_pop_head (&priv->read_queue);
+
+          priv->read_queued -= g_bytes_get_size (received->data);
+          g_signal_emit_by_name (G_OBJECT (self), "data-received",
+              priv->peer_handle, received->data);
 
-          _gabble_connection_acknowledge_set_iq (priv->conn, iq);
+          if (received->iq != NULL)
+            _gabble_connection_acknowledge_set_iq (priv->conn, received->iq);
 
-          g_object_unref (iq);
+          received_block_free (received);
         }
 
-      g_slist_free (priv->received_stanzas_not_acked);
-      priv->received_stanzas_not_acked = NULL;
+      g_object_unref (self);
     }
 }
 
@@ -26,6 +26,9 @@
 
 G_BEGIN_DECLS
 
+/* block-size is a 16 bits value in XEP-0047 */
+#define GABBLE_BYTESTREAM_IBB_MAX_BLOCK_SIZE 65535
+
 typedef struct _GabbleBytestreamIBB GabbleBytestreamIBB;
 typedef struct _GabbleBytestreamIBBClass GabbleBytestreamIBBClass;
 typedef struct _GabbleBytestreamIBBPrivate GabbleBytestreamIBBPrivate;
@@ -65,6 +68,8 @@ void gabble_bytestream_ibb_receive (GabbleBytestreamIBB *ibb,
 void gabble_bytestream_ibb_close_received (GabbleBytestreamIBB *ibb,
     WockyStanza *iq);
 
+gboolean gabble_bytestream_ibb_is_flushed (GabbleBytestreamIBB *ibb);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_BYTESTREAM_IBB_H__ */
@@ -133,6 +133,8 @@ gabble_bytestream_iface_base_init (gpointer klass)
           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
       g_object_interface_install_property (klass, param_spec);
 
+      /* (TpHandle sender, GBytes *data): @data is only guaranteed to be
+       * valid during the emission, take a reference to keep it */
       g_signal_new ("data-received",
           G_TYPE_FROM_INTERFACE (klass),
           G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
@@ -180,6 +182,33 @@ gabble_bytestream_iface_block_reading (GabbleBytestreamIface *self,
   /* else: do nothing. Some bytestreams like IBB can't implement read_block. */
 }
 
+/*
+ * gabble_bytestream_iface_splice
+ *
+ * Ask the bytestream to relay data between @transport and its own socket
+ * directly, without passing it through "data-received" and
+ * gabble_bytestream_iface_send (). Only an open bytestream with a
+ * file descriptor of its own (SOCKS5) can do that; callers must keep using
+ * the copying path when this returns FALSE.
+ */
+gboolean
+gabble_bytestream_iface_splice (GabbleBytestreamIface *self,
+                                GibberTransport *transport,
+                                GabbleBytestreamSpliceFlags flags,
+                                GabbleBytestreamSpliceFunc func,
+                                gpointer user_data)
+{
+  gboolean (*virtual_method)(GabbleBytestreamIface *, GibberTransport *,
+      GabbleBytestreamSpliceFlags, GabbleBytestreamSpliceFunc, gpointer) =
+    GABBLE_BYTESTREAM_IFACE_GET_CLASS (self)->splice;
+
+  if (virtual_method == NULL)
+    /* IBB and muc bytestreams have to copy the data anyway */
+    return FALSE;
+
+  return virtual_method (self, transport, flags, func, user_data);
+}
+
 GType
 gabble_bytestream_iface_get_type (void)
 {
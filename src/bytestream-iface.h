@@ -23,6 +23,8 @@
 #include <glib-object.h>
 #include <wocky/wocky.h>
 
+#include <gibber/gibber-transport.h>
+
 G_BEGIN_DECLS
 
 typedef enum
@@ -45,6 +47,20 @@ typedef enum
 typedef void (* GabbleBytestreamAugmentSiAcceptReply) (
     WockyNode *si, gpointer user_data);
 
+typedef enum
+{
+  /* data read from the local transport is sent through the bytestream */
+  GABBLE_BYTESTREAM_SPLICE_OUTGOING = 1 << 0,
+  /* data received from the bytestream is written to the local transport */
+  GABBLE_BYTESTREAM_SPLICE_INCOMING = 1 << 1,
+  GABBLE_BYTESTREAM_SPLICE_BOTH =
+      GABBLE_BYTESTREAM_SPLICE_OUTGOING | GABBLE_BYTESTREAM_SPLICE_INCOMING,
+} GabbleBytestreamSpliceFlags;
+
+/* @count bytes have been relayed in the direction given by @flags */
+typedef void (* GabbleBytestreamSpliceFunc) (
+    GabbleBytestreamSpliceFlags flags, gsize count, gpointer user_data);
+
 typedef struct _GabbleBytestreamIface GabbleBytestreamIface;
 typedef struct _GabbleBytestreamIfaceClass GabbleBytestreamIfaceClass;
 
@@ -58,6 +74,9 @@ struct _GabbleBytestreamIfaceClass {
   void (*accept) (GabbleBytestreamIface *bytestream,
       GabbleBytestreamAugmentSiAcceptReply func, gpointer user_data);
   void (*block_reading) (GabbleBytestreamIface *bytestream, gboolean block);
+  gboolean (*splice) (GabbleBytestreamIface *bytestream,
+      GibberTransport *transport, GabbleBytestreamSpliceFlags flags,
+      GabbleBytestreamSpliceFunc func, gpointer user_data);
 };
 
 GType gabble_bytestream_iface_get_type (void);
@@ -88,6 +107,10 @@ void gabble_bytestream_iface_accept (GabbleBytestreamIface *bytestream,
 void gabble_bytestream_iface_block_reading (GabbleBytestreamIface *bytestream,
     gboolean block);
 
+gboolean gabble_bytestream_iface_splice (GabbleBytestreamIface *bytestream,
+    GibberTransport *transport, GabbleBytestreamSpliceFlags flags,
+    GabbleBytestreamSpliceFunc func, gpointer user_data);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_BYTESTREAM_IFACE_H__ */
@@ -29,6 +29,7 @@
 
 #define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
 
+#include "base64.h"
 #include "bytestream-factory.h"
 #include "bytestream-iface.h"
 #include "connection.h"
@@ -294,7 +295,6 @@ send_data_to (GabbleBytestreamMuc *self,
   while (sent < len)
     {
       gboolean ret;
-      gchar *encoded;
       guint send_now;
       GError *error = NULL;
       WockyStanza *msg;
@@ -339,8 +339,8 @@ send_data_to (GabbleBytestreamMuc *self,
             frag = FRAG_LAST;
         }
 
-      encoded = g_base64_encode ((const guchar *) str + sent, send_now);
-      wocky_node_set_content (data, encoded);
+      gabble_base64_encode_to_node (data, (const guchar *) str + sent,
+          send_now);
 
       switch (frag)
         {
@@ -356,9 +356,7 @@ send_data_to (GabbleBytestreamMuc *self,
         }
 
       DEBUG ("send %d bytes", send_now);
-      ret = _gabble_connection_send (priv->conn, msg, &error);
-
-      g_free (encoded);
+      ret = _gabble_connection_send_bulk (priv->conn, msg, &error);
 
       if (!ret)
         {
@@ -404,7 +402,7 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
       (TpBaseConnection *) priv->conn, TP_HANDLE_TYPE_CONTACT);
   const gchar *from;
   WockyNode *data;
-  GString *str;
+  GBytes *bytes = NULL;
   guchar *st;
   gsize outlen;
   TpHandle sender;
@@ -455,10 +453,8 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
       return;
     }
 
-  st = g_base64_decode (data->content, &outlen);
-  str = g_string_new_len ((const gchar *) st, outlen);
-  g_free (st);
-  if (str == NULL)
+  st = gabble_base64_decode (data->content, &outlen);
+  if (st == NULL)
     {
       DEBUG ("base64 decoding failed");
       return;
@@ -475,6 +471,7 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
           g_hash_table_remove (priv->buffers, from);
         }
 
+      bytes = g_bytes_new_take (st, outlen);
       fully_received = TRUE;
     }
 
@@ -491,7 +488,9 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
           DEBUG ("New buffer for %s", from);
         }
 
-      g_hash_table_insert (priv->buffers, g_strdup (from), str);
+      g_hash_table_insert (priv->buffers, g_strdup (from),
+          g_string_new_len ((const gchar *) st, outlen));
+      g_free (st);
     }
 
   else if (frag == FRAG_MIDDLE)
@@ -503,11 +502,11 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
         }
       else
         {
-          DEBUG ("Append data to buffer of %s (%" G_GSIZE_FORMAT " bytes)", from, str->len);
-          g_string_append_len (buffer, str->str, str->len);
+          DEBUG ("Append data to buffer of %s (%" G_GSIZE_FORMAT " bytes)", from, outlen);
+          g_string_append_len (buffer, (const gchar *) st, outlen);
         }
 
-      g_string_free (str, TRUE);
+      g_free (st);
     }
 
   else if (frag == FRAG_LAST)
@@ -516,22 +515,34 @@ gabble_bytestream_muc_receive (GabbleBytestreamMuc *self,
           {
             DEBUG ("Drop last part stanza from %s, first parts not buffered",
                 from);
-            g_string_free (str, TRUE);
           }
       else
         {
+          gpointer key;
+          gsize len;
+
           DEBUG ("Received last part from %s, buffer flushed", from);
-          g_string_prepend_len (str, buffer->str, buffer->len);
-          g_hash_table_remove (priv->buffers, from);
+          g_string_append_len (buffer, (const gchar *) st, outlen);
+
+          /* Take over the reassembled data rather than copying it */
+          g_hash_table_lookup_extended (priv->buffers, from, &key, NULL);
+          g_hash_table_steal (priv->buffers, from);
+          g_free (key);
+
+          len = buffer->len;
+          bytes = g_bytes_new_take (g_string_free (buffer, FALSE), len);
           fully_received = TRUE;
         }
+
+      g_free (st);
     }
 
   if (fully_received)
     {
-      DEBUG ("fully received %" G_GSIZE_FORMAT " bytes of data", str->len);
-      g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, str);
-      g_string_free (str, TRUE);
+      DEBUG ("fully received %" G_GSIZE_FORMAT " bytes of data",
+          g_bytes_get_size (bytes));
+      g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, bytes);
+      g_bytes_unref (bytes);
     }
 }
 
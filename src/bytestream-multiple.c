@@ -29,6 +29,7 @@
 #define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
 
 #include "bytestream-factory.h"
+#include "bytestream-ibb.h"
 #include "bytestream-iface.h"
 #include "connection.h"
 #include "debug.h"
@@ -37,6 +38,11 @@
 #include "namespaces.h"
 #include "util.h"
 
+/* Our user stops reading once we are write-blocked, so only what it had
+ * already read ends up in the migration buffer; it shouldn't need more than
+ * that */
+#define MAX_MIGRATION_BUFFER_SIZE (256 * 1024)
+
 static void
 bytestream_iface_init (gpointer g_iface, gpointer iface_data);
 
@@ -79,6 +85,20 @@ struct _GabbleBytestreamMultiplePrivate
   GabbleBytestreamIface *active_bytestream;
   gboolean read_blocked;
 
+  /* TRUE if all the stream methods are tried at the same time rather than
+   * one after the other. The first bytestream to open is used and we move to
+   * a more preferred one if it opens later. */
+  gboolean race;
+  /* In race mode, the GabbleBytestreamIface still in use (including
+   * active_bytestream), most preferred first. The references are owned by
+   * the factory. */
+  GList *bytestreams;
+  /* The bytestream we are moving to once all the data sent through
+   * active_bytestream has been received, if any */
+  GabbleBytestreamIface *migrating_to;
+  /* Data sent while migrating */
+  GString *migration_buffer;
+
   gboolean dispose_has_run;
 };
 
@@ -86,6 +106,19 @@ struct _GabbleBytestreamMultiplePrivate
 
 static void bytestream_activate_next (GabbleBytestreamMultiple *self);
 
+static void bytestream_connection_error_cb (GabbleBytestreamIface *failed,
+    gpointer user_data);
+static void bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+    GabbleBytestreamState state, gpointer user_data);
+static void bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+    gboolean blocked, gpointer user_data);
+static void bytestream_flushed_cb (GabbleBytestreamIface *bytestream,
+    gpointer user_data);
+
+static void close_other_bytestreams (GabbleBytestreamMultiple *self,
+    GError *error);
+static void close_less_preferred_bytestreams (GabbleBytestreamMultiple *self);
+
 static void
 gabble_bytestream_multiple_init (GabbleBytestreamMultiple *self)
 {
@@ -126,6 +159,10 @@ gabble_bytestream_multiple_finalize (GObject *object)
   for (l = priv->fallback_stream_methods; l != NULL; l = g_list_next (l))
     g_free (l->data);
   g_list_free (priv->fallback_stream_methods);
+  g_list_free (priv->bytestreams);
+
+  if (priv->migration_buffer != NULL)
+    g_string_free (priv->migration_buffer, TRUE);
 
   g_free (priv->stream_id);
   g_free (priv->stream_init_id);
@@ -365,6 +402,22 @@ gabble_bytestream_multiple_send (GabbleBytestreamIface *iface,
 
   g_assert (priv->active_bytestream != NULL);
 
+  if (priv->migrating_to != NULL)
+    {
+      /* Keep the data ordered: it will be sent once the peer received
+       * everything sent through the previous bytestream */
+      if (priv->migration_buffer->len + len > MAX_MIGRATION_BUFFER_SIZE)
+        {
+          DEBUG ("already %" G_GSIZE_FORMAT " bytes waiting for the "
+              "migration, refusing %u more", priv->migration_buffer->len,
+              len);
+          return FALSE;
+        }
+
+      g_string_append_len (priv->migration_buffer, str, len);
+      return TRUE;
+    }
+
   return gabble_bytestream_iface_send (priv->active_bytestream, len, str);
 }
 
@@ -397,20 +450,54 @@ gabble_bytestream_multiple_accept (GabbleBytestreamIface *iface,
 
   g_return_if_fail (priv->active_bytestream != NULL);
 
-  all_methods = g_list_copy (priv->fallback_stream_methods);
-  g_object_get (priv->active_bytestream, "protocol", &current_method, NULL);
-  all_methods = g_list_prepend (all_methods, current_method);
+  if (priv->race)
+    {
+      GList *l;
+
+      all_methods = NULL;
+      for (l = priv->bytestreams; l != NULL; l = g_list_next (l))
+        {
+          gchar *method;
+
+          g_object_get (l->data, "protocol", &method, NULL);
+          all_methods = g_list_prepend (all_methods, method);
+        }
+      all_methods = g_list_reverse (all_methods);
+
+      msg = gabble_bytestream_factory_make_multi_accept_iq (priv->peer_jid,
+          priv->stream_init_id, all_methods);
 
-  msg = gabble_bytestream_factory_make_multi_accept_iq (priv->peer_jid,
-      priv->stream_init_id, all_methods);
+      g_list_foreach (all_methods, (GFunc) g_free, NULL);
+      g_list_free (all_methods);
+    }
+  else
+    {
+      all_methods = g_list_copy (priv->fallback_stream_methods);
+      g_object_get (priv->active_bytestream, "protocol", &current_method,
+          NULL);
+      all_methods = g_list_prepend (all_methods, current_method);
 
-  g_free (current_method);
-  g_list_free (all_methods);
+      msg = gabble_bytestream_factory_make_multi_accept_iq (priv->peer_jid,
+          priv->stream_init_id, all_methods);
+
+      g_free (current_method);
+      g_list_free (all_methods);
+    }
 
   si = wocky_node_get_child_ns (
     wocky_stanza_get_top_node (msg), "si", NS_SI);
   g_assert (si != NULL);
 
+  if (priv->race)
+    {
+      WockyNode *si_multiple;
+
+      /* Let the initiator know it can start all the methods at once */
+      si_multiple = wocky_node_get_child_ns (si, "si-multiple",
+          NS_SI_MULTIPLE);
+      wocky_node_set_attribute (si_multiple, "race", "true");
+    }
+
   if (func != NULL)
     {
       /* let the caller add his profile specific data */
@@ -421,8 +508,27 @@ gabble_bytestream_multiple_accept (GabbleBytestreamIface *iface,
     {
       DEBUG ("stream %s with %s is now accepted", priv->stream_id,
           priv->peer_jid);
-      g_object_set (priv->active_bytestream, "state",
-          GABBLE_BYTESTREAM_STATE_ACCEPTED, NULL);
+
+      if (priv->race)
+        {
+          GList *bytestreams, *l;
+
+          /* Changing the state of the active bytestream changes ours, so the
+           * others could be closed meanwhile */
+          bytestreams = g_list_copy (priv->bytestreams);
+          for (l = bytestreams; l != NULL; l = g_list_next (l))
+            {
+              if (g_list_find (priv->bytestreams, l->data) != NULL)
+                g_object_set (l->data, "state",
+                    GABBLE_BYTESTREAM_STATE_ACCEPTED, NULL);
+            }
+          g_list_free (bytestreams);
+        }
+      else
+        {
+          g_object_set (priv->active_bytestream, "state",
+              GABBLE_BYTESTREAM_STATE_ACCEPTED, NULL);
+        }
     }
 
   g_object_unref (msg);
@@ -446,6 +552,9 @@ gabble_bytestream_multiple_close (GabbleBytestreamIface *iface,
      /* bytestream already closed, do nothing */
      return;
 
+  if (priv->race)
+    close_other_bytestreams (self, error);
+
   if (priv->active_bytestream != NULL)
     gabble_bytestream_iface_close (priv->active_bytestream, error);
   else
@@ -479,19 +588,290 @@ gabble_bytestream_multiple_initiate (GabbleBytestreamIface *iface)
       return FALSE;
     }
 
+  if (priv->race)
+    {
+      GList *bytestreams, *l;
+      gboolean initiated = FALSE;
+
+      DEBUG ("initiate all the stream methods at once");
+
+      bytestreams = g_list_copy (priv->bytestreams);
+      for (l = bytestreams; l != NULL; l = g_list_next (l))
+        {
+          if (g_list_find (priv->bytestreams, l->data) != NULL &&
+              gabble_bytestream_iface_initiate (l->data))
+            initiated = TRUE;
+        }
+      g_list_free (bytestreams);
+
+      return initiated;
+    }
+
   return gabble_bytestream_iface_initiate (priv->active_bytestream);
 }
 
 static void
 bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
                              TpHandle sender,
-                             GString *str,
+                             GBytes *bytes,
                              gpointer user_data)
 {
   GabbleBytestreamMultiple *self = GABBLE_BYTESTREAM_MULTIPLE (user_data);
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  /* In race mode, the peer only sends through a bytestream once everything
+   * it sent through the previous one has been received, so data from all of
+   * them can be forwarded as it comes */
+  if (priv->race && bytestream == priv->active_bytestream &&
+      priv->migrating_to == NULL)
+    {
+      /* The peer is using the same bytestream as us, nobody will use the
+       * less preferred ones anymore */
+      close_less_preferred_bytestreams (self);
+    }
 
   /* Just forward the data */
-  g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, str);
+  g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, bytes);
+}
+
+static void
+disconnect_bytestream (GabbleBytestreamMultiple *self,
+                       GabbleBytestreamIface *bytestream)
+{
+  g_signal_handlers_disconnect_by_func (bytestream,
+      bytestream_connection_error_cb, self);
+  g_signal_handlers_disconnect_by_func (bytestream,
+      bytestream_data_received_cb, self);
+  g_signal_handlers_disconnect_by_func (bytestream,
+      bytestream_state_changed_cb, self);
+  g_signal_handlers_disconnect_by_func (bytestream,
+      bytestream_write_blocked_cb, self);
+  g_signal_handlers_disconnect_by_func (bytestream,
+      bytestream_flushed_cb, self);
+}
+
+static gboolean
+is_preferred (GabbleBytestreamMultiple *self,
+              GabbleBytestreamIface *bytestream,
+              GabbleBytestreamIface *than)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  return g_list_index (priv->bytestreams, bytestream) <
+      g_list_index (priv->bytestreams, than);
+}
+
+static void
+finish_migration (GabbleBytestreamMultiple *self)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+  GString *buffer = priv->migration_buffer;
+
+  g_signal_handlers_disconnect_by_func (priv->active_bytestream,
+      bytestream_flushed_cb, self);
+
+  DEBUG ("everything sent through the previous bytestream has been "
+      "received; now sending %" G_GSIZE_FORMAT " buffered bytes through the "
+      "new one", buffer->len);
+
+  priv->active_bytestream = priv->migrating_to;
+  priv->migrating_to = NULL;
+  priv->migration_buffer = NULL;
+
+  /* We won't send anything through the previous bytestream anymore, and
+   * the peer may never send anything through the new one to tell us it
+   * moved too */
+  close_less_preferred_bytestreams (self);
+
+  if (buffer->len > 0)
+    gabble_bytestream_iface_send (priv->active_bytestream, buffer->len,
+        buffer->str);
+
+  g_string_free (buffer, TRUE);
+
+  g_signal_emit_by_name (G_OBJECT (self), "write-blocked", FALSE);
+}
+
+static void
+abort_migration (GabbleBytestreamMultiple *self)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+  GString *buffer = priv->migration_buffer;
+
+  DEBUG ("the bytestream we were moving to is gone; keep using the "
+      "current one");
+
+  g_signal_handlers_disconnect_by_func (priv->active_bytestream,
+      bytestream_flushed_cb, self);
+
+  priv->migrating_to = NULL;
+  priv->migration_buffer = NULL;
+
+  if (buffer->len > 0)
+    gabble_bytestream_iface_send (priv->active_bytestream, buffer->len,
+        buffer->str);
+
+  g_string_free (buffer, TRUE);
+
+  g_signal_emit_by_name (G_OBJECT (self), "write-blocked", FALSE);
+}
+
+static void
+bytestream_flushed_cb (GabbleBytestreamIface *bytestream,
+                       gpointer user_data)
+{
+  GabbleBytestreamMultiple *self = GABBLE_BYTESTREAM_MULTIPLE (user_data);
+
+  finish_migration (self);
+}
+
+static void
+start_migration (GabbleBytestreamMultiple *self,
+                 GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  /* We can only tell when the peer received all the data sent through an IBB
+   * bytestream */
+  if (!GABBLE_IS_BYTESTREAM_IBB (priv->active_bytestream))
+    return;
+
+  DEBUG ("a preferred bytestream is now open; moving to it");
+
+  priv->migrating_to = bytestream;
+  priv->migration_buffer = g_string_new (NULL);
+
+  /* Don't let the user queue too much data while we are waiting */
+  g_signal_emit_by_name (G_OBJECT (self), "write-blocked", TRUE);
+
+  if (gabble_bytestream_ibb_is_flushed (
+        GABBLE_BYTESTREAM_IBB (priv->active_bytestream)))
+    finish_migration (self);
+  else
+    g_signal_connect (priv->active_bytestream, "flushed",
+        G_CALLBACK (bytestream_flushed_cb), self);
+}
+
+/* Stop using @bytestream in race mode */
+static void
+drop_bytestream (GabbleBytestreamMultiple *self,
+                 GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  disconnect_bytestream (self, bytestream);
+  priv->bytestreams = g_list_remove (priv->bytestreams, bytestream);
+
+  if (bytestream == priv->migrating_to)
+    abort_migration (self);
+
+  if (bytestream == priv->active_bytestream)
+    {
+      /* This only happens while the bytestreams are still initiated */
+      if (priv->bytestreams != NULL)
+        priv->active_bytestream = priv->bytestreams->data;
+      else
+        priv->active_bytestream = NULL;
+    }
+}
+
+static void
+close_other_bytestreams (GabbleBytestreamMultiple *self,
+                         GError *error)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+  GList *bytestreams, *l;
+
+  bytestreams = g_list_copy (priv->bytestreams);
+  for (l = bytestreams; l != NULL; l = g_list_next (l))
+    {
+      GabbleBytestreamIface *bytestream = l->data;
+
+      if (bytestream == priv->active_bytestream)
+        continue;
+
+      drop_bytestream (self, bytestream);
+      gabble_bytestream_iface_close (bytestream, error);
+    }
+  g_list_free (bytestreams);
+}
+
+static void
+close_less_preferred_bytestreams (GabbleBytestreamMultiple *self)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+  GList *l;
+
+  l = g_list_find (priv->bytestreams, priv->active_bytestream);
+  g_assert (l != NULL);
+
+  while (l->next != NULL)
+    {
+      GabbleBytestreamIface *bytestream = l->next->data;
+
+      DEBUG ("closing a less preferred bytestream");
+      drop_bytestream (self, bytestream);
+      gabble_bytestream_iface_close (bytestream, NULL);
+    }
+}
+
+static void
+race_state_changed (GabbleBytestreamMultiple *self,
+                    GabbleBytestreamIface *bytestream,
+                    GabbleBytestreamState state)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  switch (state)
+    {
+      case GABBLE_BYTESTREAM_STATE_OPEN:
+        if (priv->state != GABBLE_BYTESTREAM_STATE_OPEN)
+          {
+            DEBUG ("first bytestream to open; using it");
+            priv->active_bytestream = bytestream;
+            g_object_set (self, "state", state, NULL);
+          }
+        else if (priv->migrating_to == NULL &&
+            is_preferred (self, bytestream, priv->active_bytestream))
+          {
+            start_migration (self, bytestream);
+          }
+        break;
+
+      case GABBLE_BYTESTREAM_STATE_CLOSING:
+      case GABBLE_BYTESTREAM_STATE_CLOSED:
+        if (bytestream != priv->active_bytestream)
+          {
+            drop_bytestream (self, bytestream);
+            break;
+          }
+
+        if (priv->migrating_to != NULL)
+          {
+            /* The peer finished moving first and closed the bytestream we
+             * are leaving */
+            finish_migration (self);
+            break;
+          }
+
+        close_other_bytestreams (self, NULL);
+        g_object_set (self, "state", state, NULL);
+        break;
+
+      default:
+        /* Until one of them is open, we follow the most preferred one */
+        if (bytestream == priv->active_bytestream)
+          g_object_set (self, "state", state, NULL);
+    }
 }
 
 static void
@@ -500,6 +880,14 @@ bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
                              gpointer user_data)
 {
   GabbleBytestreamMultiple *self = GABBLE_BYTESTREAM_MULTIPLE (user_data);
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  if (priv->race)
+    {
+      race_state_changed (self, bytestream, state);
+      return;
+    }
 
   /* When there is a connection error the state of the sub-bytestream becomes
    * CLOSED. There is no risk to receive a notification for this kind of
@@ -512,8 +900,17 @@ bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
 static void
 bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
                              gboolean blocked,
-                             gpointer self)
+                             gpointer user_data)
 {
+  GabbleBytestreamMultiple *self = GABBLE_BYTESTREAM_MULTIPLE (user_data);
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  /* We are blocked anyway while migrating */
+  if (priv->race && (bytestream != priv->active_bytestream ||
+        priv->migrating_to != NULL))
+    return;
+
   /* Forward signal */
   g_signal_emit_by_name (G_OBJECT (self), "write-blocked", blocked);
 }
@@ -526,19 +923,27 @@ bytestream_connection_error_cb (GabbleBytestreamIface *failed,
   GabbleBytestreamMultiplePrivate *priv =
       GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
 
+  if (priv->race)
+    {
+      DEBUG ("one of the racing bytestreams failed");
+
+      drop_bytestream (self, failed);
+
+      if (priv->bytestreams == NULL)
+        {
+          DEBUG ("all of them failed");
+          g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED, NULL);
+        }
+
+      return;
+    }
+
   g_assert (failed == priv->active_bytestream);
   /* the error signal is only emitted when intiating the bytestream */
   g_assert (priv->state == GABBLE_BYTESTREAM_STATE_INITIATING ||
       priv->state == GABBLE_BYTESTREAM_STATE_ACCEPTED);
 
-  g_signal_handlers_disconnect_by_func (failed,
-      bytestream_connection_error_cb, self);
-  g_signal_handlers_disconnect_by_func (failed,
-      bytestream_data_received_cb, self);
-  g_signal_handlers_disconnect_by_func (failed,
-      bytestream_state_changed_cb, self);
-  g_signal_handlers_disconnect_by_func (failed,
-      bytestream_write_blocked_cb, self);
+  disconnect_bytestream (self, failed);
 
   /* We don't have to unref it because the reference is kept by the
    * factory */
@@ -557,6 +962,37 @@ bytestream_connection_error_cb (GabbleBytestreamIface *failed,
     gabble_bytestream_iface_initiate (priv->active_bytestream);
 }
 
+static GabbleBytestreamIface *
+create_bytestream (GabbleBytestreamMultiple *self,
+                   const gchar *stream_method)
+{
+  GabbleBytestreamMultiplePrivate *priv =
+      GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+  GabbleBytestreamIface *bytestream;
+
+  bytestream = gabble_bytestream_factory_create_from_method (
+      priv->factory, stream_method, priv->peer_handle, priv->stream_id,
+      priv->stream_init_id, priv->peer_resource, priv->self_full_jid,
+      priv->state);
+
+  /* Methods have already been checked so this shouldn't fail */
+  g_assert (bytestream != NULL);
+
+  /* block the new bytestream if needed */
+  gabble_bytestream_iface_block_reading (bytestream, priv->read_blocked);
+
+  g_signal_connect (bytestream, "connection-error",
+      G_CALLBACK (bytestream_connection_error_cb), self);
+  g_signal_connect (bytestream, "data-received",
+      G_CALLBACK (bytestream_data_received_cb), self);
+  g_signal_connect (bytestream, "state-changed",
+      G_CALLBACK (bytestream_state_changed_cb), self);
+  g_signal_connect (bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+
+  return bytestream;
+}
+
 static void
 bytestream_activate_next (GabbleBytestreamMultiple *self)
 {
@@ -573,28 +1009,9 @@ bytestream_activate_next (GabbleBytestreamMultiple *self)
   priv->fallback_stream_methods = g_list_delete_link (
       priv->fallback_stream_methods, priv->fallback_stream_methods);
 
-  priv->active_bytestream = gabble_bytestream_factory_create_from_method (
-      priv->factory, stream_method, priv->peer_handle, priv->stream_id,
-      priv->stream_init_id, priv->peer_resource, priv->self_full_jid,
-      priv->state);
-
-  /* Methods have already been checked so this shouldn't fail */
-  g_assert (priv->active_bytestream != NULL);
+  priv->active_bytestream = create_bytestream (self, stream_method);
 
   g_free (stream_method);
-
-  /* block the new bytestream if needed */
-  gabble_bytestream_iface_block_reading (priv->active_bytestream,
-      priv->read_blocked);
-
-  g_signal_connect (priv->active_bytestream, "connection-error",
-      G_CALLBACK (bytestream_connection_error_cb), self);
-  g_signal_connect (priv->active_bytestream, "data-received",
-      G_CALLBACK (bytestream_data_received_cb), self);
-  g_signal_connect (priv->active_bytestream, "state-changed",
-      G_CALLBACK (bytestream_state_changed_cb), self);
-  g_signal_connect (priv->active_bytestream, "write-blocked",
-      G_CALLBACK (bytestream_write_blocked_cb), self);
 }
 
 /*
@@ -615,6 +1032,18 @@ gabble_bytestream_multiple_add_stream_method (GabbleBytestreamMultiple *self,
 
   DEBUG ("Add bytestream method %s", method);
 
+  if (priv->race)
+    {
+      /* All the methods are used straight away */
+      priv->bytestreams = g_list_append (priv->bytestreams,
+          create_bytestream (self, method));
+
+      if (priv->active_bytestream == NULL)
+        priv->active_bytestream = priv->bytestreams->data;
+
+      return;
+    }
+
   priv->fallback_stream_methods = g_list_append (
       priv->fallback_stream_methods, g_strdup (method));
 
@@ -622,6 +1051,28 @@ gabble_bytestream_multiple_add_stream_method (GabbleBytestreamMultiple *self,
     bytestream_activate_next (self);
 }
 
+/*
+ * gabble_bytestream_multiple_enable_race
+ *
+ * Use all the stream methods at the same time rather than falling back to
+ * the next one when one fails. Has to be called before adding stream methods
+ * and only if the peer supports it.
+ */
+void
+gabble_bytestream_multiple_enable_race (GabbleBytestreamMultiple *self)
+{
+  GabbleBytestreamMultiplePrivate *priv;
+
+  g_return_if_fail (GABBLE_IS_BYTESTREAM_MULTIPLE (self));
+
+  priv = GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  g_return_if_fail (priv->active_bytestream == NULL);
+
+  DEBUG ("stream methods will race");
+  priv->race = TRUE;
+}
+
 gboolean
 gabble_bytestream_multiple_has_stream_method (GabbleBytestreamMultiple *self)
 {
@@ -647,10 +1098,42 @@ gabble_bytestream_multiple_block_reading (GabbleBytestreamIface *iface,
 
   priv->read_blocked = block;
 
+  if (priv->race)
+    {
+      GList *l;
+
+      for (l = priv->bytestreams; l != NULL; l = g_list_next (l))
+        gabble_bytestream_iface_block_reading (l->data, block);
+
+      return;
+    }
+
   g_assert (priv->active_bytestream != NULL);
   gabble_bytestream_iface_block_reading (priv->active_bytestream, block);
 }
 
+static gboolean
+gabble_bytestream_multiple_splice (GabbleBytestreamIface *iface,
+                                   GibberTransport *transport,
+                                   GabbleBytestreamSpliceFlags flags,
+                                   GabbleBytestreamSpliceFunc func,
+                                   gpointer user_data)
+{
+  GabbleBytestreamMultiple *self = GABBLE_BYTESTREAM_MULTIPLE (iface);
+  GabbleBytestreamMultiplePrivate *priv =
+    GABBLE_BYTESTREAM_MULTIPLE_GET_PRIVATE (self);
+
+  if (priv->active_bytestream == NULL)
+    return FALSE;
+
+  /* The transport we would splice to changes when migrating */
+  if (priv->race)
+    return FALSE;
+
+  return gabble_bytestream_iface_splice (priv->active_bytestream, transport,
+      flags, func, user_data);
+}
+
 static void
 bytestream_iface_init (gpointer g_iface,
                        gpointer iface_data)
@@ -662,4 +1145,5 @@ bytestream_iface_init (gpointer g_iface,
   klass->close = gabble_bytestream_multiple_close;
   klass->accept = gabble_bytestream_multiple_accept;
   klass->block_reading = gabble_bytestream_multiple_block_reading;
+  klass->splice = gabble_bytestream_multiple_splice;
 }
@@ -67,6 +67,8 @@ void gabble_bytestream_multiple_add_stream_method (
 gboolean gabble_bytestream_multiple_has_stream_method (
     GabbleBytestreamMultiple *self);
 
+void gabble_bytestream_multiple_enable_race (GabbleBytestreamMultiple *self);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_BYTESTREAM_MULTIPLE_H__ */
@@ -0,0 +1,1021 @@
+/*
+ * bytestream-parallel.c - Source for GabbleBytestreamParallel
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Sends the data of one stream over several bytestreams (stripes) at once,
+ * which helps when each connection is slow, e.g. through a SOCKS5 proxy
+ * limiting the rate of each of them. The first stripe is the bytestream
+ * negotiated by the SI offer; its <si> has a <parallel> child saying how
+ * many stripes the peers want, and the other ones are added as they get
+ * negotiated.
+ *
+ * The data is cut into ranges sent as frames:
+ *
+ *   offset (8 bytes) | length (4 bytes) | payload
+ *
+ * (integers are big endian, offsets are relative to the start of the
+ * stream). Each range goes through the first stripe which isn't blocked,
+ * and the receiver puts them back in order. A stripe which gets too far
+ * ahead of the others stops being read, so the ranges waiting for the
+ * previous ones don't use much more than REORDER_WINDOW bytes. As we can't
+ * know which stripe carries the missing range, they are all read again as
+ * soon as it arrives, or if they all got blocked.
+ */
+
+#include "config.h"
+#include "bytestream-parallel.h"
+
+#include <string.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
+
+#include "debug.h"
+#include "namespaces.h"
+
+static void
+bytestream_iface_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (GabbleBytestreamParallel, gabble_bytestream_parallel,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GABBLE_TYPE_BYTESTREAM_IFACE,
+      bytestream_iface_init));
+
+/* properties */
+enum
+{
+  PROP_CONNECTION = 1,
+  PROP_PEER_HANDLE,
+  PROP_PEER_HANDLE_TYPE,
+  PROP_STREAM_ID,
+  PROP_PEER_JID,
+  PROP_STATE,
+  PROP_PROTOCOL,
+  PROP_BYTESTREAM,
+  PROP_N_STREAMS,
+  LAST_PROPERTY
+};
+
+#define FRAME_HEADER_LENGTH 12
+
+/* Size of the ranges */
+#define CHUNK_SIZE (64 * 1024)
+/* How much data received out of order we keep before blocking the stripes
+ * which are ahead */
+#define REORDER_WINDOW (4 * 1024 * 1024)
+/* Never use more stripes than that, whatever the peer asks for */
+#define MAX_STREAMS 8
+
+typedef struct
+{
+  GabbleBytestreamIface *bytestream;
+  GabbleBytestreamState state;
+  /* Incomplete frame received through this stripe */
+  GString *read_buffer;
+  gboolean write_blocked;
+  /* Not read as it's too far ahead of the others */
+  gboolean ahead;
+} Stripe;
+
+struct _GabbleBytestreamParallelPrivate
+{
+  /* (Stripe *), the first one being the bytestream of the SI offer */
+  GPtrArray *stripes;
+  GabbleBytestreamState state;
+  guint n_streams;
+
+  /* Sending */
+  guint64 send_offset;
+  guint next_stripe;
+  gboolean write_blocked;
+
+  /* Receiving */
+  guint64 recv_offset;
+  /* (guint64 *) offset => (GBytes *) ranges received before the previous
+   * ones */
+  GHashTable *pending;
+  gsize pending_size;
+  gboolean read_blocked;
+
+  GabbleBytestreamAugmentSiAcceptReply accept_func;
+  gpointer accept_data;
+
+  gboolean dispose_has_run;
+};
+
+#define GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE(obj) ((obj)->priv)
+
+static Stripe *add_stripe (GabbleBytestreamParallel *self,
+    GabbleBytestreamIface *bytestream);
+
+static void
+gabble_bytestream_parallel_init (GabbleBytestreamParallel *self)
+{
+  GabbleBytestreamParallelPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GABBLE_TYPE_BYTESTREAM_PARALLEL, GabbleBytestreamParallelPrivate);
+
+  self->priv = priv;
+
+  priv->stripes = g_ptr_array_new ();
+  priv->pending = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, (GDestroyNotify) g_bytes_unref);
+}
+
+static Stripe *
+main_stripe (GabbleBytestreamParallel *self)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  if (priv->stripes->len == 0)
+    return NULL;
+
+  return g_ptr_array_index (priv->stripes, 0);
+}
+
+static void
+gabble_bytestream_parallel_dispose (GObject *object)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (object);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  if (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+    gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      g_signal_handlers_disconnect_matched (stripe->bytestream,
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+      g_object_unref (stripe->bytestream);
+      g_string_free (stripe->read_buffer, TRUE);
+      g_slice_free (Stripe, stripe);
+    }
+
+  g_ptr_array_set_size (priv->stripes, 0);
+
+  G_OBJECT_CLASS (gabble_bytestream_parallel_parent_class)->dispose (object);
+}
+
+static void
+gabble_bytestream_parallel_finalize (GObject *object)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (object);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  g_ptr_array_unref (priv->stripes);
+  g_hash_table_unref (priv->pending);
+
+  G_OBJECT_CLASS (gabble_bytestream_parallel_parent_class)->finalize (object);
+}
+
+static void
+gabble_bytestream_parallel_get_property (GObject *object,
+                                         guint property_id,
+                                         GValue *value,
+                                         GParamSpec *pspec)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (object);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  Stripe *stripe = main_stripe (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_PEER_HANDLE_TYPE:
+      case PROP_STREAM_ID:
+      case PROP_PEER_JID:
+      case PROP_PROTOCOL:
+        /* Those are the ones of the bytestream of the SI offer */
+        if (stripe != NULL)
+          g_object_get_property (G_OBJECT (stripe->bytestream),
+              g_param_spec_get_name (pspec), value);
+        break;
+      case PROP_STATE:
+        g_value_set_uint (value, priv->state);
+        break;
+      case PROP_BYTESTREAM:
+        g_value_set_object (value,
+            stripe != NULL ? stripe->bytestream : NULL);
+        break;
+      case PROP_N_STREAMS:
+        g_value_set_uint (value, priv->n_streams);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_parallel_set_property (GObject *object,
+                                         guint property_id,
+                                         const GValue *value,
+                                         GParamSpec *pspec)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (object);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_STREAM_ID:
+        /* Taken from the bytestream of the SI offer */
+        break;
+      case PROP_STATE:
+        if (main_stripe (self) != NULL)
+          g_object_set_property (G_OBJECT (main_stripe (self)->bytestream),
+              "state", value);
+        break;
+      case PROP_BYTESTREAM:
+        add_stripe (self, g_value_get_object (value));
+        break;
+      case PROP_N_STREAMS:
+        priv->n_streams = g_value_get_uint (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_parallel_constructed (GObject *obj)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (obj);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  void (*chain_up) (GObject *) =
+      ((GObjectClass *) gabble_bytestream_parallel_parent_class)->constructed;
+
+  if (chain_up != NULL)
+    chain_up (obj);
+
+  g_assert (main_stripe (self) != NULL);
+
+  priv->state = main_stripe (self)->state;
+}
+
+static void
+gabble_bytestream_parallel_class_init (
+    GabbleBytestreamParallelClass *gabble_bytestream_parallel_class)
+{
+  GObjectClass *object_class =
+      G_OBJECT_CLASS (gabble_bytestream_parallel_class);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (gabble_bytestream_parallel_class,
+      sizeof (GabbleBytestreamParallelPrivate));
+
+  object_class->dispose = gabble_bytestream_parallel_dispose;
+  object_class->finalize = gabble_bytestream_parallel_finalize;
+
+  object_class->get_property = gabble_bytestream_parallel_get_property;
+  object_class->set_property = gabble_bytestream_parallel_set_property;
+  object_class->constructed = gabble_bytestream_parallel_constructed;
+
+  g_object_class_override_property (object_class, PROP_CONNECTION,
+      "connection");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE,
+      "peer-handle");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE_TYPE,
+      "peer-handle-type");
+  g_object_class_override_property (object_class, PROP_STREAM_ID,
+      "stream-id");
+  g_object_class_override_property (object_class, PROP_PEER_JID,
+      "peer-jid");
+  g_object_class_override_property (object_class, PROP_STATE,
+      "state");
+  g_object_class_override_property (object_class, PROP_PROTOCOL,
+      "protocol");
+
+  param_spec = g_param_spec_object (
+      "bytestream",
+      "Bytestream",
+      "The GabbleBytestreamIface negotiated by the SI offer",
+      GABBLE_TYPE_BYTESTREAM_IFACE,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTESTREAM,
+      param_spec);
+
+  param_spec = g_param_spec_uint (
+      "n-streams",
+      "Number of streams",
+      "How many bytestreams the data is sent over, at most",
+      1, MAX_STREAMS, 1,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_N_STREAMS,
+      param_spec);
+}
+
+static Stripe *
+find_stripe (GabbleBytestreamParallel *self,
+             GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      if (stripe->bytestream == bytestream)
+        return stripe;
+    }
+
+  return NULL;
+}
+
+static void
+set_state (GabbleBytestreamParallel *self,
+           GabbleBytestreamState state)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  if (priv->state == state)
+    return;
+
+  priv->state = state;
+
+  if (state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    DEBUG ("parallel bytestream closed (%" G_GUINT64_FORMAT " bytes sent, %"
+        G_GUINT64_FORMAT " bytes received over %u stripes)",
+        priv->send_offset, priv->recv_offset, priv->stripes->len);
+
+  g_signal_emit_by_name (G_OBJECT (self), "state-changed", state);
+}
+
+/* We are write-blocked when all the open stripes are */
+static void
+update_write_blocked (GabbleBytestreamParallel *self)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  gboolean blocked = FALSE;
+  guint i;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      if (stripe->state != GABBLE_BYTESTREAM_STATE_OPEN)
+        continue;
+
+      if (!stripe->write_blocked)
+        {
+          blocked = FALSE;
+          break;
+        }
+
+      blocked = TRUE;
+    }
+
+  if (blocked == priv->write_blocked)
+    return;
+
+  priv->write_blocked = blocked;
+  g_signal_emit_by_name (G_OBJECT (self), "write-blocked", blocked);
+}
+
+static void
+update_reading (GabbleBytestreamParallel *self,
+                Stripe *stripe)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  if (stripe->state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  gabble_bytestream_iface_block_reading (stripe->bytestream,
+      priv->read_blocked || stripe->ahead);
+}
+
+static void
+release_ahead_stripes (GabbleBytestreamParallel *self)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      if (!stripe->ahead)
+        continue;
+
+      stripe->ahead = FALSE;
+      update_reading (self, stripe);
+    }
+}
+
+/* Whether the incomplete frame of @stripe is the range we are waiting for */
+static gboolean
+stripe_has_next_range (GabbleBytestreamParallel *self,
+                       Stripe *stripe)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  const guint8 *header = (const guint8 *) stripe->read_buffer->str;
+  guint64 range_offset = 0;
+  guint i;
+
+  if (stripe->read_buffer->len < FRAME_HEADER_LENGTH)
+    return FALSE;
+
+  for (i = 0; i < 8; i++)
+    range_offset = (range_offset << 8) | header[i];
+
+  return range_offset == priv->recv_offset;
+}
+
+/* If all the open stripes are blocked, the missing range is in one of them */
+static void
+check_all_ahead (GabbleBytestreamParallel *self)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      if (stripe->state == GABBLE_BYTESTREAM_STATE_OPEN && !stripe->ahead)
+        return;
+    }
+
+  DEBUG ("all the stripes are ahead; read them all again");
+  release_ahead_stripes (self);
+}
+
+/* Called once the frames received through @stripe have been handled */
+static void
+update_ahead_stripes (GabbleBytestreamParallel *self,
+                      Stripe *stripe,
+                      gboolean progressed)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  /* Read the stripes which were ahead again once the others caught up */
+  if (progressed || priv->pending_size <= REORDER_WINDOW / 2)
+    {
+      release_ahead_stripes (self);
+      return;
+    }
+
+  if (priv->pending_size > REORDER_WINDOW && !stripe->ahead &&
+      !stripe_has_next_range (self, stripe))
+    {
+      DEBUG ("stripe is too far ahead; stop reading it for now");
+      stripe->ahead = TRUE;
+      update_reading (self, stripe);
+    }
+
+  check_all_ahead (self);
+}
+
+static void
+emit_range (GabbleBytestreamParallel *self,
+            TpHandle sender,
+            GBytes *bytes)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  priv->recv_offset += g_bytes_get_size (bytes);
+  g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, bytes);
+}
+
+static void
+handle_range (GabbleBytestreamParallel *self,
+              Stripe *stripe,
+              TpHandle sender,
+              guint64 offset,
+              const gchar *data,
+              gsize len)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  GBytes *bytes;
+
+  if (offset < priv->recv_offset ||
+      g_hash_table_contains (priv->pending, &offset))
+    {
+      DEBUG ("range at %" G_GUINT64_FORMAT " has already been received",
+          offset);
+      return;
+    }
+
+  if (offset > priv->recv_offset)
+    {
+      guint64 *key = g_new (guint64, 1);
+
+      /* Wait for the previous ranges */
+      *key = offset;
+      g_hash_table_insert (priv->pending, key, g_bytes_new (data, len));
+      priv->pending_size += len;
+      return;
+    }
+
+  bytes = g_bytes_new (data, len);
+  emit_range (self, sender, bytes);
+  g_bytes_unref (bytes);
+
+  /* Ranges which were waiting for this one */
+  while (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED &&
+      (bytes = g_hash_table_lookup (priv->pending, &priv->recv_offset))
+        != NULL)
+    {
+      g_bytes_ref (bytes);
+      g_hash_table_remove (priv->pending, &priv->recv_offset);
+      priv->pending_size -= g_bytes_get_size (bytes);
+
+      emit_range (self, sender, bytes);
+      g_bytes_unref (bytes);
+    }
+}
+
+static void
+stripe_data_received_cb (GabbleBytestreamIface *bytestream,
+                         TpHandle sender,
+                         GBytes *data,
+                         gpointer user_data)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (user_data);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  Stripe *stripe = find_stripe (self, bytestream);
+  gsize offset = 0;
+  gsize len;
+  const gchar *buf = g_bytes_get_data (data, &len);
+  guint64 recv_offset = priv->recv_offset;
+
+  g_return_if_fail (stripe != NULL);
+
+  g_string_append_len (stripe->read_buffer, buf, len);
+
+  /* Handlers of data-received can close us */
+  g_object_ref (self);
+
+  while (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED &&
+      stripe->read_buffer->len - offset >= FRAME_HEADER_LENGTH)
+    {
+      const guint8 *header = (const guint8 *) stripe->read_buffer->str +
+          offset;
+      guint64 range_offset = 0;
+      guint32 range_len;
+      guint i;
+
+      for (i = 0; i < 8; i++)
+        range_offset = (range_offset << 8) | header[i];
+
+      range_len = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) |
+          header[11];
+
+      if (range_len > CHUNK_SIZE)
+        {
+          GError e = { WOCKY_XMPP_ERROR, WOCKY_XMPP_ERROR_BAD_REQUEST,
+              "range too big" };
+
+          DEBUG ("range at %" G_GUINT64_FORMAT " is %u bytes long; close the "
+              "bytestream", range_offset, range_len);
+          gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), &e);
+          break;
+        }
+
+      if (stripe->read_buffer->len - offset <
+          FRAME_HEADER_LENGTH + (gsize) range_len)
+        /* Wait for the rest of the range */
+        break;
+
+      handle_range (self, stripe, sender, range_offset,
+          stripe->read_buffer->str + offset + FRAME_HEADER_LENGTH, range_len);
+
+      offset += FRAME_HEADER_LENGTH + range_len;
+    }
+
+  if (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+    {
+      g_string_erase (stripe->read_buffer, 0, offset);
+      update_ahead_stripes (self, stripe, priv->recv_offset > recv_offset);
+    }
+
+  g_object_unref (self);
+}
+
+static void
+stripe_closed (GabbleBytestreamParallel *self,
+               Stripe *stripe)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *s = g_ptr_array_index (priv->stripes, i);
+
+      if (s->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+        break;
+    }
+
+  if (i == priv->stripes->len)
+    {
+      set_state (self, GABBLE_BYTESTREAM_STATE_CLOSED);
+      return;
+    }
+
+  update_write_blocked (self);
+  check_all_ahead (self);
+
+  /* The peer closes the stripes one by one once it sent everything, but
+   * when sending, some of what we sent may well have been lost. */
+  if (priv->state == GABBLE_BYTESTREAM_STATE_OPEN && priv->send_offset > 0)
+    {
+      DEBUG ("a stripe has been closed while sending; give up");
+      gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
+    }
+}
+
+static void
+stripe_state_changed_cb (GabbleBytestreamIface *bytestream,
+                         GabbleBytestreamState state,
+                         gpointer user_data)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (user_data);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  Stripe *stripe = find_stripe (self, bytestream);
+
+  g_return_if_fail (stripe != NULL);
+
+  stripe->state = state;
+
+  /* We follow the bytestream of the SI offer until it's open */
+  if (stripe == main_stripe (self) &&
+      state != GABBLE_BYTESTREAM_STATE_CLOSED &&
+      priv->state != GABBLE_BYTESTREAM_STATE_OPEN &&
+      priv->state != GABBLE_BYTESTREAM_STATE_CLOSING)
+    set_state (self, state);
+
+  if (state == GABBLE_BYTESTREAM_STATE_OPEN)
+    {
+      DEBUG ("stripe open");
+      update_reading (self, stripe);
+      update_write_blocked (self);
+    }
+  else if (state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    {
+      DEBUG ("stripe closed");
+      stripe_closed (self, stripe);
+    }
+}
+
+static void
+stripe_write_blocked_cb (GabbleBytestreamIface *bytestream,
+                         gboolean blocked,
+                         gpointer user_data)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (user_data);
+  Stripe *stripe = find_stripe (self, bytestream);
+
+  g_return_if_fail (stripe != NULL);
+
+  stripe->write_blocked = blocked;
+  update_write_blocked (self);
+}
+
+static Stripe *
+add_stripe (GabbleBytestreamParallel *self,
+            GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  Stripe *stripe = g_slice_new0 (Stripe);
+
+  stripe->bytestream = g_object_ref (bytestream);
+  stripe->read_buffer = g_string_new ("");
+  g_object_get (bytestream, "state", &stripe->state, NULL);
+
+  g_signal_connect (bytestream, "data-received",
+      G_CALLBACK (stripe_data_received_cb), self);
+  g_signal_connect (bytestream, "state-changed",
+      G_CALLBACK (stripe_state_changed_cb), self);
+  g_signal_connect (bytestream, "write-blocked",
+      G_CALLBACK (stripe_write_blocked_cb), self);
+
+  g_ptr_array_add (priv->stripes, stripe);
+
+  return stripe;
+}
+
+/*
+ * gabble_bytestream_parallel_send
+ *
+ * Implements gabble_bytestream_iface_send on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_parallel_send (GabbleBytestreamIface *iface,
+                                 guint len,
+                                 const gchar *str)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (iface);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  if (priv->state != GABBLE_BYTESTREAM_STATE_OPEN)
+    {
+      DEBUG ("can't send data through a not open bytestream (state: %d)",
+          priv->state);
+      return FALSE;
+    }
+
+  while (len > 0)
+    {
+      guint range_len = MIN (len, CHUNK_SIZE);
+      Stripe *stripe = NULL;
+      GByteArray *frame;
+      gboolean ret;
+      guint i;
+
+      /* The next stripe which isn't blocked, or at least an open one */
+      for (i = 0; i < priv->stripes->len; i++)
+        {
+          guint n = (priv->next_stripe + i) % priv->stripes->len;
+          Stripe *s = g_ptr_array_index (priv->stripes, n);
+
+          if (s->state != GABBLE_BYTESTREAM_STATE_OPEN)
+            continue;
+
+          if (stripe == NULL)
+            stripe = s;
+
+          if (!s->write_blocked)
+            {
+              stripe = s;
+              priv->next_stripe = n + 1;
+              break;
+            }
+        }
+
+      if (stripe == NULL)
+        {
+          DEBUG ("no open stripe");
+          return FALSE;
+        }
+
+      frame = g_byte_array_sized_new (FRAME_HEADER_LENGTH + range_len);
+      g_byte_array_set_size (frame, FRAME_HEADER_LENGTH);
+
+      for (i = 0; i < 8; i++)
+        frame->data[i] = (priv->send_offset >> (56 - 8 * i)) & 0xff;
+
+      frame->data[8] = (range_len >> 24) & 0xff;
+      frame->data[9] = (range_len >> 16) & 0xff;
+      frame->data[10] = (range_len >> 8) & 0xff;
+      frame->data[11] = range_len & 0xff;
+
+      g_byte_array_append (frame, (const guint8 *) str, range_len);
+
+      ret = gabble_bytestream_iface_send (stripe->bytestream, frame->len,
+          (const gchar *) frame->data);
+      g_byte_array_unref (frame);
+
+      if (!ret)
+        return FALSE;
+
+      priv->send_offset += range_len;
+      str += range_len;
+      len -= range_len;
+    }
+
+  return TRUE;
+}
+
+static void
+augment_si_accept_iq (WockyNode *si,
+                      gpointer user_data)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (user_data);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  WockyNode *node;
+  gchar *n_streams;
+
+  if (priv->accept_func != NULL)
+    priv->accept_func (si, priv->accept_data);
+
+  n_streams = g_strdup_printf ("%u", priv->n_streams);
+  node = wocky_node_add_child_ns (si, "parallel", NS_TP_FT_PARALLEL);
+  wocky_node_set_attribute (node, "streams", n_streams);
+  g_free (n_streams);
+}
+
+/*
+ * gabble_bytestream_parallel_accept
+ *
+ * Implements gabble_bytestream_iface_accept on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_parallel_accept (GabbleBytestreamIface *iface,
+                                   GabbleBytestreamAugmentSiAcceptReply func,
+                                   gpointer user_data)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (iface);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+
+  /* Tell the peer how many stripes it can open */
+  priv->accept_func = func;
+  priv->accept_data = user_data;
+
+  gabble_bytestream_iface_accept (main_stripe (self)->bytestream,
+      augment_si_accept_iq, self);
+}
+
+/*
+ * gabble_bytestream_parallel_close
+ *
+ * Implements gabble_bytestream_iface_close on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_parallel_close (GabbleBytestreamIface *iface,
+                                  GError *error)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (iface);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSED ||
+      priv->state == GABBLE_BYTESTREAM_STATE_CLOSING)
+    return;
+
+  set_state (self, GABBLE_BYTESTREAM_STATE_CLOSING);
+
+  /* We are closed once all the stripes are */
+  for (i = 0; i < priv->stripes->len; i++)
+    {
+      Stripe *stripe = g_ptr_array_index (priv->stripes, i);
+
+      if (stripe->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+        gabble_bytestream_iface_close (stripe->bytestream, error);
+    }
+}
+
+/*
+ * gabble_bytestream_parallel_initiate
+ *
+ * Implements gabble_bytestream_iface_initiate on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_parallel_initiate (GabbleBytestreamIface *iface)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (iface);
+
+  return gabble_bytestream_iface_initiate (main_stripe (self)->bytestream);
+}
+
+static void
+gabble_bytestream_parallel_block_reading (GabbleBytestreamIface *iface,
+                                          gboolean block)
+{
+  GabbleBytestreamParallel *self = GABBLE_BYTESTREAM_PARALLEL (iface);
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  guint i;
+
+  if (priv->read_blocked == block)
+    return;
+
+  priv->read_blocked = block;
+
+  for (i = 0; i < priv->stripes->len; i++)
+    update_reading (self, g_ptr_array_index (priv->stripes, i));
+}
+
+static gboolean
+gabble_bytestream_parallel_splice (GabbleBytestreamIface *iface,
+                                   GibberTransport *transport,
+                                   GabbleBytestreamSpliceFlags flags,
+                                   GabbleBytestreamSpliceFunc func,
+                                   gpointer user_data)
+{
+  /* The ranges have to be put back in order */
+  return FALSE;
+}
+
+static void
+bytestream_iface_init (gpointer g_iface,
+                       gpointer iface_data)
+{
+  GabbleBytestreamIfaceClass *klass = (GabbleBytestreamIfaceClass *) g_iface;
+
+  klass->initiate = gabble_bytestream_parallel_initiate;
+  klass->send = gabble_bytestream_parallel_send;
+  klass->close = gabble_bytestream_parallel_close;
+  klass->accept = gabble_bytestream_parallel_accept;
+  klass->block_reading = gabble_bytestream_parallel_block_reading;
+  klass->splice = gabble_bytestream_parallel_splice;
+}
+
+GabbleBytestreamParallel *
+gabble_bytestream_parallel_new (GabbleBytestreamIface *bytestream,
+                                guint n_streams)
+{
+  return g_object_new (GABBLE_TYPE_BYTESTREAM_PARALLEL,
+      "bytestream", bytestream,
+      "n-streams", CLAMP (n_streams, 1, MAX_STREAMS),
+      NULL);
+}
+
+/*
+ * gabble_bytestream_parallel_add_stripe
+ *
+ * Send and receive data through @bytestream as well. It's accepted if it
+ * was offered by the peer.
+ */
+void
+gabble_bytestream_parallel_add_stripe (GabbleBytestreamParallel *self,
+                                       GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamParallelPrivate *priv =
+      GABBLE_BYTESTREAM_PARALLEL_GET_PRIVATE (self);
+  Stripe *stripe;
+
+  if (priv->state == GABBLE_BYTESTREAM_STATE_CLOSING ||
+      priv->state == GABBLE_BYTESTREAM_STATE_CLOSED ||
+      priv->stripes->len >= priv->n_streams)
+    {
+      GError e = { WOCKY_XMPP_ERROR, WOCKY_XMPP_ERROR_NOT_ACCEPTABLE,
+          "no more stripes wanted" };
+
+      DEBUG ("%s", e.message);
+      gabble_bytestream_iface_close (bytestream, &e);
+      return;
+    }
+
+  DEBUG ("add stripe %u", priv->stripes->len);
+
+  stripe = add_stripe (self, bytestream);
+
+  if (stripe->state == GABBLE_BYTESTREAM_STATE_LOCAL_PENDING)
+    gabble_bytestream_iface_accept (bytestream, NULL, NULL);
+
+  update_reading (self, stripe);
+  update_write_blocked (self);
+}
+
+/* How many stripes the <si> @si wants, 0 if it doesn't support them */
+guint
+gabble_bytestream_parallel_get_n_streams (WockyNode *si)
+{
+  WockyNode *node;
+  const gchar *str;
+  guint64 n_streams;
+
+  node = wocky_node_get_child_ns (si, "parallel", NS_TP_FT_PARALLEL);
+  if (node == NULL)
+    return 0;
+
+  str = wocky_node_get_attribute (node, "streams");
+  if (str == NULL)
+    return 0;
+
+  n_streams = g_ascii_strtoull (str, NULL, 10);
+  return (guint) MIN (n_streams, MAX_STREAMS);
+}
@@ -0,0 +1,74 @@
+/*
+ * bytestream-parallel.h - Header for GabbleBytestreamParallel
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_BYTESTREAM_PARALLEL_H__
+#define __GABBLE_BYTESTREAM_PARALLEL_H__
+
+#include <glib-object.h>
+
+#include <wocky/wocky.h>
+
+#include "bytestream-iface.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GabbleBytestreamParallel GabbleBytestreamParallel;
+typedef struct _GabbleBytestreamParallelClass GabbleBytestreamParallelClass;
+typedef struct _GabbleBytestreamParallelPrivate GabbleBytestreamParallelPrivate;
+
+struct _GabbleBytestreamParallelClass {
+  GObjectClass parent_class;
+};
+
+struct _GabbleBytestreamParallel {
+  GObject parent;
+
+  GabbleBytestreamParallelPrivate *priv;
+};
+
+GType gabble_bytestream_parallel_get_type (void);
+
+/* TYPE MACROS */
+#define GABBLE_TYPE_BYTESTREAM_PARALLEL \
+  (gabble_bytestream_parallel_get_type ())
+#define GABBLE_BYTESTREAM_PARALLEL(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GABBLE_TYPE_BYTESTREAM_PARALLEL,\
+                              GabbleBytestreamParallel))
+#define GABBLE_BYTESTREAM_PARALLEL_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GABBLE_TYPE_BYTESTREAM_PARALLEL,\
+                           GabbleBytestreamParallelClass))
+#define GABBLE_IS_BYTESTREAM_PARALLEL(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GABBLE_TYPE_BYTESTREAM_PARALLEL))
+#define GABBLE_IS_BYTESTREAM_PARALLEL_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GABBLE_TYPE_BYTESTREAM_PARALLEL))
+#define GABBLE_BYTESTREAM_PARALLEL_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GABBLE_TYPE_BYTESTREAM_PARALLEL,\
+                              GabbleBytestreamParallelClass))
+
+GabbleBytestreamParallel *gabble_bytestream_parallel_new (
+    GabbleBytestreamIface *bytestream, guint n_streams);
+
+void gabble_bytestream_parallel_add_stripe (GabbleBytestreamParallel *self,
+    GabbleBytestreamIface *bytestream);
+
+guint gabble_bytestream_parallel_get_n_streams (WockyNode *si);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_BYTESTREAM_PARALLEL_H__ */
@@ -31,6 +31,7 @@
 # include <net/if.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 
@@ -42,6 +43,11 @@
  #include <ifaddrs.h>
 #endif
 
+#ifdef HAVE_LINUX_RTNETLINK_H
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+#endif
+
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
@@ -49,8 +55,8 @@
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
 #include <gibber/gibber-transport.h>
+#include <gibber/gibber-fd-transport.h>
 #include <gibber/gibber-tcp-transport.h>
-#include <gibber/gibber-listener.h>
 
 #define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
 
@@ -122,6 +128,12 @@ typedef enum _Socks5State Socks5State;
 
 #define CONNECT_REPLY_TIMEOUT 30
 #define CONNECT_TIMEOUT 10
+/* Delay (in ms) before the next streamhost starts racing the ones which are
+ * still trying to connect */
+#define CONNECT_ATTEMPT_DELAY 250
+/* How long (in seconds) we keep using the same local addresses if we can't
+ * be notified when they change */
+#define LOCAL_IPS_LIFE_TIME 30
 
 struct _Streamhost
 {
@@ -161,6 +173,49 @@ streamhost_free (Streamhost *streamhost)
   g_slice_free (Streamhost, streamhost);
 }
 
+/* A connection attempt to one of the streamhosts offered to us. All the
+ * streamhosts are raced and the first one completing the SOCKS5 handshake
+ * becomes the transport of the bytestream. */
+struct _ConnectAttempt
+{
+  GabbleBytestreamSocks5 *self;
+  /* borrowed from priv->streamhosts */
+  Streamhost *streamhost;
+  GibberTransport *transport;
+  /* SOCKS5_STATE_TARGET_TRYING_CONNECT, SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT
+   * or SOCKS5_STATE_TARGET_CONNECT_REQUESTED */
+  Socks5State state;
+  GString *read_buffer;
+  /* monotonic time when the attempt was started */
+  gint64 started;
+  guint timer_id;
+};
+typedef struct _ConnectAttempt ConnectAttempt;
+
+static gint64
+connect_attempt_elapsed (ConnectAttempt *attempt)
+{
+  return (g_get_monotonic_time () - attempt->started) / 1000;
+}
+
+static void
+connect_attempt_free (ConnectAttempt *attempt)
+{
+  if (attempt->timer_id != 0)
+    g_source_remove (attempt->timer_id);
+
+  if (attempt->transport != NULL)
+    {
+      g_signal_handlers_disconnect_matched (attempt->transport,
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, attempt);
+      g_object_unref (attempt->transport);
+    }
+
+  g_string_free (attempt->read_buffer, TRUE);
+
+  g_slice_free (ConnectAttempt, attempt);
+}
+
 struct _GabbleBytestreamSocks5Private
 {
   GabbleConnection *conn;
@@ -172,11 +227,19 @@ struct _GabbleBytestreamSocks5Private
   gchar *peer_jid;
   gchar *self_full_jid;
   gchar *proxy_jid;
+  /* monotonic time when we started to connect to proxy_jid */
+  gint64 proxy_connect_started;
   /* TRUE if the peer of this bytestream is a muc contact */
   gboolean muc_contact;
 
   /* List of Streamhost */
   GSList *streamhosts;
+  /* The next streamhost in streamhosts to start racing, if any */
+  GSList *next_streamhost;
+  /* List of ConnectAttempt still racing */
+  GSList *attempts;
+  /* Starts the next connection attempt once CONNECT_ATTEMPT_DELAY passed */
+  guint attempt_timer_id;
 
   /* Connections to streamhosts are async, so we keep the IQ set message
    * around */
@@ -186,11 +249,19 @@ struct _GabbleBytestreamSocks5Private
   GibberTransport *transport;
   gboolean write_blocked;
   gboolean read_blocked;
-  GibberListener *listener;
+  /* The domain of the connection we are waiting for on the factory's SOCKS5
+   * listener, if any */
+  gchar *listener_domain;
   guint timer_id;
 
   GString *read_buffer;
 
+  /* local transport data is relayed to/from with splice (), if any */
+  GibberTransport *splice_transport;
+  GabbleBytestreamSpliceFlags splice_flags;
+  GabbleBytestreamSpliceFunc splice_func;
+  gpointer splice_user_data;
+
   gboolean dispose_has_run;
 };
 
@@ -203,6 +274,15 @@ static void gabble_bytestream_socks5_close (GabbleBytestreamIface *iface,
 
 static void socks5_error (GabbleBytestreamSocks5 *self);
 
+static void stop_splice (GabbleBytestreamSocks5 *self);
+
+static void record_proxy_result (GabbleBytestreamSocks5 *self,
+    gboolean success);
+
+static void cancel_connect_attempts (GabbleBytestreamSocks5 *self);
+
+static void stop_listening (GabbleBytestreamSocks5 *self);
+
 static void transport_handler (GibberTransport *transport,
     GibberBuffer *data, gpointer user_data);
 
@@ -241,14 +321,16 @@ gabble_bytestream_socks5_dispose (GObject *object)
   priv->dispose_has_run = TRUE;
 
   stop_timer (self);
+  cancel_connect_attempts (self);
 
   if (priv->bytestream_state != GABBLE_BYTESTREAM_STATE_CLOSED)
     {
       gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
     }
 
+  stop_splice (self);
+  stop_listening (self);
   tp_clear_object (&priv->transport);
-  tp_clear_object (&priv->listener);
 
   G_OBJECT_CLASS (gabble_bytestream_socks5_parent_class)->dispose (object);
 }
@@ -490,6 +572,20 @@ write_to_transport (GabbleBytestreamSocks5 *self,
   return TRUE;
 }
 
+static void
+send_auth_request (GibberTransport *transport)
+{
+  guint8 msg[3];
+
+  msg[0] = SOCKS5_VERSION;
+  /* Number of auth methods we are offering, we support just
+   * SOCKS5_AUTH_NONE */
+  msg[1] = 1;
+  msg[2] = SOCKS5_AUTH_NONE;
+
+  gibber_transport_send (transport, msg, 3, NULL);
+}
+
 static void
 transport_connected_cb (GibberTransport *transport,
                         GabbleBytestreamSocks5 *self)
@@ -499,25 +595,14 @@ transport_connected_cb (GibberTransport *transport,
 
   stop_timer (self);
 
-  if (priv->socks5_state == SOCKS5_STATE_TARGET_TRYING_CONNECT ||
-      priv->socks5_state == SOCKS5_STATE_INITIATOR_TRYING_CONNECT)
+  /* As target, streamhosts are connected by the connection attempts */
+  if (priv->socks5_state == SOCKS5_STATE_INITIATOR_TRYING_CONNECT)
     {
-      gchar msg[3];
-
       DEBUG ("transport is connected. Sending auth request");
 
-      msg[0] = SOCKS5_VERSION;
-      /* Number of auth methods we are offering, we support just
-       * SOCKS5_AUTH_NONE */
-      msg[1] = 1;
-      msg[2] = SOCKS5_AUTH_NONE;
-
-      write_to_transport (self, msg, 3, NULL);
+      send_auth_request (priv->transport);
 
-      if (priv->socks5_state == SOCKS5_STATE_TARGET_TRYING_CONNECT)
-        priv->socks5_state = SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT;
-      else
-        priv->socks5_state = SOCKS5_STATE_INITIATOR_AUTH_REQUEST_SENT;
+      priv->socks5_state = SOCKS5_STATE_INITIATOR_AUTH_REQUEST_SENT;
     }
 }
 
@@ -544,12 +629,38 @@ change_write_blocked_state (GabbleBytestreamSocks5 *self,
   g_signal_emit_by_name (self, "write-blocked", blocked);
 }
 
+static void
+stop_splice (GabbleBytestreamSocks5 *self)
+{
+  GabbleBytestreamSocks5Private *priv =
+    GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  if (priv->splice_transport == NULL)
+    return;
+
+  if (priv->splice_flags & GABBLE_BYTESTREAM_SPLICE_OUTGOING)
+    gibber_fd_transport_stop_splice (
+        GIBBER_FD_TRANSPORT (priv->splice_transport));
+
+  if (priv->splice_flags & GABBLE_BYTESTREAM_SPLICE_INCOMING &&
+      priv->transport != NULL)
+    gibber_fd_transport_stop_splice (GIBBER_FD_TRANSPORT (priv->transport));
+
+  priv->splice_flags = 0;
+  priv->splice_func = NULL;
+  priv->splice_user_data = NULL;
+  tp_clear_object (&priv->splice_transport);
+}
+
 static void
 socks5_close_transport (GabbleBytestreamSocks5 *self)
 {
   GabbleBytestreamSocks5Private *priv =
     GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
 
+  stop_splice (self);
+  cancel_connect_attempts (self);
+
   if (priv->read_buffer != NULL)
     {
       g_string_free (priv->read_buffer, TRUE);
@@ -568,6 +679,7 @@ socks5_close_transport (GabbleBytestreamSocks5 *self)
 static void
 bytestream_closed (GabbleBytestreamSocks5 *self)
 {
+  stop_listening (self);
   socks5_close_transport (self);
   g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED, NULL);
 }
@@ -628,27 +740,9 @@ socks5_error (GabbleBytestreamSocks5 *self)
   switch (previous_state)
     {
       case SOCKS5_STATE_TARGET_TRYING_CONNECT:
-      case SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT:
-      case SOCKS5_STATE_TARGET_CONNECT_REQUESTED:
-        /* The attempt for connect to the streamhost failed */
+        /* We couldn't connect to any streamhost */
         socks5_close_transport (self);
 
-        if (priv->streamhosts != NULL)
-          {
-            /* Remove the failed streamhost */
-            streamhost_free (priv->streamhosts->data);
-            priv->streamhosts = g_slist_delete_link (priv->streamhosts,
-                priv->streamhosts);
-          }
-
-        if (priv->streamhosts != NULL)
-          {
-            DEBUG ("connection to streamhost failed, trying the next one");
-
-            socks5_connect (self);
-            return;
-          }
-
         DEBUG ("no more streamhosts to try");
 
         g_signal_emit_by_name (self, "connection-error");
@@ -663,13 +757,10 @@ socks5_error (GabbleBytestreamSocks5 *self)
         priv->msg_for_acknowledge_connection = NULL;
         break;
 
-      case SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST:
-      case SOCKS5_STATE_INITIATOR_AWAITING_COMMAND:
-        DEBUG ("Something goes wrong during SOCKS5 negotiation. Don't close "
-            "the bytestream yet as the target can still try other streamhosts");
-        break;
-
       default:
+        /* If we were still trying to use the proxy selected by the target,
+         * it failed */
+        record_proxy_result (self, FALSE);
         DEBUG ("error, closing the connection\n");
         gabble_bytestream_socks5_close (GABBLE_BYTESTREAM_IFACE (self), NULL);
     }
@@ -704,6 +795,92 @@ check_domain (const gchar *domain,
   return TRUE;
 }
 
+static void
+send_connect_request (GibberTransport *transport,
+                      const gchar *domain)
+{
+  guint8 msg[SOCKS5_CONNECT_LENGTH];
+
+  msg[0] = SOCKS5_VERSION;
+  msg[1] = SOCKS5_CMD_CONNECT;
+  msg[2] = SOCKS5_RESERVED;
+  msg[3] = SOCKS5_ATYP_DOMAIN;
+  /* Length of a hex SHA1 */
+  msg[4] = SHA1_LENGTH;
+  /* Domain name: SHA-1(sid + initiator + target) */
+  memcpy (&msg[5], domain, SHA1_LENGTH);
+  /* Port: 0 */
+  msg[45] = 0x00;
+  msg[46] = 0x00;
+
+  gibber_transport_send (transport, msg, SOCKS5_CONNECT_LENGTH, NULL);
+}
+
+/* Parses the reply to our CONNECT command and returns its length, 0 if it
+ * has not been fully received yet or -1 if the connection was refused */
+static gssize
+parse_connect_reply (GString *string,
+                     const gchar *domain)
+{
+  /* the length of the BND.ADDR field */
+  guint addr_len;
+
+  if (string->len < SOCKS5_MIN_LENGTH)
+    return 0;
+
+  if (string->str[0] != SOCKS5_VERSION ||
+      string->str[1] != SOCKS5_STATUS_OK ||
+      string->str[2] != SOCKS5_RESERVED)
+    {
+      DEBUG ("Connection refused");
+      return -1;
+    }
+
+  if (string->str[3] == SOCKS5_ATYP_DOMAIN)
+    {
+      /* correct domain. The first byte of the domain contains its
+       * length */
+      addr_len = (guint8) string->str[4];
+      addr_len += 1;
+    }
+  else if (string->str[3] == 0x00)
+    {
+      DEBUG ("Got 0x00 as domain. Pretend it's ok to be able to interop "
+          "with ejabberd < 2.0.2");
+      addr_len = 0;
+    }
+  else
+    {
+      DEBUG ("Wrong domain");
+      return -1;
+    }
+
+  if (string->len < SOCKS5_MIN_LENGTH + addr_len)
+    /* We didn't receive the full packet yet */
+    return 0;
+
+  if (
+      /* first half of the port number */
+      string->str[4 + addr_len] != 0 ||
+      /* second half of the port number */
+      string->str[5 + addr_len] != 0)
+    {
+      DEBUG ("Connection refused");
+      return -1;
+    }
+
+  if (addr_len > 0)
+    {
+      if (!check_domain (&string->str[5], addr_len - 1, domain))
+        {
+          /* Thanks Pidgin... */
+          DEBUG ("Ignoring to interop with buggy implementations");
+        }
+    }
+
+  return SOCKS5_MIN_LENGTH + addr_len;
+}
+
 static gboolean
 socks5_timer_cb (gpointer data)
 {
@@ -728,12 +905,12 @@ start_timer (GabbleBytestreamSocks5 *self,
 }
 
 static void
-target_got_connect_reply (GabbleBytestreamSocks5 *self)
+target_got_connect_reply (GabbleBytestreamSocks5 *self,
+                          Streamhost *streamhost)
 {
   GabbleBytestreamSocks5Private *priv = GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (
       self);
   WockyPorter *porter = wocky_session_get_porter (priv->conn->session);
-  Streamhost *current_streamhost;
 
   DEBUG ("Received CONNECT reply. Socks5 stream connected. "
       "Bytestream is now open");
@@ -741,7 +918,6 @@ target_got_connect_reply (GabbleBytestreamSocks5 *self)
   g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_OPEN, NULL);
 
   /* Acknowledge the connection */
-  current_streamhost = priv->streamhosts->data;
   wocky_porter_acknowledge_iq (porter, priv->msg_for_acknowledge_connection,
       '(', "query", ':', NS_BYTESTREAMS,
         /* streamhost-used informs the other end of the streamhost we
@@ -749,7 +925,7 @@ target_got_connect_reply (GabbleBytestreamSocks5 *self)
          * but if we are using an external proxy we need to know which
          * one was selected */
         '(', "streamhost-used",
-          '@', "jid", current_streamhost->jid,
+          '@', "jid", streamhost->jid,
         ')',
       ')', NULL);
 
@@ -791,6 +967,7 @@ socks5_activation_reply_cb (
     }
 
   DEBUG ("Proxy activated the bytestream. It's now open");
+  record_proxy_result (self, TRUE);
 
   priv->socks5_state = SOCKS5_STATE_CONNECTED;
   g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_OPEN, NULL);
@@ -799,6 +976,7 @@ socks5_activation_reply_cb (
   goto out;
 
 activation_failed:
+  record_proxy_result (self, FALSE);
   g_signal_emit_by_name (self, "connection-error");
   g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED, NULL);
 
@@ -835,6 +1013,20 @@ initiator_got_connect_reply (GabbleBytestreamSocks5 *self)
   g_object_unref (iq);
 }
 
+static void
+emit_data_received (GabbleBytestreamSocks5 *self,
+                    const guint8 *data,
+                    gsize len)
+{
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+  GBytes *bytes = g_bytes_new (data, len);
+
+  g_signal_emit_by_name (G_OBJECT (self), "data-received",
+      priv->peer_handle, bytes);
+  g_bytes_unref (bytes);
+}
+
 /* Process the received data and returns the number of bytes that have been
  * used */
 static gssize
@@ -843,17 +1035,12 @@ socks5_handle_received_data (GabbleBytestreamSocks5 *self,
 {
   GabbleBytestreamSocks5Private *priv =
       GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
-  gchar msg[SOCKS5_CONNECT_LENGTH];
-  guint auth_len;
-  guint i;
   gchar *domain;
-  /* the length of the BND.ADDR field */
-  guint8 addr_len;
   gsize len;
+  gssize used;
 
   switch (priv->socks5_state)
     {
-      case SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT:
       case SOCKS5_STATE_INITIATOR_AUTH_REQUEST_SENT:
         /* We sent an authorization request and we are awaiting for a
          * response, the response is 2 bytes-long */
@@ -873,39 +1060,12 @@ socks5_handle_received_data (GabbleBytestreamSocks5 *self,
 
         DEBUG ("Received auth reply. Sending CONNECT command");
 
-        if (priv->socks5_state == SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT)
-          {
-            domain = compute_domain (priv->stream_id, priv->peer_jid,
-                priv->self_full_jid);
-          }
-        else
-          {
-            /* SOCKS5_STATE_INITIATOR_AUTH_REQUEST_SENT */
-            domain = compute_domain (priv->stream_id, priv->self_full_jid,
-                priv->peer_jid);
-          }
-
-        msg[0] = SOCKS5_VERSION;
-        msg[1] = SOCKS5_CMD_CONNECT;
-        msg[2] = SOCKS5_RESERVED;
-        msg[3] = SOCKS5_ATYP_DOMAIN;
-        /* Length of a hex SHA1 */
-        msg[4] = 40;
-        /* Domain name: SHA-1(sid + initiator + target) */
-        memcpy (&msg[5], domain, 40);
-        /* Port: 0 */
-        msg[45] = 0x00;
-        msg[46] = 0x00;
-
+        domain = compute_domain (priv->stream_id, priv->self_full_jid,
+            priv->peer_jid);
+        send_connect_request (priv->transport, domain);
         g_free (domain);
 
-        write_to_transport (self, msg, SOCKS5_CONNECT_LENGTH, NULL);
-
-        if (priv->socks5_state == SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT)
-          priv->socks5_state = SOCKS5_STATE_TARGET_CONNECT_REQUESTED;
-        else
-          /* SOCKS5_STATE_INITIATOR_AUTH_REQUEST_SENT */
-          priv->socks5_state = SOCKS5_STATE_INITIATOR_CONNECT_REQUESTED;
+        priv->socks5_state = SOCKS5_STATE_INITIATOR_CONNECT_REQUESTED;
 
         /* Older version of Gabble (pre 0.7.22) are bugged and just send 2
          * bytes as CONNECT reply. We set a timer to not wait the full reply
@@ -916,328 +1076,413 @@ socks5_handle_received_data (GabbleBytestreamSocks5 *self,
 
         return 2;
 
-      case SOCKS5_STATE_TARGET_CONNECT_REQUESTED:
       case SOCKS5_STATE_INITIATOR_CONNECT_REQUESTED:
         /* We sent a CONNECT request and are awaiting for the response */
-        if (string->len < SOCKS5_MIN_LENGTH)
-          return 0;
-
-        if (string->str[0] != SOCKS5_VERSION ||
-            string->str[1] != SOCKS5_STATUS_OK ||
-            string->str[2] != SOCKS5_RESERVED)
-          {
-            DEBUG ("Connection refused");
-
-            socks5_error (self);
-            return -1;
-          }
-
-        if (string->str[3] == SOCKS5_ATYP_DOMAIN)
-          {
-            /* correct domain. The first byte of the domain contains its
-             * length */
-            addr_len = (guint8) string->str[4];
-            addr_len += 1;
-          }
-        else if (string->str[3] == 0x00)
-          {
-            DEBUG ("Got 0x00 as domain. Pretend it's ok to be able to interop "
-                "with ejabberd < 2.0.2");
-            addr_len = 0;
-          }
-        else
-          {
-            DEBUG ("Wrong domain");
-
-            socks5_error (self);
-            return -1;
-          }
+        domain = compute_domain (priv->stream_id, priv->self_full_jid,
+            priv->peer_jid);
+        used = parse_connect_reply (string, domain);
+        g_free (domain);
 
-        if ((guint8) string->len < SOCKS5_MIN_LENGTH + addr_len)
-          /* We didn't receive the full packet yet */
+        if (used == 0)
           return 0;
 
         stop_timer (self);
 
-        if (
-            /* first half of the port number */
-            string->str[4 + addr_len] != 0 ||
-            /* second half of the port number */
-            string->str[5 + addr_len] != 0)
+        if (used < 0)
           {
-            DEBUG ("Connection refused");
-
             socks5_error (self);
             return -1;
           }
 
-        if (priv->socks5_state == SOCKS5_STATE_TARGET_CONNECT_REQUESTED)
-          {
-            domain = compute_domain (priv->stream_id, priv->peer_jid,
-                priv->self_full_jid);
-          }
-        else
-          {
-            /* SOCKS5_STATE_INITIATOR_CONNECT_REQUESTED */
-            domain = compute_domain (priv->stream_id, priv->self_full_jid,
-                priv->peer_jid);
-          }
+        initiator_got_connect_reply (self);
 
-        if (addr_len > 0)
-          {
-            if (!check_domain (&string->str[5], addr_len - 1, domain))
-              {
-                /* Thanks Pidgin... */
-                DEBUG ("Ignoring to interop with buggy implementations");
-              }
-          }
+        return used;
 
-        g_free (domain);
+      case SOCKS5_STATE_CONNECTED:
+        /* We are connected, everything we receive now is data */
 
-        if (priv->socks5_state == SOCKS5_STATE_TARGET_CONNECT_REQUESTED)
-          target_got_connect_reply (self);
-        else
-          /* SOCKS5_STATE_INITIATOR_CONNECT_REQUESTED */
-          initiator_got_connect_reply (self);
+        /* store the buffer len because if something went wront in the
+         * data-received callback, the bytestream could be freed and so the
+         * priv->read_buffer */
+        len = string->len;
+        emit_data_received (self, (const guint8 *) string->str, len);
 
-        return SOCKS5_MIN_LENGTH + addr_len;
+        return len;
 
-      case SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST:
-        /* A client connected to us and we are awaiting for the authorization
-         * request (at least 2 bytes) */
-        if (string->len < 2)
-          return 0;
+      case SOCKS5_STATE_ERROR:
+        /* An error occurred and the channel will be closed in an idle
+         * callback, so let's just throw away the data we receive */
+        DEBUG ("An error occurred, throwing away received data");
+        return string->len;
 
-        if (string->str[0] != SOCKS5_VERSION)
-          {
-            DEBUG ("Authentication failed");
+      case SOCKS5_STATE_TARGET_TRYING_CONNECT:
+      case SOCKS5_STATE_INITIATOR_TRYING_CONNECT:
+        DEBUG ("Impossible to receive data when not yet connected to the "
+            "socket");
+        break;
 
-            socks5_error (self);
-            return -1;
-          }
+      case SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT:
+      case SOCKS5_STATE_TARGET_CONNECT_REQUESTED:
+        DEBUG ("The target side handshake is done by the connection "
+            "attempts");
+        break;
 
-        /* The auth request string is SOCKS5_VERSION + # of methods + methods */
-        auth_len = string->str[1] + 2;
-        if (string->len < auth_len)
-          /* We are still receiving some auth method */
-          return 0;
+      case SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST:
+      case SOCKS5_STATE_INITIATOR_AWAITING_COMMAND:
+        DEBUG ("The handshake of incoming connections is done before "
+            "handing them to the bytestream");
+        break;
 
-        for (i = 2; i < auth_len; i++)
-          {
-            if (string->str[i] == SOCKS5_AUTH_NONE)
-              {
-                /* Authorize the connection */
-                msg[0] = SOCKS5_VERSION;
-                msg[1] = SOCKS5_AUTH_NONE;
+      case SOCKS5_STATE_INITIATOR_OFFER_SENT:
+        DEBUG ("Shouldn't receive data when we just sent the offer");
+        break;
 
-                DEBUG ("Received auth request. Sending auth reply");
-                write_to_transport (self, msg, 2, NULL);
+      case SOCKS5_STATE_INITIATOR_ACTIVATION_SENT:
+        DEBUG ("Shouldn't receive data before we received activation reply");
+        break;
 
-                priv->socks5_state = SOCKS5_STATE_INITIATOR_AWAITING_COMMAND;
+      case SOCKS5_STATE_INVALID:
+        DEBUG ("Invalid SOCKS5 state");
+        break;
+    }
 
-                return auth_len;
-              }
-          }
+  g_assert_not_reached ();
+  return string->len;
+}
 
-        DEBUG ("Unauthenticated access is not supported by the streamhost");
+static void
+transport_handler (GibberTransport *transport,
+                   GibberBuffer *data,
+                   gpointer user_data)
 
-        socks5_error (self);
+{
+  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (user_data);
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+  gssize used_bytes;
 
-        return -1;
+  g_assert (priv->read_buffer != NULL);
 
-      case SOCKS5_STATE_INITIATOR_AWAITING_COMMAND:
-        /* The client has been authorized and we are waiting for a command,
-         * the only one supported by the SOCKS5 bytestreams XEP is
-         * CONNECT with:
-         *  - ATYP = DOMAIN
-         *  - PORT = 0
-         *  - DOMAIN = SHA1(sid + initiator + target)
-         */
-        if (string->len < SOCKS5_MIN_LENGTH)
-          return 0;
+  if (priv->socks5_state == SOCKS5_STATE_CONNECTED &&
+      priv->read_buffer->len == 0)
+    {
+      /* The handshake is over and nothing is left over from it: pass the
+       * data through without staging it */
+      emit_data_received (self, data->data, data->length);
+      return;
+    }
 
-        addr_len = (guint8) string->str[4];
-        /* the first byte is the length */
-        addr_len += 1;
+  g_string_append_len (priv->read_buffer, (const gchar *) data->data,
+      data->length);
 
-        if ((guint8) string->len < SOCKS5_MIN_LENGTH + addr_len)
-          /* We didn't receive the full packet yet */
-          return 0;
+  /* If something goes wrong in socks5_handle_received_data, the bytestream
+   * could be closed and disposed. Ref it to artificially keep this bytestream
+   * object alive while we are in this function. */
+  g_object_ref (self);
 
-        if (string->str[0] != SOCKS5_VERSION ||
-            string->str[1] != SOCKS5_CMD_CONNECT ||
-            string->str[2] != SOCKS5_RESERVED ||
-            string->str[3] != SOCKS5_ATYP_DOMAIN ||
-            /* first half of the port number */
-            string->str[4 + addr_len] != 0 ||
-            /* second half of the port number */
-            string->str[5 + addr_len] != 0)
-          {
-            DEBUG ("Invalid SOCKS5 connect message");
+  do
+    {
+      /* socks5_handle_received_data() processes the data and returns the
+       * number of bytes that have been used. 0 means that there is not enough
+       * data to do anything, so we just wait for more data from the socket */
+      used_bytes = socks5_handle_received_data (self, priv->read_buffer);
 
-            socks5_error (self);
-            return -1;
-          }
+      if (priv->read_buffer == NULL)
+        /* If something did wrong in socks5_handle_received_data, the
+         * bytestream can be closed and so destroyed. */
+        break;
 
-        domain = compute_domain (priv->stream_id, priv->self_full_jid,
-            priv->peer_jid);
+      g_string_erase (priv->read_buffer, 0, used_bytes);
+    }
+  while (used_bytes > 0 && priv->read_buffer->len > 0);
 
-        if (!check_domain (&string->str[5], addr_len - 1, domain))
-          {
-            DEBUG ("Reject connection to prevent spoofing");
-            socks5_close_transport (self);
-            socks5_error (self);
-            g_free (domain);
-            return -1;
-          }
+  g_object_unref (self);
+}
 
-        msg[0] = SOCKS5_VERSION;
-        msg[1] = SOCKS5_STATUS_OK;
-        msg[2] = SOCKS5_RESERVED;
-        msg[3] = SOCKS5_ATYP_DOMAIN;
-        msg[4] = SHA1_LENGTH;
-        /* Domain name: SHA-1(sid + initiator + target) */
-        memcpy (&msg[5], domain, 40);
-        /* Port: 0 */
-        msg[45] = 0x00;
-        msg[46] = 0x00;
+static void
+cancel_connect_attempts (GabbleBytestreamSocks5 *self)
+{
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+  GSList *l;
 
-        g_free (domain);
+  if (priv->attempt_timer_id != 0)
+    {
+      g_source_remove (priv->attempt_timer_id);
+      priv->attempt_timer_id = 0;
+    }
 
-        DEBUG ("Received CONNECT cmd. Sending CONNECT reply");
-        write_to_transport (self, msg, 47, NULL);
+  priv->next_streamhost = NULL;
 
-        priv->socks5_state = SOCKS5_STATE_CONNECTED;
+  for (l = priv->attempts; l != NULL; l = g_slist_next (l))
+    {
+      ConnectAttempt *attempt = l->data;
 
-        /* Sock5 is connected but the bytestream is not open yet as we need
-         * to wait for the IQ reply. Stop reading until the bytestream
-         * is open to avoid data loss. */
-        gibber_transport_block_receiving (priv->transport, TRUE);
+      DEBUG ("cancel connection to streamhost %s (%s:%d) after %"
+          G_GINT64_FORMAT " ms", attempt->streamhost->jid,
+          attempt->streamhost->host, attempt->streamhost->port,
+          connect_attempt_elapsed (attempt));
 
-        DEBUG ("sock5 stream connected. Stop to listen for connections");
-        g_assert (priv->listener != NULL);
-        tp_clear_object (&priv->listener);
+      connect_attempt_free (attempt);
+    }
 
-        return SOCKS5_MIN_LENGTH + addr_len;
+  g_slist_free (priv->attempts);
+  priv->attempts = NULL;
+}
 
-      case SOCKS5_STATE_CONNECTED:
-        /* We are connected, everything we receive now is data */
+static void start_next_attempt (GabbleBytestreamSocks5 *self);
 
-        /* store the buffer len because if something went wront in the
-         * data-received callback, the bytestream could be freed and so the
-         * priv->read_buffer */
-        len = string->len;
-        g_signal_emit_by_name (G_OBJECT (self), "data-received",
-            priv->peer_handle, string);
+static void
+connect_attempt_failed (ConnectAttempt *attempt,
+                        const gchar *reason)
+{
+  GabbleBytestreamSocks5 *self = attempt->self;
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
 
-        return len;
+  DEBUG ("connection to streamhost %s (%s:%d) failed after %"
+      G_GINT64_FORMAT " ms: %s", attempt->streamhost->jid,
+      attempt->streamhost->host, attempt->streamhost->port,
+      connect_attempt_elapsed (attempt), reason);
 
-      case SOCKS5_STATE_ERROR:
-        /* An error occurred and the channel will be closed in an idle
-         * callback, so let's just throw away the data we receive */
-        DEBUG ("An error occurred, throwing away received data");
-        return string->len;
+  gabble_bytestream_factory_record_socks5_proxy (
+      priv->conn->bytestream_factory, attempt->streamhost->jid, FALSE,
+      connect_attempt_elapsed (attempt));
 
-      case SOCKS5_STATE_TARGET_TRYING_CONNECT:
-      case SOCKS5_STATE_INITIATOR_TRYING_CONNECT:
-        DEBUG ("Impossible to receive data when not yet connected to the "
-            "socket");
-        break;
+  priv->attempts = g_slist_remove (priv->attempts, attempt);
+  connect_attempt_free (attempt);
 
-      case SOCKS5_STATE_INITIATOR_OFFER_SENT:
-        DEBUG ("Shouldn't receive data when we just sent the offer");
-        break;
+  if (priv->next_streamhost != NULL)
+    {
+      /* No need to wait for the delay; start racing the next one now */
+      start_next_attempt (self);
+    }
+  else if (priv->attempts == NULL)
+    {
+      socks5_error (self);
+    }
+}
 
-      case SOCKS5_STATE_INITIATOR_ACTIVATION_SENT:
-        DEBUG ("Shouldn't receive data before we received activation reply");
-        break;
+static void
+connect_attempt_succeeded (ConnectAttempt *attempt,
+                           gsize reply_len)
+{
+  GabbleBytestreamSocks5 *self = attempt->self;
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+  Streamhost *streamhost = attempt->streamhost;
+  GibberTransport *transport;
 
-      case SOCKS5_STATE_INVALID:
-        DEBUG ("Invalid SOCKS5 state");
-        break;
-    }
+  DEBUG ("streamhost %s (%s:%d) won after %" G_GINT64_FORMAT " ms",
+      streamhost->jid, streamhost->host, streamhost->port,
+      connect_attempt_elapsed (attempt));
 
-  g_assert_not_reached ();
-  return string->len;
+  gabble_bytestream_factory_record_socks5_proxy (
+      priv->conn->bytestream_factory, streamhost->jid, TRUE,
+      connect_attempt_elapsed (attempt));
+
+  priv->attempts = g_slist_remove (priv->attempts, attempt);
+  cancel_connect_attempts (self);
+
+  /* Steal the transport of the winner */
+  transport = attempt->transport;
+  attempt->transport = NULL;
+  g_signal_handlers_disconnect_matched (transport, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, attempt);
+  gibber_transport_set_handler (transport, NULL, NULL);
+
+  set_transport (self, transport);
+  g_object_unref (transport);
+
+  /* The initiator shouldn't send anything before it activated the stream.
+   * If it did anyway, it will be delivered with the next received data. */
+  g_string_append_len (priv->read_buffer,
+      attempt->read_buffer->str + reply_len,
+      attempt->read_buffer->len - reply_len);
+
+  connect_attempt_free (attempt);
+
+  target_got_connect_reply (self, streamhost);
+}
+
+static gboolean
+connect_attempt_timeout_cb (gpointer data)
+{
+  ConnectAttempt *attempt = data;
+
+  attempt->timer_id = 0;
+  connect_attempt_failed (attempt, "timed out");
+  return FALSE;
 }
 
 static void
-transport_handler (GibberTransport *transport,
-                   GibberBuffer *data,
-                   gpointer user_data)
+connect_attempt_connected_cb (GibberTransport *transport,
+                              ConnectAttempt *attempt)
+{
+  DEBUG ("connected to streamhost %s (%s:%d) after %" G_GINT64_FORMAT
+      " ms. Sending auth request", attempt->streamhost->jid,
+      attempt->streamhost->host, attempt->streamhost->port,
+      connect_attempt_elapsed (attempt));
+
+  send_auth_request (transport);
+  attempt->state = SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT;
+
+  /* Older version of Gabble (pre 0.7.22) are bugged and just send 2 bytes
+   * as CONNECT reply. Don't wait for the full reply forever. */
+  g_source_remove (attempt->timer_id);
+  attempt->timer_id = g_timeout_add_seconds (CONNECT_REPLY_TIMEOUT,
+      connect_attempt_timeout_cb, attempt);
+}
 
+static void
+connect_attempt_disconnected_cb (GibberTransport *transport,
+                                 ConnectAttempt *attempt)
 {
-  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (user_data);
+  connect_attempt_failed (attempt, "disconnected");
+}
+
+static void
+connect_attempt_handler (GibberTransport *transport,
+                         GibberBuffer *data,
+                         gpointer user_data)
+{
+  ConnectAttempt *attempt = user_data;
   GabbleBytestreamSocks5Private *priv =
-      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
-  gssize used_bytes;
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (attempt->self);
+  GString *buffer = attempt->read_buffer;
+  gchar *domain;
+  gssize used;
 
-  g_assert (priv->read_buffer != NULL);
-  g_string_append_len (priv->read_buffer, (const gchar *) data->data,
-      data->length);
+  g_string_append_len (buffer, (const gchar *) data->data, data->length);
 
-  /* If something goes wrong in socks5_handle_received_data, the bytestream
-   * could be closed and disposed. Ref it to artificially keep this bytestream
-   * object alive while we are in this function. */
-  g_object_ref (self);
+  domain = compute_domain (priv->stream_id, priv->peer_jid,
+      priv->self_full_jid);
 
-  do
+  if (attempt->state == SOCKS5_STATE_TARGET_AUTH_REQUEST_SENT &&
+      buffer->len >= 2)
     {
-      /* socks5_handle_received_data() processes the data and returns the
-       * number of bytes that have been used. 0 means that there is not enough
-       * data to do anything, so we just wait for more data from the socket */
-      used_bytes = socks5_handle_received_data (self, priv->read_buffer);
+      if (buffer->str[0] != SOCKS5_VERSION ||
+          buffer->str[1] != SOCKS5_STATUS_OK)
+        {
+          g_free (domain);
+          connect_attempt_failed (attempt, "authentication failed");
+          return;
+        }
 
-      if (priv->read_buffer == NULL)
-        /* If something did wrong in socks5_handle_received_data, the
-         * bytestream can be closed and so destroyed. */
-        break;
+      DEBUG ("received auth reply from streamhost %s after %" G_GINT64_FORMAT
+          " ms. Sending CONNECT command", attempt->streamhost->jid,
+          connect_attempt_elapsed (attempt));
 
-      g_string_erase (priv->read_buffer, 0, used_bytes);
+      g_string_erase (buffer, 0, 2);
+      send_connect_request (transport, domain);
+      attempt->state = SOCKS5_STATE_TARGET_CONNECT_REQUESTED;
     }
-  while (used_bytes > 0 && priv->read_buffer->len > 0);
 
-  g_object_unref (self);
+  if (attempt->state != SOCKS5_STATE_TARGET_CONNECT_REQUESTED)
+    {
+      g_free (domain);
+      return;
+    }
+
+  used = parse_connect_reply (buffer, domain);
+  g_free (domain);
+
+  if (used < 0)
+    connect_attempt_failed (attempt, "connection refused");
+  else if (used > 0)
+    connect_attempt_succeeded (attempt, used);
+}
+
+static gboolean
+start_next_attempt_cb (gpointer data)
+{
+  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (data);
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  priv->attempt_timer_id = 0;
+  start_next_attempt (self);
+  return FALSE;
 }
 
 static void
-socks5_connect (GabbleBytestreamSocks5 *self)
+start_next_attempt (GabbleBytestreamSocks5 *self)
 {
   GabbleBytestreamSocks5Private *priv =
       GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
-  Streamhost* streamhost;
+  ConnectAttempt *attempt;
   GibberTCPTransport *transport;
 
-  priv->socks5_state = SOCKS5_STATE_TARGET_TRYING_CONNECT;
+  g_assert (priv->next_streamhost != NULL);
 
-  if (priv->streamhosts != NULL)
+  if (priv->attempt_timer_id != 0)
     {
-      streamhost = priv->streamhosts->data;
+      g_source_remove (priv->attempt_timer_id);
+      priv->attempt_timer_id = 0;
     }
-  else
-    {
-      DEBUG ("No more streamhosts to try, closing");
 
-      socks5_error (self);
-      return;
-    }
+  attempt = g_slice_new0 (ConnectAttempt);
+  attempt->self = self;
+  attempt->streamhost = priv->next_streamhost->data;
+  attempt->state = SOCKS5_STATE_TARGET_TRYING_CONNECT;
+  attempt->read_buffer = g_string_sized_new (SOCKS5_CONNECT_LENGTH);
+  attempt->started = g_get_monotonic_time ();
+
+  priv->next_streamhost = g_slist_next (priv->next_streamhost);
+  priv->attempts = g_slist_prepend (priv->attempts, attempt);
 
-  DEBUG ("Trying streamhost %s on port %d", streamhost->host,
-      streamhost->port);
+  DEBUG ("Trying streamhost %s on port %d", attempt->streamhost->host,
+      attempt->streamhost->port);
 
   transport = gibber_tcp_transport_new ();
-  set_transport (self, GIBBER_TRANSPORT (transport));
-  g_object_unref (transport);
+  attempt->transport = GIBBER_TRANSPORT (transport);
+
+  gibber_transport_set_handler (attempt->transport, connect_attempt_handler,
+      attempt);
+  g_signal_connect (transport, "connected",
+      G_CALLBACK (connect_attempt_connected_cb), attempt);
+  g_signal_connect (transport, "disconnected",
+      G_CALLBACK (connect_attempt_disconnected_cb), attempt);
+
+  /* We don't want to wait for the TCP timeout if the host is unreachable */
+  attempt->timer_id = g_timeout_add_seconds (CONNECT_TIMEOUT,
+      connect_attempt_timeout_cb, attempt);
 
-  /* We don't wait to wait for the TCP timeout is the host is unreachable */
-  start_timer (self, CONNECT_TIMEOUT);
+  /* Give this streamhost a head start before racing the next one */
+  if (priv->next_streamhost != NULL)
+    priv->attempt_timer_id = g_timeout_add (CONNECT_ATTEMPT_DELAY,
+        start_next_attempt_cb, self);
 
-  gibber_tcp_transport_connect (transport, streamhost->host,
-      streamhost->port);
+  /* This can fail synchronously and so free the attempt */
+  gibber_tcp_transport_connect (transport, attempt->streamhost->host,
+      attempt->streamhost->port);
 
   /* We'll send the auth request once the transport is connected */
 }
 
+static void
+socks5_connect (GabbleBytestreamSocks5 *self)
+{
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  priv->socks5_state = SOCKS5_STATE_TARGET_TRYING_CONNECT;
+
+  if (priv->streamhosts == NULL)
+    {
+      DEBUG ("No streamhost to try, closing");
+
+      socks5_error (self);
+      return;
+    }
+
+  /* Connect to all the streamhosts in parallel, starting them
+   * CONNECT_ATTEMPT_DELAY apart so the preferred ones get a head start. The
+   * first one completing the SOCKS5 handshake is used. */
+  priv->next_streamhost = priv->streamhosts;
+  start_next_attempt (self);
+}
+
 /**
  * gabble_bytestream_socks5_add_streamhost
  *
@@ -1374,9 +1619,9 @@ gabble_bytestream_socks5_send (GabbleBytestreamIface *iface,
   /* At this point we know that the bytestream has not been closed */
   g_object_unref (self);
 
-  if (!gibber_transport_buffer_is_empty (priv->transport))
+  if (gibber_transport_buffer_is_full (priv->transport))
     {
-      /* We >don't want to send more data while the buffer isn't empty */
+      /* We don't want to queue more data until the buffer has drained */
       change_write_blocked_state (self, TRUE);
     }
 
@@ -1499,6 +1744,25 @@ gabble_bytestream_socks5_close (GabbleBytestreamIface *iface,
     }
 }
 
+/* Let the factory know how the proxy selected by the target performed */
+static void
+record_proxy_result (GabbleBytestreamSocks5 *self,
+                     gboolean success)
+{
+  GabbleBytestreamSocks5Private *priv = GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (
+      self);
+
+  if (priv->proxy_jid == NULL || priv->proxy_connect_started == 0)
+    return;
+
+  gabble_bytestream_factory_record_socks5_proxy (
+      priv->conn->bytestream_factory, priv->proxy_jid, success,
+      (g_get_monotonic_time () - priv->proxy_connect_started) / 1000);
+
+  /* Only record it once */
+  priv->proxy_connect_started = 0;
+}
+
 static void
 initiator_connected_to_proxy (GabbleBytestreamSocks5 *self)
 {
@@ -1531,6 +1795,7 @@ initiator_connected_to_proxy (GabbleBytestreamSocks5 *self)
 
   DEBUG ("connect to proxy: %s (%s:%d)", proxy->jid, proxy->host, proxy->port);
   priv->socks5_state = SOCKS5_STATE_INITIATOR_TRYING_CONNECT;
+  priv->proxy_connect_started = g_get_monotonic_time ();
 
   transport = gibber_tcp_transport_new ();
   set_transport (self, GIBBER_TRANSPORT (transport));
@@ -1591,6 +1856,9 @@ socks5_init_reply_cb (
               goto socks5_init_error;
             }
 
+          /* The target won't connect to us */
+          stop_listening (self);
+
           priv->proxy_jid = g_strdup (jid);
           initiator_connected_to_proxy (self);
           goto out;
@@ -1618,6 +1886,8 @@ socks5_init_reply_cb (
 socks5_init_error:
   DEBUG ("error during Socks5 initiation");
 
+  stop_listening (self);
+
   g_signal_emit_by_name (self, "connection-error");
   g_object_set (self, "state", GABBLE_BYTESTREAM_STATE_CLOSED, NULL);
 
@@ -1629,7 +1899,7 @@ out:
 #ifdef G_OS_WIN32
 
 static GSList *
-get_local_interfaces_ips (void)
+enumerate_local_interfaces_ips (void)
 {
   gint sockfd;
   INTERFACE_INFO *iflist = NULL;
@@ -1703,7 +1973,7 @@ get_local_interfaces_ips (void)
 
 #else
 
-/* get_local_interfaces_ips original code from Farsight 2 (function
+/* enumerate_local_interfaces_ips original code from Farsight 2 (function
  * fs_interfaces_get_local_ips in /gst-libs/gst/farsight/fs-interfaces.c).
  *   Copyright (C) 2006 Youness Alaoui <kakaroto@kakaroto.homelinux.net>
  *   Copyright (C) 2007 Collabora
@@ -1711,7 +1981,7 @@ get_local_interfaces_ips (void)
 #ifdef HAVE_GETIFADDRS
 
 static GSList *
-get_local_interfaces_ips (void)
+enumerate_local_interfaces_ips (void)
 {
   struct ifaddrs *ifa, *results;
   GSList *ips = NULL;
@@ -1777,21 +2047,86 @@ get_local_interfaces_ips (void)
 
 #else /* ! HAVE_GETIFADDRS */
 
+/* Linux lists the IPv6 addresses in /proc/net/if_inet6, one per line:
+ * address (32 hex digits), interface index, prefix length, scope, flags and
+ * interface name */
 static GSList *
-get_local_interfaces_ips (void)
+get_ipv6_addresses_from_proc (void)
+{
+  gchar *contents;
+  gchar **lines;
+  GSList *ips = NULL;
+  guint i;
+
+  if (!g_file_get_contents ("/proc/net/if_inet6", &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", 0);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar hex[33];
+      gchar name[17];
+      guint index, prefix, scope, flags;
+      struct in6_addr addr;
+      char straddr[INET6_ADDRSTRLEN];
+      guint j;
+
+      if (sscanf (lines[i], "%32s %x %x %x %x %16s", hex, &index, &prefix,
+            &scope, &flags, name) != 6)
+        continue;
+
+      /* Only keep global addresses: skip loopback (0x10), link-local (0x20)
+       * and site-local (0x40) ones */
+      if (scope != 0)
+        continue;
+
+      for (j = 0; j < 16; j++)
+        {
+          gint high = g_ascii_xdigit_value (hex[2 * j]);
+          gint low = g_ascii_xdigit_value (hex[2 * j + 1]);
+
+          if (high < 0 || low < 0)
+            break;
+
+          addr.s6_addr[j] = (high << 4) | low;
+        }
+
+      if (j < 16)
+        continue;
+
+      inet_ntop (AF_INET6, &addr, straddr, sizeof (straddr));
+
+      DEBUG ("Interface:  %s", name);
+      DEBUG ("IP Address: %s", straddr);
+
+      /* Add IPv6 addresses to the begin of the list */
+      ips = g_slist_prepend (ips, g_strdup (straddr));
+    }
+
+  g_strfreev (lines);
+
+  return ips;
+}
+
+static GSList *
+enumerate_local_interfaces_ips (void)
 {
   gint sockfd;
   gint size = 0;
   struct ifreq *ifr;
   struct ifconf ifc;
   struct sockaddr_in *sa;
-  GSList *ips = NULL;
+  GSList *ips;
+
+  /* SIOCGIFCONF only knows about IPv4 */
+  ips = get_ipv6_addresses_from_proc ();
 
-  /* FIXME: add IPv6 addresses */
   if ((sockfd = socket (AF_INET, SOCK_DGRAM, IPPROTO_IP)) < 0)
     {
       DEBUG ("Cannot open socket to retreive interface list");
-      return NULL;
+      return ips;
     }
 
   ifc.ifc_len = 0;
@@ -1807,7 +2142,7 @@ get_local_interfaces_ips (void)
           DEBUG ("Out of memory while allocation interface configuration"
               " structure");
           close (sockfd);
-          return NULL;
+          return ips;
         }
       ifc.ifc_len = size;
 
@@ -1816,7 +2151,7 @@ get_local_interfaces_ips (void)
           DEBUG ("ioctl SIOCFIFCONF");
           close (sockfd);
           free (ifc.ifc_req);
-          return NULL;
+          return ips;
         }
     } while  (size <= ifc.ifc_len);
 
@@ -1841,7 +2176,8 @@ get_local_interfaces_ips (void)
         }
       else
         {
-          ips = g_slist_prepend (ips, g_strdup (inet_ntoa (sa->sin_addr)));
+          /* Add IPv4 addresses to the end of the list */
+          ips = g_slist_append (ips, g_strdup (inet_ntoa (sa->sin_addr)));
         }
     }
 
@@ -1855,22 +2191,472 @@ get_local_interfaces_ips (void)
 
 #endif /* ! G_OS_WIN32 */
 
-static void
-new_connection_cb (GibberListener *listener,
-                   GibberTransport *transport,
-                   struct sockaddr *addr,
-                   guint size,
-                   gpointer user_data)
-{
-  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (user_data);
-  GabbleBytestreamSocks5Private *priv =
-    GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+/* The local addresses are the same for all the bytestreams so we only
+ * enumerate them again once they changed */
+static GSList *local_ips = NULL;
+static gboolean local_ips_valid = FALSE;
+static gint64 local_ips_stamp = 0;
+/* TRUE if we are notified when local_ips becomes outdated */
+static gboolean local_ips_watched = FALSE;
 
-  DEBUG ("New connection...");
+#ifdef HAVE_LINUX_RTNETLINK_H
 
-  priv->socks5_state = SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST;
-  set_transport (self, transport);
-}
+static gboolean
+netlink_event_cb (GIOChannel *source,
+                  GIOCondition condition,
+                  gpointer user_data)
+{
+  gint fd = g_io_channel_unix_get_fd (source);
+  gchar buf[4096];
+  gssize len;
+  gboolean changed = FALSE;
+
+  while ((len = recv (fd, buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+    {
+      struct nlmsghdr *header;
+      gint remaining = len;
+
+      for (header = (struct nlmsghdr *) buf;
+          NLMSG_OK (header, remaining);
+          header = NLMSG_NEXT (header, remaining))
+        {
+          switch (header->nlmsg_type)
+            {
+              case RTM_NEWADDR:
+              case RTM_DELADDR:
+              case RTM_NEWLINK:
+              case RTM_DELLINK:
+                changed = TRUE;
+                break;
+            }
+        }
+    }
+
+  /* ENOBUFS means we missed some notifications */
+  if (changed || (len < 0 && errno == ENOBUFS))
+    {
+      DEBUG ("local addresses changed");
+      local_ips_valid = FALSE;
+    }
+
+  if ((condition & (G_IO_ERR | G_IO_HUP)) != 0 ||
+      (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+       errno != EINTR && errno != ENOBUFS))
+    {
+      DEBUG ("error reading the netlink socket; local addresses will expire "
+          "after %d seconds", LOCAL_IPS_LIFE_TIME);
+      local_ips_watched = FALSE;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+watch_local_interfaces (void)
+{
+  struct sockaddr_nl addr;
+  GIOChannel *channel;
+  gint fd;
+
+  fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+  if (fd < 0)
+    {
+      DEBUG ("can't open netlink socket: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  memset (&addr, 0, sizeof (addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    {
+      DEBUG ("can't bind netlink socket: %s", g_strerror (errno));
+      close (fd);
+      return FALSE;
+    }
+
+  channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+  g_io_add_watch (channel, G_IO_IN | G_IO_ERR | G_IO_HUP,
+      netlink_event_cb, NULL);
+  g_io_channel_unref (channel);
+
+  return TRUE;
+}
+
+#else /* ! HAVE_LINUX_RTNETLINK_H */
+
+static gboolean
+watch_local_interfaces (void)
+{
+  return FALSE;
+}
+
+#endif /* ! HAVE_LINUX_RTNETLINK_H */
+
+static GSList *
+get_local_interfaces_ips (void)
+{
+  static gboolean watch_tried = FALSE;
+  GSList *ips = NULL, *l;
+
+  if (!watch_tried)
+    {
+      /* Start watching before enumerating so we don't miss a change */
+      local_ips_watched = watch_local_interfaces ();
+      watch_tried = TRUE;
+    }
+
+  if (local_ips_valid && !local_ips_watched &&
+      g_get_monotonic_time () - local_ips_stamp >
+        (gint64) LOCAL_IPS_LIFE_TIME * G_USEC_PER_SEC)
+    local_ips_valid = FALSE;
+
+  if (!local_ips_valid)
+    {
+      g_slist_foreach (local_ips, (GFunc) g_free, NULL);
+      g_slist_free (local_ips);
+
+      local_ips = enumerate_local_interfaces_ips ();
+      local_ips_stamp = g_get_monotonic_time ();
+      local_ips_valid = TRUE;
+    }
+
+  for (l = local_ips; l != NULL; l = g_slist_next (l))
+    ips = g_slist_prepend (ips, g_strdup (l->data));
+
+  return g_slist_reverse (ips);
+}
+
+static void
+stop_listening (GabbleBytestreamSocks5 *self)
+{
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  if (priv->listener_domain == NULL)
+    return;
+
+  gabble_bytestream_factory_remove_socks5_domain (
+      priv->conn->bytestream_factory, priv->listener_domain);
+
+  g_free (priv->listener_domain);
+  priv->listener_domain = NULL;
+}
+
+/* The target connected to our listener and completed the SOCKS5 handshake.
+ * @data and @len are what we received after its CONNECT command. */
+static void
+initiator_got_connection (GabbleBytestreamSocks5 *self,
+                          GibberTransport *transport,
+                          const gchar *data,
+                          gsize len)
+{
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  DEBUG ("sock5 stream connected. Stop to listen for connections");
+  stop_listening (self);
+
+  set_transport (self, transport);
+  g_string_append_len (priv->read_buffer, data, len);
+
+  priv->socks5_state = SOCKS5_STATE_CONNECTED;
+
+  /* Sock5 is connected but the bytestream is not open yet as we need
+   * to wait for the IQ reply. Stop reading until the bytestream
+   * is open to avoid data loss. */
+  gibber_transport_block_receiving (priv->transport, TRUE);
+}
+
+/* A connection to the listener shared by the bytestreams we initiate. We
+ * only know which bytestream it's for once we get its CONNECT command. */
+struct _IncomingConnection
+{
+  /* weak pointer */
+  GabbleBytestreamFactory *factory;
+  GibberTransport *transport;
+  /* SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST or
+   * SOCKS5_STATE_INITIATOR_AWAITING_COMMAND */
+  Socks5State state;
+  GString *read_buffer;
+  guint timer_id;
+};
+typedef struct _IncomingConnection IncomingConnection;
+
+static void
+incoming_connection_free (IncomingConnection *incoming)
+{
+  if (incoming->factory != NULL)
+    g_object_remove_weak_pointer (G_OBJECT (incoming->factory),
+        (gpointer *) &incoming->factory);
+
+  if (incoming->timer_id != 0)
+    g_source_remove (incoming->timer_id);
+
+  if (incoming->transport != NULL)
+    {
+      gibber_transport_set_handler (incoming->transport, NULL, NULL);
+      g_signal_handlers_disconnect_matched (incoming->transport,
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, incoming);
+      g_object_unref (incoming->transport);
+    }
+
+  g_string_free (incoming->read_buffer, TRUE);
+
+  g_slice_free (IncomingConnection, incoming);
+}
+
+static void
+incoming_connection_error (IncomingConnection *incoming)
+{
+  GibberTransport *transport = g_object_ref (incoming->transport);
+
+  /* Don't get the disconnected signal */
+  incoming_connection_free (incoming);
+
+  gibber_transport_disconnect (transport);
+  g_object_unref (transport);
+}
+
+static gboolean
+incoming_connection_timeout_cb (gpointer data)
+{
+  IncomingConnection *incoming = data;
+
+  DEBUG ("SOCKS5 handshake of an incoming connection timed out");
+
+  incoming->timer_id = 0;
+  incoming_connection_error (incoming);
+  return FALSE;
+}
+
+static void
+incoming_connection_disconnected_cb (GibberTransport *transport,
+                                     IncomingConnection *incoming)
+{
+  DEBUG ("incoming connection closed before the end of the SOCKS5 "
+      "handshake");
+
+  incoming_connection_free (incoming);
+}
+
+/* Process the received data and returns the number of bytes that have been
+ * used, or -1 if @incoming has been freed */
+static gssize
+incoming_connection_handle_data (IncomingConnection *incoming)
+{
+  GString *string = incoming->read_buffer;
+  GabbleBytestreamSocks5 *self;
+  GabbleBytestreamSocks5Private *priv;
+  GibberTransport *transport;
+  gchar msg[SOCKS5_CONNECT_LENGTH];
+  guint auth_len;
+  guint i;
+  gchar *domain;
+  /* the length of the BND.ADDR field */
+  guint8 addr_len;
+  gsize used;
+
+  switch (incoming->state)
+    {
+      case SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST:
+        /* A client connected to us and we are awaiting for the authorization
+         * request (at least 2 bytes) */
+        if (string->len < 2)
+          return 0;
+
+        if (string->str[0] != SOCKS5_VERSION)
+          {
+            DEBUG ("Authentication failed");
+
+            incoming_connection_error (incoming);
+            return -1;
+          }
+
+        /* The auth request string is SOCKS5_VERSION + # of methods + methods */
+        auth_len = (guint8) string->str[1] + 2;
+        if (string->len < auth_len)
+          /* We are still receiving some auth method */
+          return 0;
+
+        for (i = 2; i < auth_len; i++)
+          {
+            if (string->str[i] == SOCKS5_AUTH_NONE)
+              {
+                /* Authorize the connection */
+                msg[0] = SOCKS5_VERSION;
+                msg[1] = SOCKS5_AUTH_NONE;
+
+                DEBUG ("Received auth request. Sending auth reply");
+                gibber_transport_send (incoming->transport,
+                    (const guint8 *) msg, 2, NULL);
+
+                incoming->state = SOCKS5_STATE_INITIATOR_AWAITING_COMMAND;
+
+                return auth_len;
+              }
+          }
+
+        DEBUG ("Unauthenticated access is not supported by the streamhost");
+
+        incoming_connection_error (incoming);
+        return -1;
+
+      case SOCKS5_STATE_INITIATOR_AWAITING_COMMAND:
+        /* The client has been authorized and we are waiting for a command,
+         * the only one supported by the SOCKS5 bytestreams XEP is
+         * CONNECT with:
+         *  - ATYP = DOMAIN
+         *  - PORT = 0
+         *  - DOMAIN = SHA1(sid + initiator + target)
+         */
+        if (string->len < SOCKS5_MIN_LENGTH)
+          return 0;
+
+        addr_len = (guint8) string->str[4];
+        /* the first byte is the length */
+        addr_len += 1;
+
+        if (string->len < SOCKS5_MIN_LENGTH + (gsize) addr_len)
+          /* We didn't receive the full packet yet */
+          return 0;
+
+        if (string->str[0] != SOCKS5_VERSION ||
+            string->str[1] != SOCKS5_CMD_CONNECT ||
+            string->str[2] != SOCKS5_RESERVED ||
+            string->str[3] != SOCKS5_ATYP_DOMAIN ||
+            /* first half of the port number */
+            string->str[4 + addr_len] != 0 ||
+            /* second half of the port number */
+            string->str[5 + addr_len] != 0)
+          {
+            DEBUG ("Invalid SOCKS5 connect message");
+
+            incoming_connection_error (incoming);
+            return -1;
+          }
+
+        /* Find the bytestream waiting for this domain */
+        self = NULL;
+        if (addr_len - 1 == SHA1_LENGTH && incoming->factory != NULL)
+          {
+            domain = g_strndup (&string->str[5], SHA1_LENGTH);
+            self = gabble_bytestream_factory_find_socks5_domain (
+                incoming->factory, domain);
+            g_free (domain);
+          }
+
+        if (self == NULL)
+          {
+            DEBUG ("Reject connection to an unknown domain to prevent "
+                "spoofing");
+            incoming_connection_error (incoming);
+            return -1;
+          }
+
+        priv = GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+        if (priv->socks5_state != SOCKS5_STATE_INITIATOR_OFFER_SENT)
+          {
+            DEBUG ("Bytestream is not waiting for a connection anymore "
+                "(state: %u)", priv->socks5_state);
+            incoming_connection_error (incoming);
+            return -1;
+          }
+
+        msg[0] = SOCKS5_VERSION;
+        msg[1] = SOCKS5_STATUS_OK;
+        msg[2] = SOCKS5_RESERVED;
+        msg[3] = SOCKS5_ATYP_DOMAIN;
+        msg[4] = SHA1_LENGTH;
+        /* Domain name: SHA-1(sid + initiator + target) */
+        memcpy (&msg[5], &string->str[5], SHA1_LENGTH);
+        /* Port: 0 */
+        msg[45] = 0x00;
+        msg[46] = 0x00;
+
+        DEBUG ("Received CONNECT cmd. Sending CONNECT reply");
+        gibber_transport_send (incoming->transport, (const guint8 *) msg,
+            SOCKS5_CONNECT_LENGTH, NULL);
+
+        used = SOCKS5_MIN_LENGTH + addr_len;
+
+        /* Hand the connection over to the bytestream */
+        transport = incoming->transport;
+        incoming->transport = NULL;
+        gibber_transport_set_handler (transport, NULL, NULL);
+        g_signal_handlers_disconnect_matched (transport, G_SIGNAL_MATCH_DATA,
+            0, 0, NULL, NULL, incoming);
+
+        initiator_got_connection (self, transport, string->str + used,
+            string->len - used);
+
+        g_object_unref (transport);
+        incoming_connection_free (incoming);
+        return -1;
+
+      default:
+        g_assert_not_reached ();
+    }
+
+  return -1;
+}
+
+static void
+incoming_connection_handler (GibberTransport *transport,
+                             GibberBuffer *data,
+                             gpointer user_data)
+{
+  IncomingConnection *incoming = user_data;
+  gssize used_bytes;
+
+  g_string_append_len (incoming->read_buffer, (const gchar *) data->data,
+      data->length);
+
+  do
+    {
+      used_bytes = incoming_connection_handle_data (incoming);
+
+      if (used_bytes < 0)
+        /* incoming has been freed */
+        return;
+
+      g_string_erase (incoming->read_buffer, 0, used_bytes);
+    }
+  while (used_bytes > 0 && incoming->read_buffer->len > 0);
+}
+
+/*
+ * gabble_bytestream_socks5_handle_incoming
+ *
+ * Does the SOCKS5 handshake of a connection to the listener of @factory,
+ * then hands it over to the bytestream waiting for it.
+ */
+void
+gabble_bytestream_socks5_handle_incoming (GabbleBytestreamFactory *factory,
+                                          GibberTransport *transport)
+{
+  IncomingConnection *incoming = g_slice_new0 (IncomingConnection);
+
+  incoming->factory = factory;
+  g_object_add_weak_pointer (G_OBJECT (factory),
+      (gpointer *) &incoming->factory);
+
+  incoming->transport = g_object_ref (transport);
+  incoming->state = SOCKS5_STATE_INITIATOR_AWAITING_AUTH_REQUEST;
+  incoming->read_buffer = g_string_sized_new (SOCKS5_CONNECT_LENGTH);
+
+  gibber_transport_set_handler (transport, incoming_connection_handler,
+      incoming);
+  g_signal_connect (transport, "disconnected",
+      G_CALLBACK (incoming_connection_disconnected_cb), incoming);
+
+  incoming->timer_id = g_timeout_add_seconds (CONNECT_TIMEOUT,
+      incoming_connection_timeout_cb, incoming);
+}
 
 /*
  * Consumes @ips.
@@ -1978,21 +2764,41 @@ gabble_bytestream_socks5_initiate (GabbleBytestreamIface *iface)
     }
   else
     {
-      g_assert (priv->listener == NULL);
-      priv->listener = gibber_listener_new ();
-
-      g_signal_connect (priv->listener, "new-connection",
-          G_CALLBACK (new_connection_cb), self);
+      /* All the bytestreams share the same listener, which passes each
+       * connection to the bytestream its domain is computed for */
+      port_num = gabble_bytestream_factory_get_socks5_port (
+          priv->conn->bytestream_factory);
 
-      if (!gibber_listener_listen_tcp (priv->listener, 0, NULL))
+      if (port_num == 0)
         {
           DEBUG ("can't listen for incoming connection; will send empty offer.");
+        }
+      else
+        {
+          gchar *domain = compute_domain (priv->stream_id,
+              priv->self_full_jid, priv->peer_jid);
+
+          if (gabble_bytestream_factory_add_socks5_domain (
+                priv->conn->bytestream_factory, domain, self))
+            {
+              g_assert (priv->listener_domain == NULL);
+              priv->listener_domain = domain;
+            }
+          else
+            {
+              DEBUG ("another bytestream is already waiting for a connection "
+                  "to the same domain; will send empty offer.");
+              g_free (domain);
+              port_num = 0;
+            }
+        }
+
+      if (port_num == 0)
+        {
           g_slist_foreach (ips, (GFunc) g_free, NULL);
           g_slist_free (ips);
           ips = NULL;
         }
-
-      port_num = gibber_listener_get_port (priv->listener);
     }
 
   send_streamhosts (self, ips, port_num);
@@ -2016,6 +2822,87 @@ gabble_bytestream_socks5_block_reading (GabbleBytestreamIface *iface,
     gibber_transport_block_receiving (priv->transport, block);
 }
 
+static void
+splice_progress_cb (GibberFdTransport *source,
+                    gsize written,
+                    gpointer user_data)
+{
+  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (user_data);
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  if (priv->splice_func == NULL)
+    return;
+
+  if (GIBBER_TRANSPORT (source) == priv->transport)
+    priv->splice_func (GABBLE_BYTESTREAM_SPLICE_INCOMING, written,
+        priv->splice_user_data);
+  else
+    priv->splice_func (GABBLE_BYTESTREAM_SPLICE_OUTGOING, written,
+        priv->splice_user_data);
+}
+
+/*
+ * gabble_bytestream_socks5_splice
+ *
+ * Implements gabble_bytestream_iface_splice on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_socks5_splice (GabbleBytestreamIface *iface,
+                                 GibberTransport *transport,
+                                 GabbleBytestreamSpliceFlags flags,
+                                 GabbleBytestreamSpliceFunc func,
+                                 gpointer user_data)
+{
+  GabbleBytestreamSocks5 *self = GABBLE_BYTESTREAM_SOCKS5 (iface);
+  GabbleBytestreamSocks5Private *priv =
+      GABBLE_BYTESTREAM_SOCKS5_GET_PRIVATE (self);
+
+  if (!gibber_fd_transport_splice_supported ())
+    return FALSE;
+
+  if (priv->bytestream_state != GABBLE_BYTESTREAM_STATE_OPEN ||
+      priv->socks5_state != SOCKS5_STATE_CONNECTED)
+    {
+      DEBUG ("bytestream is not open yet, can't splice");
+      return FALSE;
+    }
+
+  if (priv->splice_transport != NULL)
+    {
+      DEBUG ("already relaying with splice");
+      return FALSE;
+    }
+
+  if (!GIBBER_IS_FD_TRANSPORT (priv->transport) ||
+      !GIBBER_IS_FD_TRANSPORT (transport))
+    return FALSE;
+
+  if (flags & GABBLE_BYTESTREAM_SPLICE_INCOMING &&
+      !gibber_fd_transport_splice_to (GIBBER_FD_TRANSPORT (priv->transport),
+        GIBBER_FD_TRANSPORT (transport), splice_progress_cb, self))
+    return FALSE;
+
+  if (flags & GABBLE_BYTESTREAM_SPLICE_OUTGOING &&
+      !gibber_fd_transport_splice_to (GIBBER_FD_TRANSPORT (transport),
+        GIBBER_FD_TRANSPORT (priv->transport), splice_progress_cb, self))
+    {
+      if (flags & GABBLE_BYTESTREAM_SPLICE_INCOMING)
+        gibber_fd_transport_stop_splice (
+            GIBBER_FD_TRANSPORT (priv->transport));
+
+      return FALSE;
+    }
+
+  DEBUG ("relaying data with splice () (flags: %u)", flags);
+
+  priv->splice_transport = g_object_ref (transport);
+  priv->splice_flags = flags;
+  priv->splice_func = func;
+  priv->splice_user_data = user_data;
+  return TRUE;
+}
+
 static void
 bytestream_iface_init (gpointer g_iface,
                        gpointer iface_data)
@@ -2027,4 +2914,5 @@ bytestream_iface_init (gpointer g_iface,
   klass->close = gabble_bytestream_socks5_close;
   klass->accept = gabble_bytestream_socks5_accept;
   klass->block_reading = gabble_bytestream_socks5_block_reading;
+  klass->splice = gabble_bytestream_socks5_splice;
 }
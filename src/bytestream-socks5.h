@@ -26,6 +26,10 @@
 #include <wocky/wocky.h>
 #include <telepathy-glib/telepathy-glib.h>
 
+#include <gibber/gibber-transport.h>
+
+#include "types.h"
+
 G_BEGIN_DECLS
 
 typedef struct _GabbleBytestreamSocks5 GabbleBytestreamSocks5;
@@ -67,6 +71,9 @@ void gabble_bytestream_socks5_add_streamhost (GabbleBytestreamSocks5 *socks5,
 void gabble_bytestream_socks5_connect_to_streamhost (
     GabbleBytestreamSocks5 *socks5, WockyStanza *msg);
 
+void gabble_bytestream_socks5_handle_incoming (
+    GabbleBytestreamFactory *factory, GibberTransport *transport);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_BYTESTREAM_SOCKS5_H__ */
@@ -0,0 +1,623 @@
+/*
+ * bytestream-throttle.c - Source for GabbleBytestreamThrottle
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Limits the rate of a bytestream to what its GabbleTransferScheduler
+ * allows. Each byte sent or received uses the allowance the scheduler
+ * refills regularly; once it's used up, the bytestream stops being read and
+ * the user sees it as write-blocked until the next refill. What the user
+ * sent past the allowance is kept and sent on the next refills, as a
+ * single read from the local socket can be much bigger than a share. */
+
+#include "config.h"
+#include "bytestream-throttle.h"
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
+
+#include "debug.h"
+
+static void
+bytestream_iface_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (GabbleBytestreamThrottle, gabble_bytestream_throttle,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GABBLE_TYPE_BYTESTREAM_IFACE,
+      bytestream_iface_init));
+
+/* properties */
+enum
+{
+  PROP_CONNECTION = 1,
+  PROP_PEER_HANDLE,
+  PROP_PEER_HANDLE_TYPE,
+  PROP_STREAM_ID,
+  PROP_PEER_JID,
+  PROP_STATE,
+  PROP_PROTOCOL,
+  PROP_BYTESTREAM,
+  PROP_SCHEDULER,
+  LAST_PROPERTY
+};
+
+struct _GabbleBytestreamThrottlePrivate
+{
+  GabbleBytestreamIface *bytestream;
+  GabbleTransferScheduler *scheduler;
+  GabbleBytestreamState state;
+
+  /* Bytes we can still transfer before the next refill; can be negative if
+   * the last chunk was bigger than what was left */
+  gint64 allowance;
+  gboolean throttled;
+
+  /* Asked by the user of the bytestream */
+  gboolean read_blocked;
+  /* Signalled by the wrapped bytestream */
+  gboolean write_blocked;
+  /* What we told the user */
+  gboolean write_blocked_emitted;
+
+  /* Sent by the user but not allowed through yet */
+  GString *pending;
+  /* The user closed us cleanly while data was pending; we hold a ref on
+   * ourself until it's sent */
+  gboolean close_pending;
+
+  gboolean dispose_has_run;
+};
+
+#define GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE(obj) ((obj)->priv)
+
+static void bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+    TpHandle sender, GBytes *data, gpointer user_data);
+static void bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+    GabbleBytestreamState state, gpointer user_data);
+static void bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+    gboolean blocked, gpointer user_data);
+static void bytestream_connection_error_cb (GabbleBytestreamIface *bytestream,
+    gpointer user_data);
+
+static void
+gabble_bytestream_throttle_init (GabbleBytestreamThrottle *self)
+{
+  GabbleBytestreamThrottlePrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GABBLE_TYPE_BYTESTREAM_THROTTLE, GabbleBytestreamThrottlePrivate);
+
+  self->priv = priv;
+
+  priv->pending = g_string_new (NULL);
+}
+
+static void
+gabble_bytestream_throttle_dispose (GObject *object)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (object);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  if (priv->scheduler != NULL)
+    {
+      gabble_transfer_scheduler_remove_flow (priv->scheduler, self);
+      g_object_unref (priv->scheduler);
+      priv->scheduler = NULL;
+    }
+
+  if (priv->bytestream != NULL)
+    {
+      g_signal_handlers_disconnect_matched (priv->bytestream,
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+
+      if (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED)
+        gabble_bytestream_iface_close (priv->bytestream, NULL);
+
+      g_object_unref (priv->bytestream);
+      priv->bytestream = NULL;
+    }
+
+  G_OBJECT_CLASS (gabble_bytestream_throttle_parent_class)->dispose (object);
+}
+
+static void
+gabble_bytestream_throttle_finalize (GObject *object)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (object);
+
+  g_string_free (self->priv->pending, TRUE);
+
+  G_OBJECT_CLASS (gabble_bytestream_throttle_parent_class)->finalize (object);
+}
+
+static void
+gabble_bytestream_throttle_get_property (GObject *object,
+                                         guint property_id,
+                                         GValue *value,
+                                         GParamSpec *pspec)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (object);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_PEER_HANDLE_TYPE:
+      case PROP_STREAM_ID:
+      case PROP_PEER_JID:
+      case PROP_PROTOCOL:
+        /* Those are the ones of the wrapped bytestream */
+        if (priv->bytestream != NULL)
+          g_object_get_property (G_OBJECT (priv->bytestream),
+              g_param_spec_get_name (pspec), value);
+        break;
+      case PROP_STATE:
+        g_value_set_uint (value, priv->state);
+        break;
+      case PROP_BYTESTREAM:
+        g_value_set_object (value, priv->bytestream);
+        break;
+      case PROP_SCHEDULER:
+        g_value_set_object (value, priv->scheduler);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_throttle_set_property (GObject *object,
+                                         guint property_id,
+                                         const GValue *value,
+                                         GParamSpec *pspec)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (object);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_STREAM_ID:
+        /* Taken from the wrapped bytestream */
+        break;
+      case PROP_STATE:
+        /* state-changed will be forwarded back to us */
+        if (priv->bytestream != NULL)
+          g_object_set_property (G_OBJECT (priv->bytestream), "state", value);
+        break;
+      case PROP_BYTESTREAM:
+        priv->bytestream = g_value_dup_object (value);
+        break;
+      case PROP_SCHEDULER:
+        priv->scheduler = g_value_dup_object (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_throttle_constructed (GObject *obj)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (obj);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+  void (*chain_up) (GObject *) =
+      ((GObjectClass *) gabble_bytestream_throttle_parent_class)->constructed;
+
+  if (chain_up != NULL)
+    chain_up (obj);
+
+  g_assert (priv->bytestream != NULL);
+  g_assert (priv->scheduler != NULL);
+
+  g_object_get (priv->bytestream, "state", &priv->state, NULL);
+
+  g_signal_connect (priv->bytestream, "data-received",
+      G_CALLBACK (bytestream_data_received_cb), self);
+  g_signal_connect (priv->bytestream, "state-changed",
+      G_CALLBACK (bytestream_state_changed_cb), self);
+  g_signal_connect (priv->bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+  g_signal_connect (priv->bytestream, "connection-error",
+      G_CALLBACK (bytestream_connection_error_cb), self);
+}
+
+static void
+gabble_bytestream_throttle_class_init (
+    GabbleBytestreamThrottleClass *gabble_bytestream_throttle_class)
+{
+  GObjectClass *object_class =
+      G_OBJECT_CLASS (gabble_bytestream_throttle_class);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (gabble_bytestream_throttle_class,
+      sizeof (GabbleBytestreamThrottlePrivate));
+
+  object_class->dispose = gabble_bytestream_throttle_dispose;
+  object_class->finalize = gabble_bytestream_throttle_finalize;
+
+  object_class->get_property = gabble_bytestream_throttle_get_property;
+  object_class->set_property = gabble_bytestream_throttle_set_property;
+  object_class->constructed = gabble_bytestream_throttle_constructed;
+
+  g_object_class_override_property (object_class, PROP_CONNECTION,
+      "connection");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE,
+      "peer-handle");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE_TYPE,
+      "peer-handle-type");
+  g_object_class_override_property (object_class, PROP_STREAM_ID,
+      "stream-id");
+  g_object_class_override_property (object_class, PROP_PEER_JID,
+      "peer-jid");
+  g_object_class_override_property (object_class, PROP_STATE,
+      "state");
+  g_object_class_override_property (object_class, PROP_PROTOCOL,
+      "protocol");
+
+  param_spec = g_param_spec_object (
+      "bytestream",
+      "Bytestream",
+      "The GabbleBytestreamIface whose rate is limited",
+      GABBLE_TYPE_BYTESTREAM_IFACE,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTESTREAM,
+      param_spec);
+
+  param_spec = g_param_spec_object (
+      "scheduler",
+      "Scheduler",
+      "The GabbleTransferScheduler refilling our allowance",
+      GABBLE_TYPE_TRANSFER_SCHEDULER,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_SCHEDULER,
+      param_spec);
+}
+
+static void
+update_blocking (GabbleBytestreamThrottle *self)
+{
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+  gboolean write_blocked = priv->write_blocked || priv->throttled;
+
+  if (priv->bytestream == NULL ||
+      priv->state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  gabble_bytestream_iface_block_reading (priv->bytestream,
+      priv->read_blocked || priv->throttled);
+
+  if (write_blocked != priv->write_blocked_emitted)
+    {
+      priv->write_blocked_emitted = write_blocked;
+      g_signal_emit_by_name (G_OBJECT (self), "write-blocked", write_blocked);
+    }
+}
+
+static void
+consume (GabbleBytestreamThrottle *self,
+         gsize len)
+{
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  priv->allowance -= len;
+
+  if (priv->allowance <= 0 && !priv->throttled)
+    {
+      priv->throttled = TRUE;
+      update_blocking (self);
+    }
+}
+
+static void
+bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+                             TpHandle sender,
+                             GBytes *data,
+                             gpointer user_data)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (user_data);
+
+  g_object_ref (self);
+
+  g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, data);
+  consume (self, g_bytes_get_size (data));
+
+  g_object_unref (self);
+}
+
+static void
+bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+                             GabbleBytestreamState state,
+                             gpointer user_data)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (user_data);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->state == state)
+    return;
+
+  priv->state = state;
+
+  if (state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    {
+      /* Leave the bandwidth to the others */
+      if (priv->scheduler != NULL)
+        gabble_transfer_scheduler_remove_flow (priv->scheduler, self);
+
+      /* Nobody will take what's left */
+      g_string_truncate (priv->pending, 0);
+    }
+
+  g_object_ref (self);
+
+  g_signal_emit_by_name (G_OBJECT (self), "state-changed", state);
+
+  if (state == GABBLE_BYTESTREAM_STATE_CLOSED && priv->close_pending)
+    {
+      priv->close_pending = FALSE;
+      g_object_unref (self);
+    }
+
+  g_object_unref (self);
+}
+
+static void
+bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+                             gboolean blocked,
+                             gpointer user_data)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (user_data);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  priv->write_blocked = blocked;
+  update_blocking (self);
+}
+
+static void
+bytestream_connection_error_cb (GabbleBytestreamIface *bytestream,
+                                gpointer user_data)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (user_data);
+
+  /* Forward signal */
+  g_signal_emit_by_name (G_OBJECT (self), "connection-error");
+}
+
+/* Send as much of the pending data as the allowance lets through, and
+ * close the wrapped bytestream if the user was only waiting for that. */
+static gboolean
+send_pending (GabbleBytestreamThrottle *self)
+{
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  while (priv->pending->len > 0 && priv->allowance > 0)
+    {
+      gsize len = MIN (priv->pending->len, (gsize) priv->allowance);
+
+      if (!gabble_bytestream_iface_send (priv->bytestream, len,
+            priv->pending->str))
+        return FALSE;
+
+      g_string_erase (priv->pending, 0, len);
+      consume (self, len);
+    }
+
+  if (priv->pending->len == 0 && priv->close_pending)
+    {
+      DEBUG ("pending data sent, closing");
+      priv->close_pending = FALSE;
+      gabble_bytestream_iface_close (priv->bytestream, NULL);
+      g_object_unref (self);
+    }
+
+  return TRUE;
+}
+
+/*
+ * gabble_bytestream_throttle_send
+ *
+ * Implements gabble_bytestream_iface_send on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_throttle_send (GabbleBytestreamIface *iface,
+                                 guint len,
+                                 const gchar *str)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (iface);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->bytestream == NULL || priv->close_pending)
+    return FALSE;
+
+  /* What was read before we said we were blocked is still accepted, and
+   * sent once the allowance is refilled */
+  g_string_append_len (priv->pending, str, len);
+
+  return send_pending (self);
+}
+
+/*
+ * gabble_bytestream_throttle_accept
+ *
+ * Implements gabble_bytestream_iface_accept on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_throttle_accept (GabbleBytestreamIface *iface,
+                                   GabbleBytestreamAugmentSiAcceptReply func,
+                                   gpointer user_data)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (iface);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->bytestream != NULL)
+    gabble_bytestream_iface_accept (priv->bytestream, func, user_data);
+}
+
+/*
+ * gabble_bytestream_throttle_close
+ *
+ * Implements gabble_bytestream_iface_close on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_throttle_close (GabbleBytestreamIface *iface,
+                                  GError *error)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (iface);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->bytestream == NULL || priv->close_pending)
+    return;
+
+  if (error == NULL && priv->pending->len > 0 &&
+      priv->state == GABBLE_BYTESTREAM_STATE_OPEN)
+    {
+      /* Our user is done with us but we still have to send what it gave us,
+       * so the file doesn't end up truncated */
+      DEBUG ("%" G_GSIZE_FORMAT " bytes still to send, delaying close",
+          priv->pending->len);
+      priv->close_pending = TRUE;
+      g_object_ref (self);
+      return;
+    }
+
+  g_string_truncate (priv->pending, 0);
+  gabble_bytestream_iface_close (priv->bytestream, error);
+}
+
+/*
+ * gabble_bytestream_throttle_initiate
+ *
+ * Implements gabble_bytestream_iface_initiate on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_throttle_initiate (GabbleBytestreamIface *iface)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (iface);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->bytestream == NULL)
+    return FALSE;
+
+  return gabble_bytestream_iface_initiate (priv->bytestream);
+}
+
+static void
+gabble_bytestream_throttle_block_reading (GabbleBytestreamIface *iface,
+                                          gboolean block)
+{
+  GabbleBytestreamThrottle *self = GABBLE_BYTESTREAM_THROTTLE (iface);
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  if (priv->read_blocked == block)
+    return;
+
+  priv->read_blocked = block;
+  update_blocking (self);
+}
+
+static gboolean
+gabble_bytestream_throttle_splice (GabbleBytestreamIface *iface,
+                                   GibberTransport *transport,
+                                   GabbleBytestreamSpliceFlags flags,
+                                   GabbleBytestreamSpliceFunc func,
+                                   gpointer user_data)
+{
+  /* We couldn't stop the data once the allowance is used up */
+  return FALSE;
+}
+
+static void
+bytestream_iface_init (gpointer g_iface,
+                       gpointer iface_data)
+{
+  GabbleBytestreamIfaceClass *klass = (GabbleBytestreamIfaceClass *) g_iface;
+
+  klass->initiate = gabble_bytestream_throttle_initiate;
+  klass->send = gabble_bytestream_throttle_send;
+  klass->close = gabble_bytestream_throttle_close;
+  klass->accept = gabble_bytestream_throttle_accept;
+  klass->block_reading = gabble_bytestream_throttle_block_reading;
+  klass->splice = gabble_bytestream_throttle_splice;
+}
+
+GabbleBytestreamThrottle *
+gabble_bytestream_throttle_new (GabbleBytestreamIface *bytestream,
+                                GabbleTransferScheduler *scheduler)
+{
+  return g_object_new (GABBLE_TYPE_BYTESTREAM_THROTTLE,
+      "bytestream", bytestream,
+      "scheduler", scheduler,
+      NULL);
+}
+
+/*
+ * gabble_bytestream_throttle_refill
+ *
+ * Called by the scheduler: @bytes more can be transferred. What wasn't used
+ * since the last refill is lost, but what was used in advance isn't.
+ */
+void
+gabble_bytestream_throttle_refill (GabbleBytestreamThrottle *self,
+                                   gint64 bytes)
+{
+  GabbleBytestreamThrottlePrivate *priv =
+      GABBLE_BYTESTREAM_THROTTLE_GET_PRIVATE (self);
+
+  priv->allowance = MIN (priv->allowance, 0) + bytes;
+
+  /* Sending the last pending bytes can close us */
+  g_object_ref (self);
+
+  if (priv->bytestream != NULL && priv->pending->len > 0 &&
+      !send_pending (self))
+    {
+      DEBUG ("sending pending data failed");
+      g_string_truncate (priv->pending, 0);
+      gabble_bytestream_iface_close (priv->bytestream, NULL);
+    }
+
+  /* Only let the user send more once what it already gave us is out */
+  if (priv->throttled && priv->allowance > 0 && priv->pending->len == 0)
+    {
+      priv->throttled = FALSE;
+      update_blocking (self);
+    }
+
+  g_object_unref (self);
+}
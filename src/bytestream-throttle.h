@@ -0,0 +1,71 @@
+/*
+ * bytestream-throttle.h - Header for GabbleBytestreamThrottle
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_BYTESTREAM_THROTTLE_H__
+#define __GABBLE_BYTESTREAM_THROTTLE_H__
+
+#include <glib-object.h>
+
+#include "bytestream-iface.h"
+#include "transfer-scheduler.h"
+
+G_BEGIN_DECLS
+
+/* GabbleBytestreamThrottle is declared in transfer-scheduler.h */
+typedef struct _GabbleBytestreamThrottleClass GabbleBytestreamThrottleClass;
+typedef struct _GabbleBytestreamThrottlePrivate GabbleBytestreamThrottlePrivate;
+
+struct _GabbleBytestreamThrottleClass {
+  GObjectClass parent_class;
+};
+
+struct _GabbleBytestreamThrottle {
+  GObject parent;
+
+  GabbleBytestreamThrottlePrivate *priv;
+};
+
+GType gabble_bytestream_throttle_get_type (void);
+
+/* TYPE MACROS */
+#define GABBLE_TYPE_BYTESTREAM_THROTTLE \
+  (gabble_bytestream_throttle_get_type ())
+#define GABBLE_BYTESTREAM_THROTTLE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GABBLE_TYPE_BYTESTREAM_THROTTLE,\
+                              GabbleBytestreamThrottle))
+#define GABBLE_BYTESTREAM_THROTTLE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GABBLE_TYPE_BYTESTREAM_THROTTLE,\
+                           GabbleBytestreamThrottleClass))
+#define GABBLE_IS_BYTESTREAM_THROTTLE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GABBLE_TYPE_BYTESTREAM_THROTTLE))
+#define GABBLE_IS_BYTESTREAM_THROTTLE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GABBLE_TYPE_BYTESTREAM_THROTTLE))
+#define GABBLE_BYTESTREAM_THROTTLE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GABBLE_TYPE_BYTESTREAM_THROTTLE,\
+                              GabbleBytestreamThrottleClass))
+
+GabbleBytestreamThrottle *gabble_bytestream_throttle_new (
+    GabbleBytestreamIface *bytestream, GabbleTransferScheduler *scheduler);
+
+void gabble_bytestream_throttle_refill (GabbleBytestreamThrottle *self,
+    gint64 bytes);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_BYTESTREAM_THROTTLE_H__ */
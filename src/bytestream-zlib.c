@@ -0,0 +1,853 @@
+/*
+ * bytestream-zlib.c - Source for GabbleBytestreamZlib
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Compresses the data sent through a bytestream. Both sides have to agree
+ * to use it: the SI request of a tube bytestream has a compression="zlib"
+ * attribute if the peer advertised NS_TUBES_ZLIB, and the accepting side
+ * echoes it in the <tube> node of its reply.
+ *
+ * The data is a sequence of frames:
+ *
+ *   type (1 byte) | payload length (4 bytes, big endian) | payload
+ *
+ * The payloads of FRAME_DEFLATE frames are a single raw deflate stream,
+ * flushed at the end of each frame so the receiver can decompress it as it
+ * comes. Data which doesn't compress well (already compressed files, media,
+ * TLS...) is sent in FRAME_RAW frames instead: the compression ratio is
+ * sampled regularly and compression is skipped for a while if it doesn't
+ * save enough.
+ *
+ * Neither the payload of a frame nor what it decompresses to can be bigger
+ * than MAX_FRAME_SIZE; the bytestream is closed if the peer goes over it.
+ */
+
+#include "config.h"
+#include "bytestream-zlib.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
+
+#include "debug.h"
+#include "namespaces.h"
+
+static void
+bytestream_iface_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (GabbleBytestreamZlib, gabble_bytestream_zlib,
+    G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GABBLE_TYPE_BYTESTREAM_IFACE,
+      bytestream_iface_init));
+
+/* properties */
+enum
+{
+  PROP_CONNECTION = 1,
+  PROP_PEER_HANDLE,
+  PROP_PEER_HANDLE_TYPE,
+  PROP_STREAM_ID,
+  PROP_PEER_JID,
+  PROP_STATE,
+  PROP_PROTOCOL,
+  PROP_BYTESTREAM,
+  PROP_BYTES_SAVED,
+  LAST_PROPERTY
+};
+
+enum _FrameType
+{
+  FRAME_RAW = 0,
+  FRAME_DEFLATE
+};
+
+typedef enum _FrameType FrameType;
+
+#define FRAME_HEADER_LENGTH 5
+
+/* How much data we compress before checking if it's worth it */
+#define SAMPLE_SIZE (64 * 1024)
+/* Stop compressing if the data isn't reduced by at least 10% */
+#define MIN_RATIO 0.9
+/* How much data is sent uncompressed before sampling again */
+#define RAW_PERIOD (1024 * 1024)
+/* Minimum amount of space available for the output of the converters */
+#define CONVERT_CHUNK 4096
+/* Biggest payload of a frame, before and after decompression */
+#define MAX_FRAME_SIZE (64 * 1024)
+/* Biggest amount of data sent in one frame, leaving room for deflate to
+ * make it slightly bigger if it doesn't compress */
+#define SEND_CHUNK (60 * 1024)
+
+#define WRAPPER_KEY "gabble-bytestream-zlib"
+
+struct _GabbleBytestreamZlibPrivate
+{
+  /* Weak pointer: owned by the factory, and owns us */
+  GabbleBytestreamIface *bytestream;
+  GabbleBytestreamState state;
+
+  GConverter *compressor;
+  GConverter *decompressor;
+  GByteArray *read_buffer;
+  /* Frames stay in read_buffer while reading is blocked */
+  gboolean read_blocked;
+  gboolean processing;
+  TpHandle sender;
+
+  /* Input and output sizes of the data compressed in the current sample */
+  gsize sample_in;
+  gsize sample_out;
+  /* Bytes left to send uncompressed */
+  gsize raw_left;
+
+  guint64 bytes_in;
+  gint64 bytes_saved;
+
+  GabbleBytestreamAugmentSiAcceptReply accept_func;
+  gpointer accept_data;
+
+  gboolean dispose_has_run;
+};
+
+#define GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE(obj) ((obj)->priv)
+
+static void bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+    TpHandle sender, GBytes *data, gpointer user_data);
+static void bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+    GabbleBytestreamState state, gpointer user_data);
+static void bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+    gboolean blocked, gpointer user_data);
+static void bytestream_connection_error_cb (GabbleBytestreamIface *bytestream,
+    gpointer user_data);
+
+static void
+gabble_bytestream_zlib_init (GabbleBytestreamZlib *self)
+{
+  GabbleBytestreamZlibPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GABBLE_TYPE_BYTESTREAM_ZLIB, GabbleBytestreamZlibPrivate);
+
+  self->priv = priv;
+
+  priv->compressor = G_CONVERTER (g_zlib_compressor_new (
+        G_ZLIB_COMPRESSOR_FORMAT_RAW, -1));
+  priv->decompressor = G_CONVERTER (g_zlib_decompressor_new (
+        G_ZLIB_COMPRESSOR_FORMAT_RAW));
+  priv->read_buffer = g_byte_array_new ();
+}
+
+static void
+gabble_bytestream_zlib_dispose (GObject *object)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (object);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  if (priv->bytestream != NULL)
+    {
+      g_signal_handlers_disconnect_matched (priv->bytestream,
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+      g_object_remove_weak_pointer (G_OBJECT (priv->bytestream),
+          (gpointer *) &priv->bytestream);
+      priv->bytestream = NULL;
+    }
+
+  G_OBJECT_CLASS (gabble_bytestream_zlib_parent_class)->dispose (object);
+}
+
+static void
+gabble_bytestream_zlib_finalize (GObject *object)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (object);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  g_object_unref (priv->compressor);
+  g_object_unref (priv->decompressor);
+  g_byte_array_unref (priv->read_buffer);
+
+  G_OBJECT_CLASS (gabble_bytestream_zlib_parent_class)->finalize (object);
+}
+
+static void
+gabble_bytestream_zlib_get_property (GObject *object,
+                                     guint property_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (object);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_PEER_HANDLE_TYPE:
+      case PROP_STREAM_ID:
+      case PROP_PEER_JID:
+      case PROP_PROTOCOL:
+        /* Those are the ones of the wrapped bytestream */
+        if (priv->bytestream != NULL)
+          g_object_get_property (G_OBJECT (priv->bytestream),
+              g_param_spec_get_name (pspec), value);
+        break;
+      case PROP_STATE:
+        g_value_set_uint (value, priv->state);
+        break;
+      case PROP_BYTESTREAM:
+        g_value_set_object (value, priv->bytestream);
+        break;
+      case PROP_BYTES_SAVED:
+        g_value_set_int64 (value, priv->bytes_saved);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_zlib_set_property (GObject *object,
+                                     guint property_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (object);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_CONNECTION:
+      case PROP_PEER_HANDLE:
+      case PROP_STREAM_ID:
+        /* Taken from the wrapped bytestream */
+        break;
+      case PROP_STATE:
+        /* state-changed will be forwarded back to us */
+        if (priv->bytestream != NULL)
+          g_object_set_property (G_OBJECT (priv->bytestream), "state", value);
+        break;
+      case PROP_BYTESTREAM:
+        priv->bytestream = g_value_get_object (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_bytestream_zlib_constructed (GObject *obj)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (obj);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  void (*chain_up) (GObject *) =
+      ((GObjectClass *) gabble_bytestream_zlib_parent_class)->constructed;
+
+  if (chain_up != NULL)
+    chain_up (obj);
+
+  g_assert (priv->bytestream != NULL);
+
+  g_object_add_weak_pointer (G_OBJECT (priv->bytestream),
+      (gpointer *) &priv->bytestream);
+  g_object_get (priv->bytestream, "state", &priv->state, NULL);
+
+  g_signal_connect (priv->bytestream, "data-received",
+      G_CALLBACK (bytestream_data_received_cb), self);
+  g_signal_connect (priv->bytestream, "state-changed",
+      G_CALLBACK (bytestream_state_changed_cb), self);
+  g_signal_connect (priv->bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+  g_signal_connect (priv->bytestream, "connection-error",
+      G_CALLBACK (bytestream_connection_error_cb), self);
+}
+
+static void
+gabble_bytestream_zlib_class_init (
+    GabbleBytestreamZlibClass *gabble_bytestream_zlib_class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (gabble_bytestream_zlib_class);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (gabble_bytestream_zlib_class,
+      sizeof (GabbleBytestreamZlibPrivate));
+
+  object_class->dispose = gabble_bytestream_zlib_dispose;
+  object_class->finalize = gabble_bytestream_zlib_finalize;
+
+  object_class->get_property = gabble_bytestream_zlib_get_property;
+  object_class->set_property = gabble_bytestream_zlib_set_property;
+  object_class->constructed = gabble_bytestream_zlib_constructed;
+
+  g_object_class_override_property (object_class, PROP_CONNECTION,
+      "connection");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE,
+      "peer-handle");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE_TYPE,
+      "peer-handle-type");
+  g_object_class_override_property (object_class, PROP_STREAM_ID,
+      "stream-id");
+  g_object_class_override_property (object_class, PROP_PEER_JID,
+      "peer-jid");
+  g_object_class_override_property (object_class, PROP_STATE,
+      "state");
+  g_object_class_override_property (object_class, PROP_PROTOCOL,
+      "protocol");
+
+  param_spec = g_param_spec_object (
+      "bytestream",
+      "Bytestream",
+      "The GabbleBytestreamIface carrying the compressed data",
+      GABBLE_TYPE_BYTESTREAM_IFACE,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTESTREAM,
+      param_spec);
+
+  param_spec = g_param_spec_int64 (
+      "bytes-saved",
+      "Bytes saved",
+      "How many bytes compression saved so far (can be negative)",
+      G_MININT64, G_MAXINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTES_SAVED,
+      param_spec);
+}
+
+/* Feed @len bytes of @data to @converter and append everything it produced
+ * to @out, flushing it. Fails if that's more than @max_out bytes. */
+static gboolean
+convert (GConverter *converter,
+         const guint8 *data,
+         gsize len,
+         GByteArray *out,
+         gsize max_out,
+         GError **error)
+{
+  GConverterResult result;
+  guint start = out->len;
+
+  do
+    {
+      guint offset = out->len;
+      gsize produced = offset - start;
+      gsize bytes_read = 0, bytes_written = 0;
+
+      if (produced > max_out)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+              "more than %" G_GSIZE_FORMAT " bytes of output", max_out);
+          return FALSE;
+        }
+
+      /* Leave room for one byte more than allowed, to tell when it's
+       * exceeded */
+      g_byte_array_set_size (out, offset +
+          MIN (MAX (len, CONVERT_CHUNK), max_out - produced + 1));
+
+      result = g_converter_convert (converter, data, len, out->data + offset,
+          out->len - offset, G_CONVERTER_FLUSH, &bytes_read, &bytes_written,
+          error);
+
+      g_byte_array_set_size (out, offset + bytes_written);
+
+      if (result == G_CONVERTER_ERROR)
+        return FALSE;
+
+      data += bytes_read;
+      len -= bytes_read;
+    }
+  while (result == G_CONVERTER_CONVERTED);
+
+  if (out->len - start > max_out)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+          "more than %" G_GSIZE_FORMAT " bytes of output", max_out);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+set_frame_header (GByteArray *frame,
+                  FrameType type)
+{
+  guint32 len = frame->len - FRAME_HEADER_LENGTH;
+
+  frame->data[0] = type;
+  frame->data[1] = (len >> 24) & 0xff;
+  frame->data[2] = (len >> 16) & 0xff;
+  frame->data[3] = (len >> 8) & 0xff;
+  frame->data[4] = len & 0xff;
+}
+
+/* Check if the last sample compressed well enough */
+static void
+end_sample (GabbleBytestreamZlib *self)
+{
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->sample_out > priv->sample_in * MIN_RATIO)
+    {
+      DEBUG ("data doesn't compress well (%" G_GSIZE_FORMAT " -> %"
+          G_GSIZE_FORMAT " bytes); send it uncompressed for a while",
+          priv->sample_in, priv->sample_out);
+      priv->raw_left = RAW_PERIOD;
+    }
+
+  priv->sample_in = 0;
+  priv->sample_out = 0;
+}
+
+/* Send @len bytes of @str in a single frame */
+static gboolean
+send_frame (GabbleBytestreamZlib *self,
+            guint len,
+            const gchar *str)
+{
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  GByteArray *frame;
+  GError *error = NULL;
+  gboolean ret;
+
+  frame = g_byte_array_sized_new (FRAME_HEADER_LENGTH + len);
+  g_byte_array_set_size (frame, FRAME_HEADER_LENGTH);
+
+  priv->bytes_in += len;
+
+  if (priv->raw_left > 0)
+    {
+      g_byte_array_append (frame, (const guint8 *) str, len);
+      set_frame_header (frame, FRAME_RAW);
+
+      priv->raw_left -= MIN (priv->raw_left, len);
+    }
+  else
+    {
+      gsize compressed_len;
+
+      if (!convert (priv->compressor, (const guint8 *) str, len, frame,
+            MAX_FRAME_SIZE, &error))
+        {
+          DEBUG ("compression failed: %s", error->message);
+          g_error_free (error);
+          g_byte_array_unref (frame);
+          return FALSE;
+        }
+
+      set_frame_header (frame, FRAME_DEFLATE);
+
+      compressed_len = frame->len - FRAME_HEADER_LENGTH;
+      priv->bytes_saved += (gint64) len - (gint64) compressed_len;
+      priv->sample_in += len;
+      priv->sample_out += compressed_len;
+
+      if (priv->sample_in >= SAMPLE_SIZE)
+        end_sample (self);
+    }
+
+  ret = gabble_bytestream_iface_send (priv->bytestream, frame->len,
+      (const gchar *) frame->data);
+
+  g_byte_array_unref (frame);
+  return ret;
+}
+
+/*
+ * gabble_bytestream_zlib_send
+ *
+ * Implements gabble_bytestream_iface_send on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_zlib_send (GabbleBytestreamIface *iface,
+                             guint len,
+                             const gchar *str)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (iface);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  while (len > 0)
+    {
+      guint chunk = MIN (len, SEND_CHUNK);
+
+      if (priv->bytestream == NULL)
+        return FALSE;
+
+      if (!send_frame (self, chunk, str))
+        return FALSE;
+
+      str += chunk;
+      len -= chunk;
+    }
+
+  return TRUE;
+}
+
+static void
+handle_frame (GabbleBytestreamZlib *self,
+              TpHandle sender,
+              guint8 type,
+              const guint8 *payload,
+              gsize len)
+{
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  GByteArray *out;
+  GBytes *bytes;
+  GError *error = NULL;
+
+  switch (type)
+    {
+      case FRAME_RAW:
+        bytes = g_bytes_new (payload, len);
+        break;
+
+      case FRAME_DEFLATE:
+        out = g_byte_array_new ();
+
+        if (!convert (priv->decompressor, payload, len, out, MAX_FRAME_SIZE,
+              &error))
+          {
+            GError e = { WOCKY_XMPP_ERROR, WOCKY_XMPP_ERROR_BAD_REQUEST,
+                "invalid compressed data" };
+
+            DEBUG ("decompression failed: %s", error->message);
+            g_error_free (error);
+            g_byte_array_unref (out);
+
+            gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), &e);
+            return;
+          }
+
+        bytes = g_byte_array_free_to_bytes (out);
+        break;
+
+      default:
+        DEBUG ("unknown frame type %u; ignoring", type);
+        return;
+    }
+
+  if (g_bytes_get_size (bytes) > 0)
+    g_signal_emit_by_name (G_OBJECT (self), "data-received", sender, bytes);
+
+  g_bytes_unref (bytes);
+}
+
+/* Handle the complete frames in read_buffer, unless reading is blocked */
+static void
+process_frames (GabbleBytestreamZlib *self)
+{
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  gsize offset = 0;
+
+  /* A data-received handler blocking and unblocking us again; the loop
+   * below carries on */
+  if (priv->processing)
+    return;
+
+  priv->processing = TRUE;
+
+  /* Handlers of data-received can close us */
+  g_object_ref (self);
+
+  while (priv->state != GABBLE_BYTESTREAM_STATE_CLOSED &&
+      !priv->read_blocked &&
+      priv->read_buffer->len - offset >= FRAME_HEADER_LENGTH)
+    {
+      const guint8 *header = priv->read_buffer->data + offset;
+      guint32 payload_len;
+
+      payload_len = (header[1] << 24) | (header[2] << 16) | (header[3] << 8) |
+          header[4];
+
+      if (payload_len > MAX_FRAME_SIZE)
+        {
+          GError e = { WOCKY_XMPP_ERROR, WOCKY_XMPP_ERROR_BAD_REQUEST,
+              "frame too big" };
+
+          DEBUG ("frame of %u bytes; close the bytestream", payload_len);
+          gabble_bytestream_iface_close (GABBLE_BYTESTREAM_IFACE (self), &e);
+          break;
+        }
+
+      if (priv->read_buffer->len - offset <
+          FRAME_HEADER_LENGTH + (gsize) payload_len)
+        /* Wait for the rest of the frame */
+        break;
+
+      handle_frame (self, priv->sender, header[0],
+          header + FRAME_HEADER_LENGTH, payload_len);
+
+      offset += FRAME_HEADER_LENGTH + payload_len;
+    }
+
+  g_byte_array_remove_range (priv->read_buffer, 0, offset);
+
+  priv->processing = FALSE;
+  g_object_unref (self);
+}
+
+static void
+bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+                             TpHandle sender,
+                             GBytes *data,
+                             gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (user_data);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (data, &len);
+
+  g_byte_array_append (priv->read_buffer, buf, len);
+  priv->sender = sender;
+
+  if (priv->read_blocked)
+    DEBUG ("Bytestream is blocked. Buffering data");
+
+  process_frames (self);
+}
+
+static void
+bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+                             GabbleBytestreamState state,
+                             gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (user_data);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->state == state)
+    return;
+
+  priv->state = state;
+
+  if (state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    DEBUG ("compressed bytestream closed; %" G_GUINT64_FORMAT " bytes sent, "
+        "%" G_GINT64_FORMAT " bytes saved", priv->bytes_in, priv->bytes_saved);
+
+  g_signal_emit_by_name (G_OBJECT (self), "state-changed", state);
+}
+
+static void
+bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+                             gboolean blocked,
+                             gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (user_data);
+
+  /* Forward signal */
+  g_signal_emit_by_name (G_OBJECT (self), "write-blocked", blocked);
+}
+
+static void
+bytestream_connection_error_cb (GabbleBytestreamIface *bytestream,
+                                gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (user_data);
+
+  /* Forward signal */
+  g_signal_emit_by_name (G_OBJECT (self), "connection-error");
+}
+
+static void
+augment_si_accept_iq (WockyNode *si,
+                      gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (user_data);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+  WockyNode *tube_node;
+
+  if (priv->accept_func != NULL)
+    priv->accept_func (si, priv->accept_data);
+
+  tube_node = wocky_node_get_child_ns (si, "tube", NS_TUBES);
+  if (tube_node == NULL)
+    tube_node = wocky_node_add_child_ns (si, "tube", NS_TUBES);
+
+  wocky_node_set_attribute (tube_node, "compression", "zlib");
+}
+
+/*
+ * gabble_bytestream_zlib_accept
+ *
+ * Implements gabble_bytestream_iface_accept on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_zlib_accept (GabbleBytestreamIface *iface,
+                               GabbleBytestreamAugmentSiAcceptReply func,
+                               gpointer user_data)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (iface);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->bytestream == NULL)
+    return;
+
+  /* Tell the peer we'll compress too */
+  priv->accept_func = func;
+  priv->accept_data = user_data;
+
+  gabble_bytestream_iface_accept (priv->bytestream, augment_si_accept_iq,
+      self);
+}
+
+/*
+ * gabble_bytestream_zlib_close
+ *
+ * Implements gabble_bytestream_iface_close on GabbleBytestreamIface
+ */
+static void
+gabble_bytestream_zlib_close (GabbleBytestreamIface *iface,
+                              GError *error)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (iface);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->bytestream != NULL)
+    gabble_bytestream_iface_close (priv->bytestream, error);
+}
+
+/*
+ * gabble_bytestream_zlib_initiate
+ *
+ * Implements gabble_bytestream_iface_initiate on GabbleBytestreamIface
+ */
+static gboolean
+gabble_bytestream_zlib_initiate (GabbleBytestreamIface *iface)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (iface);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->bytestream == NULL)
+    return FALSE;
+
+  return gabble_bytestream_iface_initiate (priv->bytestream);
+}
+
+static void
+gabble_bytestream_zlib_block_reading (GabbleBytestreamIface *iface,
+                                      gboolean block)
+{
+  GabbleBytestreamZlib *self = GABBLE_BYTESTREAM_ZLIB (iface);
+  GabbleBytestreamZlibPrivate *priv = GABBLE_BYTESTREAM_ZLIB_GET_PRIVATE (self);
+
+  if (priv->bytestream != NULL)
+    gabble_bytestream_iface_block_reading (priv->bytestream, block);
+
+  if (priv->read_blocked == block)
+    return;
+
+  priv->read_blocked = block;
+
+  /* Deliver the frames received before we were blocked */
+  if (!block)
+    process_frames (self);
+}
+
+static gboolean
+gabble_bytestream_zlib_splice (GabbleBytestreamIface *iface,
+                               GibberTransport *transport,
+                               GabbleBytestreamSpliceFlags flags,
+                               GabbleBytestreamSpliceFunc func,
+                               gpointer user_data)
+{
+  /* The data has to go through us */
+  return FALSE;
+}
+
+static void
+bytestream_iface_init (gpointer g_iface,
+                       gpointer iface_data)
+{
+  GabbleBytestreamIfaceClass *klass = (GabbleBytestreamIfaceClass *) g_iface;
+
+  klass->initiate = gabble_bytestream_zlib_initiate;
+  klass->send = gabble_bytestream_zlib_send;
+  klass->close = gabble_bytestream_zlib_close;
+  klass->accept = gabble_bytestream_zlib_accept;
+  klass->block_reading = gabble_bytestream_zlib_block_reading;
+  klass->splice = gabble_bytestream_zlib_splice;
+}
+
+/*
+ * gabble_bytestream_zlib_wrap
+ *
+ * Returns: (transfer none): a bytestream compressing the data sent through
+ * @bytestream. As with the bytestreams given by the factory, take a
+ * reference to keep it.
+ */
+GabbleBytestreamIface *
+gabble_bytestream_zlib_wrap (GabbleBytestreamIface *bytestream)
+{
+  GabbleBytestreamIface *wrapper;
+
+  g_return_val_if_fail (bytestream != NULL, NULL);
+
+  wrapper = g_object_get_data (G_OBJECT (bytestream), WRAPPER_KEY);
+  if (wrapper != NULL)
+    return wrapper;
+
+  wrapper = g_object_new (GABBLE_TYPE_BYTESTREAM_ZLIB,
+      "bytestream", bytestream,
+      NULL);
+
+  g_object_set_data_full (G_OBJECT (bytestream), WRAPPER_KEY, wrapper,
+      g_object_unref);
+
+  return wrapper;
+}
+
+/* Ask the peer to compress the bytestream negotiated by the SI request
+ * @node (its <stream> or <tube>) belongs to */
+void
+gabble_bytestream_zlib_request (WockyNode *node)
+{
+  wocky_node_set_attribute (node, "compression", "zlib");
+}
+
+/* Whether the SI request @node belongs to asks for compression */
+gboolean
+gabble_bytestream_zlib_requested (WockyNode *node)
+{
+  return !tp_strdiff (wocky_node_get_attribute (node, "compression"),
+      "zlib");
+}
+
+/* Whether the peer accepted to compress the bytestream in its SI @reply */
+gboolean
+gabble_bytestream_zlib_accepted (WockyStanza *reply)
+{
+  WockyNode *si_node, *tube_node;
+
+  si_node = wocky_node_get_child_ns (wocky_stanza_get_top_node (reply), "si",
+      NS_SI);
+  if (si_node == NULL)
+    return FALSE;
+
+  tube_node = wocky_node_get_child_ns (si_node, "tube", NS_TUBES);
+  if (tube_node == NULL)
+    return FALSE;
+
+  return gabble_bytestream_zlib_requested (tube_node);
+}
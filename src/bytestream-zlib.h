@@ -0,0 +1,75 @@
+/*
+ * bytestream-zlib.h - Header for GabbleBytestreamZlib
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_BYTESTREAM_ZLIB_H__
+#define __GABBLE_BYTESTREAM_ZLIB_H__
+
+#include <glib-object.h>
+
+#include <wocky/wocky.h>
+
+#include "bytestream-iface.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GabbleBytestreamZlib GabbleBytestreamZlib;
+typedef struct _GabbleBytestreamZlibClass GabbleBytestreamZlibClass;
+typedef struct _GabbleBytestreamZlibPrivate GabbleBytestreamZlibPrivate;
+
+struct _GabbleBytestreamZlibClass {
+  GObjectClass parent_class;
+};
+
+struct _GabbleBytestreamZlib {
+  GObject parent;
+
+  GabbleBytestreamZlibPrivate *priv;
+};
+
+GType gabble_bytestream_zlib_get_type (void);
+
+/* TYPE MACROS */
+#define GABBLE_TYPE_BYTESTREAM_ZLIB \
+  (gabble_bytestream_zlib_get_type ())
+#define GABBLE_BYTESTREAM_ZLIB(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GABBLE_TYPE_BYTESTREAM_ZLIB,\
+                              GabbleBytestreamZlib))
+#define GABBLE_BYTESTREAM_ZLIB_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GABBLE_TYPE_BYTESTREAM_ZLIB,\
+                           GabbleBytestreamZlibClass))
+#define GABBLE_IS_BYTESTREAM_ZLIB(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GABBLE_TYPE_BYTESTREAM_ZLIB))
+#define GABBLE_IS_BYTESTREAM_ZLIB_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GABBLE_TYPE_BYTESTREAM_ZLIB))
+#define GABBLE_BYTESTREAM_ZLIB_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GABBLE_TYPE_BYTESTREAM_ZLIB,\
+                              GabbleBytestreamZlibClass))
+
+GabbleBytestreamIface *gabble_bytestream_zlib_wrap (
+    GabbleBytestreamIface *bytestream);
+
+void gabble_bytestream_zlib_request (WockyNode *node);
+
+gboolean gabble_bytestream_zlib_requested (WockyNode *node);
+
+gboolean gabble_bytestream_zlib_accepted (WockyStanza *reply);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_BYTESTREAM_ZLIB_H__ */
@@ -60,6 +60,7 @@ static const Feature self_advertised_features[] =
   { FEATURE_FIXED, NS_SI },
   { FEATURE_FIXED, NS_IBB },
   { FEATURE_FIXED, NS_TUBES },
+  { FEATURE_FIXED, NS_TUBES_ZLIB },
   { FEATURE_FIXED, NS_BYTESTREAMS },
   { FEATURE_FIXED, NS_VERSION },
   { FEATURE_FIXED, NS_LAST },
@@ -68,6 +69,7 @@ static const Feature self_advertised_features[] =
 #ifdef ENABLE_FILE_TRANSFER
   { FEATURE_OPTIONAL, NS_FILE_TRANSFER },
   { FEATURE_OPTIONAL, NS_TP_FT_METADATA },
+  { FEATURE_OPTIONAL, NS_TP_FT_PARALLEL },
 #endif
 
 #ifdef ENABLE_VOIP
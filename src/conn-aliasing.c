@@ -250,7 +250,8 @@ aliases_request_basic_pep_cb (GabbleConnection *self,
     {
       /* no alias in PEP, get the vcard */
       gabble_vcard_manager_request (self->vcard_manager, handle, 0,
-        NULL, NULL, G_OBJECT (self));
+        GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND, NULL, NULL,
+        G_OBJECT (self));
     }
 }
 
@@ -296,7 +297,8 @@ aliases_request_pep_cb (GabbleConnection *self,
     {
       /* not in PEP and we have no vCard - chain to looking up their vCard */
       GabbleVCardManagerRequest *vcard_request = gabble_vcard_manager_request
-          (self->vcard_manager, handle, 0, aliases_request_vcard_cb,
+          (self->vcard_manager, handle, 0,
+           GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL, aliases_request_vcard_cb,
            aliases_request, G_OBJECT (self));
 
       g_free (alias);
@@ -335,6 +337,7 @@ static GabbleRequestPipelineItem *
 gabble_do_pep_request (GabbleConnection *self,
                        TpHandle handle,
                        TpHandleRepoIface *contact_handles,
+                       GabbleRequestPipelinePriority priority,
                        GabbleRequestPipelineCb callback,
                        gpointer user_data)
 {
@@ -366,8 +369,8 @@ gabble_do_pep_request (GabbleConnection *self,
         ')',
       ')',
       NULL);
-   pep_request = gabble_request_pipeline_enqueue (self->req_pipeline,
-      msg, 0, pep_request_cb, ctx);
+   pep_request = gabble_request_pipeline_enqueue_with_priority (
+      self->req_pipeline, msg, 0, priority, pep_request_cb, ctx);
    g_object_unref (msg);
 
    return pep_request;
@@ -442,7 +445,8 @@ gabble_connection_request_aliases (TpSvcConnectionInterfaceAliasing *iface,
 
           request->pending_pep_requests++;
           request->pep_requests[i] = gabble_do_pep_request (self,
-              handle, contact_handles, aliases_request_pep_cb, data);
+              handle, contact_handles, GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL,
+              aliases_request_pep_cb, data);
 
         }
       else
@@ -452,7 +456,8 @@ gabble_connection_request_aliases (TpSvcConnectionInterfaceAliasing *iface,
 
           g_free (alias);
           vcard_request = gabble_vcard_manager_request (self->vcard_manager,
-              handle, 0, aliases_request_vcard_cb, request, G_OBJECT (self));
+              handle, 0, GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL,
+              aliases_request_vcard_cb, request, G_OBJECT (self));
 
           request->vcard_requests[i] = vcard_request;
           request->pending_vcard_requests++;
@@ -1060,12 +1065,14 @@ maybe_request_vcard (GabbleConnection *self, TpHandle handle,
             tp_base_connection_get_handles (base, TP_HANDLE_TYPE_CONTACT);
 
           gabble_do_pep_request (self, handle, contact_handles,
+            GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND,
             aliases_request_basic_pep_cb, GUINT_TO_POINTER (handle));
         }
       else
         {
           gabble_vcard_manager_request (self->vcard_manager,
-             handle, 0, NULL, NULL, G_OBJECT (self));
+             handle, 0, GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND, NULL,
+             NULL, G_OBJECT (self));
         }
     }
 }
@@ -29,6 +29,7 @@
 
 #include "presence.h"
 #include "presence-cache.h"
+#include "base64.h"
 #include "conn-presence.h"
 #include "namespaces.h"
 #include "vcard-manager.h"
@@ -456,7 +457,7 @@ parse_avatar (WockyNode *vcard,
       return FALSE;
     }
 
-  st = g_base64_decode (binval_value, &outlen);
+  st = gabble_base64_decode (binval_value, &outlen);
   *avatar = g_string_new_len ((gchar *) st, outlen);
   g_free (st);
 
@@ -619,7 +620,8 @@ gabble_connection_request_avatar (TpSvcConnectionInterfaceAvatars *iface,
   else
     {
       gabble_vcard_manager_request (self->vcard_manager, contact, 0,
-          _request_avatar_cb, context, NULL);
+          GABBLE_REQUEST_PIPELINE_PRIORITY_INTERACTIVE, _request_avatar_cb,
+          context, NULL);
     }
 }
 
@@ -720,8 +722,10 @@ gabble_connection_request_avatars (TpSvcConnectionInterfaceAvatars *iface,
               g_hash_table_insert (self->avatar_requests,
                   GUINT_TO_POINTER (contact), ctx);
 
+              /* Clients ask for everyone's avatars at once */
               gabble_vcard_manager_request (self->vcard_manager,
-                contact, 0, request_avatars_cb, ctx, NULL);
+                contact, 0, GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND,
+                request_avatars_cb, ctx, NULL);
             }
         }
     }
@@ -34,12 +34,18 @@ conn_util_send_iq_cb (GObject *source_object,
     GAsyncResult *res,
     gpointer user_data)
 {
-  WockyPorter *porter = WOCKY_PORTER (source_object);
-  WockyStanza *reply;
+  WockyStanza *reply = NULL;
   GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
   GError *error = NULL;
 
-  reply = wocky_porter_send_iq_finish (porter, res, &error);
+  /* A bulk IQ sent while disconnected never reaches the porter, see
+   * _gabble_connection_send_bulk_iq_async () */
+  if (WOCKY_IS_PORTER (source_object))
+    reply = wocky_porter_send_iq_finish (WOCKY_PORTER (source_object), res,
+        &error);
+  else
+    g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res),
+        &error);
 
   if (reply != NULL)
     {
@@ -71,6 +77,22 @@ conn_util_send_iq_async (GabbleConnection *self,
       conn_util_send_iq_cb, result);
 }
 
+/* Like conn_util_send_iq_async (), for IQs carrying bulk data: see
+ * _gabble_connection_send_bulk (). Finish with conn_util_send_iq_finish (). */
+void
+conn_util_send_bulk_iq_async (GabbleConnection *self,
+    WockyStanza *stanza,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GSimpleAsyncResult *result = g_simple_async_result_new (G_OBJECT (self),
+      callback, user_data, conn_util_send_iq_async);
+
+  _gabble_connection_send_bulk_iq_async (self, stanza, cancellable,
+      conn_util_send_iq_cb, result);
+}
+
 gboolean
 conn_util_send_iq_finish (GabbleConnection *self,
     GAsyncResult *result,
@@ -103,6 +125,33 @@ conn_util_send_iq_finish (GabbleConnection *self,
   return TRUE;
 }
 
+/* Like conn_util_send_iq_finish (), but an error reply is returned as is
+ * rather than turned into a GError, for callers which need to look at the
+ * error type. @error is only set if no reply was received at all. */
+WockyStanza *
+conn_util_send_iq_finish_reply (GabbleConnection *self,
+    GAsyncResult *result,
+    GError **error)
+{
+  GSimpleAsyncResult *res;
+  GError *err = NULL;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+          G_OBJECT (self), conn_util_send_iq_async), NULL);
+
+  res = (GSimpleAsyncResult *) result;
+
+  if (g_simple_async_result_propagate_error (res, &err))
+    {
+      gabble_set_tp_error_from_wocky (err, error);
+      g_error_free (err);
+
+      return NULL;
+    }
+
+  return g_object_ref (g_simple_async_result_get_op_res_gpointer (res));
+}
+
 const gchar *
 conn_util_get_bare_self_jid (GabbleConnection *conn)
 {
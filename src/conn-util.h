@@ -32,11 +32,21 @@ void conn_util_send_iq_async (GabbleConnection *self,
     GAsyncReadyCallback callback,
     gpointer user_data);
 
+void conn_util_send_bulk_iq_async (GabbleConnection *self,
+    WockyStanza *stanza,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data);
+
 gboolean conn_util_send_iq_finish (GabbleConnection *self,
     GAsyncResult *result,
     WockyStanza **response,
     GError **error);
 
+WockyStanza *conn_util_send_iq_finish_reply (GabbleConnection *self,
+    GAsyncResult *result,
+    GError **error);
+
 const gchar *conn_util_get_bare_self_jid (GabbleConnection *conn);
 
 G_END_DECLS
@@ -82,7 +82,12 @@ static guint disco_reply_timeout = 5;
 
 #define DISCONNECT_TIMEOUT 5
 
+/* Bytes of bulk stanzas the porter can have queued, waiting to be written,
+ * at any time. Anything sent in the meantime only waits behind these. */
+#define BULK_IN_PORTER_MAX (16 * 1024)
+
 static void gabble_conn_contact_caps_iface_init (gpointer, gpointer);
+static void flush_bulk_queue (GabbleConnection *self, gboolean all);
 static void conn_contact_capabilities_fill_contact_attributes (GObject *obj,
   const GArray *contacts, GHashTable *attributes_hash);
 static void gabble_plugin_connection_iface_init (
@@ -165,6 +170,8 @@ enum
     PROP_ALIAS,
     PROP_FALLBACK_SOCKS5_PROXIES,
     PROP_KEEPALIVE_INTERVAL,
+    PROP_TRANSFER_RATE_LIMIT,
+    PROP_TRANSFER_CHANNEL_RATE_LIMIT,
     PROP_DECLOAK_AUTOMATICALLY,
     PROP_FALLBACK_SERVERS,
     PROP_EXTRA_CERTIFICATE_IDENTITIES,
@@ -200,6 +207,19 @@ struct _GabbleConnectionPrivate
 
   guint keepalive_interval;
 
+  /* bytes per second, 0 if unlimited */
+  guint transfer_rate_limit;
+  guint transfer_channel_rate_limit;
+
+  /* Bulk stanzas (bytestream data) wait here while BULK_IN_PORTER_MAX bytes
+   * of them are already queued in the porter, so the other stanzas don't
+   * wait behind too many of them: (BulkStanza *) */
+  GQueue bulk_queue;
+  /* (WockyStanza *) => size, bulk stanzas handed to the porter and not
+   * written yet */
+  GHashTable *bulk_in_porter;
+  gsize bulk_in_porter_size;
+
   gchar *https_proxy_server;
   guint16 https_proxy_port;
 
@@ -551,6 +571,10 @@ gabble_connection_init (GabbleConnection *self)
   self->priv = priv;
   priv->iq_reply_cancellable = g_cancellable_new ();
 
+  g_queue_init (&priv->bulk_queue);
+  priv->bulk_in_porter = g_hash_table_new_full (NULL, NULL, g_object_unref,
+      NULL);
+
   priv->caps_serial = 1;
   priv->last_activity_time = time (NULL);
   priv->port = 5222;
@@ -637,6 +661,12 @@ gabble_connection_get_property (GObject    *object,
     case PROP_KEEPALIVE_INTERVAL:
       g_value_set_uint (value, priv->keepalive_interval);
       break;
+    case PROP_TRANSFER_RATE_LIMIT:
+      g_value_set_uint (value, priv->transfer_rate_limit);
+      break;
+    case PROP_TRANSFER_CHANNEL_RATE_LIMIT:
+      g_value_set_uint (value, priv->transfer_channel_rate_limit);
+      break;
 
     case PROP_DECLOAK_AUTOMATICALLY:
       g_value_set_boolean (value, priv->decloak_automatically);
@@ -786,6 +816,20 @@ gabble_connection_set_property (GObject      *object,
         g_object_set (priv->pinger, "ping-interval",
             priv->keepalive_interval, NULL);
       break;
+    case PROP_TRANSFER_RATE_LIMIT:
+      priv->transfer_rate_limit = g_value_get_uint (value);
+      if (self->bytestream_factory != NULL)
+        g_object_set (
+            gabble_bytestream_factory_get_scheduler (self->bytestream_factory),
+            "rate-limit", priv->transfer_rate_limit, NULL);
+      break;
+    case PROP_TRANSFER_CHANNEL_RATE_LIMIT:
+      priv->transfer_channel_rate_limit = g_value_get_uint (value);
+      if (self->bytestream_factory != NULL)
+        g_object_set (
+            gabble_bytestream_factory_get_scheduler (self->bytestream_factory),
+            "flow-rate-limit", priv->transfer_channel_rate_limit, NULL);
+      break;
 
     case PROP_DECLOAK_AUTOMATICALLY:
       priv->decloak_automatically = g_value_get_boolean (value);
@@ -1181,6 +1225,22 @@ gabble_connection_class_init (GabbleConnectionClass *gabble_connection_class)
           0, G_MAXUINT, 30,
           G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_TRANSFER_RATE_LIMIT,
+      g_param_spec_uint (
+          "transfer-rate-limit", "transfer rate limit",
+          "Bytes per second all the file transfers can use together, "
+          "less what tubes used, or 0 for no limit",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class,
+      PROP_TRANSFER_CHANNEL_RATE_LIMIT,
+      g_param_spec_uint (
+          "transfer-channel-rate-limit", "transfer channel rate limit",
+          "Bytes per second each file transfer can use, or 0 for no limit",
+          0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (
       object_class, PROP_DECLOAK_AUTOMATICALLY,
       g_param_spec_boolean (
@@ -1284,6 +1344,11 @@ gabble_connection_dispose (GObject *object)
   conn_mail_notif_dispose (self);
 
   tp_clear_object (&priv->connector);
+
+  /* Let the porter fail whatever bulk stanzas are left */
+  if (priv->porter != NULL)
+    flush_bulk_queue (self, TRUE);
+
   tp_clear_object (&self->session);
 
   /* The porter was borrowed from the session. */
@@ -1347,6 +1412,9 @@ gabble_connection_finalize (GObject *object)
   g_free (priv->alias);
   g_free (priv->stream_id);
 
+  g_assert (g_queue_is_empty (&priv->bulk_queue));
+  g_hash_table_unref (priv->bulk_in_porter);
+
   tp_contacts_mixin_finalize (G_OBJECT(self));
 
   conn_aliasing_finalize (self);
@@ -1458,6 +1526,155 @@ gabble_connection_get_session (GabblePluginConnection *plugin_connection)
   return connection->session;
 }
 
+typedef struct {
+    WockyStanza *stanza;
+    gsize size;
+    /* NULL if the stanza is not an IQ waiting for a reply */
+    GAsyncReadyCallback callback;
+    GCancellable *cancellable;
+    gpointer user_data;
+} BulkStanza;
+
+/* Roughly the number of bytes the stanza will take on the wire */
+static gsize
+node_size (WockyNode *node)
+{
+  gsize size = 0;
+  GSList *l;
+
+  if (node->content != NULL)
+    size += strlen (node->content);
+
+  for (l = node->children; l != NULL; l = l->next)
+    size += node_size (l->data);
+
+  return size;
+}
+
+static void
+flush_bulk_queue (GabbleConnection *self,
+    gboolean all)
+{
+  GabbleConnectionPrivate *priv = self->priv;
+  BulkStanza *bulk;
+
+  while ((all || priv->bulk_in_porter_size < BULK_IN_PORTER_MAX) &&
+      (bulk = g_queue_pop_head (&priv->bulk_queue)) != NULL)
+    {
+      /* The table takes our ref */
+      g_hash_table_insert (priv->bulk_in_porter, bulk->stanza,
+          GSIZE_TO_POINTER (bulk->size));
+      priv->bulk_in_porter_size += bulk->size;
+
+      if (bulk->callback != NULL)
+        wocky_porter_send_iq_async (priv->porter, bulk->stanza,
+            bulk->cancellable, bulk->callback, bulk->user_data);
+      else
+        wocky_porter_send (priv->porter, bulk->stanza);
+
+      tp_clear_object (&bulk->cancellable);
+      g_slice_free (BulkStanza, bulk);
+    }
+}
+
+static void
+porter_sending_cb (WockyPorter *porter,
+    WockyStanza *stanza,
+    gpointer user_data)
+{
+  GabbleConnection *self = GABBLE_CONNECTION (user_data);
+  GabbleConnectionPrivate *priv = self->priv;
+  gpointer size;
+
+  /* stanza is NULL for whitespace pings */
+  if (stanza == NULL ||
+      !g_hash_table_lookup_extended (priv->bulk_in_porter, stanza, NULL,
+          &size))
+    return;
+
+  priv->bulk_in_porter_size -= GPOINTER_TO_SIZE (size);
+  g_hash_table_remove (priv->bulk_in_porter, stanza);
+
+  flush_bulk_queue (self, FALSE);
+}
+
+static void
+queue_bulk (GabbleConnection *self,
+    WockyStanza *stanza,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  GabbleConnectionPrivate *priv = self->priv;
+  BulkStanza *bulk = g_slice_new0 (BulkStanza);
+
+  bulk->stanza = g_object_ref (stanza);
+  bulk->size = node_size (wocky_stanza_get_top_node (stanza));
+  bulk->callback = callback;
+  bulk->user_data = user_data;
+
+  if (cancellable != NULL)
+    bulk->cancellable = g_object_ref (cancellable);
+
+  g_queue_push_tail (&priv->bulk_queue, bulk);
+  flush_bulk_queue (self, FALSE);
+}
+
+/**
+ * _gabble_connection_send_bulk
+ *
+ * Like _gabble_connection_send(), for stanzas carrying bulk data such as
+ * in-band bytestreams: they are held back rather than queued in the porter
+ * when it already has BULK_IN_PORTER_MAX bytes of them to write, so other
+ * stanzas don't have to wait for all of them.
+ */
+gboolean
+_gabble_connection_send_bulk (GabbleConnection *conn,
+    WockyStanza *msg,
+    GError **error)
+{
+  g_assert (GABBLE_IS_CONNECTION (conn));
+
+  if (conn->priv->porter == NULL)
+    {
+      g_set_error_literal (error, TP_ERROR, TP_ERROR_NETWORK_ERROR,
+              "connection is disconnected");
+      return FALSE;
+    }
+
+  queue_bulk (conn, msg, NULL, NULL, NULL);
+  return TRUE;
+}
+
+/**
+ * _gabble_connection_send_bulk_iq_async
+ *
+ * The wocky_porter_send_iq_async() counterpart of
+ * _gabble_connection_send_bulk(); @callback gets the porter as its source
+ * object, or @conn if the connection is disconnected.
+ */
+void
+_gabble_connection_send_bulk_iq_async (GabbleConnection *conn,
+    WockyStanza *stanza,
+    GCancellable *cancellable,
+    GAsyncReadyCallback callback,
+    gpointer user_data)
+{
+  g_assert (GABBLE_IS_CONNECTION (conn));
+  g_return_if_fail (callback != NULL);
+
+  if (conn->priv->porter == NULL)
+    {
+      /* There may well be no session either */
+      g_simple_async_report_error_in_idle (G_OBJECT (conn), callback,
+          user_data, TP_ERROR, TP_ERROR_NETWORK_ERROR,
+          "connection is disconnected");
+      return;
+    }
+
+  queue_bulk (conn, stanza, cancellable, callback, user_data);
+}
+
 /**
  * _gabble_connection_send
  *
@@ -1928,6 +2145,8 @@ connector_connected (GabbleConnection *self,
       G_CALLBACK (remote_closed_cb), self);
   g_signal_connect (priv->porter, "remote-error",
       G_CALLBACK (remote_error_cb), self);
+  tp_g_signal_connect_object (priv->porter, "sending",
+      G_CALLBACK (porter_sending_cb), self, 0);
 
   g_signal_emit_by_name (self, "porter-available", priv->porter);
   connect_iq_callbacks (self);
@@ -274,6 +274,11 @@ gboolean _gabble_connection_set_properties_from_account (
     GabbleConnection *conn, const gchar *account, GError **error);
 gboolean _gabble_connection_send (GabbleConnection *conn, WockyStanza *msg,
     GError **error);
+gboolean _gabble_connection_send_bulk (GabbleConnection *conn,
+    WockyStanza *msg, GError **error);
+void _gabble_connection_send_bulk_iq_async (GabbleConnection *conn,
+    WockyStanza *stanza, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data);
 gboolean _gabble_connection_send_with_reply (GabbleConnection *conn,
     WockyStanza *msg, GabbleConnectionMsgReplyFunc reply_func, GObject *object,
     gpointer user_data, GError **error);
@@ -38,10 +38,13 @@
 #include "debug.h"
 
 #include <gibber/gibber-listener.h>
+#include <gibber/gibber-fd-transport.h>
 #include <gibber/gibber-transport.h>
-#include <gibber/gibber-unix-transport.h>       /* just for the feature-test */
+#include <gibber/gibber-unix-transport.h>
 
+#include "bytestream-parallel.h"
 #include "connection.h"
+#include "extensions/extensions.h"
 #include "ft-channel.h"
 #include "gabble-signals-marshal.h"
 #include "namespaces.h"
@@ -53,6 +56,8 @@
 
 static void file_transfer_iface_init (gpointer g_iface, gpointer iface_data);
 static void transferred_chunk (GabbleFileTransferChannel *self, guint64 count);
+static void try_splice (GabbleFileTransferChannel *self);
+static gboolean seek_to_initial_offset (GabbleFileTransferChannel *self);
 static gboolean set_bytestream (GabbleFileTransferChannel *self,
     GabbleBytestreamIface *bytestream);
 #ifdef ENABLE_JINGLE_FILE_TRANSFER
@@ -67,10 +72,15 @@ G_DEFINE_TYPE_WITH_CODE (GabbleFileTransferChannel, gabble_file_transfer_channel
                            file_transfer_iface_init);
     G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_INTERFACE_FILE_TRANSFER_METADATA,
                            NULL);
+    G_IMPLEMENT_INTERFACE (GABBLE_TYPE_SVC_CHANNEL_INTERFACE_GABBLE_HASH_CHECK,
+                           NULL);
 );
 
 #define GABBLE_UNDEFINED_FILE_SIZE G_MAXUINT64
 
+/* How many bytestreams we offer to send the file over */
+#define PARALLEL_STREAMS 4
+
 /* properties */
 enum
 {
@@ -101,6 +111,9 @@ enum
   PROP_SERVICE_NAME,
   PROP_METADATA,
 
+  /* Chan.Iface.Gabble.HashCheck */
+  PROP_HASH_CHECK_RESULT,
+
   LAST_PROPERTY
 };
 
@@ -120,6 +133,17 @@ struct _GabbleFileTransferChannelPrivate {
   GabbleBytestreamIface *bytestream;
   GibberListener *listener;
   GibberTransport *transport;
+  /* TRUE if the bytestream relays the local transport with splice () */
+  gboolean splicing;
+  /* GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING: the client's connection, over
+   * which it passes the file descriptor; transport then wraps the file
+   * itself */
+  gboolean fd_passing;
+  GibberTransport *control_transport;
+  /* MD5 of the data going through us, if there is a content hash to check
+   * it against */
+  GChecksum *checksum;
+  GabbleFileHashCheckResult hash_check_result;
 
   /* properties */
   TpFileTransferState state;
@@ -250,6 +274,9 @@ gabble_file_transfer_channel_get_property (GObject *object,
             }
         }
         break;
+      case PROP_HASH_CHECK_RESULT:
+        g_value_set_uint (value, self->priv->hash_check_result);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -408,6 +435,13 @@ gabble_file_transfer_channel_constructed (GObject *obj)
       sizeof (TpSocketAccessControl), 1);
   access_control = TP_SOCKET_ACCESS_CONTROL_LOCALHOST;
   g_array_append_val (socket_access, access_control);
+
+  if (gibber_unix_transport_supports_fd_passing ())
+    {
+      access_control = GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING;
+      g_array_append_val (socket_access, access_control);
+    }
+
   g_hash_table_insert (self->priv->available_socket_types,
       GUINT_TO_POINTER (TP_SOCKET_ADDRESS_TYPE_UNIX), socket_access);
 #endif
@@ -546,6 +580,7 @@ gabble_file_transfer_channel_get_interfaces (TpBaseChannel *base)
       gabble_file_transfer_channel_parent_class)->get_interfaces (base);
 
   g_ptr_array_add (interfaces, TP_IFACE_CHANNEL_INTERFACE_FILE_TRANSFER_METADATA);
+  g_ptr_array_add (interfaces, GABBLE_IFACE_CHANNEL_INTERFACE_GABBLE_HASH_CHECK);
 
   return interfaces;
 }
@@ -583,6 +618,11 @@ gabble_file_transfer_channel_class_init (
     { NULL }
   };
 
+  static TpDBusPropertiesMixinPropImpl hash_check_props[] = {
+    { "HashCheckResult", "hash-check-result", NULL },
+    { NULL }
+  };
+
   static TpDBusPropertiesMixinIfaceImpl prop_interfaces[] = {
     { TP_IFACE_CHANNEL_TYPE_FILE_TRANSFER,
       tp_dbus_properties_mixin_getter_gobject_properties,
@@ -594,6 +634,11 @@ gabble_file_transfer_channel_class_init (
       NULL,
       file_metadata_props
     },
+    { GABBLE_IFACE_CHANNEL_INTERFACE_GABBLE_HASH_CHECK,
+      tp_dbus_properties_mixin_getter_gobject_properties,
+      NULL,
+      hash_check_props
+    },
     { NULL }
   };
 
@@ -795,6 +840,15 @@ gabble_file_transfer_channel_class_init (
   g_object_class_install_property (object_class, PROP_METADATA,
       param_spec);
 
+  param_spec = g_param_spec_uint ("hash-check-result",
+      "HashCheckResult",
+      "Whether the data transferred matched the content hash",
+      0, NUM_GABBLE_FILE_HASH_CHECK_RESULTS - 1,
+      GABBLE_FILE_HASH_CHECK_RESULT_NOT_CHECKED,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_HASH_CHECK_RESULT,
+      param_spec);
+
   gabble_file_transfer_channel_class->dbus_props_class.interfaces =
       prop_interfaces;
   tp_dbus_properties_mixin_class_init (object_class,
@@ -864,6 +918,8 @@ gabble_file_transfer_channel_finalize (GObject *object)
   g_free (self->priv->service_name);
   if (self->priv->metadata != NULL)
     g_hash_table_unref (self->priv->metadata);
+  if (self->priv->checksum != NULL)
+    g_checksum_free (self->priv->checksum);
 
   G_OBJECT_CLASS (gabble_file_transfer_channel_parent_class)->finalize (object);
 }
@@ -887,6 +943,11 @@ close_session_and_transport (GabbleFileTransferChannel *self)
   tp_clear_object (&self->priv->bytestream);
   tp_clear_object (&self->priv->listener);
   tp_clear_object (&self->priv->transport);
+
+  if (self->priv->control_transport != NULL)
+    gibber_transport_disconnect (self->priv->control_transport);
+
+  tp_clear_object (&self->priv->control_transport);
 }
 
 static gboolean setup_local_socket (GabbleFileTransferChannel *self,
@@ -946,6 +1007,47 @@ check_address_and_access_control (GabbleFileTransferChannel *self,
   return FALSE;
 }
 
+static void
+start_hashing (GabbleFileTransferChannel *self)
+{
+  if (self->priv->checksum != NULL ||
+      self->priv->content_hash_type != TP_FILE_HASH_TYPE_MD5 ||
+      tp_str_empty (self->priv->content_hash))
+    return;
+
+  if (self->priv->initial_offset != 0)
+    {
+      DEBUG ("can't check the hash of a resumed transfer");
+      return;
+    }
+
+  self->priv->checksum = g_checksum_new (G_CHECKSUM_MD5);
+}
+
+/* Returns FALSE if the data we transferred doesn't match the content hash */
+static gboolean
+check_hash (GabbleFileTransferChannel *self)
+{
+  const gchar *hash;
+
+  if (self->priv->checksum == NULL)
+    return TRUE;
+
+  hash = g_checksum_get_string (self->priv->checksum);
+
+  if (g_ascii_strcasecmp (hash, self->priv->content_hash) != 0)
+    {
+      DEBUG ("MD5 of the file is %s, but %s was announced", hash,
+          self->priv->content_hash);
+      self->priv->hash_check_result = GABBLE_FILE_HASH_CHECK_RESULT_MISMATCH;
+      return FALSE;
+    }
+
+  DEBUG ("MD5 of the file matches the announced one");
+  self->priv->hash_check_result = GABBLE_FILE_HASH_CHECK_RESULT_MATCH;
+  return TRUE;
+}
+
 static void
 channel_open (GabbleFileTransferChannel *self)
 {
@@ -966,8 +1068,31 @@ channel_open (GabbleFileTransferChannel *self)
           TP_FILE_TRANSFER_STATE_OPEN,
           TP_FILE_TRANSFER_STATE_CHANGE_REASON_NONE);
 
+      start_hashing (self);
+
       if (self->priv->transport != NULL)
-        gibber_transport_block_receiving (self->priv->transport, FALSE);
+        {
+          gboolean receiver = !tp_base_channel_is_requested (
+              TP_BASE_CHANNEL (self));
+
+          if (self->priv->fd_passing)
+            {
+              /* The offset was unknown when an outgoing file was passed */
+              if (!receiver && !seek_to_initial_offset (self))
+                return;
+
+              /* A passed file we are receiving is only ever written to */
+              if (!receiver)
+                gibber_transport_block_receiving (self->priv->transport,
+                    FALSE);
+            }
+          else
+            {
+              gibber_transport_block_receiving (self->priv->transport, FALSE);
+            }
+
+          try_splice (self);
+        }
     }
   else
     {
@@ -1064,6 +1189,70 @@ set_gtalk_file_collection (
 }
 #endif
 
+static void
+stripe_negotiate_cb (GabbleBytestreamIface *bytestream,
+                     WockyStanza *msg,
+                     GObject *object,
+                     gpointer user_data)
+{
+  if (bytestream == NULL)
+    {
+      /* The transfer goes on with the other ones */
+      DEBUG ("receiver refused an extra bytestream");
+      return;
+    }
+
+  gabble_bytestream_parallel_add_stripe (GABBLE_BYTESTREAM_PARALLEL (object),
+      bytestream);
+}
+
+/* Offer @n more bytestreams for the data of @parallel */
+static void
+offer_stripes (GabbleFileTransferChannel *self,
+               GabbleBytestreamParallel *parallel,
+               guint n)
+{
+  GabbleConnection *conn = GABBLE_CONNECTION (tp_base_channel_get_connection (
+          TP_BASE_CHANNEL (self)));
+  gchar *full_jid, *main_stream_id;
+  guint i;
+
+  g_object_get (parallel,
+      "peer-jid", &full_jid,
+      "stream-id", &main_stream_id,
+      NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      WockyStanza *msg;
+      WockyNode *si_node, *stripe_node;
+      gchar *stream_id;
+
+      stream_id = gabble_bytestream_factory_generate_stream_id ();
+
+      msg = gabble_bytestream_factory_make_stream_init_iq (full_jid,
+          stream_id, NS_FILE_TRANSFER);
+
+      si_node = wocky_node_get_child_ns (
+          wocky_stanza_get_top_node (msg), "si", NS_SI);
+      g_assert (si_node != NULL);
+
+      stripe_node = wocky_node_add_child_ns (si_node, "stripe",
+          NS_TP_FT_PARALLEL);
+      wocky_node_set_attribute (stripe_node, "sid", main_stream_id);
+
+      gabble_bytestream_factory_negotiate_stream (
+          conn->bytestream_factory, msg, stream_id,
+          stripe_negotiate_cb, NULL, G_OBJECT (parallel));
+
+      g_object_unref (msg);
+      g_free (stream_id);
+    }
+
+  g_free (full_jid);
+  g_free (main_stream_id);
+}
+
 static void
 bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
                          WockyStanza *msg,
@@ -1072,7 +1261,11 @@ bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
 {
   GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
   WockyNode *si;
+  GabbleConnection *conn = GABBLE_CONNECTION (tp_base_channel_get_connection (
+          TP_BASE_CHANNEL (self)));
   WockyNode *file = NULL;
+  GabbleBytestreamParallel *parallel = NULL;
+  guint n_streams = 0;
 
   if (bytestream == NULL)
     {
@@ -1109,8 +1302,29 @@ bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
   DEBUG ("receiver accepted file offer (offset: %" G_GUINT64_FORMAT ")",
       self->priv->initial_offset);
 
+  if (si != NULL)
+    n_streams = gabble_bytestream_parallel_get_n_streams (si);
+
+  if (n_streams > 1)
+    {
+      DEBUG ("receiver accepted to use %u bytestreams", n_streams);
+
+      parallel = gabble_bytestream_parallel_new (bytestream, n_streams);
+      bytestream = GABBLE_BYTESTREAM_IFACE (parallel);
+    }
+
+  /* Files get the bandwidth left by interactive traffic */
+  bytestream = gabble_transfer_scheduler_add_bulk (
+      gabble_bytestream_factory_get_scheduler (conn->bytestream_factory),
+      bytestream);
   set_bytestream (self, bytestream);
+  g_object_unref (bytestream);
 
+  if (parallel != NULL)
+    {
+      offer_stripes (self, parallel, n_streams - 1);
+      g_object_unref (parallel);
+    }
 }
 
 static void
@@ -1246,6 +1460,26 @@ offer_bytestream (GabbleFileTransferChannel *self, const gchar *jid,
   /* we support resume */
   wocky_node_add_child (file_node, "range");
 
+  /* the receiver can take the data over several bytestreams */
+  if (resource != NULL)
+    {
+      GabblePresence *presence = gabble_presence_cache_get (
+          conn->presence_cache,
+          tp_base_channel_get_target_handle (TP_BASE_CHANNEL (self)));
+
+      if (presence != NULL && gabble_presence_resource_has_caps (presence,
+            resource, gabble_capability_set_predicate_has, NS_TP_FT_PARALLEL))
+        {
+          WockyNode *parallel_node;
+          gchar *n_streams = g_strdup_printf ("%u", PARALLEL_STREAMS);
+
+          parallel_node = wocky_node_add_child_ns (si_node, "parallel",
+              NS_TP_FT_PARALLEL);
+          wocky_node_set_attribute (parallel_node, "streams", n_streams);
+          g_free (n_streams);
+        }
+    }
+
   gabble_bytestream_factory_negotiate_stream (
       conn->bytestream_factory, msg, stream_id,
       bytestream_negotiate_cb, self, G_OBJECT (self));
@@ -1559,6 +1793,37 @@ transferred_chunk (GabbleFileTransferChannel *self,
        emit_progress_update_cb, self);
 }
 
+/* Returns TRUE if the whole file has been received */
+static gboolean
+check_receive_completed (GabbleFileTransferChannel *self)
+{
+  if (self->priv->bytestream == NULL ||
+      self->priv->transferred_bytes + self->priv->initial_offset <
+      self->priv->size)
+    return FALSE;
+
+  if (!check_hash (self))
+    {
+      gabble_file_transfer_channel_set_state (
+          TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+          TP_FILE_TRANSFER_STATE_CANCELLED,
+          TP_FILE_TRANSFER_STATE_CHANGE_REASON_REMOTE_ERROR);
+      close_session_and_transport (self);
+      return TRUE;
+    }
+
+  DEBUG ("Received all the file. Transfer is complete");
+  gabble_file_transfer_channel_set_state (
+      TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+      TP_FILE_TRANSFER_STATE_COMPLETED,
+      TP_FILE_TRANSFER_STATE_CHANGE_REASON_NONE);
+
+  if (gibber_transport_buffer_is_empty (self->priv->transport))
+    gibber_transport_disconnect (self->priv->transport);
+
+  return TRUE;
+}
+
 static void
 data_received_cb (GabbleFileTransferChannel *self, const guint8 *data, guint len)
 {
@@ -1578,27 +1843,17 @@ data_received_cb (GabbleFileTransferChannel *self, const guint8 *data, guint len
       return;
     }
 
-  transferred_chunk (self, (guint64) len);
-
-  if (self->priv->bytestream != NULL &&
-      self->priv->transferred_bytes + self->priv->initial_offset >=
-      self->priv->size)
-    {
-      DEBUG ("Received all the file. Transfer is complete");
-      gabble_file_transfer_channel_set_state (
-          TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
-          TP_FILE_TRANSFER_STATE_COMPLETED,
-          TP_FILE_TRANSFER_STATE_CHANGE_REASON_NONE);
+  if (self->priv->checksum != NULL)
+    g_checksum_update (self->priv->checksum, data, len);
 
-      if (gibber_transport_buffer_is_empty (self->priv->transport))
-        gibber_transport_disconnect (self->priv->transport);
+  transferred_chunk (self, (guint64) len);
 
-      return;
-    }
+  if (check_receive_completed (self))
+    return;
 
-  if (!gibber_transport_buffer_is_empty (self->priv->transport))
+  if (gibber_transport_buffer_is_full (self->priv->transport))
     {
-      /* We don't want to send more data while the buffer isn't empty */
+      /* We don't want to queue more data until the buffer has drained */
       if (self->priv->bytestream != NULL)
         gabble_bytestream_iface_block_reading (self->priv->bytestream, TRUE);
 #ifdef ENABLE_JINGLE_FILE_TRANSFER
@@ -1621,11 +1876,14 @@ gabble_file_transfer_channel_gtalk_file_collection_data_received (
 static void
 bytestream_data_received_cb (GabbleBytestreamIface *stream,
                   TpHandle sender,
-                  GString *data,
+                  GBytes *data,
                   gpointer user_data)
 {
   GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
-  data_received_cb (self, (const guint8 *) data->str, data->len);
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (data, &len);
+
+  data_received_cb (self, buf, len);
 }
 
 static void
@@ -1829,6 +2087,8 @@ gabble_file_transfer_channel_provide_file (
       gabble_file_transfer_channel_set_state (iface,
           TP_FILE_TRANSFER_STATE_OPEN,
           TP_FILE_TRANSFER_STATE_CHANGE_REASON_REQUESTED);
+
+      start_hashing (self);
     }
 
   tp_svc_channel_type_file_transfer_return_from_provide_file (context,
@@ -1880,6 +2140,41 @@ get_local_unix_socket_path (GabbleFileTransferChannel *self)
 }
 #endif
 
+static void
+check_send_completed (GabbleFileTransferChannel *self)
+{
+  if (self->priv->transferred_bytes + self->priv->initial_offset >=
+      self->priv->size)
+    {
+      if (!check_hash (self))
+        {
+          /* The client didn't give us the file it described */
+          gabble_file_transfer_channel_set_state (
+              TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+              TP_FILE_TRANSFER_STATE_CANCELLED,
+              TP_FILE_TRANSFER_STATE_CHANGE_REASON_LOCAL_ERROR);
+          close_session_and_transport (self);
+        }
+      else if (self->priv->bytestream != NULL)
+        {
+          DEBUG ("All the file has been sent. Closing the bytestream");
+          gabble_file_transfer_channel_set_state (
+              TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+              TP_FILE_TRANSFER_STATE_COMPLETED,
+              TP_FILE_TRANSFER_STATE_CHANGE_REASON_NONE);
+          gabble_bytestream_iface_close (self->priv->bytestream, NULL);
+        }
+#ifdef ENABLE_JINGLE_FILE_TRANSFER
+      else if (self->priv->gtalk_file_collection != NULL)
+        {
+          DEBUG ("All the file has been sent.");
+          gtalk_file_collection_completed (self->priv->gtalk_file_collection,
+              self);
+        }
+#endif
+    }
+}
+
 /*
  * Data is available from the channel so we can send it.
  */
@@ -1913,29 +2208,58 @@ transport_handler (GibberTransport *transport,
     }
 #endif
 
+  if (self->priv->checksum != NULL)
+    g_checksum_update (self->priv->checksum, data->data, data->length);
+
   transferred_chunk (self, (guint64) data->length);
+  check_send_completed (self);
+}
 
-  if (self->priv->transferred_bytes + self->priv->initial_offset >=
-      self->priv->size)
-    {
-      if (self->priv->bytestream != NULL)
-        {
-          DEBUG ("All the file has been sent. Closing the bytestream");
-          gabble_file_transfer_channel_set_state (
-              TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
-              TP_FILE_TRANSFER_STATE_COMPLETED,
-              TP_FILE_TRANSFER_STATE_CHANGE_REASON_NONE);
-          gabble_bytestream_iface_close (self->priv->bytestream, NULL);
-        }
-#ifdef ENABLE_JINGLE_FILE_TRANSFER
-      else if (self->priv->gtalk_file_collection != NULL)
-        {
-          DEBUG ("All the file has been sent.");
-          gtalk_file_collection_completed (self->priv->gtalk_file_collection,
-              self);
-        }
-#endif
-    }
+static void
+splice_progress_cb (GabbleBytestreamSpliceFlags flags,
+                    gsize count,
+                    gpointer user_data)
+{
+  GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
+
+  transferred_chunk (self, (guint64) count);
+
+  if (flags & GABBLE_BYTESTREAM_SPLICE_OUTGOING)
+    check_send_completed (self);
+  else
+    check_receive_completed (self);
+}
+
+/*
+ * Once both the client and the bytestream are connected, let the bytestream
+ * move the data itself if it can; we only keep track of the progress then.
+ */
+static void
+try_splice (GabbleFileTransferChannel *self)
+{
+  GabbleBytestreamSpliceFlags flags;
+
+  if (self->priv->splicing || self->priv->transport == NULL ||
+      self->priv->bytestream == NULL ||
+      self->priv->state != TP_FILE_TRANSFER_STATE_OPEN)
+    return;
+
+  /* The data has to go through us to be hashed. Checking the hash is worth
+   * more than saving the copies, which only matter for fast local links. */
+  if (self->priv->checksum != NULL)
+    return;
+
+  if (tp_base_channel_is_requested (TP_BASE_CHANNEL (self)))
+    flags = GABBLE_BYTESTREAM_SPLICE_OUTGOING;
+  else
+    flags = GABBLE_BYTESTREAM_SPLICE_INCOMING;
+
+  self->priv->splicing = gabble_bytestream_iface_splice (
+      self->priv->bytestream, self->priv->transport, flags,
+      splice_progress_cb, self);
+
+  if (self->priv->splicing)
+    DEBUG ("transferring the file with splice ()");
 }
 
 static void
@@ -1993,6 +2317,11 @@ transport_disconnected_cb (GibberTransport *transport,
 
   DEBUG ("transport to local socket has been disconnected");
 
+  /* The client waits for its socket to be closed to know that we are done
+   * with the file it passed */
+  if (self->priv->control_transport != NULL)
+    gibber_transport_disconnect (self->priv->control_transport);
+
   /* If we are sending the file, we can expect the transport to be closed as
      soon as we received all the data. Otherwise, it should only get closed once
      the channel has gone to state COMPLETED.
@@ -2032,21 +2361,12 @@ transport_buffer_empty_cb (GibberTransport *transport,
     gibber_transport_disconnect (transport);
 }
 
-/*
- * Some client is connecting to the Unix socket.
- */
 static void
-new_connection_cb (GibberListener *listener,
-                   GibberTransport *transport,
-                   struct sockaddr_storage *addr,
-                   guint size,
-                   gpointer user_data)
+set_transport (GabbleFileTransferChannel *self,
+    GibberTransport *transport)
 {
-  GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
   TpBaseChannel *base = TP_BASE_CHANNEL (self);
 
-  DEBUG ("Client connected to local socket");
-
   self->priv->transport = g_object_ref (transport);
   gabble_signal_connect_weak (transport, "disconnected",
     G_CALLBACK (transport_disconnected_cb), G_OBJECT (self));
@@ -2060,6 +2380,103 @@ new_connection_cb (GibberListener *listener,
     /* Outgoing file transfer */
     file_transfer_send (self);
 
+  try_splice (self);
+}
+
+static gboolean
+seek_to_initial_offset (GabbleFileTransferChannel *self)
+{
+  int fd = GIBBER_FD_TRANSPORT (self->priv->transport)->fd;
+
+  if (lseek (fd, (off_t) self->priv->initial_offset, SEEK_SET) != (off_t) -1)
+    return TRUE;
+
+  DEBUG ("can't seek file to %" G_GUINT64_FORMAT ": %s",
+      self->priv->initial_offset, g_strerror (errno));
+
+  gabble_file_transfer_channel_set_state (
+      TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+      TP_FILE_TRANSFER_STATE_CANCELLED,
+      TP_FILE_TRANSFER_STATE_CHANGE_REASON_LOCAL_ERROR);
+
+  close_session_and_transport (self);
+  return FALSE;
+}
+
+#ifdef GIBBER_TYPE_UNIX_TRANSPORT
+static void
+file_fd_received_cb (GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data)
+{
+  GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
+  GibberTransport *file_transport;
+
+  if (error != NULL)
+    {
+      DEBUG ("client didn't pass the file: %s", error->message);
+
+      gabble_file_transfer_channel_set_state (
+          TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+          TP_FILE_TRANSFER_STATE_CANCELLED,
+          TP_FILE_TRANSFER_STATE_CHANGE_REASON_LOCAL_ERROR);
+
+      close_session_and_transport (self);
+      return;
+    }
+
+  DEBUG ("client passed the file as fd %d", fd);
+
+  file_transport = g_object_new (GIBBER_TYPE_FD_TRANSPORT, NULL);
+
+  /* The file may well be write-only when receiving, never poll it for
+   * reading then */
+  if (!tp_base_channel_is_requested (TP_BASE_CHANNEL (self)))
+    gibber_transport_block_receiving (file_transport, TRUE);
+
+  gibber_fd_transport_set_fd (GIBBER_FD_TRANSPORT (file_transport), fd,
+      FALSE);
+
+  set_transport (self, file_transport);
+  g_object_unref (file_transport);
+
+  /* Cancels the transfer if the file can't be seeked */
+  if (self->priv->transport != NULL)
+    seek_to_initial_offset (self);
+}
+#endif
+
+/*
+ * Some client is connecting to the Unix socket.
+ */
+static void
+new_connection_cb (GibberListener *listener,
+                   GibberTransport *transport,
+                   struct sockaddr_storage *addr,
+                   guint size,
+                   gpointer user_data)
+{
+  GabbleFileTransferChannel *self = GABBLE_FILE_TRANSFER_CHANNEL (user_data);
+
+  DEBUG ("Client connected to local socket");
+
+#ifdef GIBBER_TYPE_UNIX_TRANSPORT
+  if (self->priv->fd_passing)
+    {
+      /* The data will flow through the file passed by the client, not
+       * through this socket */
+      self->priv->control_transport = g_object_ref (transport);
+      gibber_unix_transport_recv_fd (GIBBER_UNIX_TRANSPORT (transport),
+          file_fd_received_cb, self);
+    }
+  else
+#endif
+    {
+      set_transport (self, transport);
+    }
+
   /* stop listening on local socket */
   tp_clear_object (&self->priv->listener);
 }
@@ -2082,7 +2499,11 @@ setup_local_socket (GabbleFileTransferChannel *self,
       gchar *path;
       GArray *array;
 
-      g_assert (access_control == TP_SOCKET_ACCESS_CONTROL_LOCALHOST);
+      g_assert (access_control == TP_SOCKET_ACCESS_CONTROL_LOCALHOST ||
+          access_control == GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING);
+
+      self->priv->fd_passing =
+          (access_control == GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING);
 
       path = get_local_unix_socket_path (self);
       if (path == NULL)
@@ -38,6 +38,16 @@ typedef struct _GabbleFileTransferChannel GabbleFileTransferChannel;
 
 G_BEGIN_DECLS
 
+/* Socket_Access_Control value, outside of the range defined by the
+ * Telepathy spec, offered along with Socket_Address_Type_Unix when the
+ * platform can pass file descriptors. Once connected to the socket, the
+ * client sends one message with the file's descriptor attached as
+ * SCM_RIGHTS ancillary data. Gabble then reads (ProvideFile) or writes
+ * (AcceptFile) the file directly, starting at InitialOffset, instead of
+ * having the client copy it through the socket. The socket is closed once the
+ * transfer is over. */
+#define GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING ((TpSocketAccessControl) 0x100)
+
 typedef struct _GabbleFileTransferChannelClass GabbleFileTransferChannelClass;
 typedef struct _GabbleFileTransferChannelPrivate GabbleFileTransferChannelPrivate;
 
@@ -34,6 +34,8 @@
 #include "jingle-share.h"
 #endif
 #include "gabble/caps-channel-manager.h"
+#include "bytestream-parallel.h"
+#include "bytestream-throttle.h"
 #include "connection.h"
 #include "ft-manager.h"
 #include "ft-channel.h"
@@ -806,6 +808,66 @@ extract_metadata (WockyNode *file)
   return metadata;
 }
 
+/* Another bytestream for the data of a transfer we accepted, see
+ * GabbleBytestreamParallel */
+static void
+add_stripe (GabbleFtManager *self,
+            GabbleBytestreamIface *bytestream,
+            TpHandle handle,
+            WockyNode *stripe_node)
+{
+  const gchar *sid = wocky_node_get_attribute (stripe_node, "sid");
+  GError e = { WOCKY_XMPP_ERROR, WOCKY_XMPP_ERROR_ITEM_NOT_FOUND,
+      "no such parallel transfer" };
+  GList *l;
+
+  for (l = self->priv->channels; l != NULL && sid != NULL; l = l->next)
+    {
+      GabbleBytestreamIface *existing = NULL;
+      TpHandle peer;
+      gchar *stream_id;
+      gboolean found;
+
+      g_object_get (l->data, "bytestream", &existing, NULL);
+
+      if (existing != NULL && GABBLE_IS_BYTESTREAM_THROTTLE (existing))
+        {
+          GabbleBytestreamIface *throttled = existing;
+
+          /* The transfer is rate limited */
+          g_object_get (throttled, "bytestream", &existing, NULL);
+          g_object_unref (throttled);
+        }
+
+      if (existing == NULL)
+        continue;
+
+      g_object_get (existing,
+          "peer-handle", &peer,
+          "stream-id", &stream_id,
+          NULL);
+
+      found = (GABBLE_IS_BYTESTREAM_PARALLEL (existing) && peer == handle &&
+          !tp_strdiff (stream_id, sid));
+
+      if (found)
+        {
+          DEBUG ("new stripe for stream %s", sid);
+          gabble_bytestream_parallel_add_stripe (
+              GABBLE_BYTESTREAM_PARALLEL (existing), bytestream);
+        }
+
+      g_free (stream_id);
+      g_object_unref (existing);
+
+      if (found)
+        return;
+    }
+
+  DEBUG ("%s: %s", e.message, sid);
+  gabble_bytestream_iface_close (bytestream, &e);
+}
+
 void gabble_ft_manager_handle_si_request (GabbleFtManager *self,
                                           GabbleBytestreamIface *bytestream,
                                           TpHandle handle,
@@ -822,12 +884,23 @@ void gabble_ft_manager_handle_si_request (GabbleFtManager *self,
   TpFileHashType content_hash_type;
   GabbleFileTransferChannel *chan;
   gboolean resume_supported;
+  GabbleBytestreamParallel *parallel = NULL;
+  WockyNode *stripe_node;
+  guint n_streams;
   GError *error = NULL;
 
   si_node = wocky_node_get_child_ns (
       wocky_stanza_get_top_node (msg), "si", NS_SI);
   g_assert (si_node != NULL);
 
+  stripe_node = wocky_node_get_child_ns (si_node, "stripe",
+      NS_TP_FT_PARALLEL);
+  if (stripe_node != NULL)
+    {
+      add_stripe (self, bytestream, handle, stripe_node);
+      return;
+    }
+
   file_node = hyvaa_vappua (si_node, &filename, &size_str, &error);
 
   if (file_node == NULL)
@@ -873,6 +946,20 @@ void gabble_ft_manager_handle_si_request (GabbleFtManager *self,
   service_name = extract_service_name (file_node);
   metadata = extract_metadata (file_node);
 
+  /* The sender can open more bytestreams once we accept */
+  n_streams = gabble_bytestream_parallel_get_n_streams (si_node);
+  if (n_streams > 1)
+    {
+      parallel = gabble_bytestream_parallel_new (bytestream, n_streams);
+      bytestream = GABBLE_BYTESTREAM_IFACE (parallel);
+    }
+
+  /* Files get the bandwidth left by interactive traffic */
+  bytestream = gabble_transfer_scheduler_add_bulk (
+      gabble_bytestream_factory_get_scheduler (
+        self->priv->connection->bytestream_factory),
+      bytestream);
+
   chan = gabble_file_transfer_channel_new (self->priv->connection,
       handle, handle, TP_FILE_TRANSFER_STATE_PENDING,
       content_type, filename, size, content_hash_type, content_hash,
@@ -884,6 +971,9 @@ void gabble_ft_manager_handle_si_request (GabbleFtManager *self,
   g_free (service_name);
   if (metadata != NULL)
     g_hash_table_unref (metadata);
+  g_object_unref (bytestream);
+  if (parallel != NULL)
+    g_object_unref (parallel);
 }
 
 static void
@@ -1049,6 +1139,7 @@ gabble_ft_manager_represent_client (
       gabble_capability_set_add (cap_set, NS_FILE_TRANSFER);
       gabble_capability_set_add (cap_set, NS_GOOGLE_FEAT_SHARE);
       gabble_capability_set_add (cap_set, NS_TP_FT_METADATA);
+      gabble_capability_set_add (cap_set, NS_TP_FT_PARALLEL);
 
       /* now look at service names */
 
@@ -93,8 +93,10 @@
  * Simple files are being transferred normally, while directories will be
  * transferred as a tarball with 'chuncked' Transfer-Encoding since the resulting
  * size of the tarball isn't known in advance.
- * Once a file is completely transferred, then the next file is requested on the
- * same ShareChannel. If all files are transferred, then the <complete> info
+ * Files are requested on the same ShareChannel, with up to
+ * MAX_PIPELINED_REQUESTS GET requests in flight so that small files don't each
+ * cost a round-trip; the responses come back in order. If all files are
+ * transferred, then the <complete> info
  * action is being sent through the jingle signaling, and the session can then
  * be terminated safely.
  *
@@ -102,7 +104,7 @@
  * ShareChannel is never created with gabble.
  * Also note that we only create one ShareChannel and we serialize the file
  * transfers one after the other, they do not each get one ShareChannel and they
- * cannot be downloaded in parallel.
+ * cannot be downloaded in parallel. Their requests are pipelined though.
  *
  */
 
@@ -123,6 +125,9 @@ enum
   LAST_PROPERTY
 };
 
+/* How many files we request at once on a ShareChannel */
+#define MAX_PIPELINED_REQUESTS 4
+
 typedef enum
   {
     HTTP_SERVER_IDLE,
@@ -154,8 +159,75 @@ typedef struct
   guint write_len;
   gchar *read_buffer;
   guint read_len;
+  /* Channels we sent a GET request for, in order, the first one being the
+   * one we are receiving; NULL if it has been removed since then:
+   * (GabbleFileTransferChannel *) */
+  GQueue requests;
 } ShareChannel;
 
+/* Push the channels of @channels, in order, whose files are usable and not
+ * requested yet onto @requests, as long as there are fewer than
+ * MAX_PIPELINED_REQUESTS of them, and mark them as requested. Returns the
+ * channels pushed, to send their requests.
+ *
+ * Only extern for the benefit of tests/test-gtalk-file-collection.c */
+GList *
+_gtalk_file_collection_fill_pipeline (GQueue *requests,
+    GList *channels,
+    GHashTable *usable,
+    GHashTable *requested)
+{
+  GList *pushed = NULL;
+  GList *i;
+
+  for (i = channels;
+       i != NULL && requests->length < MAX_PIPELINED_REQUESTS;
+       i = i->next)
+    {
+      if (!GPOINTER_TO_INT (g_hash_table_lookup (usable, i->data)) ||
+          GPOINTER_TO_INT (g_hash_table_lookup (requested, i->data)))
+        continue;
+
+      /* Don't request it again, it stays usable until its response is
+       * over */
+      g_hash_table_replace (requested, i->data, GINT_TO_POINTER (TRUE));
+      g_queue_push_tail (requests, i->data);
+      pushed = g_list_prepend (pushed, i->data);
+    }
+
+  return g_list_reverse (pushed);
+}
+
+/* @channel is gone but the response to its request will still come: keep
+ * its place in @requests.
+ *
+ * Only extern for the benefit of tests/test-gtalk-file-collection.c */
+void
+_gtalk_file_collection_forget_request (GQueue *requests,
+    gpointer channel)
+{
+  GList *l;
+
+  for (l = requests->head; l != NULL; l = l->next)
+    {
+      if (l->data == channel)
+        l->data = NULL;
+    }
+}
+
+/* The response to the first request of @requests is over. Returns the
+ * channel receiving the next response, or NULL if it is gone or there is
+ * none, as told by the length of @requests.
+ *
+ * Only extern for the benefit of tests/test-gtalk-file-collection.c */
+gpointer
+_gtalk_file_collection_next_request (GQueue *requests)
+{
+  g_queue_pop_head (requests);
+
+  return g_queue_peek_head (requests);
+}
+
 
 typedef enum
 {
@@ -180,6 +252,9 @@ struct _GTalkFileCollectionPrivate
   /* GHashTable of GabbleFileTransferChannel => GINT_TO_POINTER (gboolean) */
   /* the weakref to the channel here is held through the GList *channels */
   GHashTable *channels_usable;
+  /* GHashTable of GabbleFileTransferChannel => GINT_TO_POINTER (gboolean) */
+  /* the weakref to the channel here is held through the GList *channels */
+  GHashTable *channels_requested;
   GabbleFileTransferChannel *current_channel;
   WockyJingleFactory *jingle_factory;
   WockyJingleSession *jingle;
@@ -216,6 +291,8 @@ gtalk_file_collection_init (GTalkFileCollection *self)
 
   self->priv->channels_reading = g_hash_table_new_full (NULL, NULL, NULL, NULL);
   self->priv->channels_usable = g_hash_table_new_full (NULL, NULL, NULL, NULL);
+  self->priv->channels_requested = g_hash_table_new_full (NULL, NULL, NULL,
+      NULL);
 
   self->priv->share_channels = g_hash_table_new_full (NULL, NULL,
       NULL, free_share_channel);
@@ -256,6 +333,7 @@ gtalk_file_collection_dispose (GObject *object)
 
   tp_clear_pointer (&self->priv->channels_reading, g_hash_table_unref);
   tp_clear_pointer (&self->priv->channels_usable, g_hash_table_unref);
+  tp_clear_pointer (&self->priv->channels_requested, g_hash_table_unref);
   tp_clear_pointer (&self->priv->share_channels, g_hash_table_unref);
 
   for (i = self->priv->channels; i; i = i->next)
@@ -399,12 +477,26 @@ add_channel (GTalkFileCollection * self, GabbleFileTransferChannel *channel)
 static void
 del_channel (GTalkFileCollection * self, GabbleFileTransferChannel *channel)
 {
+  GHashTableIter iter;
+  gpointer value;
+
   g_return_if_fail (channel_exists (self, channel));
 
   self->priv->channels = g_list_remove (self->priv->channels, channel);
   g_hash_table_remove (self->priv->channels_reading, channel);
   g_hash_table_remove (self->priv->channels_usable, channel);
+  g_hash_table_remove (self->priv->channels_requested, channel);
   g_object_weak_unref (G_OBJECT (channel), channel_disposed, self);
+
+  g_hash_table_iter_init (&iter, self->priv->share_channels);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ShareChannel *share_channel = value;
+
+      _gtalk_file_collection_forget_request (&share_channel->requests,
+          channel);
+    }
+
   if (self->priv->current_channel == channel)
     set_current_channel (self, NULL);
 }
@@ -683,65 +775,49 @@ nice_component_state_changed (NiceAgent *agent,  guint stream_id,
   wocky_jingle_content_set_transport_state (content, ts);
 }
 
+/* Request the files which have been accepted and not requested yet, as long
+ * as there is room in the pipeline */
 static void
-get_next_manifest_entry (GTalkFileCollection *self,
-    ShareChannel *share_channel, gboolean error)
+send_requests (GTalkFileCollection *self,
+    ShareChannel *share_channel)
 {
   GabbleJingleShareManifest *manifest = NULL;
-  GabbleJingleShareManifestEntry *entry = NULL;
-  GabbleFileTransferChannel *channel = NULL;
+  /* GabbleFileTransferChannel => GabbleJingleShareManifestEntry */
+  GHashTable *entries = g_hash_table_new (NULL, NULL);
+  GList *channels = NULL;
+  GList *pushed;
+  gboolean idle = g_queue_is_empty (&share_channel->requests);
   GList *i;
 
   DEBUG ("called");
 
-  if (self->priv->current_channel != NULL)
-    {
-      if (g_list_length (self->priv->channels) == 1)
-        {
-          WockyJingleContent *content = \
-              WOCKY_JINGLE_CONTENT (share_channel->content);
-
-          DEBUG ("Received all the files. Transfer is complete");
-          wocky_jingle_content_send_complete (content);
-        }
-
-      g_hash_table_replace (self->priv->channels_usable,
-          self->priv->current_channel, GINT_TO_POINTER (FALSE));
-      gabble_file_transfer_channel_gtalk_file_collection_state_changed (
-          self->priv->current_channel,
-          error ? GTALK_FILE_COLLECTION_STATE_ERROR:
-          GTALK_FILE_COLLECTION_STATE_COMPLETED, FALSE);
-
-      set_current_channel (self, NULL);
-    }
-
   manifest = gabble_jingle_share_get_manifest (share_channel->content);
-  for (i = manifest->entries; i; i = i->next)
+  for (i = manifest->entries; i != NULL; i = i->next)
     {
+      GabbleJingleShareManifestEntry *entry = i->data;
+      GabbleFileTransferChannel *channel = NULL;
       gchar *filename = NULL;
-      gboolean usable;
-
-      entry = i->data;
 
       filename = g_strdup_printf ("%s%s", entry->name,
           (entry->folder ? ".tar" : ""));
       channel = get_channel_by_filename (self, filename);
       g_free (filename);
-      if (channel != NULL)
-        {
-          usable = GPOINTER_TO_INT (g_hash_table_lookup (
-                  self->priv->channels_usable, channel));
-          if (usable)
-            break;
-        }
-      entry = NULL;
-    }
 
-  self->priv->status = GTALK_FT_STATUS_WAITING;
+      if (channel == NULL || g_hash_table_contains (entries, channel))
+        continue;
+
+      g_hash_table_insert (entries, channel, entry);
+      channels = g_list_prepend (channels, channel);
+    }
 
+  channels = g_list_reverse (channels);
+  pushed = _gtalk_file_collection_fill_pipeline (&share_channel->requests,
+      channels, self->priv->channels_usable, self->priv->channels_requested);
 
-  if (entry != NULL)
+  for (i = pushed; i != NULL; i = i->next)
     {
+      GabbleJingleShareManifestEntry *entry = g_hash_table_lookup (entries,
+          i->data);
       gchar *buffer = NULL;
       gchar *source_url = manifest->source_url;
       guint url_len = (source_url != NULL? strlen (source_url) : 0);
@@ -751,8 +827,6 @@ get_next_manifest_entry (GTalkFileCollection *self,
       if (source_url != NULL && source_url[url_len -1] != '/')
         separator = "/";
 
-      self->priv->status = GTALK_FT_STATUS_TRANSFERRING;
-
       filename = g_uri_escape_string (entry->name, NULL, TRUE);
 
       /* The session initiator will always be the full JID of the peer */
@@ -771,11 +845,83 @@ get_next_manifest_entry (GTalkFileCollection *self,
       nice_agent_send (share_channel->agent, share_channel->stream_id,
           share_channel->component_id, strlen (buffer), buffer);
       g_free (buffer);
+    }
 
+  DEBUG ("%u requests in flight", share_channel->requests.length);
+
+  if (idle && pushed != NULL)
+    {
       share_channel->http_status = HTTP_CLIENT_RECEIVE;
       /* Block or unblock accordingly */
-      set_current_channel (self, channel);
+      set_current_channel (self, pushed->data);
     }
+
+  g_list_free (pushed);
+  g_list_free (channels);
+  g_hash_table_unref (entries);
+
+  if (share_channel->requests.length > 0)
+    self->priv->status = GTALK_FT_STATUS_TRANSFERRING;
+  else
+    self->priv->status = GTALK_FT_STATUS_WAITING;
+}
+
+/* The response to the first request in the pipeline is over: move on to the
+ * next one */
+static void
+get_next_manifest_entry (GTalkFileCollection *self,
+    ShareChannel *share_channel, gboolean error)
+{
+  GabbleFileTransferChannel *next;
+
+  DEBUG ("called");
+
+  if (self->priv->current_channel != NULL)
+    {
+      if (g_list_length (self->priv->channels) == 1)
+        {
+          WockyJingleContent *content = \
+              WOCKY_JINGLE_CONTENT (share_channel->content);
+
+          DEBUG ("Received all the files. Transfer is complete");
+          wocky_jingle_content_send_complete (content);
+        }
+
+      g_hash_table_replace (self->priv->channels_usable,
+          self->priv->current_channel, GINT_TO_POINTER (FALSE));
+      gabble_file_transfer_channel_gtalk_file_collection_state_changed (
+          self->priv->current_channel,
+          error ? GTALK_FILE_COLLECTION_STATE_ERROR:
+          GTALK_FILE_COLLECTION_STATE_COMPLETED, FALSE);
+
+      set_current_channel (self, NULL);
+    }
+
+  next = _gtalk_file_collection_next_request (&share_channel->requests);
+
+  if (share_channel->requests.length > 0)
+    {
+      share_channel->http_status = HTTP_CLIENT_RECEIVE;
+
+      if (next != NULL)
+        {
+          set_current_channel (self, next);
+        }
+      else if (!share_channel->agent_attached)
+        {
+          /* Keep reading to skip its response */
+          share_channel->agent_attached = TRUE;
+          nice_agent_attach_recv (share_channel->agent,
+              share_channel->stream_id, share_channel->component_id,
+              g_main_context_default (), nice_data_received_cb, self);
+        }
+    }
+  else
+    {
+      share_channel->http_status = HTTP_CLIENT_IDLE;
+    }
+
+  send_requests (self, share_channel);
 }
 
 static void
@@ -787,7 +933,7 @@ nice_component_writable (NiceAgent *agent, guint stream_id, guint component_id,
 
   if (share_channel->http_status == HTTP_CLIENT_IDLE)
     {
-      get_next_manifest_entry (self, share_channel, FALSE);
+      send_requests (self, share_channel);
     }
   else if (share_channel->http_status == HTTP_SERVER_SEND)
     {
@@ -993,6 +1139,7 @@ free_share_channel (gpointer data)
 
   tp_clear_pointer (&share_channel->write_buffer, g_free);
   tp_clear_pointer (&share_channel->read_buffer, g_free);
+  g_queue_clear (&share_channel->requests);
   g_object_unref (share_channel->agent);
   g_slice_free (ShareChannel, share_channel);
 }
@@ -1258,6 +1405,24 @@ http_data_received (GTalkFileCollection *self, ShareChannel *share_channel,
         {
           guint consumed = 0;
 
+          if (self->priv->current_channel == NULL &&
+              !g_queue_is_empty (&share_channel->requests))
+            {
+              /* The channel this file was requested for is gone, drop it */
+              consumed = MIN (len, share_channel->content_length);
+              share_channel->content_length -= consumed;
+
+              if (share_channel->content_length == 0)
+                {
+                  if (share_channel->is_chunked)
+                    share_channel->http_status = HTTP_CLIENT_CHUNK_END;
+                  else
+                    get_next_manifest_entry (self, share_channel, FALSE);
+                }
+
+              return consumed;
+            }
+
           if (len >= share_channel->content_length)
             {
               if (self->priv->current_channel == NULL)
@@ -1328,6 +1493,35 @@ http_data_received (GTalkFileCollection *self, ShareChannel *share_channel,
   return 0;
 }
 
+/* Feed @buffer to the HTTP state machine, keeping what it can't handle yet
+ * for later */
+static void
+http_consume (GTalkFileCollection *self,
+    ShareChannel *share_channel,
+    gchar *buffer,
+    guint len)
+{
+  while (len > 0)
+    {
+      guint consumed = http_data_received (self, share_channel, buffer, len);
+
+      if (consumed == 0)
+        {
+          share_channel->read_buffer = g_memdup (buffer, len);
+          share_channel->read_len = len;
+          break;
+        }
+      else
+        {
+          /* we assume http_data_received never returns consumed > len */
+          g_assert (consumed <= len);
+
+          len -= consumed;
+          buffer += consumed;
+        }
+    }
+}
+
 static void
 nice_data_received_cb (NiceAgent *agent,
                        guint stream_id,
@@ -1354,25 +1548,8 @@ nice_data_received_cb (NiceAgent *agent,
       share_channel->read_buffer = NULL;
       share_channel->read_len = 0;
     }
-  while (len > 0)
-    {
-      guint consumed = http_data_received (self, share_channel, buffer, len);
 
-      if (consumed == 0)
-        {
-          share_channel->read_buffer = g_memdup (buffer, len);
-          share_channel->read_len = len;
-          break;
-        }
-      else
-        {
-          /* we assume http_data_received never returns consumed > len */
-          g_assert (consumed <= len);
-
-          len -= consumed;
-          buffer += consumed;
-        }
-    }
+  http_consume (self, share_channel, buffer, len);
 
   if (free_buffer != NULL)
     g_free (free_buffer);
@@ -1561,13 +1738,15 @@ gtalk_file_collection_accept (GTalkFileCollection *self,
           channel, GTALK_FILE_COLLECTION_STATE_ACCEPTED, FALSE);
     }
 
-  if (self->priv->status == GTALK_FT_STATUS_WAITING)
+  /* Request it straight away if there is room in the pipeline */
+  if (self->priv->status == GTALK_FT_STATUS_WAITING ||
+      self->priv->status == GTALK_FT_STATUS_TRANSFERRING)
     {
       /* FIXME: this and other lookups should not check for channel '1' */
       ShareChannel *share_channel = g_hash_table_lookup (
           self->priv->share_channels, GINT_TO_POINTER (1));
 
-      get_next_manifest_entry (self, share_channel, FALSE);
+      send_requests (self, share_channel);
     }
 }
 
@@ -1658,6 +1837,18 @@ gtalk_file_collection_completed (GTalkFileCollection *self,
      completed. */
   share_channel->http_status = HTTP_SERVER_IDLE;
   self->priv->status = GTALK_FT_STATUS_WAITING;
+
+  /* The peer may have pipelined its next requests while we were sending */
+  if (share_channel->read_buffer != NULL)
+    {
+      gchar *buffer = share_channel->read_buffer;
+      guint len = share_channel->read_len;
+
+      share_channel->read_buffer = NULL;
+      share_channel->read_len = 0;
+      http_consume (self, share_channel, buffer, len);
+      g_free (buffer);
+    }
 }
 
 void
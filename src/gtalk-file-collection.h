@@ -97,5 +97,11 @@ gboolean gtalk_file_collection_send_data (GTalkFileCollection *self,
 
 void gtalk_file_collection_set_test_mode (void);
 
+GList *_gtalk_file_collection_fill_pipeline (GQueue *requests,
+    GList *channels, GHashTable *usable, GHashTable *requested);
+void _gtalk_file_collection_forget_request (GQueue *requests,
+    gpointer channel);
+gpointer _gtalk_file_collection_next_request (GQueue *requests);
+
 #endif /* __GTALK_FILE_COLLECTION_H__ */
 
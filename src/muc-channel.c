@@ -2163,6 +2163,14 @@ gabble_muc_channel_handle_si_stream_request (GabbleMucChannel *self,
   DEBUG ("received new bytestream request for existing tube: %" G_GUINT64_FORMAT,
       tube_id);
 
+  if (GABBLE_IS_TUBE_STREAM (tube) &&
+      !tp_strdiff (wocky_node_get_attribute (stream_node, "pool"), "true"))
+    {
+      gabble_tube_stream_add_pooled_bytestream (GABBLE_TUBE_STREAM (tube),
+          bytestream);
+      return;
+    }
+
   gabble_tube_iface_add_bytestream (tube, bytestream);
 }
 
@@ -2307,8 +2315,12 @@ tubes_presence_update (GabbleMucChannel *gmuc,
                   continue;
                 }
 
-              gabble_tube_dbus_add_name (GABBLE_TUBE_DBUS (tube),
-                  contact, new_name);
+              if (gabble_tube_dbus_add_name (GABBLE_TUBE_DBUS (tube),
+                    contact, new_name) &&
+                  !tp_strdiff (wocky_node_get_attribute (tube_node,
+                      "batching"), "true"))
+                gabble_tube_dbus_add_batching_peer (GABBLE_TUBE_DBUS (tube),
+                    contact);
             }
         }
     }
@@ -110,6 +110,7 @@
 #define NS_SI                   "http://jabber.org/protocol/si"
 #define NS_SI_MULTIPLE          "http://telepathy.freedesktop.org/xmpp/si-multiple"
 #define NS_TUBES                "http://telepathy.freedesktop.org/xmpp/tubes"
+#define NS_TUBES_ZLIB           NS_TUBES "#zlib"
 #define NS_MUJI                 "http://telepathy.freedesktop.org/xmpp/muji"
 #define NS_VCARD_TEMP           "vcard-temp"
 #define NS_VCARD_TEMP_UPDATE    "vcard-temp:x:update"
@@ -135,6 +136,7 @@
 
 #define NS_TP_FT_METADATA_SERVICE "http://telepathy.freedesktop.org/xmpp/file-transfer-service"
 #define NS_TP_FT_METADATA       "http://telepathy.freedesktop.org/xmpp/file-transfer-metadata"
+#define NS_TP_FT_PARALLEL       "http://telepathy.freedesktop.org/xmpp/file-transfer-parallel"
 
 /* This is used by WLM to convert Windows Live ID to XMPP jid.
  * See http://msdn.microsoft.com/en-us/library/live/hh550849.aspx */
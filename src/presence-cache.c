@@ -844,7 +844,7 @@ self_avatar_resolve_conflict (GabblePresenceCache *cache)
       tp_base_connection_get_self_handle (base_conn));
   gabble_vcard_manager_request (priv->conn->vcard_manager,
       tp_base_connection_get_self_handle (base_conn), 0,
-      self_vcard_request_cb, cache,
+      GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL, self_vcard_request_cb, cache,
       NULL);
 }
 
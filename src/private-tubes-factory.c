@@ -34,6 +34,7 @@
 #define DEBUG_FLAG GABBLE_DEBUG_TUBES
 
 #include "bytestream-factory.h"
+#include "bytestream-zlib.h"
 #include "gabble/caps-channel-manager.h"
 #include "connection.h"
 #include "debug.h"
@@ -711,6 +712,9 @@ gabble_private_tubes_factory_handle_si_tube_request (
       return;
     }
 
+  if (gabble_bytestream_zlib_requested (tube_node))
+    bytestream = gabble_bytestream_zlib_wrap (bytestream);
+
   /* New tube */
   new_channel_from_stanza (self, msg, tube_node,
       tube_id, bytestream);
@@ -784,6 +788,28 @@ gabble_private_tubes_factory_handle_si_stream_request (
   DEBUG ("received new bytestream request for existing tube: %" G_GUINT64_FORMAT,
       tube_id);
 
+  /* The tube will accept the bytestream through the wrapper, which tells
+   * the peer we compress too */
+  if (gabble_bytestream_zlib_requested (stream_node))
+    bytestream = gabble_bytestream_zlib_wrap (bytestream);
+
+  if (GABBLE_IS_TUBE_STREAM (tube) &&
+      !tp_strdiff (wocky_node_get_attribute (stream_node, "multiplex"),
+        "true"))
+    {
+      gabble_tube_stream_add_multiplexed_bytestream (GABBLE_TUBE_STREAM (tube),
+          bytestream);
+      return;
+    }
+
+  if (GABBLE_IS_TUBE_STREAM (tube) &&
+      !tp_strdiff (wocky_node_get_attribute (stream_node, "pool"), "true"))
+    {
+      gabble_tube_stream_add_pooled_bytestream (GABBLE_TUBE_STREAM (tube),
+          bytestream);
+      return;
+    }
+
   gabble_tube_iface_add_bytestream (tube, bytestream);
 }
 
@@ -1171,6 +1197,10 @@ new_channel_from_stanza (GabblePrivateTubesFactory *self,
               tp_base_connection_get_self_handle (base_conn),
               handle, service, parameters,
               stream_id, tube_id, bytestream, NULL, FALSE));
+
+      if (!tp_strdiff (wocky_node_get_attribute (tube_node, "batching"),
+            "true"))
+        gabble_tube_dbus_add_batching_peer (GABBLE_TUBE_DBUS (tube), handle);
     }
 
   tp_base_channel_register ((TpBaseChannel *) tube);
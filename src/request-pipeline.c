@@ -31,6 +31,9 @@
 
 #define DEFAULT_REQUEST_TIMEOUT 180
 #define REQUEST_PIPELINE_SIZE 10
+/* How many requests can be sent ahead of a pending lower priority one before
+ * it goes first */
+#define MAX_PASSED_OVER 5
 
 /* Properties */
 enum
@@ -49,6 +52,7 @@ struct _GabbleRequestPipelineItem
   guint timeout;
   gboolean in_flight;
   gboolean zombie;
+  GabbleRequestPipelinePriority priority;
 
   GabbleRequestPipelineCb callback;
   gpointer user_data;
@@ -57,7 +61,10 @@ struct _GabbleRequestPipelineItem
 struct _GabbleRequestPipelinePrivate
 {
   GabbleConnection *connection;
-  GSList *pending_items;
+  /* One FIFO per GabbleRequestPipelinePriority */
+  GSList *pending_items[GABBLE_REQUEST_PIPELINE_N_PRIORITIES];
+  /* How many requests were sent while each class had some pending */
+  guint passed_over[GABBLE_REQUEST_PIPELINE_N_PRIORITIES];
   GSList *items_in_flight;
   /* Zombie storage (items which were cancelled while the IQ was in flight) */
   GSList *crypt_items;
@@ -187,7 +194,8 @@ delete_item (GabbleRequestPipelineItem *item)
     }
   else
     {
-      priv->pending_items = g_slist_remove (priv->pending_items, item);
+      priv->pending_items[item->priority] = g_slist_remove (
+          priv->pending_items[item->priority], item);
     }
 
   if (item->timer_id)
@@ -240,6 +248,29 @@ gabble_request_pipeline_item_cancel (GabbleRequestPipelineItem *item)
   gabble_request_pipeline_create_zombie (item->pipeline, item, &cancelled);
 }
 
+/* Move @item ahead if it hasn't been sent yet and @priority is higher than
+ * the one it was enqueued with. */
+void
+gabble_request_pipeline_item_raise_priority (GabbleRequestPipelineItem *item,
+    GabbleRequestPipelinePriority priority)
+{
+  GabbleRequestPipelinePrivate *priv = item->pipeline->priv;
+
+  g_return_if_fail (priority < GABBLE_REQUEST_PIPELINE_N_PRIORITIES);
+
+  if (item->in_flight || item->zombie || priority >= item->priority)
+    return;
+
+  DEBUG ("raising the priority of item %p from %u to %u", item,
+      item->priority, priority);
+
+  priv->pending_items[item->priority] = g_slist_remove (
+      priv->pending_items[item->priority], item);
+  item->priority = priority;
+  priv->pending_items[priority] = g_slist_append (
+      priv->pending_items[priority], item);
+}
+
 static void
 gabble_request_pipeline_flush (GabbleRequestPipeline *self,
     GSList **list)
@@ -266,6 +297,7 @@ gabble_request_pipeline_dispose (GObject *object)
   GabbleRequestPipeline *self = GABBLE_REQUEST_PIPELINE (object);
   GabbleRequestPipelinePrivate *priv =
       GABBLE_REQUEST_PIPELINE_GET_PRIVATE (self);
+  guint i;
 
   if (priv->dispose_has_run)
     return;
@@ -275,7 +307,9 @@ gabble_request_pipeline_dispose (GObject *object)
   DEBUG ("disposing request-pipeline");
 
   gabble_request_pipeline_flush (self, &priv->items_in_flight);
-  gabble_request_pipeline_flush (self, &priv->pending_items);
+
+  for (i = 0; i < GABBLE_REQUEST_PIPELINE_N_PRIORITIES; i++)
+    gabble_request_pipeline_flush (self, &priv->pending_items[i]);
   gabble_request_pipeline_flush (self, &priv->crypt_items);
 
   g_idle_remove_by_data (self);
@@ -343,6 +377,68 @@ timeout_cb (gpointer data)
   return FALSE;
 }
 
+static gboolean
+has_pending_items (GabbleRequestPipelinePrivate *priv)
+{
+  guint i;
+
+  for (i = 0; i < GABBLE_REQUEST_PIPELINE_N_PRIORITIES; i++)
+    {
+      if (priv->pending_items[i] != NULL)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Remove and return the next item to send, or NULL if there is none */
+static GabbleRequestPipelineItem *
+pop_next_item (GabbleRequestPipelinePrivate *priv)
+{
+  GabbleRequestPipelineItem *item;
+  guint next = GABBLE_REQUEST_PIPELINE_N_PRIORITIES;
+  guint i;
+
+  for (i = 0; i < GABBLE_REQUEST_PIPELINE_N_PRIORITIES; i++)
+    {
+      if (priv->pending_items[i] != NULL)
+        {
+          next = i;
+          break;
+        }
+    }
+
+  if (next == GABBLE_REQUEST_PIPELINE_N_PRIORITIES)
+    return NULL;
+
+  /* The lowest class which waited too long goes first */
+  for (i = GABBLE_REQUEST_PIPELINE_N_PRIORITIES - 1; i > next; i--)
+    {
+      if (priv->pending_items[i] != NULL &&
+          priv->passed_over[i] >= MAX_PASSED_OVER)
+        {
+          DEBUG ("priority %u was passed over %u times, sending from it",
+              i, priv->passed_over[i]);
+          next = i;
+          break;
+        }
+    }
+
+  for (i = 0; i < GABBLE_REQUEST_PIPELINE_N_PRIORITIES; i++)
+    {
+      if (i == next || priv->pending_items[i] == NULL)
+        priv->passed_over[i] = 0;
+      else if (i > next)
+        priv->passed_over[i]++;
+    }
+
+  item = priv->pending_items[next]->data;
+  priv->pending_items[next] = g_slist_remove (priv->pending_items[next],
+      item);
+
+  return item;
+}
+
 static void
 send_next_request (GabbleRequestPipeline *pipeline)
 {
@@ -351,17 +447,15 @@ send_next_request (GabbleRequestPipeline *pipeline)
   GabbleRequestPipelineItem *item;
   GError *error = NULL;
 
-  if (priv->pending_items == NULL)
-      return;
+  item = pop_next_item (priv);
 
-  item = priv->pending_items->data;
+  if (item == NULL)
+      return;
 
-  DEBUG ("processing request %p", item);
+  DEBUG ("processing request %p with priority %u", item, item->priority);
 
   g_assert (item->in_flight == FALSE);
 
-  priv->pending_items = g_slist_remove (priv->pending_items, item);
-
   if (!_gabble_connection_send_with_reply (priv->connection, item->message,
       response_cb, G_OBJECT (pipeline), item, &error))
     {
@@ -383,11 +477,16 @@ gabble_request_pipeline_go (GabbleRequestPipeline *pipeline)
   GabbleRequestPipelinePrivate *priv =
       GABBLE_REQUEST_PIPELINE_GET_PRIVATE (pipeline);
 
-  DEBUG ("called; %d pending items, %d items in flight",
-    g_slist_length (priv->pending_items),
+  DEBUG ("called; %d/%d/%d pending items, %d items in flight",
+    g_slist_length (
+        priv->pending_items[GABBLE_REQUEST_PIPELINE_PRIORITY_INTERACTIVE]),
+    g_slist_length (
+        priv->pending_items[GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL]),
+    g_slist_length (
+        priv->pending_items[GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND]),
     g_slist_length (priv->items_in_flight));
 
-  while (priv->pending_items &&
+  while (has_pending_items (priv) &&
       (g_slist_length (priv->items_in_flight) < REQUEST_PIPELINE_SIZE))
     {
       send_next_request (pipeline);
@@ -408,12 +507,27 @@ gabble_request_pipeline_enqueue (GabbleRequestPipeline *pipeline,
                                  guint timeout,
                                  GabbleRequestPipelineCb callback,
                                  gpointer user_data)
+{
+  return gabble_request_pipeline_enqueue_with_priority (pipeline, msg,
+      timeout, GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL, callback, user_data);
+}
+
+GabbleRequestPipelineItem *
+gabble_request_pipeline_enqueue_with_priority (
+    GabbleRequestPipeline *pipeline,
+    WockyStanza *msg,
+    guint timeout,
+    GabbleRequestPipelinePriority priority,
+    GabbleRequestPipelineCb callback,
+    gpointer user_data)
 {
   GabbleRequestPipelinePrivate *priv =
       GABBLE_REQUEST_PIPELINE_GET_PRIVATE (pipeline);
   GabbleRequestPipelineItem *item = g_slice_new0 (GabbleRequestPipelineItem);
 
   g_return_val_if_fail (callback != NULL, NULL);
+  g_return_val_if_fail (priority < GABBLE_REQUEST_PIPELINE_N_PRIORITIES,
+      NULL);
 
   item->pipeline = pipeline;
   item->message = msg;
@@ -421,14 +535,16 @@ gabble_request_pipeline_enqueue (GabbleRequestPipeline *pipeline,
       timeout = DEFAULT_REQUEST_TIMEOUT;
   item->timeout = timeout;
   item->in_flight = FALSE;
+  item->priority = priority;
   item->callback = callback;
   item->user_data = user_data;
 
   g_object_ref (msg);
 
-  priv->pending_items = g_slist_append (priv->pending_items, item);
+  priv->pending_items[priority] = g_slist_append (
+      priv->pending_items[priority], item);
 
-  DEBUG ("enqueued new request as item %p", item);
+  DEBUG ("enqueued new request as item %p with priority %u", item, priority);
   DEBUG ("number of items in flight: %d", g_slist_length (priv->items_in_flight));
 
   /* If the pipeline isn't full, schedule a run. Run it delayed so that if
@@ -44,6 +44,25 @@ typedef enum
   GABBLE_REQUEST_PIPELINE_ERROR_TIMEOUT
 } GabbleRequestPipelineError;
 
+/**
+ * GabbleRequestPipelinePriority:
+ * @GABBLE_REQUEST_PIPELINE_PRIORITY_INTERACTIVE: A client is waiting for the
+ *  reply
+ * @GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL: The default
+ * @GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND: Speculative fetches, such as
+ *  the aliases of the whole roster
+ *
+ * Pending requests are sent in this order, but a class which has been passed
+ * over too many times in a row goes next so it is never starved.
+ */
+typedef enum
+{
+  GABBLE_REQUEST_PIPELINE_PRIORITY_INTERACTIVE,
+  GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL,
+  GABBLE_REQUEST_PIPELINE_PRIORITY_BACKGROUND,
+  GABBLE_REQUEST_PIPELINE_N_PRIORITIES
+} GabbleRequestPipelinePriority;
+
 GQuark gabble_request_pipeline_error_quark (void);
 #define GABBLE_REQUEST_PIPELINE_ERROR gabble_request_pipeline_error_quark ()
 
@@ -79,7 +98,13 @@ GabbleRequestPipeline *gabble_request_pipeline_new (GabbleConnection *conn);
 GabbleRequestPipelineItem *gabble_request_pipeline_enqueue
     (GabbleRequestPipeline *pipeline, WockyStanza *msg, guint timeout,
      GabbleRequestPipelineCb callback, gpointer user_data);
+GabbleRequestPipelineItem *gabble_request_pipeline_enqueue_with_priority
+    (GabbleRequestPipeline *pipeline, WockyStanza *msg, guint timeout,
+     GabbleRequestPipelinePriority priority, GabbleRequestPipelineCb callback,
+     gpointer user_data);
 void gabble_request_pipeline_item_cancel (GabbleRequestPipelineItem *req);
+void gabble_request_pipeline_item_raise_priority (
+    GabbleRequestPipelineItem *req, GabbleRequestPipelinePriority priority);
 
 G_END_DECLS
 
@@ -0,0 +1,301 @@
+/*
+ * transfer-scheduler.c - Source for GabbleTransferScheduler
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Shares the bandwidth of a connection between its bytestreams.
+ *
+ * Interactive traffic (tubes) is never slowed down, but what it used is
+ * taken from the budget of bulk transfers (files). Every TICK_MS, the
+ * budget left is split evenly between the bulk transfers, each of them
+ * getting at most its own limit; they are GabbleBytestreamThrottles which
+ * block once they used their share. Both limits are token buckets only one
+ * tick deep, so there is no burst after an idle period. */
+
+#include "config.h"
+#include "transfer-scheduler.h"
+
+#define DEBUG_FLAG GABBLE_DEBUG_BYTESTREAM
+
+#include "bytestream-throttle.h"
+#include "debug.h"
+
+G_DEFINE_TYPE (GabbleTransferScheduler, gabble_transfer_scheduler,
+    G_TYPE_OBJECT);
+
+/* properties */
+enum
+{
+  PROP_RATE_LIMIT = 1,
+  PROP_FLOW_RATE_LIMIT,
+  LAST_PROPERTY
+};
+
+#define TICK_MS 100
+
+struct _GabbleTransferSchedulerPrivate
+{
+  /* In bytes per second, 0 if unlimited */
+  guint rate_limit;
+  guint flow_rate_limit;
+
+  /* Borrowed (GabbleBytestreamThrottle *); they remove themselves when they
+   * are closed or disposed */
+  GPtrArray *flows;
+  /* Interactive traffic since the last tick */
+  guint64 interactive_bytes;
+  guint tick_id;
+
+  gboolean dispose_has_run;
+};
+
+static void
+gabble_transfer_scheduler_init (GabbleTransferScheduler *self)
+{
+  GabbleTransferSchedulerPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GABBLE_TYPE_TRANSFER_SCHEDULER, GabbleTransferSchedulerPrivate);
+
+  self->priv = priv;
+
+  priv->flows = g_ptr_array_new ();
+}
+
+static void
+gabble_transfer_scheduler_dispose (GObject *object)
+{
+  GabbleTransferScheduler *self = GABBLE_TRANSFER_SCHEDULER (object);
+  GabbleTransferSchedulerPrivate *priv = self->priv;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  if (priv->tick_id != 0)
+    {
+      g_source_remove (priv->tick_id);
+      priv->tick_id = 0;
+    }
+
+  G_OBJECT_CLASS (gabble_transfer_scheduler_parent_class)->dispose (object);
+}
+
+static void
+gabble_transfer_scheduler_finalize (GObject *object)
+{
+  GabbleTransferScheduler *self = GABBLE_TRANSFER_SCHEDULER (object);
+
+  /* Each flow holds a ref on us */
+  g_assert (self->priv->flows->len == 0);
+  g_ptr_array_unref (self->priv->flows);
+
+  G_OBJECT_CLASS (gabble_transfer_scheduler_parent_class)->finalize (object);
+}
+
+static void
+gabble_transfer_scheduler_get_property (GObject *object,
+                                        guint property_id,
+                                        GValue *value,
+                                        GParamSpec *pspec)
+{
+  GabbleTransferScheduler *self = GABBLE_TRANSFER_SCHEDULER (object);
+
+  switch (property_id)
+    {
+      case PROP_RATE_LIMIT:
+        g_value_set_uint (value, self->priv->rate_limit);
+        break;
+      case PROP_FLOW_RATE_LIMIT:
+        g_value_set_uint (value, self->priv->flow_rate_limit);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_transfer_scheduler_set_property (GObject *object,
+                                        guint property_id,
+                                        const GValue *value,
+                                        GParamSpec *pspec)
+{
+  GabbleTransferScheduler *self = GABBLE_TRANSFER_SCHEDULER (object);
+
+  switch (property_id)
+    {
+      case PROP_RATE_LIMIT:
+        self->priv->rate_limit = g_value_get_uint (value);
+        break;
+      case PROP_FLOW_RATE_LIMIT:
+        self->priv->flow_rate_limit = g_value_get_uint (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_transfer_scheduler_class_init (
+    GabbleTransferSchedulerClass *gabble_transfer_scheduler_class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (
+      gabble_transfer_scheduler_class);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (gabble_transfer_scheduler_class,
+      sizeof (GabbleTransferSchedulerPrivate));
+
+  object_class->dispose = gabble_transfer_scheduler_dispose;
+  object_class->finalize = gabble_transfer_scheduler_finalize;
+
+  object_class->get_property = gabble_transfer_scheduler_get_property;
+  object_class->set_property = gabble_transfer_scheduler_set_property;
+
+  param_spec = g_param_spec_uint (
+      "rate-limit",
+      "Rate limit",
+      "Bytes per second all the transfers can use together, or 0",
+      0, G_MAXUINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_RATE_LIMIT,
+      param_spec);
+
+  param_spec = g_param_spec_uint (
+      "flow-rate-limit",
+      "Flow rate limit",
+      "Bytes per second each bulk transfer can use, or 0",
+      0, G_MAXUINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_FLOW_RATE_LIMIT,
+      param_spec);
+}
+
+/* How much each bulk transfer can use until the next tick */
+static gint64
+get_share (GabbleTransferScheduler *self)
+{
+  GabbleTransferSchedulerPrivate *priv = self->priv;
+  gint64 share = G_MAXINT32;
+
+  if (priv->rate_limit != 0)
+    {
+      gint64 budget = (gint64) priv->rate_limit * TICK_MS / 1000 -
+          (gint64) priv->interactive_bytes;
+
+      share = MAX (budget, 0) / MAX (priv->flows->len, 1);
+    }
+
+  if (priv->flow_rate_limit != 0)
+    share = MIN (share, (gint64) priv->flow_rate_limit * TICK_MS / 1000);
+
+  return share;
+}
+
+static gboolean
+tick_cb (gpointer user_data)
+{
+  GabbleTransferScheduler *self = GABBLE_TRANSFER_SCHEDULER (user_data);
+  GabbleTransferSchedulerPrivate *priv = self->priv;
+  gint64 share;
+  guint i;
+
+  if (priv->flows->len == 0)
+    {
+      priv->tick_id = 0;
+      return FALSE;
+    }
+
+  share = get_share (self);
+  priv->interactive_bytes = 0;
+
+  /* Refilling can close a flow, removing it from the array */
+  g_object_ref (self);
+
+  for (i = priv->flows->len; i > 0; i--)
+    {
+      if (i <= priv->flows->len)
+        gabble_bytestream_throttle_refill (
+            g_ptr_array_index (priv->flows, i - 1), share);
+    }
+
+  g_object_unref (self);
+  return TRUE;
+}
+
+GabbleTransferScheduler *
+gabble_transfer_scheduler_new (guint rate_limit,
+                               guint flow_rate_limit)
+{
+  return g_object_new (GABBLE_TYPE_TRANSFER_SCHEDULER,
+      "rate-limit", rate_limit,
+      "flow-rate-limit", flow_rate_limit,
+      NULL);
+}
+
+/*
+ * gabble_transfer_scheduler_add_bulk
+ *
+ * Returns: a new ref on the bytestream to use instead of @bytestream, which
+ * is @bytestream itself if there is no limit to enforce.
+ */
+GabbleBytestreamIface *
+gabble_transfer_scheduler_add_bulk (GabbleTransferScheduler *self,
+                                    GabbleBytestreamIface *bytestream)
+{
+  GabbleTransferSchedulerPrivate *priv = self->priv;
+  GabbleBytestreamThrottle *flow;
+
+  if (priv->rate_limit == 0 && priv->flow_rate_limit == 0)
+    return g_object_ref (bytestream);
+
+  flow = gabble_bytestream_throttle_new (bytestream, self);
+  g_ptr_array_add (priv->flows, flow);
+
+  DEBUG ("%u bulk transfers", priv->flows->len);
+
+  if (priv->tick_id == 0)
+    priv->tick_id = g_timeout_add (TICK_MS, tick_cb, self);
+
+  /* Start with the same share as the others */
+  gabble_bytestream_throttle_refill (flow, get_share (self));
+
+  return GABBLE_BYTESTREAM_IFACE (flow);
+}
+
+/*
+ * gabble_transfer_scheduler_charge
+ *
+ * Account for @len bytes of interactive traffic, which bulk transfers will
+ * make room for.
+ */
+void
+gabble_transfer_scheduler_charge (GabbleTransferScheduler *self,
+                                  gsize len)
+{
+  if (self->priv->flows->len > 0)
+    self->priv->interactive_bytes += len;
+}
+
+void
+gabble_transfer_scheduler_remove_flow (GabbleTransferScheduler *self,
+                                       GabbleBytestreamThrottle *flow)
+{
+  if (g_ptr_array_remove (self->priv->flows, flow))
+    DEBUG ("%u bulk transfers left", self->priv->flows->len);
+}
@@ -0,0 +1,80 @@
+/*
+ * transfer-scheduler.h - Header for GabbleTransferScheduler
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_TRANSFER_SCHEDULER_H__
+#define __GABBLE_TRANSFER_SCHEDULER_H__
+
+#include <glib-object.h>
+
+#include "bytestream-iface.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GabbleTransferScheduler GabbleTransferScheduler;
+typedef struct _GabbleTransferSchedulerClass GabbleTransferSchedulerClass;
+typedef struct _GabbleTransferSchedulerPrivate GabbleTransferSchedulerPrivate;
+
+/* Defined in bytestream-throttle.h */
+typedef struct _GabbleBytestreamThrottle GabbleBytestreamThrottle;
+
+struct _GabbleTransferSchedulerClass {
+  GObjectClass parent_class;
+};
+
+struct _GabbleTransferScheduler {
+  GObject parent;
+
+  GabbleTransferSchedulerPrivate *priv;
+};
+
+GType gabble_transfer_scheduler_get_type (void);
+
+/* TYPE MACROS */
+#define GABBLE_TYPE_TRANSFER_SCHEDULER \
+  (gabble_transfer_scheduler_get_type ())
+#define GABBLE_TRANSFER_SCHEDULER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GABBLE_TYPE_TRANSFER_SCHEDULER,\
+                              GabbleTransferScheduler))
+#define GABBLE_TRANSFER_SCHEDULER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GABBLE_TYPE_TRANSFER_SCHEDULER,\
+                           GabbleTransferSchedulerClass))
+#define GABBLE_IS_TRANSFER_SCHEDULER(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GABBLE_TYPE_TRANSFER_SCHEDULER))
+#define GABBLE_IS_TRANSFER_SCHEDULER_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GABBLE_TYPE_TRANSFER_SCHEDULER))
+#define GABBLE_TRANSFER_SCHEDULER_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GABBLE_TYPE_TRANSFER_SCHEDULER,\
+                              GabbleTransferSchedulerClass))
+
+GabbleTransferScheduler *gabble_transfer_scheduler_new (guint rate_limit,
+    guint flow_rate_limit);
+
+GabbleBytestreamIface *gabble_transfer_scheduler_add_bulk (
+    GabbleTransferScheduler *self, GabbleBytestreamIface *bytestream);
+
+void gabble_transfer_scheduler_charge (GabbleTransferScheduler *self,
+    gsize len);
+
+/* Only used by GabbleBytestreamThrottle */
+void gabble_transfer_scheduler_remove_flow (GabbleTransferScheduler *self,
+    GabbleBytestreamThrottle *flow);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_TRANSFER_SCHEDULER_H__ */
@@ -37,6 +37,7 @@
 #include "bytestream-factory.h"
 #include "bytestream-ibb.h"
 #include "bytestream-iface.h"
+#include "bytestream-zlib.h"
 #include "connection.h"
 #include "debug.h"
 #include "disco.h"
@@ -56,6 +57,11 @@
  * arbitrary limit on the queue size set to 4MB. */
 #define MAX_QUEUE_SIZE (4096*1024)
 
+/* Messages sent less than BATCH_DELAY ms after the previous write are
+ * coalesced into writes of up to BATCH_MAX_SIZE bytes */
+#define BATCH_DELAY 5
+#define BATCH_MAX_SIZE 4096
+
 static void tube_iface_init (gpointer g_iface, gpointer iface_data);
 static void dbustube_iface_init (gpointer g_iface, gpointer iface_data);
 
@@ -150,6 +156,15 @@ struct _GabbleTubeDBusPrivate
   /* Number of bytes that will be in the next message, 0 if unknown */
   guint32 reassembly_bytes_needed;
 
+  /* Marshalled messages waiting to be sent in one write, see
+   * send_message () */
+  GString *batch;
+  /* Running while we coalesce messages */
+  guint batch_timer;
+  /* (TpHandle) MUC participants announcing they can split a write into
+   * several messages (MUC tubes only) */
+  GHashTable *batching_peers;
+
   gboolean dispose_has_run;
 };
 
@@ -169,7 +184,7 @@ gabble_tube_dbus_get_interfaces (TpBaseChannel *base)
 }
 
 static void data_received_cb (GabbleBytestreamIface *stream, TpHandle sender,
-    GString *data, gpointer user_data);
+    GBytes *data, gpointer user_data);
 
 /*
  * Characters used are permissible both in filenames and in D-Bus names. (See
@@ -190,6 +205,101 @@ generate_ascii_string (guint len,
     buf[i] = chars[g_random_int_range (0, 64)];
 }
 
+static gboolean
+batching_enabled (GabbleTubeDBus *self)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (self);
+  TpBaseChannel *base = TP_BASE_CHANNEL (self);
+  TpBaseChannelClass *cls = TP_BASE_CHANNEL_GET_CLASS (base);
+  GHashTableIter iter;
+  gpointer handle;
+
+  /* Batching delays messages, so we only do it if the contact asked for
+   * it in the SI negotiating the bytestream */
+  if (cls->target_handle_type == TP_HANDLE_TYPE_CONTACT)
+    return g_hash_table_contains (priv->batching_peers,
+        GUINT_TO_POINTER (tp_base_channel_get_target_handle (base)));
+
+  /* Each write is a MUC message, which older participants expect to contain
+   * exactly one D-Bus message */
+  g_hash_table_iter_init (&iter, priv->dbus_names);
+  while (g_hash_table_iter_next (&iter, &handle, NULL))
+    {
+      if (GPOINTER_TO_UINT (handle) != priv->self_handle &&
+          !g_hash_table_contains (priv->batching_peers, handle))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+flush_batch (GabbleTubeDBus *self)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (self);
+
+  if (priv->batch->len == 0)
+    return;
+
+  if (priv->bytestream != NULL)
+    gabble_bytestream_iface_send (priv->bytestream, priv->batch->len,
+        priv->batch->str);
+
+  g_string_truncate (priv->batch, 0);
+}
+
+static gboolean
+batch_timeout_cb (gpointer user_data)
+{
+  GabbleTubeDBus *self = GABBLE_TUBE_DBUS (user_data);
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (self);
+
+  if (priv->batch->len == 0)
+    {
+      /* Nothing has been sent for a while */
+      priv->batch_timer = 0;
+      return FALSE;
+    }
+
+  flush_batch (self);
+
+  /* Keep coalescing while messages keep coming */
+  return TRUE;
+}
+
+/* Like Nagle's algorithm: a message is sent straight away unless we sent
+ * something less than BATCH_DELAY ms ago, in which case it waits for the
+ * next messages so they're sent together. */
+static void
+send_message (GabbleTubeDBus *self,
+              const gchar *marshalled,
+              gint len)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (self);
+
+  if (!batching_enabled (self))
+    {
+      flush_batch (self);
+      gabble_bytestream_iface_send (priv->bytestream, len, marshalled);
+      return;
+    }
+
+  if (priv->batch_timer == 0)
+    {
+      gabble_bytestream_iface_send (priv->bytestream, len, marshalled);
+      priv->batch_timer = g_timeout_add (BATCH_DELAY, batch_timeout_cb, self);
+      return;
+    }
+
+  if (priv->batch->len + len > BATCH_MAX_SIZE)
+    flush_batch (self);
+
+  g_string_append_len (priv->batch, marshalled, len);
+
+  if (priv->batch->len >= BATCH_MAX_SIZE)
+    flush_batch (self);
+}
+
 static DBusHandlerResult
 filter_cb (DBusConnection *conn,
            DBusMessage *msg,
@@ -241,6 +351,9 @@ filter_cb (DBusConnection *conn,
               goto out;
             }
 
+          /* Keep messages in order */
+          flush_batch (tube);
+
           gabble_bytestream_muc_send_to (
               GABBLE_BYTESTREAM_MUC (priv->bytestream), handle, len,
               marshalled);
@@ -249,7 +362,7 @@ filter_cb (DBusConnection *conn,
         }
     }
 
-  gabble_bytestream_iface_send (priv->bytestream, len, marshalled);
+  send_message (tube, marshalled, len);
 
 out:
   if (marshalled != NULL)
@@ -328,6 +441,8 @@ gabble_tube_dbus_close (TpBaseChannel *base)
    * disappear when we finally remove the Tubes channel type.. */
   g_object_ref (base);
 
+  flush_batch (self);
+
   if (priv->bytestream != NULL)
     gabble_bytestream_iface_close (priv->bytestream, NULL);
   else
@@ -447,6 +562,9 @@ gabble_tube_dbus_init (GabbleTubeDBus *self)
       GABBLE_TYPE_TUBE_DBUS, GabbleTubeDBusPrivate);
 
   self->priv = priv;
+
+  priv->batch = g_string_new (NULL);
+  priv->batching_peers = g_hash_table_new (g_direct_hash, g_direct_equal);
 }
 
 static TpTubeChannelState
@@ -523,6 +641,14 @@ gabble_tube_dbus_dispose (GObject *object)
 
   priv->dispose_has_run = TRUE;
 
+  if (priv->batch_timer != 0)
+    {
+      g_source_remove (priv->batch_timer);
+      priv->batch_timer = 0;
+    }
+
+  flush_batch (self);
+
   if (priv->bytestream != NULL)
     gabble_bytestream_iface_close (priv->bytestream, NULL);
 
@@ -562,6 +688,7 @@ gabble_tube_dbus_dispose (GObject *object)
   tp_clear_pointer (&priv->dbus_local_name, g_free);
   tp_clear_pointer (&priv->dbus_names, g_hash_table_unref);
   tp_clear_pointer (&priv->dbus_name_to_handle, g_hash_table_unref);
+  tp_clear_pointer (&priv->batching_peers, g_hash_table_unref);
 
   if (priv->reassembly_buffer)
     g_string_free (priv->reassembly_buffer, TRUE);
@@ -580,6 +707,7 @@ gabble_tube_dbus_finalize (GObject *object)
   g_free (priv->service);
   g_hash_table_unref (priv->parameters);
   g_array_unref (priv->supported_access_controls);
+  g_string_free (priv->batch, TRUE);
 
   if (priv->muc != NULL)
     tp_external_group_mixin_finalize (object);
@@ -998,6 +1126,25 @@ gabble_tube_dbus_class_init (GabbleTubeDBusClass *gabble_tube_dbus_class)
   tp_external_group_mixin_init_dbus_properties (object_class);
 }
 
+/* Whether the <tube> node of the SI @msg has batching="true" */
+static gboolean
+si_tube_wants_batching (WockyStanza *msg)
+{
+  WockyNode *si_node, *tube_node;
+
+  si_node = wocky_node_get_child_ns (wocky_stanza_get_top_node (msg), "si",
+      NS_SI);
+  if (si_node == NULL)
+    return FALSE;
+
+  tube_node = wocky_node_get_child_ns (si_node, "tube", NS_TUBES);
+  if (tube_node == NULL)
+    return FALSE;
+
+  return !tp_strdiff (wocky_node_get_attribute (tube_node, "batching"),
+      "true");
+}
+
 static void
 bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
                          WockyStanza *msg,
@@ -1015,6 +1162,16 @@ bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
 
   /* Tube was accepted by remote user */
 
+  if (gabble_bytestream_zlib_accepted (msg))
+    {
+      DEBUG ("contact accepted to compress the bytestream");
+      bytestream = gabble_bytestream_zlib_wrap (bytestream);
+    }
+
+  if (si_tube_wants_batching (msg))
+    gabble_tube_dbus_add_batching_peer (GABBLE_TUBE_DBUS (tube),
+        tp_base_channel_get_target_handle (TP_BASE_CHANNEL (tube)));
+
   g_object_set (tube,
       "bytestream", bytestream,
       NULL);
@@ -1084,6 +1241,10 @@ gabble_tube_dbus_offer (GabbleTubeDBus *tube,
       gabble_tube_iface_publish_in_node (GABBLE_TUBE_IFACE (tube),
           base_conn, tube_node);
 
+      if (gabble_presence_resource_has_caps (presence, resource,
+            gabble_capability_set_predicate_has, NS_TUBES_ZLIB))
+        gabble_bytestream_zlib_request (tube_node);
+
       tube->priv->offered = TRUE;
       gabble_bytestream_factory_negotiate_stream (
           conn->bytestream_factory, msg, priv->stream_id,
@@ -1201,133 +1362,229 @@ unref:
 }
 
 static guint32
-collect_le32 (char *str)
+collect_le32 (const char *str)
 {
-  unsigned char *bytes = (unsigned char *) str;
+  const unsigned char *bytes = (const unsigned char *) str;
 
   return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
 }
 
 static guint32
-collect_be32 (char *str)
+collect_be32 (const char *str)
 {
-  unsigned char *bytes = (unsigned char *) str;
+  const unsigned char *bytes = (const unsigned char *) str;
 
-  return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 24) | bytes[3];
+  return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+/* Returns the size of the D-Bus message starting with the 16-byte @header,
+ * or 0 if it's invalid.
+ *
+ * Each D-Bus message has a 16-byte fixed header, in which
+ *
+ * * byte 0 is 'l' (ell) or 'B' for endianness
+ * * bytes 4-7 are body length "n" in bytes in that endianness
+ * * bytes 12-15 are length "m" of param array in bytes in that
+ *   endianness
+ *
+ * followed by m + n + ((8 - (m % 8)) % 8) bytes of other content.
+ */
+guint32
+_gabble_tube_dbus_get_message_length (const gchar *header)
+{
+  guint32 body_length, params_length, m;
+
+  if (header[0] == DBUS_BIG_ENDIAN)
+    {
+      body_length = collect_be32 (header + 4);
+      m = collect_be32 (header + 12);
+    }
+  else if (header[0] == DBUS_LITTLE_ENDIAN)
+    {
+      body_length = collect_le32 (header + 4);
+      m = collect_le32 (header + 12);
+    }
+  else
+    {
+      DEBUG ("D-Bus message has unknown endianness byte 0x%x",
+          (unsigned int) header[0]);
+      return 0;
+    }
+
+  /* pad to 8-byte boundary */
+  params_length = m + ((8 - (m % 8)) % 8);
+  g_assert (params_length % 8 == 0);
+  g_assert (params_length >= m);
+  g_assert (params_length < m + 8);
+
+  /* n.b.: this looks as if it could be simplified to just the third
+   * test, but that would be wrong if the addition had overflowed, so
+   * don't do that. The first and second tests are sufficient to
+   * ensure no overflow on 32-bit platforms */
+  if (body_length > DBUS_MAXIMUM_MESSAGE_LENGTH ||
+      params_length > DBUS_MAXIMUM_ARRAY_LENGTH ||
+      params_length + body_length + 16 > DBUS_MAXIMUM_MESSAGE_LENGTH)
+    {
+      DEBUG ("D-Bus message is too large to be valid");
+      return 0;
+    }
+
+  return params_length + body_length + 16;
+}
+
+/* Deliver every complete D-Bus message at the start of @data, straight from
+ * @data. Returns the number of bytes used, the rest being the start of an
+ * incomplete message, or -1 if the stream is invalid and the tube has been
+ * closed. */
+static gssize
+reassemble_messages (GabbleTubeDBus *tube,
+                     TpHandle sender,
+                     const gchar *data,
+                     gsize len)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (tube);
+  gsize used = 0;
+
+  while (len - used >= 16)
+    {
+      guint32 size = _gabble_tube_dbus_get_message_length (data + used);
+
+      if (size == 0)
+        {
+          DEBUG ("invalid D-Bus message, closing tube");
+          gabble_tube_iface_close ((GabbleTubeIface *) tube, TRUE);
+          return -1;
+        }
+
+      if (len - used < size)
+        {
+          /* we'll have to wait for more data */
+          priv->reassembly_bytes_needed = size;
+          DEBUG ("We need %" G_GINT32_FORMAT " bytes for the next full "
+              "message", size);
+          break;
+        }
+
+      DEBUG ("Received complete D-Bus message of size %" G_GINT32_FORMAT,
+          size);
+      message_received (tube, sender, data + used, size);
+      used += size;
+    }
+
+  return used;
+}
+
+/* Copy from @data what the message at the start of the reassembly buffer
+ * still needs. Returns FALSE if it's still incomplete or invalid, in which
+ * case everything has been used. */
+static gboolean
+complete_buffered_message (GabbleTubeDBus *tube,
+                           TpHandle sender,
+                           const gchar **data,
+                           gsize *len)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (tube);
+  GString *buf = priv->reassembly_buffer;
+  gsize take;
+
+  if (priv->reassembly_bytes_needed == 0)
+    {
+      /* We don't even have the whole header yet */
+      take = MIN (16 - buf->len, *len);
+      g_string_append_len (buf, *data, take);
+      *data += take;
+      *len -= take;
+
+      if (buf->len < 16)
+        return FALSE;
+
+      priv->reassembly_bytes_needed = _gabble_tube_dbus_get_message_length (
+          buf->str);
+      if (priv->reassembly_bytes_needed == 0)
+        {
+          DEBUG ("invalid D-Bus message, closing tube");
+          gabble_tube_iface_close ((GabbleTubeIface *) tube, TRUE);
+          return FALSE;
+        }
+    }
+
+  take = MIN (priv->reassembly_bytes_needed - buf->len, *len);
+  g_string_append_len (buf, *data, take);
+  *data += take;
+  *len -= take;
+
+  if (buf->len < priv->reassembly_bytes_needed)
+    return FALSE;
+
+  DEBUG ("Received complete D-Bus message of size %" G_GINT32_FORMAT,
+      priv->reassembly_bytes_needed);
+  message_received (tube, sender, buf->str, buf->len);
+
+  g_string_truncate (buf, 0);
+  priv->reassembly_bytes_needed = 0;
+  return TRUE;
 }
 
 static void
 data_received_cb (GabbleBytestreamIface *stream,
                   TpHandle sender,
-                  GString *data,
+                  GBytes *data,
                   gpointer user_data)
 {
   GabbleTubeDBus *tube = GABBLE_TUBE_DBUS (user_data);
   GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (tube);
   TpBaseChannel *base = TP_BASE_CHANNEL (tube);
   TpBaseChannelClass *cls = TP_BASE_CHANNEL_GET_CLASS (base);
+  gsize len;
+  const gchar *str = g_bytes_get_data (data, &len);
 
   if (cls->target_handle_type == TP_HANDLE_TYPE_CONTACT)
     {
       GString *buf = priv->reassembly_buffer;
+      gssize used;
 
       g_assert (buf != NULL);
 
-      g_string_append_len (buf, data->str, data->len);
-      DEBUG ("Received %" G_GSIZE_FORMAT " bytes, so we now have %"
-          G_GSIZE_FORMAT " bytes in reassembly buffer", data->len, buf->len);
-
-      /* Each D-Bus message has a 16-byte fixed header, in which
-       *
-       * * byte 0 is 'l' (ell) or 'B' for endianness
-       * * bytes 4-7 are body length "n" in bytes in that endianness
-       * * bytes 12-15 are length "m" of param array in bytes in that
-       *   endianness
-       *
-       * followed by m + n + ((8 - (m % 8)) % 8) bytes of other content.
-       */
-
-      while (buf->len >= 16)
-        {
-          guint32 body_length, params_length, m;
+      DEBUG ("Received %" G_GSIZE_FORMAT " bytes, %" G_GSIZE_FORMAT
+          " bytes were already in reassembly buffer", len, buf->len);
 
-          /* see if we have a whole message and have already calculated
-           * how many bytes it needs */
+      /* Messages are parsed straight from the received block; only a
+       * message spanning several blocks is copied */
+      if (buf->len > 0 &&
+          !complete_buffered_message (tube, sender, &str, &len))
+        return;
 
-          if (priv->reassembly_bytes_needed != 0)
-            {
-              if (buf->len >= priv->reassembly_bytes_needed)
-                {
-                  DEBUG ("Received complete D-Bus message of size %"
-                      G_GINT32_FORMAT, priv->reassembly_bytes_needed);
-                  message_received (tube, sender, buf->str,
-                      priv->reassembly_bytes_needed);
-                  g_string_erase (buf, 0, priv->reassembly_bytes_needed);
-                  priv->reassembly_bytes_needed = 0;
-                }
-              else
-                {
-                  /* we'll have to wait for more data */
-                  break;
-                }
-            }
+      used = reassemble_messages (tube, sender, str, len);
+      if (used < 0)
+        return;
 
-          if (buf->len < 16)
-            break;
+      g_string_append_len (buf, str + used, len - used);
+    }
+  else
+    {
+      /* MUC bytestreams are message-boundary preserving, which is necessary,
+       * because we can't assume we started at the beginning. A sender can
+       * batch several D-Bus messages in one MUC message. */
+      g_assert (GABBLE_IS_BYTESTREAM_MUC (priv->bytestream));
 
-          /* work out how big the next message is going to be */
+      while (len > 0)
+        {
+          guint32 size = 0;
 
-          if (buf->str[0] == DBUS_BIG_ENDIAN)
-            {
-              body_length = collect_be32 (buf->str + 4);
-              m = collect_be32 (buf->str + 12);
-            }
-          else if (buf->str[0] == DBUS_LITTLE_ENDIAN)
-            {
-              body_length = collect_le32 (buf->str + 4);
-              m = collect_le32 (buf->str + 12);
-            }
-          else
-            {
-              DEBUG ("D-Bus message has unknown endianness byte 0x%x, "
-                  "closing tube", (unsigned int) buf->str[0]);
-              gabble_tube_iface_close ((GabbleTubeIface *) tube, TRUE);
-              return;
-            }
+          if (len >= 16)
+            size = _gabble_tube_dbus_get_message_length (str);
 
-          /* pad to 8-byte boundary */
-          params_length = m + ((8 - (m % 8)) % 8);
-          g_assert (params_length % 8 == 0);
-          g_assert (params_length >= m);
-          g_assert (params_length < m + 8);
-
-          priv->reassembly_bytes_needed = params_length + body_length + 16;
-
-          /* n.b.: this looks as if it could be simplified to just the third
-           * test, but that would be wrong if the addition had overflowed, so
-           * don't do that. The first and second tests are sufficient to
-           * ensure no overflow on 32-bit platforms */
-          if (body_length > DBUS_MAXIMUM_MESSAGE_LENGTH ||
-              params_length > DBUS_MAXIMUM_ARRAY_LENGTH ||
-              priv->reassembly_bytes_needed > DBUS_MAXIMUM_MESSAGE_LENGTH)
+          if (size == 0 || size > len)
             {
-              DEBUG ("D-Bus message is too large to be valid, closing tube");
-              gabble_tube_iface_close ((GabbleTubeIface *) tube, TRUE);
-              return;
+              /* let libdbus complain about it */
+              size = len;
             }
 
-          g_assert (priv->reassembly_bytes_needed != 0);
-          DEBUG ("We need %" G_GINT32_FORMAT " bytes for the next full "
-              "message", priv->reassembly_bytes_needed);
+          message_received (tube, sender, str, size);
+          str += size;
+          len -= size;
         }
     }
-  else
-    {
-      /* MUC bytestreams are message-boundary preserving, which is necessary,
-       * because we can't assume we started at the beginning */
-      g_assert (GABBLE_IS_BYTESTREAM_MUC (priv->bytestream));
-      message_received (tube, sender, data->str, data->len);
-    }
 }
 
 GabbleTubeDBus *
@@ -1373,7 +1630,12 @@ static void
 augment_si_accept_iq (WockyNode *si,
                       gpointer user_data)
 {
-  wocky_node_add_child_ns (si, "tube", NS_TUBES);
+  WockyNode *tube_node;
+
+  tube_node = wocky_node_add_child_ns (si, "tube", NS_TUBES);
+
+  /* We can receive several D-Bus messages in one write */
+  wocky_node_set_attribute (tube_node, "batching", "true");
 }
 
 /*
@@ -1544,6 +1806,7 @@ gabble_tube_dbus_remove_name (GabbleTubeDBus *self,
 
   g_hash_table_remove (priv->dbus_name_to_handle, name);
   g_hash_table_remove (priv->dbus_names, GUINT_TO_POINTER (handle));
+  g_hash_table_remove (priv->batching_peers, GUINT_TO_POINTER (handle));
 
   g_assert (g_hash_table_size (priv->dbus_names) ==
       g_hash_table_size (priv->dbus_name_to_handle));
@@ -1562,6 +1825,17 @@ gabble_tube_dbus_remove_name (GabbleTubeDBus *self,
   return TRUE;
 }
 
+/* @handle announced, in its MUC presence or in the SI negotiating the
+ * bytestream, that it can receive several D-Bus messages in one write */
+void
+gabble_tube_dbus_add_batching_peer (GabbleTubeDBus *self,
+                                    TpHandle handle)
+{
+  GabbleTubeDBusPrivate *priv = GABBLE_TUBE_DBUS_GET_PRIVATE (self);
+
+  g_hash_table_add (priv->batching_peers, GUINT_TO_POINTER (handle));
+}
+
 gboolean
 gabble_tube_dbus_handle_in_names (GabbleTubeDBus *self,
                                   TpHandle handle)
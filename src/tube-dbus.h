@@ -79,6 +79,9 @@ gboolean gabble_tube_dbus_add_name (GabbleTubeDBus *tube, TpHandle handle,
 
 gboolean gabble_tube_dbus_remove_name (GabbleTubeDBus *tube, TpHandle handle);
 
+void gabble_tube_dbus_add_batching_peer (GabbleTubeDBus *tube,
+    TpHandle handle);
+
 gboolean gabble_tube_dbus_handle_in_names (GabbleTubeDBus *tube,
     TpHandle handle);
 
@@ -89,6 +92,9 @@ const gchar * const * gabble_tube_dbus_channel_get_allowed_properties (void);
 /* Only extern for the benefit of tests/test-dtube-unique-names.c */
 gchar *_gabble_generate_dbus_unique_name (const gchar *nick);
 
+/* Only extern for the benefit of tests/test-dtube-message-length.c */
+guint32 _gabble_tube_dbus_get_message_length (const gchar *header);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_TUBE_DBUS_H__ */
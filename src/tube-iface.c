@@ -194,6 +194,10 @@ gabble_tube_iface_publish_in_node (GabbleTubeIface *tube,
           if (name != NULL)
             wocky_node_set_attribute (node, "dbus-name", name);
 
+          /* We can receive several D-Bus messages in one MUC message or
+           * bytestream write */
+          wocky_node_set_attribute (node, "batching", "true");
+
           g_free (name);
           g_free (stream_id);
         }
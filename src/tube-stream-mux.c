@@ -0,0 +1,938 @@
+/*
+ * tube-stream-mux.c - Source for GabbleTubeStreamMux
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Carries several connections of a stream tube (channels) over one
+ * bytestream. The bytestream data is a sequence of frames:
+ *
+ *   type (1 byte) | channel ID (4 bytes) | payload length (2 bytes) | payload
+ *
+ * (integers are big endian). Only the side accepting connections from local
+ * applications opens channels, so channel IDs can't collide.
+ *
+ * Each channel has its own flow control: a side can't send more than
+ * CHANNEL_WINDOW bytes on a channel before the other side grants it more
+ * with a WINDOW frame, which it does once the data has been written to the
+ * local socket. So a slow application only stops its own connection and
+ * never the shared bytestream. A peer sending more than it has been granted
+ * gets the whole bytestream closed.
+ */
+
+#include "config.h"
+#include "tube-stream-mux.h"
+
+#include <string.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#define DEBUG_FLAG GABBLE_DEBUG_TUBES
+
+#include "debug.h"
+#include "gabble-signals-marshal.h"
+
+G_DEFINE_TYPE (GabbleTubeStreamMux, gabble_tube_stream_mux, G_TYPE_OBJECT);
+
+/* signals */
+enum
+{
+  NEW_CHANNEL,
+  CHANNEL_CLOSED,
+  CLOSED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = {0};
+
+/* properties */
+enum
+{
+  PROP_BYTESTREAM = 1,
+  LAST_PROPERTY
+};
+
+enum _FrameType
+{
+  /* Opens a new channel */
+  FRAME_OPEN = 1,
+  FRAME_DATA,
+  /* The connection of the sender has been closed */
+  FRAME_CLOSE,
+  /* The payload is the number of bytes (32 bits) the receiver of the frame
+   * can send on the channel in addition */
+  FRAME_WINDOW
+};
+
+typedef enum _FrameType FrameType;
+
+#define FRAME_HEADER_LENGTH 7
+#define MAX_FRAME_PAYLOAD 16384
+/* How many bytes we can send on a channel without being granted more */
+#define CHANNEL_WINDOW (256 * 1024)
+
+struct _GabbleTubeStreamMuxPrivate
+{
+  GabbleBytestreamIface *bytestream;
+  /* TRUE once the bytestream is open */
+  gboolean open;
+  gboolean write_blocked;
+  /* Frames sent before the bytestream is open */
+  GString *pending_output;
+  GString *read_buffer;
+
+  /* guint -> owned MuxChannel */
+  GHashTable *channels;
+  guint last_channel_id;
+
+  /* TRUE once the bytestream is closed */
+  gboolean closed;
+  gboolean dispose_has_run;
+};
+
+#define GABBLE_TUBE_STREAM_MUX_GET_PRIVATE(obj) ((obj)->priv)
+
+struct _MuxChannel
+{
+  GabbleTubeStreamMux *mux;
+  guint id;
+  GibberTransport *transport;
+  /* How many bytes we can still send before the peer grants us more */
+  gint64 send_credit;
+  /* Data read from the transport beyond send_credit, sent once the peer
+   * grants us more; we stop reading in the meantime */
+  GString *unsent;
+  /* How many bytes the peer can still send before we grant it more */
+  gint64 recv_credit;
+  /* Bytes written to the transport that we didn't grant back yet */
+  guint32 consumed;
+  /* Data received while the transport is still connecting */
+  GString *pending_input;
+  /* TRUE if the peer closed its side of the channel */
+  gboolean got_close;
+  /* TRUE if the transport has been disconnected while there is still
+   * unsent data: the channel is closed once it has been sent */
+  gboolean disconnected;
+};
+typedef struct _MuxChannel MuxChannel;
+
+static void transport_handler (GibberTransport *transport,
+    GibberBuffer *data, gpointer user_data);
+static void transport_connected_cb (GibberTransport *transport,
+    MuxChannel *channel);
+static void transport_disconnected_cb (GibberTransport *transport,
+    MuxChannel *channel);
+static void transport_buffer_empty_cb (GibberTransport *transport,
+    MuxChannel *channel);
+
+static void
+mux_channel_free (MuxChannel *channel)
+{
+  gibber_transport_set_handler (channel->transport, NULL, NULL);
+  g_signal_handlers_disconnect_matched (channel->transport,
+      G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, channel);
+  g_object_unref (channel->transport);
+
+  if (channel->pending_input != NULL)
+    g_string_free (channel->pending_input, TRUE);
+
+  if (channel->unsent != NULL)
+    g_string_free (channel->unsent, TRUE);
+
+  g_slice_free (MuxChannel, channel);
+}
+
+static void
+gabble_tube_stream_mux_init (GabbleTubeStreamMux *self)
+{
+  GabbleTubeStreamMuxPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GABBLE_TYPE_TUBE_STREAM_MUX, GabbleTubeStreamMuxPrivate);
+
+  self->priv = priv;
+
+  priv->pending_output = g_string_new (NULL);
+  priv->read_buffer = g_string_new (NULL);
+  priv->channels = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, (GDestroyNotify) mux_channel_free);
+}
+
+static void
+gabble_tube_stream_mux_dispose (GObject *object)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (object);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  gabble_tube_stream_mux_close (self);
+
+  g_signal_handlers_disconnect_matched (priv->bytestream, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, self);
+  tp_clear_object (&priv->bytestream);
+
+  G_OBJECT_CLASS (gabble_tube_stream_mux_parent_class)->dispose (object);
+}
+
+static void
+gabble_tube_stream_mux_finalize (GObject *object)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (object);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  g_hash_table_unref (priv->channels);
+  g_string_free (priv->pending_output, TRUE);
+  g_string_free (priv->read_buffer, TRUE);
+
+  G_OBJECT_CLASS (gabble_tube_stream_mux_parent_class)->finalize (object);
+}
+
+static void
+gabble_tube_stream_mux_get_property (GObject *object,
+                                     guint property_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (object);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_BYTESTREAM:
+        g_value_set_object (value, priv->bytestream);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void
+gabble_tube_stream_mux_set_property (GObject *object,
+                                     guint property_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (object);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  switch (property_id)
+    {
+      case PROP_BYTESTREAM:
+        priv->bytestream = g_value_dup_object (value);
+        break;
+      default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+
+static void bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+    GabbleBytestreamState state, gpointer user_data);
+static void bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+    TpHandle sender, GBytes *data, gpointer user_data);
+static void bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+    gboolean blocked, gpointer user_data);
+
+static void
+gabble_tube_stream_mux_constructed (GObject *object)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (object);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  GabbleBytestreamState state;
+
+  if (G_OBJECT_CLASS (gabble_tube_stream_mux_parent_class)->constructed)
+    G_OBJECT_CLASS (gabble_tube_stream_mux_parent_class)->constructed (object);
+
+  g_assert (priv->bytestream != NULL);
+
+  g_signal_connect (priv->bytestream, "state-changed",
+      G_CALLBACK (bytestream_state_changed_cb), self);
+  g_signal_connect (priv->bytestream, "data-received",
+      G_CALLBACK (bytestream_data_received_cb), self);
+  g_signal_connect (priv->bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+
+  g_object_get (priv->bytestream, "state", &state, NULL);
+  priv->open = (state == GABBLE_BYTESTREAM_STATE_OPEN);
+}
+
+static void
+gabble_tube_stream_mux_class_init (
+    GabbleTubeStreamMuxClass *gabble_tube_stream_mux_class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (gabble_tube_stream_mux_class);
+  GParamSpec *param_spec;
+
+  g_type_class_add_private (gabble_tube_stream_mux_class,
+      sizeof (GabbleTubeStreamMuxPrivate));
+
+  object_class->dispose = gabble_tube_stream_mux_dispose;
+  object_class->finalize = gabble_tube_stream_mux_finalize;
+  object_class->get_property = gabble_tube_stream_mux_get_property;
+  object_class->set_property = gabble_tube_stream_mux_set_property;
+  object_class->constructed = gabble_tube_stream_mux_constructed;
+
+  param_spec = g_param_spec_object (
+      "bytestream",
+      "GabbleBytestreamIface object",
+      "The bytestream carrying the channels",
+      GABBLE_TYPE_BYTESTREAM_IFACE,
+      G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_BYTESTREAM, param_spec);
+
+  /* (guint channel_id): the peer opened a channel. The handler is expected
+   * to call gabble_tube_stream_mux_add_channel () or the channel is
+   * refused. */
+  signals[NEW_CHANNEL] =
+    g_signal_new ("new-channel",
+                  G_OBJECT_CLASS_TYPE (gabble_tube_stream_mux_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__UINT,
+                  G_TYPE_NONE, 1, G_TYPE_UINT);
+
+  /* (GibberTransport *transport, gboolean remotely) */
+  signals[CHANNEL_CLOSED] =
+    g_signal_new ("channel-closed",
+                  G_OBJECT_CLASS_TYPE (gabble_tube_stream_mux_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  gabble_marshal_VOID__OBJECT_BOOLEAN,
+                  G_TYPE_NONE, 2, GIBBER_TYPE_TRANSPORT, G_TYPE_BOOLEAN);
+
+  /* The bytestream has been closed, and all the channels with it */
+  signals[CLOSED] =
+    g_signal_new ("closed",
+                  G_OBJECT_CLASS_TYPE (gabble_tube_stream_mux_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+}
+
+static void
+send_frame (GabbleTubeStreamMux *self,
+            FrameType type,
+            guint id,
+            const guint8 *payload,
+            guint16 len)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  guint8 header[FRAME_HEADER_LENGTH];
+  gchar *frame;
+
+  if (priv->closed)
+    return;
+
+  header[0] = type;
+  header[1] = (id >> 24) & 0xff;
+  header[2] = (id >> 16) & 0xff;
+  header[3] = (id >> 8) & 0xff;
+  header[4] = id & 0xff;
+  header[5] = (len >> 8) & 0xff;
+  header[6] = len & 0xff;
+
+  if (!priv->open)
+    {
+      g_string_append_len (priv->pending_output, (const gchar *) header,
+          FRAME_HEADER_LENGTH);
+      g_string_append_len (priv->pending_output, (const gchar *) payload,
+          len);
+      return;
+    }
+
+  frame = g_malloc (FRAME_HEADER_LENGTH + len);
+  memcpy (frame, header, FRAME_HEADER_LENGTH);
+  if (len > 0)
+    memcpy (frame + FRAME_HEADER_LENGTH, payload, len);
+
+  gabble_bytestream_iface_send (priv->bytestream, FRAME_HEADER_LENGTH + len,
+      frame);
+  g_free (frame);
+}
+
+static void
+channel_update_blocking (MuxChannel *channel)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (
+      channel->mux);
+
+  if (channel->disconnected)
+    return;
+
+  gibber_transport_block_receiving (channel->transport,
+      !priv->open || priv->write_blocked || channel->send_credit <= 0 ||
+      channel->got_close);
+}
+
+static void
+update_all_blocking (GabbleTubeStreamMux *self)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, priv->channels);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    channel_update_blocking (value);
+}
+
+/* Let the peer send again what we wrote to the transport */
+static void
+channel_grant (MuxChannel *channel,
+               gboolean force)
+{
+  guint8 payload[4];
+
+  if (channel->consumed == 0)
+    return;
+
+  /* Don't send a frame for each chunk */
+  if (!force && channel->consumed < CHANNEL_WINDOW / 2)
+    return;
+
+  payload[0] = (channel->consumed >> 24) & 0xff;
+  payload[1] = (channel->consumed >> 16) & 0xff;
+  payload[2] = (channel->consumed >> 8) & 0xff;
+  payload[3] = channel->consumed & 0xff;
+
+  send_frame (channel->mux, FRAME_WINDOW, channel->id, payload, 4);
+  channel->recv_credit += channel->consumed;
+  channel->consumed = 0;
+}
+
+/* Send as much of @data as the peer lets us, and keep the rest for when it
+ * grants us more */
+static void
+channel_send (MuxChannel *channel,
+              const guint8 *data,
+              gsize len)
+{
+  gsize sendable = MIN (len, (gsize) MAX (channel->send_credit, 0));
+  gsize offset;
+
+  for (offset = 0; offset < sendable; offset += MAX_FRAME_PAYLOAD)
+    send_frame (channel->mux, FRAME_DATA, channel->id, data + offset,
+        MIN (sendable - offset, MAX_FRAME_PAYLOAD));
+  channel->send_credit -= sendable;
+
+  if (sendable == len)
+    return;
+
+  if (channel->unsent == NULL)
+    channel->unsent = g_string_new (NULL);
+
+  g_string_append_len (channel->unsent, (const gchar *) data + sendable,
+      len - sendable);
+}
+
+static void
+transport_handler (GibberTransport *transport,
+                   GibberBuffer *data,
+                   gpointer user_data)
+{
+  MuxChannel *channel = user_data;
+
+  if (channel->unsent != NULL)
+    /* Keep the data in order */
+    g_string_append_len (channel->unsent, (const gchar *) data->data,
+        data->length);
+  else
+    channel_send (channel, data->data, data->length);
+
+  channel_update_blocking (channel);
+}
+
+static void
+remove_channel (GabbleTubeStreamMux *self,
+                MuxChannel *channel,
+                gboolean remotely)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  GibberTransport *transport = g_object_ref (channel->transport);
+
+  DEBUG ("channel %u closed %s", channel->id,
+      remotely ? "remotely" : "locally");
+
+  g_hash_table_remove (priv->channels, GUINT_TO_POINTER (channel->id));
+
+  g_signal_emit (self, signals[CHANNEL_CLOSED], 0, transport, remotely);
+  g_object_unref (transport);
+}
+
+static void
+transport_disconnected_cb (GibberTransport *transport,
+                           MuxChannel *channel)
+{
+  GabbleTubeStreamMux *self = channel->mux;
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  gboolean remotely = channel->got_close || priv->closed;
+
+  if (!remotely && channel->unsent != NULL)
+    {
+      DEBUG ("channel %u disconnected; wait for the peer to let us send "
+          "what is left", channel->id);
+      channel->disconnected = TRUE;
+      return;
+    }
+
+  if (!remotely)
+    send_frame (self, FRAME_CLOSE, channel->id, NULL, 0);
+
+  remove_channel (self, channel, remotely);
+}
+
+static void
+transport_buffer_empty_cb (GibberTransport *transport,
+                           MuxChannel *channel)
+{
+  if (channel->got_close)
+    {
+      DEBUG ("everything has been written; closing channel %u",
+          channel->id);
+      gibber_transport_disconnect (transport);
+      return;
+    }
+
+  channel_grant (channel, TRUE);
+}
+
+static void
+channel_write (MuxChannel *channel,
+               const gchar *data,
+               gsize len)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (
+      channel->mux);
+  GError *error = NULL;
+  guint id = channel->id;
+
+  if (gibber_transport_get_state (channel->transport) !=
+      GIBBER_TRANSPORT_CONNECTED)
+    {
+      if (channel->pending_input == NULL)
+        channel->pending_input = g_string_new (NULL);
+
+      g_string_append_len (channel->pending_input, data, len);
+      return;
+    }
+
+  if (!gibber_transport_send (channel->transport, (const guint8 *) data, len,
+        &error))
+    {
+      DEBUG ("sending failed on channel %u: %s", id, error->message);
+      g_error_free (error);
+    }
+
+  /* Sending can disconnect the transport and so remove the channel */
+  if (g_hash_table_lookup (priv->channels, GUINT_TO_POINTER (id)) != channel)
+    return;
+
+  channel->consumed += len;
+
+  /* If the application doesn't read fast enough, only grant the peer more
+   * once the buffer has been drained */
+  if (!gibber_transport_buffer_is_full (channel->transport))
+    channel_grant (channel, FALSE);
+}
+
+static void
+transport_connected_cb (GibberTransport *transport,
+                        MuxChannel *channel)
+{
+  GString *pending = channel->pending_input;
+
+  channel_update_blocking (channel);
+
+  if (pending == NULL)
+    return;
+
+  channel->pending_input = NULL;
+  channel_write (channel, pending->str, pending->len);
+  g_string_free (pending, TRUE);
+}
+
+static MuxChannel *
+add_channel (GabbleTubeStreamMux *self,
+             guint id,
+             GibberTransport *transport)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  MuxChannel *channel = g_slice_new0 (MuxChannel);
+
+  channel->mux = self;
+  channel->id = id;
+  channel->transport = g_object_ref (transport);
+  channel->send_credit = CHANNEL_WINDOW;
+  channel->recv_credit = CHANNEL_WINDOW;
+
+  g_hash_table_insert (priv->channels, GUINT_TO_POINTER (id), channel);
+
+  gibber_transport_set_handler (transport, transport_handler, channel);
+
+  g_signal_connect (transport, "connected",
+      G_CALLBACK (transport_connected_cb), channel);
+  g_signal_connect (transport, "disconnected",
+      G_CALLBACK (transport_disconnected_cb), channel);
+  g_signal_connect (transport, "buffer-empty",
+      G_CALLBACK (transport_buffer_empty_cb), channel);
+
+  channel_update_blocking (channel);
+
+  return channel;
+}
+
+static void close_channels (GabbleTubeStreamMux *self, gboolean notify);
+
+/* The peer doesn't follow the protocol: give up on the whole bytestream */
+static void
+close_on_error (GabbleTubeStreamMux *self)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  priv->closed = TRUE;
+
+  g_object_ref (self);
+  close_channels (self, TRUE);
+  gabble_bytestream_iface_close (priv->bytestream, NULL);
+  g_signal_emit (self, signals[CLOSED], 0);
+  g_object_unref (self);
+}
+
+static void
+handle_frame (GabbleTubeStreamMux *self,
+              FrameType type,
+              guint id,
+              const gchar *payload,
+              guint16 len)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  MuxChannel *channel;
+
+  channel = g_hash_table_lookup (priv->channels, GUINT_TO_POINTER (id));
+
+  switch (type)
+    {
+      case FRAME_OPEN:
+        if (channel != NULL || id == 0)
+          {
+            DEBUG ("peer opened channel %u twice; ignoring", id);
+            return;
+          }
+
+        DEBUG ("peer opened channel %u", id);
+        g_signal_emit (self, signals[NEW_CHANNEL], 0, id);
+
+        if (g_hash_table_lookup (priv->channels, GUINT_TO_POINTER (id)) == NULL)
+          {
+            DEBUG ("channel %u has been refused", id);
+            send_frame (self, FRAME_CLOSE, id, NULL, 0);
+          }
+        break;
+
+      case FRAME_DATA:
+        if (channel == NULL || channel->got_close || channel->disconnected)
+          {
+            /* The channel has just been closed */
+            DEBUG ("ignoring data received on closed channel %u", id);
+            return;
+          }
+
+        if (len > channel->recv_credit)
+          {
+            DEBUG ("peer sent %u bytes on channel %u but was only granted "
+                "%" G_GINT64_FORMAT "; closing", len, id,
+                channel->recv_credit);
+            close_on_error (self);
+            return;
+          }
+
+        channel->recv_credit -= len;
+        channel_write (channel, payload, len);
+        break;
+
+      case FRAME_CLOSE:
+        if (channel == NULL)
+          return;
+
+        channel->got_close = TRUE;
+        channel_update_blocking (channel);
+
+        if (channel->pending_input != NULL ||
+            !gibber_transport_buffer_is_empty (channel->transport))
+          {
+            DEBUG ("peer closed channel %u; wait for the buffer to be "
+                "empty", id);
+            return;
+          }
+
+        DEBUG ("peer closed channel %u", id);
+        gibber_transport_disconnect (channel->transport);
+        break;
+
+      case FRAME_WINDOW:
+        if (channel == NULL)
+          return;
+
+        if (len != 4)
+          {
+            DEBUG ("invalid window frame on channel %u", id);
+            return;
+          }
+
+        channel->send_credit += ((guint8) payload[0] << 24) |
+            ((guint8) payload[1] << 16) | ((guint8) payload[2] << 8) |
+            (guint8) payload[3];
+
+        if (channel->unsent != NULL)
+          {
+            GString *unsent = channel->unsent;
+
+            channel->unsent = NULL;
+            channel_send (channel, (const guint8 *) unsent->str,
+                unsent->len);
+            g_string_free (unsent, TRUE);
+          }
+
+        if (channel->disconnected && channel->unsent == NULL)
+          {
+            send_frame (self, FRAME_CLOSE, id, NULL, 0);
+            remove_channel (self, channel, FALSE);
+            return;
+          }
+
+        channel_update_blocking (channel);
+        break;
+
+      default:
+        DEBUG ("unknown frame type %u; ignoring", type);
+    }
+}
+
+static void
+bytestream_data_received_cb (GabbleBytestreamIface *bytestream,
+                             TpHandle sender,
+                             GBytes *data,
+                             gpointer user_data)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (user_data);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  gsize offset = 0;
+  gsize len;
+  const gchar *buf = g_bytes_get_data (data, &len);
+
+  g_string_append_len (priv->read_buffer, buf, len);
+
+  /* A frame can make the tube close us */
+  g_object_ref (self);
+
+  while (!priv->closed &&
+      priv->read_buffer->len - offset >= FRAME_HEADER_LENGTH)
+    {
+      const guint8 *header = (const guint8 *) priv->read_buffer->str + offset;
+      guint id;
+      guint16 payload_len;
+
+      id = (header[1] << 24) | (header[2] << 16) | (header[3] << 8) |
+          header[4];
+      payload_len = (header[5] << 8) | header[6];
+
+      if (priv->read_buffer->len - offset < FRAME_HEADER_LENGTH + payload_len)
+        /* Wait for the rest of the frame */
+        break;
+
+      handle_frame (self, header[0], id,
+          priv->read_buffer->str + offset + FRAME_HEADER_LENGTH, payload_len);
+
+      offset += FRAME_HEADER_LENGTH + payload_len;
+    }
+
+  g_string_erase (priv->read_buffer, 0, offset);
+
+  g_object_unref (self);
+}
+
+static void
+bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
+                             gboolean blocked,
+                             gpointer user_data)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (user_data);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  priv->write_blocked = blocked;
+  update_all_blocking (self);
+}
+
+/* Disconnect the transports of all the channels. If @notify is FALSE,
+ * channel-closed is not emitted. */
+static void
+close_channels (GabbleTubeStreamMux *self,
+                gboolean notify)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  GList *ids, *l;
+
+  /* Look channels up again as closing one can close others */
+  ids = g_hash_table_get_keys (priv->channels);
+  for (l = ids; l != NULL; l = g_list_next (l))
+    {
+      MuxChannel *channel = g_hash_table_lookup (priv->channels, l->data);
+      GibberTransport *transport;
+
+      if (channel == NULL)
+        continue;
+
+      if (channel->disconnected)
+        {
+          /* Only waiting to send what it had left */
+          if (notify)
+            remove_channel (self, channel, FALSE);
+          else
+            g_hash_table_remove (priv->channels, l->data);
+
+          continue;
+        }
+
+      transport = g_object_ref (channel->transport);
+
+      /* Otherwise transport_disconnected_cb will remove it */
+      if (!notify)
+        g_hash_table_remove (priv->channels, l->data);
+
+      gibber_transport_disconnect (transport);
+      g_object_unref (transport);
+    }
+  g_list_free (ids);
+}
+
+static void
+bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+                             GabbleBytestreamState state,
+                             gpointer user_data)
+{
+  GabbleTubeStreamMux *self = GABBLE_TUBE_STREAM_MUX (user_data);
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  if (state == GABBLE_BYTESTREAM_STATE_OPEN && !priv->open)
+    {
+      DEBUG ("multiplexed bytestream is open");
+      priv->open = TRUE;
+
+      if (priv->pending_output->len > 0)
+        {
+          gabble_bytestream_iface_send (priv->bytestream,
+              priv->pending_output->len, priv->pending_output->str);
+          g_string_truncate (priv->pending_output, 0);
+        }
+
+      update_all_blocking (self);
+    }
+  else if (state == GABBLE_BYTESTREAM_STATE_CLOSED && !priv->closed)
+    {
+      DEBUG ("multiplexed bytestream has been closed");
+      priv->closed = TRUE;
+
+      g_object_ref (self);
+      close_channels (self, TRUE);
+      g_signal_emit (self, signals[CLOSED], 0);
+      g_object_unref (self);
+    }
+}
+
+/*
+ * gabble_tube_stream_mux_new
+ *
+ * @bytestream: the bytestream used to carry the channels. Data is buffered
+ * until it's open.
+ */
+GabbleTubeStreamMux *
+gabble_tube_stream_mux_new (GabbleBytestreamIface *bytestream)
+{
+  return g_object_new (GABBLE_TYPE_TUBE_STREAM_MUX,
+      "bytestream", bytestream,
+      NULL);
+}
+
+/*
+ * gabble_tube_stream_mux_open_channel
+ *
+ * Relay @transport through a new channel. Returns the ID of the channel.
+ */
+guint
+gabble_tube_stream_mux_open_channel (GabbleTubeStreamMux *self,
+                                     GibberTransport *transport)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+  guint id;
+
+  g_return_val_if_fail (!priv->closed, 0);
+
+  id = ++priv->last_channel_id;
+
+  DEBUG ("opening channel %u", id);
+
+  send_frame (self, FRAME_OPEN, id, NULL, 0);
+  add_channel (self, id, transport);
+
+  return id;
+}
+
+/*
+ * gabble_tube_stream_mux_add_channel
+ *
+ * Relay @transport through the channel @channel_id opened by the peer. To be
+ * called from the new-channel signal. @transport doesn't have to be
+ * connected yet.
+ */
+void
+gabble_tube_stream_mux_add_channel (GabbleTubeStreamMux *self,
+                                    guint channel_id,
+                                    GibberTransport *transport)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  g_return_if_fail (g_hash_table_lookup (priv->channels,
+        GUINT_TO_POINTER (channel_id)) == NULL);
+
+  add_channel (self, channel_id, transport);
+}
+
+/*
+ * gabble_tube_stream_mux_close
+ *
+ * Disconnect all the channels, without emitting channel-closed, and close the
+ * bytestream.
+ */
+void
+gabble_tube_stream_mux_close (GabbleTubeStreamMux *self)
+{
+  GabbleTubeStreamMuxPrivate *priv = GABBLE_TUBE_STREAM_MUX_GET_PRIVATE (self);
+
+  if (priv->closed)
+    return;
+
+  priv->closed = TRUE;
+
+  close_channels (self, FALSE);
+  gabble_bytestream_iface_close (priv->bytestream, NULL);
+}
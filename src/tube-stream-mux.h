@@ -0,0 +1,77 @@
+/*
+ * tube-stream-mux.h - Header for GabbleTubeStreamMux
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GABBLE_TUBE_STREAM_MUX_H__
+#define __GABBLE_TUBE_STREAM_MUX_H__
+
+#include <glib-object.h>
+
+#include <gibber/gibber-transport.h>
+
+#include "bytestream-iface.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GabbleTubeStreamMux GabbleTubeStreamMux;
+typedef struct _GabbleTubeStreamMuxClass GabbleTubeStreamMuxClass;
+typedef struct _GabbleTubeStreamMuxPrivate GabbleTubeStreamMuxPrivate;
+
+struct _GabbleTubeStreamMuxClass {
+  GObjectClass parent_class;
+};
+
+struct _GabbleTubeStreamMux {
+  GObject parent;
+
+  GabbleTubeStreamMuxPrivate *priv;
+};
+
+GType gabble_tube_stream_mux_get_type (void);
+
+/* TYPE MACROS */
+#define GABBLE_TYPE_TUBE_STREAM_MUX \
+  (gabble_tube_stream_mux_get_type ())
+#define GABBLE_TUBE_STREAM_MUX(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GABBLE_TYPE_TUBE_STREAM_MUX,\
+                              GabbleTubeStreamMux))
+#define GABBLE_TUBE_STREAM_MUX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GABBLE_TYPE_TUBE_STREAM_MUX,\
+                           GabbleTubeStreamMuxClass))
+#define GABBLE_IS_TUBE_STREAM_MUX(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GABBLE_TYPE_TUBE_STREAM_MUX))
+#define GABBLE_IS_TUBE_STREAM_MUX_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GABBLE_TYPE_TUBE_STREAM_MUX))
+#define GABBLE_TUBE_STREAM_MUX_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GABBLE_TYPE_TUBE_STREAM_MUX,\
+                              GabbleTubeStreamMuxClass))
+
+GabbleTubeStreamMux *gabble_tube_stream_mux_new (
+    GabbleBytestreamIface *bytestream);
+
+guint gabble_tube_stream_mux_open_channel (GabbleTubeStreamMux *self,
+    GibberTransport *transport);
+
+void gabble_tube_stream_mux_add_channel (GabbleTubeStreamMux *self,
+    guint channel_id, GibberTransport *transport);
+
+void gabble_tube_stream_mux_close (GabbleTubeStreamMux *self);
+
+G_END_DECLS
+
+#endif /* #ifndef __GABBLE_TUBE_STREAM_MUX_H__ */
@@ -47,6 +47,7 @@
 
 #include "bytestream-factory.h"
 #include "bytestream-iface.h"
+#include "bytestream-zlib.h"
 #include "connection.h"
 #include "debug.h"
 #include "disco.h"
@@ -57,6 +58,7 @@
 #include "presence-cache.h"
 #include "presence.h"
 #include "tube-iface.h"
+#include "tube-stream-mux.h"
 #include "util.h"
 
 static void tube_iface_init (gpointer g_iface, gpointer iface_data);
@@ -124,6 +126,40 @@ enum
   LAST_PROPERTY
 };
 
+/* Whether the connections of local applications are multiplexed over one
+ * bytestream (recipient side only) */
+typedef enum
+{
+  /* No multiplexed bytestream yet; try to negotiate one for the next
+   * connection */
+  MUX_STATE_NONE = 0,
+  MUX_STATE_NEGOTIATING,
+  /* The initiator doesn't support it, use one bytestream per connection */
+  MUX_STATE_UNSUPPORTED,
+  MUX_STATE_OPEN
+} MuxState;
+
+/* What a bytestream we initiate is used for (recipient side only) */
+typedef enum
+{
+  /* Relay one connection */
+  STREAM_MODE_SINGLE,
+  /* Relay all the connections, see tube-stream-mux.c */
+  STREAM_MODE_MULTIPLEX,
+  /* Stay idle until a connection is bound to it, see pool_refill () */
+  STREAM_MODE_POOL
+} StreamMode;
+
+/* Sent on a pooled bytestream to bind it to a new connection */
+#define POOL_ACTIVATE 0x01
+/* Maximum number of idle bytestreams we keep negotiated in advance */
+#define POOL_MAX_SIZE 4
+/* Let the pool drain if no connection has been made for this long
+ * (in seconds) */
+#define POOL_IDLE_TIMEOUT 60
+
+static guint pool_idle_timeout = POOL_IDLE_TIMEOUT;
+
 struct _GabbleTubeStreamPrivate
 {
   TpHandle self_handle;
@@ -167,6 +203,42 @@ struct _GabbleTubeStreamPrivate
   GibberListener *local_listener;
   GabbleMucChannel *muc;
 
+  /* Recipient side: the bytestream carrying the connections of local
+   * applications, once negotiated */
+  GabbleTubeStreamMux *mux;
+  MuxState mux_state;
+  /* (GibberTransport *) connections made while the multiplexed bytestream is
+   * being negotiated */
+  GSList *mux_pending;
+
+  /* Initiator side: (GabbleTubeStreamMux *) opened by the recipient */
+  GSList *incoming_muxes;
+
+  /* Recipient side: idle bytestreams negotiated in advance so new
+   * connections don't have to wait for a stream initiation. The size of the
+   * pool follows the rate at which connections are made. */
+  /* TRUE if the initiator accepts pooled bytestreams */
+  gboolean pool_supported;
+  /* owned (GabbleBytestreamIface *) */
+  GQueue *pool;
+  /* Number of pooled bytestreams being negotiated */
+  guint pool_negotiating;
+  guint pool_timer;
+  /* in microseconds, 0 if no connection has been made yet */
+  gint64 last_connection_time;
+  /* Moving averages, in seconds, of the time between two connections and of
+   * the time needed to negotiate a bytestream. 0 if unknown. */
+  gdouble connection_interval;
+  gdouble negotiation_time;
+
+  /* Initiator side: owned (GabbleBytestreamIface *) waiting to be
+   * activated */
+  GSList *pooled;
+  /* (GibberTransport *) -> (GBytes *) data received on a pooled bytestream
+   * with the activation byte, to be written once the transport is connected
+   */
+  GHashTable *transport_to_early_data;
+
   gboolean dispose_has_run;
 };
 
@@ -190,9 +262,14 @@ typedef struct
 } transport_connected_data;
 
 static void data_received_cb (GabbleBytestreamIface *ibb, TpHandle sender,
-    GString *data, gpointer user_data);
+    GBytes *data, gpointer user_data);
 static void transport_connected_cb (GibberTransport *transport,
     transport_connected_data *data);
+static void mux_negotiate_cb (GabbleBytestreamIface *bytestream,
+    WockyStanza *msg, GObject *object, gpointer user_data);
+static void pool_negotiate_cb (GabbleBytestreamIface *bytestream,
+    WockyStanza *msg, GObject *object, gpointer user_data);
+static void pool_refill (GabbleTubeStream *self);
 
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
 static void
@@ -211,6 +288,18 @@ generate_ascii_string (guint len,
 }
 #endif
 
+/* Tubes are interactive: file transfers make room for their traffic */
+static void
+charge_interactive (GabbleTubeStream *self,
+                    gsize len)
+{
+  GabbleConnection *conn = GABBLE_CONNECTION (tp_base_channel_get_connection (
+        TP_BASE_CHANNEL (self)));
+
+  gabble_transfer_scheduler_charge (
+      gabble_bytestream_factory_get_scheduler (conn->bytestream_factory), len);
+}
+
 static void
 transport_handler (GibberTransport *transport,
                    GibberBuffer *data,
@@ -229,6 +318,7 @@ transport_handler (GibberTransport *transport,
 
   gabble_bytestream_iface_send (bytestream, data->length,
       (const gchar *) data->data);
+  charge_interactive (self, data->length);
 }
 
 static void
@@ -298,6 +388,7 @@ remove_transport (GabbleTubeStream *self,
   fire_connection_closed (self, transport, TP_ERROR_STR_CONNECTION_LOST,
       "bytestream has been broken");
 
+  g_hash_table_remove (priv->transport_to_early_data, transport);
   g_hash_table_remove (priv->transport_to_bytestream, transport);
   g_hash_table_remove (priv->bytestream_to_transport, bytestream);
   g_hash_table_remove (priv->transport_to_id, transport);
@@ -331,6 +422,8 @@ add_transport (GabbleTubeStream *self,
                GibberTransport *transport,
                GabbleBytestreamIface *bytestream)
 {
+  GabbleTubeStreamPrivate *priv = self->priv;
+
   gibber_transport_set_handler (transport, transport_handler, self);
 
   g_signal_connect (transport, "disconnected",
@@ -338,6 +431,14 @@ add_transport (GabbleTubeStream *self,
   g_signal_connect (transport, "buffer-empty",
       G_CALLBACK (transport_buffer_empty_cb), self);
 
+  /* Let the bytestream relay the data itself if it can, data_received_cb and
+   * transport_handler are only used as fallback. Data already read from the
+   * bytestream has to be written first, so don't splice in that case. */
+  if (!g_hash_table_contains (priv->transport_to_early_data, transport) &&
+      gabble_bytestream_iface_splice (bytestream, transport,
+        GABBLE_BYTESTREAM_SPLICE_BOTH, NULL, NULL))
+    DEBUG ("relaying tube connection with splice ()");
+
   /* We can transfer transport's data; unblock it. */
   gibber_transport_block_receiving (transport, FALSE);
 }
@@ -357,6 +458,25 @@ bytestream_write_blocked_cb (GabbleBytestreamIface *bytestream,
   gibber_transport_block_receiving (transport, blocked);
 }
 
+static void
+extra_bytestream_open (GabbleTubeStream *self,
+                       GabbleBytestreamIface *bytestream)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GibberTransport *transport;
+
+  g_signal_connect (bytestream, "data-received",
+      G_CALLBACK (data_received_cb), self);
+  g_signal_connect (bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+
+  transport = g_hash_table_lookup (priv->bytestream_to_transport,
+        bytestream);
+  g_assert (transport != NULL);
+
+  add_transport (self, transport, bytestream);
+}
+
 static void
 extra_bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
                                    GabbleBytestreamState state,
@@ -369,20 +489,9 @@ extra_bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
 
   if (state == GABBLE_BYTESTREAM_STATE_OPEN)
     {
-      GibberTransport *transport;
-
       DEBUG ("extra bytestream open");
 
-      g_signal_connect (bytestream, "data-received",
-          G_CALLBACK (data_received_cb), self);
-      g_signal_connect (bytestream, "write-blocked",
-          G_CALLBACK (bytestream_write_blocked_cb), self);
-
-      transport = g_hash_table_lookup (priv->bytestream_to_transport,
-            bytestream);
-      g_assert (transport != NULL);
-
-      add_transport (self, transport, bytestream);
+      extra_bytestream_open (self, bytestream);
     }
   else if (state == GABBLE_BYTESTREAM_STATE_CLOSED)
     {
@@ -406,6 +515,35 @@ extra_bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
     }
 }
 
+/* The initiator says in its SI replies if it accepts pooled bytestreams */
+static void
+check_pool_support (GabbleTubeStream *self,
+                    WockyStanza *reply)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  WockyNode *si_node, *tube_node = NULL;
+
+  si_node = wocky_node_get_child_ns (wocky_stanza_get_top_node (reply), "si",
+      NS_SI);
+  if (si_node != NULL)
+    tube_node = wocky_node_get_child_ns (si_node, "tube", NS_TUBES);
+
+  priv->pool_supported = (tube_node != NULL &&
+      !tp_strdiff (wocky_node_get_attribute (tube_node, "pool"), "true"));
+}
+
+/* Returns: (transfer none): the bytestream to use for the SI @reply */
+static GabbleBytestreamIface *
+maybe_compress (GabbleBytestreamIface *bytestream,
+                WockyStanza *reply)
+{
+  if (bytestream == NULL || !gabble_bytestream_zlib_accepted (reply))
+    return bytestream;
+
+  DEBUG ("initiator accepted to compress the bytestream");
+  return gabble_bytestream_zlib_wrap (bytestream);
+}
+
 static void
 extra_bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
                                WockyStanza *msg,
@@ -429,6 +567,9 @@ extra_bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
 
   DEBUG ("extra bytestream accepted");
 
+  check_pool_support (self, msg);
+  bytestream = maybe_compress (bytestream, msg);
+
   /* transport has been refed in start_stream_initiation () */
   g_assert (gibber_transport_get_state (transport) ==
       GIBBER_TRANSPORT_CONNECTED);
@@ -440,11 +581,15 @@ extra_bytestream_negotiate_cb (GabbleBytestreamIface *bytestream,
 
   g_signal_connect (bytestream, "state-changed",
                 G_CALLBACK (extra_bytestream_state_changed_cb), self);
+
+  pool_refill (self);
 }
 
+/* @transport is NULL if @mode is STREAM_MODE_POOL */
 static gboolean
 start_stream_initiation (GabbleTubeStream *self,
                          GibberTransport *transport,
+                         StreamMode mode,
                          GError **error)
 {
   GabbleTubeStreamPrivate *priv = self->priv;
@@ -458,6 +603,9 @@ start_stream_initiation (GabbleTubeStream *self,
   TpHandleRepoIface *contact_repo;
   const gchar *jid;
   gchar *full_jid, *stream_id, *id_str;
+  GabbleBytestreamFactoryNegotiateReplyFunc func;
+  gpointer user_data;
+  gboolean compress = FALSE;
 
   contact_repo = tp_base_connection_get_handles (
      base_conn, TP_HANDLE_TYPE_CONTACT);
@@ -491,6 +639,11 @@ start_stream_initiation (GabbleTubeStream *self,
         }
 
         full_jid = g_strdup_printf ("%s/%s", jid, resource);
+
+        /* Compressing helps most with IBB and its base64 encoding, but we
+         * don't know yet which method will be used */
+        compress = gabble_presence_resource_has_caps (presence, resource,
+            gabble_capability_set_predicate_has, NS_TUBES_ZLIB);
     }
   else
     {
@@ -520,9 +673,34 @@ start_stream_initiation (GabbleTubeStream *self,
 
   wocky_node_set_attribute (node, "tube", id_str);
 
+  switch (mode)
+    {
+      case STREAM_MODE_SINGLE:
+        func = extra_bytestream_negotiate_cb;
+        user_data = g_object_ref (transport);
+        break;
+      case STREAM_MODE_MULTIPLEX:
+        wocky_node_set_attribute (node, "multiplex", "true");
+        func = mux_negotiate_cb;
+        user_data = g_object_ref (transport);
+        break;
+      case STREAM_MODE_POOL:
+        wocky_node_set_attribute (node, "pool", "true");
+        func = pool_negotiate_cb;
+        /* when the negotiation started */
+        user_data = g_slice_new (gint64);
+        *((gint64 *) user_data) = g_get_monotonic_time ();
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+
+  if (compress)
+    gabble_bytestream_zlib_request (node);
+
   gabble_bytestream_factory_negotiate_stream (
-      conn->bytestream_factory, msg, stream_id,
-      extra_bytestream_negotiate_cb, g_object_ref (transport), G_OBJECT (self));
+      conn->bytestream_factory, msg, stream_id, func, user_data,
+      G_OBJECT (self));
 
   /* FIXME: data and one ref on data->transport are leaked if the tube is
    * closed before we got the SI reply. */
@@ -560,6 +738,419 @@ fire_new_local_connection (GabbleTubeStream *self,
       connection_id);
 }
 
+static void
+mux_channel_closed_cb (GabbleTubeStreamMux *mux,
+                       GibberTransport *transport,
+                       gboolean remotely,
+                       GabbleTubeStream *self)
+{
+  /* See remove_transport () */
+  g_signal_handlers_disconnect_matched (transport, G_SIGNAL_MATCH_FUNC,
+      0, 0, NULL, G_CALLBACK (transport_connected_cb), NULL);
+
+  if (remotely)
+    fire_connection_closed (self, transport, TP_ERROR_STR_CONNECTION_LOST,
+        "connection has been closed by the remote side");
+  else
+    fire_connection_closed (self, transport, TP_ERROR_STR_CANCELLED,
+        "local socket has been disconnected");
+}
+
+static void
+mux_closed_cb (GabbleTubeStreamMux *mux,
+               GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+
+  DEBUG ("multiplexed bytestream has been closed");
+
+  g_signal_handlers_disconnect_matched (mux, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, self);
+
+  if (mux == priv->mux)
+    {
+      /* Negotiate a new one for the next connection */
+      tp_clear_object (&priv->mux);
+      priv->mux_state = MUX_STATE_NONE;
+    }
+  else
+    {
+      priv->incoming_muxes = g_slist_remove (priv->incoming_muxes, mux);
+      g_object_unref (mux);
+    }
+}
+
+static void
+mux_negotiate_cb (GabbleBytestreamIface *bytestream,
+                  WockyStanza *msg,
+                  GObject *object,
+                  gpointer user_data)
+{
+  GabbleTubeStream *self = GABBLE_TUBE_STREAM (object);
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GibberTransport *transport = GIBBER_TRANSPORT (user_data);
+  WockyNode *si_node, *tube_node = NULL;
+  GSList *pending, *l;
+
+  if (tp_base_channel_is_destroyed (TP_BASE_CHANNEL (self)))
+    {
+      DEBUG ("tube has been closed; drop the multiplexed bytestream");
+
+      if (bytestream != NULL)
+        gabble_bytestream_iface_close (bytestream, NULL);
+
+      g_object_unref (transport);
+      return;
+    }
+
+  pending = priv->mux_pending;
+  priv->mux_pending = NULL;
+
+  if (bytestream == NULL)
+    {
+      DEBUG ("initiator refused multiplexed bytestream");
+      priv->mux_state = MUX_STATE_NONE;
+
+      fire_connection_closed (self, transport,
+          TP_ERROR_STR_CONNECTION_REFUSED, "connection has been refused");
+      g_object_unref (transport);
+
+      for (l = pending; l != NULL; l = g_slist_next (l))
+        fire_connection_closed (self, l->data,
+            TP_ERROR_STR_CONNECTION_REFUSED, "connection has been refused");
+
+      g_slist_free_full (pending, g_object_unref);
+      return;
+    }
+
+  si_node = wocky_node_get_child_ns (wocky_stanza_get_top_node (msg), "si",
+      NS_SI);
+  if (si_node != NULL)
+    tube_node = wocky_node_get_child_ns (si_node, "tube", NS_TUBES);
+
+  if (tube_node == NULL ||
+      tp_strdiff (wocky_node_get_attribute (tube_node, "multiplex"), "true"))
+    {
+      DEBUG ("initiator doesn't support multiplexing; use one bytestream per "
+          "connection");
+      priv->mux_state = MUX_STATE_UNSUPPORTED;
+
+      extra_bytestream_negotiate_cb (bytestream, msg, object, transport);
+
+      for (l = pending; l != NULL; l = g_slist_next (l))
+        {
+          GError *error = NULL;
+
+          if (!start_stream_initiation (self, l->data, STREAM_MODE_SINGLE,
+                &error))
+            {
+              fire_connection_closed (self, l->data,
+                  tp_error_get_dbus_name (error->code), error->message);
+              g_error_free (error);
+            }
+        }
+
+      g_slist_free_full (pending, g_object_unref);
+      return;
+    }
+
+  DEBUG ("multiplexed bytestream accepted");
+
+  bytestream = maybe_compress (bytestream, msg);
+  priv->mux = gabble_tube_stream_mux_new (bytestream);
+  priv->mux_state = MUX_STATE_OPEN;
+
+  g_signal_connect (priv->mux, "channel-closed",
+      G_CALLBACK (mux_channel_closed_cb), self);
+  g_signal_connect (priv->mux, "closed", G_CALLBACK (mux_closed_cb), self);
+
+  gabble_tube_stream_mux_open_channel (priv->mux, transport);
+  g_object_unref (transport);
+
+  for (l = pending; l != NULL; l = g_slist_next (l))
+    gabble_tube_stream_mux_open_channel (priv->mux, l->data);
+
+  g_slist_free_full (pending, g_object_unref);
+}
+
+/* Exponential moving average, @sample having a weight of 1/4 */
+static gdouble
+update_average (gdouble average,
+                gdouble sample)
+{
+  if (average <= 0)
+    return sample;
+
+  return (3 * average + sample) / 4;
+}
+
+static void
+record_connection (GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  gint64 now = g_get_monotonic_time ();
+
+  if (priv->last_connection_time != 0)
+    priv->connection_interval = update_average (priv->connection_interval,
+        (gdouble) (now - priv->last_connection_time) / G_USEC_PER_SEC);
+
+  priv->last_connection_time = now;
+}
+
+static gboolean
+pool_wanted (GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  TpBaseChannel *base = TP_BASE_CHANNEL (self);
+  TpBaseChannelClass *cls = TP_BASE_CHANNEL_GET_CLASS (base);
+
+  if (!priv->pool_supported || tp_base_channel_is_destroyed (base))
+    return FALSE;
+
+  /* Multiplexed connections don't need extra bytestreams */
+  return (cls->target_handle_type == TP_HANDLE_TYPE_ROOM ||
+      priv->mux_state == MUX_STATE_UNSUPPORTED);
+}
+
+/* How many idle bytestreams we should have: enough for the connections
+ * expected while a new bytestream is being negotiated */
+static guint
+pool_target_size (GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  gdouble expected;
+
+  if (!pool_wanted (self) || priv->last_connection_time == 0)
+    return 0;
+
+  if (g_get_monotonic_time () - priv->last_connection_time >
+      (gint64) pool_idle_timeout * G_USEC_PER_SEC)
+    return 0;
+
+  if (priv->connection_interval <= 0 || priv->negotiation_time <= 0)
+    return 1;
+
+  expected = priv->negotiation_time / priv->connection_interval;
+  if (expected >= POOL_MAX_SIZE)
+    return POOL_MAX_SIZE;
+
+  return (guint) expected + 1;
+}
+
+static void
+pool_bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+                                  GabbleBytestreamState state,
+                                  gpointer user_data)
+{
+  GabbleTubeStream *self = GABBLE_TUBE_STREAM (user_data);
+  GabbleTubeStreamPrivate *priv = self->priv;
+
+  if (state != GABBLE_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  DEBUG ("pooled bytestream has been closed");
+
+  g_signal_handlers_disconnect_by_func (bytestream,
+      pool_bytestream_state_changed_cb, self);
+
+  if (g_queue_remove (priv->pool, bytestream))
+    g_object_unref (bytestream);
+}
+
+static void
+pool_negotiate_cb (GabbleBytestreamIface *bytestream,
+                   WockyStanza *msg,
+                   GObject *object,
+                   gpointer user_data)
+{
+  GabbleTubeStream *self = GABBLE_TUBE_STREAM (object);
+  GabbleTubeStreamPrivate *priv = self->priv;
+  gint64 *started = user_data;
+
+  priv->pool_negotiating--;
+
+  if (bytestream == NULL)
+    {
+      DEBUG ("initiator refused pooled bytestream; stop pooling");
+      priv->pool_supported = FALSE;
+      goto out;
+    }
+
+  if (!pool_wanted (self))
+    {
+      DEBUG ("pooled bytestream isn't needed any more");
+      gabble_bytestream_iface_close (bytestream, NULL);
+      goto out;
+    }
+
+  priv->negotiation_time = update_average (priv->negotiation_time,
+      (gdouble) (g_get_monotonic_time () - *started) / G_USEC_PER_SEC);
+
+  DEBUG ("pooled bytestream accepted (%u in the pool)",
+      g_queue_get_length (priv->pool) + 1);
+
+  bytestream = maybe_compress (bytestream, msg);
+  g_queue_push_tail (priv->pool, g_object_ref (bytestream));
+  g_signal_connect (bytestream, "state-changed",
+      G_CALLBACK (pool_bytestream_state_changed_cb), self);
+
+out:
+  g_slice_free (gint64, started);
+}
+
+static void
+pool_drop_bytestream (GabbleTubeStream *self,
+                      GabbleBytestreamIface *bytestream)
+{
+  g_signal_handlers_disconnect_by_func (bytestream,
+      pool_bytestream_state_changed_cb, self);
+  gabble_bytestream_iface_close (bytestream, NULL);
+  g_object_unref (bytestream);
+}
+
+static gboolean
+pool_timeout_cb (gpointer user_data)
+{
+  GabbleTubeStream *self = GABBLE_TUBE_STREAM (user_data);
+
+  self->priv->pool_timer = 0;
+  pool_refill (self);
+
+  return FALSE;
+}
+
+/* Negotiate or close idle bytestreams so the pool has the right size */
+static void
+pool_refill (GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  guint target = pool_target_size (self);
+
+  while (g_queue_get_length (priv->pool) > target)
+    pool_drop_bytestream (self, g_queue_pop_tail (priv->pool));
+
+  while (g_queue_get_length (priv->pool) + priv->pool_negotiating < target)
+    {
+      if (!start_stream_initiation (self, NULL, STREAM_MODE_POOL, NULL))
+        break;
+
+      priv->pool_negotiating++;
+    }
+
+  /* Check again once connections stop for a while */
+  if (priv->pool_timer != 0)
+    g_source_remove (priv->pool_timer);
+
+  priv->pool_timer = 0;
+
+  if (!g_queue_is_empty (priv->pool) || priv->pool_negotiating > 0)
+    priv->pool_timer = g_timeout_add_seconds (pool_idle_timeout,
+        pool_timeout_cb, self);
+}
+
+/* Relay @transport through an open pooled bytestream, if we have one */
+static gboolean
+bind_pooled_bytestream (GabbleTubeStream *self,
+                        GibberTransport *transport)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GabbleBytestreamIface *bytestream = NULL;
+  GList *l;
+  const gchar activate = POOL_ACTIVATE;
+
+  for (l = priv->pool->head; l != NULL; l = g_list_next (l))
+    {
+      GabbleBytestreamState state;
+
+      g_object_get (l->data, "state", &state, NULL);
+      if (state == GABBLE_BYTESTREAM_STATE_OPEN)
+        {
+          bytestream = l->data;
+          g_queue_delete_link (priv->pool, l);
+          break;
+        }
+    }
+
+  if (bytestream == NULL)
+    return FALSE;
+
+  DEBUG ("relay new connection through a pooled bytestream");
+
+  g_signal_handlers_disconnect_by_func (bytestream,
+      pool_bytestream_state_changed_cb, self);
+
+  /* Tell the initiator to connect to its socket */
+  gabble_bytestream_iface_send (bytestream, 1, &activate);
+
+  /* The pool's ref is given to the table */
+  g_hash_table_insert (priv->bytestream_to_transport, bytestream,
+      g_object_ref (transport));
+  g_hash_table_insert (priv->transport_to_bytestream,
+      g_object_ref (transport), g_object_ref (bytestream));
+
+  g_signal_connect (bytestream, "state-changed",
+      G_CALLBACK (extra_bytestream_state_changed_cb), self);
+
+  extra_bytestream_open (self, bytestream);
+
+  return TRUE;
+}
+
+/* Relay a new connection from a local application to the initiator */
+static void
+handle_local_connection (GabbleTubeStream *self,
+                         GibberTransport *transport)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  TpBaseChannel *base = TP_BASE_CHANNEL (self);
+  TpBaseChannelClass *cls = TP_BASE_CHANNEL_GET_CLASS (base);
+  gboolean multiplex;
+
+  if (priv->mux_state == MUX_STATE_OPEN)
+    {
+      fire_new_local_connection (self, transport);
+      gabble_tube_stream_mux_open_channel (priv->mux, transport);
+      return;
+    }
+
+  if (priv->mux_state == MUX_STATE_NEGOTIATING)
+    {
+      DEBUG ("wait for the multiplexed bytestream to be negotiated");
+      priv->mux_pending = g_slist_append (priv->mux_pending,
+          g_object_ref (transport));
+      fire_new_local_connection (self, transport);
+      return;
+    }
+
+  record_connection (self);
+
+  if (bind_pooled_bytestream (self, transport))
+    {
+      fire_new_local_connection (self, transport);
+      pool_refill (self);
+      return;
+    }
+
+  /* Streams in stream tubes are established with stream initiation
+   * (XEP-0095). We only multiplex private tubes, as the bytestreams of a
+   * muc tube can be made with each of its members. */
+  multiplex = (priv->mux_state == MUX_STATE_NONE &&
+      cls->target_handle_type == TP_HANDLE_TYPE_CONTACT);
+
+  if (!start_stream_initiation (self, transport,
+        multiplex ? STREAM_MODE_MULTIPLEX : STREAM_MODE_SINGLE, NULL))
+    {
+      DEBUG ("closing new client connection");
+      return;
+    }
+
+  if (multiplex)
+    priv->mux_state = MUX_STATE_NEGOTIATING;
+
+  fire_new_local_connection (self, transport);
+  pool_refill (self);
+}
+
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
 static void
 credentials_received_cb (GibberUnixTransport *transport,
@@ -597,17 +1188,10 @@ credentials_received_cb (GibberUnixTransport *transport,
 
   DEBUG ("Connection properly authentificated");
 
-  if (!start_stream_initiation (self, GIBBER_TRANSPORT (transport), NULL))
-    {
-      DEBUG ("SI failed. Closing connection");
-    }
-  else
-    {
-      fire_new_local_connection (self, GIBBER_TRANSPORT (transport));
-    }
+  handle_local_connection (self, GIBBER_TRANSPORT (transport));
 
 credentials_received_cb_out:
-  /* start_stream_initiation reffed the transport if everything went fine */
+  /* handle_local_connection reffed the transport if everything went fine */
   g_object_unref (transport);
 }
 #endif
@@ -728,17 +1312,7 @@ local_new_connection_cb (GibberListener *listener,
       return;
     }
 
-  /* Streams in stream tubes are established with stream initiation (XEP-0095).
-   * We use SalutSiBytestreamManager.
-   */
-  if (!start_stream_initiation (self, transport, NULL))
-    {
-      DEBUG ("closing new client connection");
-    }
-  else
-    {
-      fire_new_local_connection (self, transport);
-    }
+  handle_local_connection (self, transport);
 }
 
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
@@ -880,6 +1454,37 @@ fire_new_remote_connection (GabbleTubeStream *self,
   g_value_unset (&access_control_param);
 }
 
+/* Start relaying a transport bound to a pooled bytestream once it's
+ * connected */
+static void
+flush_early_data (GabbleTubeStream *self,
+                  GibberTransport *transport,
+                  GabbleBytestreamIface *bytestream)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GBytes *early_data;
+  GError *error = NULL;
+
+  early_data = g_hash_table_lookup (priv->transport_to_early_data, transport);
+  if (early_data == NULL)
+    return;
+
+  add_transport (self, transport, bytestream);
+
+  g_bytes_ref (early_data);
+  g_hash_table_remove (priv->transport_to_early_data, transport);
+
+  if (g_bytes_get_size (early_data) > 0 &&
+      !gibber_transport_send (transport, g_bytes_get_data (early_data, NULL),
+        g_bytes_get_size (early_data), &error))
+    {
+      DEBUG ("sending failed: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_bytes_unref (early_data);
+}
+
 static void
 transport_connected_cb (GibberTransport *transport,
     transport_connected_data *data)
@@ -887,6 +1492,10 @@ transport_connected_cb (GibberTransport *transport,
   GabbleTubeStreamPrivate *priv = data->self->priv;
   GabbleBytestreamIface *bytestream;
 
+  bytestream = g_hash_table_lookup (priv->transport_to_bytestream, transport);
+  if (bytestream != NULL)
+    flush_early_data (data->self, transport, bytestream);
+
   fire_new_remote_connection (data->self, transport, data->contact);
 
   bytestream = g_hash_table_lookup (priv->transport_to_bytestream, transport);
@@ -896,17 +1505,32 @@ transport_connected_cb (GibberTransport *transport,
   gabble_bytestream_iface_block_reading (bytestream, FALSE);
 }
 
+static void
+wait_for_transport_connected (GabbleTubeStream *self,
+                              GibberTransport *transport,
+                              TpHandle contact)
+{
+  /* NewConnection will be fired once the transport is connected.
+   * We can't get access_control_param (as the source port for example)
+   * until it's connected. */
+  transport_connected_data *data;
+
+  data = transport_connected_data_new (self, contact);
+
+  g_signal_connect_data (transport, "connected",
+      G_CALLBACK (transport_connected_cb), data,
+      (GClosureNotify) transport_connected_data_free, 0);
+}
+
+/* Returns a new reference on a transport connecting to the socket of the
+ * local service. It's blocked until it can be relayed. */
 static GibberTransport *
-new_connection_to_socket (GabbleTubeStream *self,
-                          GabbleBytestreamIface *bytestream,
-                          TpHandle contact)
+connect_to_local_socket (GabbleTubeStream *self)
 {
   GabbleTubeStreamPrivate *priv = self->priv;
   TpBaseChannel *base = TP_BASE_CHANNEL (self);
   GibberTransport *transport;
 
-  DEBUG ("Called.");
-
   g_assert (tp_base_channel_is_requested (base));
 
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
@@ -948,6 +1572,21 @@ new_connection_to_socket (GabbleTubeStream *self,
    * its data. */
   gibber_transport_block_receiving (transport, TRUE);
 
+  return transport;
+}
+
+static GibberTransport *
+new_connection_to_socket (GabbleTubeStream *self,
+                          GabbleBytestreamIface *bytestream,
+                          TpHandle contact)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GibberTransport *transport;
+
+  DEBUG ("Called.");
+
+  transport = connect_to_local_socket (self);
+
   generate_connection_id (self, transport);
 
   gabble_bytestream_iface_block_reading (bytestream, TRUE);
@@ -1105,6 +1744,11 @@ gabble_tube_stream_init (GabbleTubeStream *self)
       g_direct_equal, NULL, NULL);
   priv->last_connection_id = 0;
 
+  priv->pool = g_queue_new ();
+  priv->transport_to_early_data = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, (GDestroyNotify) g_object_unref,
+      (GDestroyNotify) g_bytes_unref);
+
   priv->address_type = TP_SOCKET_ADDRESS_TYPE_UNIX;
   priv->address = NULL;
   priv->access_control = TP_SOCKET_ACCESS_CONTROL_LOCALHOST;
@@ -1141,11 +1785,24 @@ close_each_extra_bytestream (gpointer key,
   fire_connection_closed (self, transport, TP_ERROR_STR_CANCELLED,
       "tube is closing");
 
+  g_hash_table_remove (priv->transport_to_early_data, transport);
   g_hash_table_remove (priv->transport_to_bytestream, transport);
 
   return TRUE;
 }
 
+static void
+close_mux (GabbleTubeStream *self,
+           GabbleTubeStreamMux *mux)
+{
+  /* Connections are closed below */
+  g_signal_handlers_disconnect_matched (mux, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, self);
+
+  gabble_tube_stream_mux_close (mux);
+  g_object_unref (mux);
+}
+
 static void
 gabble_tube_stream_dispose (GObject *object)
 {
@@ -1180,6 +1837,7 @@ gabble_tube_stream_dispose (GObject *object)
   tp_clear_pointer (&priv->transport_to_bytestream, g_hash_table_unref);
   tp_clear_pointer (&priv->bytestream_to_transport, g_hash_table_unref);
   tp_clear_pointer (&priv->transport_to_id, g_hash_table_unref);
+  tp_clear_pointer (&priv->transport_to_early_data, g_hash_table_unref);
 
   tp_clear_object (&priv->local_listener);
 
@@ -1202,6 +1860,7 @@ gabble_tube_stream_finalize (GObject *object)
 
   g_free (priv->service);
   g_hash_table_unref (priv->parameters);
+  g_queue_free (priv->pool);
 
   if (priv->address != NULL)
     {
@@ -1571,19 +2230,107 @@ gabble_tube_stream_class_init (GabbleTubeStreamClass *gabble_tube_stream_class)
   tp_external_group_mixin_init_dbus_properties (object_class);
 }
 
+static void
+pooled_bytestream_state_changed_cb (GabbleBytestreamIface *bytestream,
+                                    GabbleBytestreamState state,
+                                    gpointer user_data)
+{
+  GabbleTubeStream *self = GABBLE_TUBE_STREAM (user_data);
+  GabbleTubeStreamPrivate *priv = self->priv;
+
+  if (state != GABBLE_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  DEBUG ("idle pooled bytestream has been closed");
+
+  g_signal_handlers_disconnect_matched (bytestream, G_SIGNAL_MATCH_DATA,
+      0, 0, NULL, NULL, self);
+
+  priv->pooled = g_slist_remove (priv->pooled, bytestream);
+  g_object_unref (bytestream);
+}
+
+/* The recipient bound a connection to a pooled bytestream by sending
+ * POOL_ACTIVATE; connect to the socket */
+static void
+activate_pooled_bytestream (GabbleTubeStream *self,
+                            GabbleBytestreamIface *bytestream,
+                            const guint8 *data,
+                            gsize len)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  GibberTransport *transport;
+  TpHandle contact;
+  GSList *link;
+
+  if (len == 0)
+    return;
+
+  link = g_slist_find (priv->pooled, bytestream);
+  g_assert (link != NULL);
+
+  priv->pooled = g_slist_delete_link (priv->pooled, link);
+  g_signal_handlers_disconnect_by_func (bytestream,
+      pooled_bytestream_state_changed_cb, self);
+
+  if (data[0] != POOL_ACTIVATE)
+    {
+      DEBUG ("unexpected data on an idle pooled bytestream; closing it");
+      g_signal_handlers_disconnect_matched (bytestream, G_SIGNAL_MATCH_DATA,
+          0, 0, NULL, NULL, self);
+      gabble_bytestream_iface_close (bytestream, NULL);
+      g_object_unref (bytestream);
+      return;
+    }
+
+  DEBUG ("pooled bytestream activated; connect to the socket");
+
+  g_object_get (bytestream, "peer-handle", &contact, NULL);
+
+  transport = new_connection_to_socket (self, bytestream, contact);
+
+  /* new_connection_to_socket () reffed it */
+  g_object_unref (bytestream);
+
+  g_hash_table_insert (priv->transport_to_early_data,
+      g_object_ref (transport), g_bytes_new (data + 1, len - 1));
+
+  g_signal_connect (bytestream, "write-blocked",
+      G_CALLBACK (bytestream_write_blocked_cb), self);
+
+  g_signal_emit (G_OBJECT (self), signals[NEW_CONNECTION], 0, contact);
+
+  if (gibber_transport_get_state (transport) == GIBBER_TRANSPORT_CONNECTED)
+    {
+      flush_early_data (self, transport, bytestream);
+      gabble_bytestream_iface_block_reading (bytestream, FALSE);
+      fire_new_remote_connection (self, transport, contact);
+    }
+  else
+    {
+      wait_for_transport_connected (self, transport, contact);
+    }
+}
+
 static void
 data_received_cb (GabbleBytestreamIface *bytestream,
                   TpHandle sender,
-                  GString *data,
+                  GBytes *data,
                   gpointer user_data)
 {
   GabbleTubeStream *tube = GABBLE_TUBE_STREAM (user_data);
   GabbleTubeStreamPrivate *priv = tube->priv;
   GibberTransport *transport;
   GError *error = NULL;
+  gsize len;
+  const guint8 *buf = g_bytes_get_data (data, &len);
 
   transport = g_hash_table_lookup (priv->bytestream_to_transport, bytestream);
-  g_assert (transport != NULL);
+  if (transport == NULL)
+    {
+      activate_pooled_bytestream (tube, bytestream, buf, len);
+      return;
+    }
 
   /* If something goes wrong when trying to write the data on the transport,
    * it could be disconnected, causing its removal from the hash tables.
@@ -1592,8 +2339,7 @@ data_received_cb (GabbleBytestreamIface *bytestream,
    * We avoid that by reffing the transport between the 2 calls so we keep it
    * artificially alive if needed. */
   g_object_ref (transport);
-  if (!gibber_transport_send (transport, (const guint8 *) data->str, data->len,
-      &error))
+  if (!gibber_transport_send (transport, buf, len, &error))
   {
     DEBUG ("sending failed: %s", error->message);
     g_error_free (error);
@@ -1601,10 +2347,12 @@ data_received_cb (GabbleBytestreamIface *bytestream,
     return;
   }
 
-  if (!gibber_transport_buffer_is_empty (transport))
+  charge_interactive (tube, len);
+
+  if (gibber_transport_buffer_is_full (transport))
     {
-      /* We don't want to send more data while the buffer isn't empty */
-      DEBUG ("tube buffer isn't empty. Block the bytestream");
+      /* We don't want to queue more data until the buffer has drained */
+      DEBUG ("tube buffer is full. Block the bytestream");
       gabble_bytestream_iface_block_reading (bytestream, TRUE);
     }
   g_object_unref (transport);
@@ -1706,13 +2454,59 @@ gabble_tube_iface_stream_close (GabbleTubeIface *tube,
   TpBaseChannelClass *cls = TP_BASE_CHANNEL_GET_CLASS (base);
   TpBaseConnection *base_conn = tp_base_channel_get_connection (base);
   GabbleConnection *conn = GABBLE_CONNECTION (base_conn);
+  GList *transports, *l;
 
   if (tp_base_channel_is_destroyed (base))
     return;
 
+  if (priv->mux != NULL)
+    {
+      close_mux (self, priv->mux);
+      priv->mux = NULL;
+    }
+
+  while (priv->incoming_muxes != NULL)
+    {
+      close_mux (self, priv->incoming_muxes->data);
+      priv->incoming_muxes = g_slist_delete_link (priv->incoming_muxes,
+          priv->incoming_muxes);
+    }
+
+  if (priv->pool_timer != 0)
+    {
+      g_source_remove (priv->pool_timer);
+      priv->pool_timer = 0;
+    }
+
+  while (!g_queue_is_empty (priv->pool))
+    pool_drop_bytestream (self, g_queue_pop_head (priv->pool));
+
+  while (priv->pooled != NULL)
+    {
+      GabbleBytestreamIface *bytestream = priv->pooled->data;
+
+      g_signal_handlers_disconnect_matched (bytestream, G_SIGNAL_MATCH_DATA,
+          0, 0, NULL, NULL, self);
+      gabble_bytestream_iface_close (bytestream, NULL);
+      g_object_unref (bytestream);
+      priv->pooled = g_slist_delete_link (priv->pooled, priv->pooled);
+    }
+
+  g_slist_foreach (priv->mux_pending, (GFunc) gibber_transport_disconnect,
+      NULL);
+  g_slist_free_full (priv->mux_pending, g_object_unref);
+  priv->mux_pending = NULL;
+
   g_hash_table_foreach_remove (priv->bytestream_to_transport,
       close_each_extra_bytestream, self);
 
+  /* Connections which were multiplexed or waiting for their bytestream */
+  transports = g_hash_table_get_keys (priv->transport_to_id);
+  for (l = transports; l != NULL; l = g_list_next (l))
+    fire_connection_closed (self, l->data, TP_ERROR_STR_CANCELLED,
+        "tube is closing");
+  g_list_free (transports);
+
   if (!closed_remotely && cls->target_handle_type == TP_HANDLE_TYPE_CONTACT)
     {
       WockyStanza *msg;
@@ -1758,11 +2552,42 @@ gabble_tube_iface_stream_close (GabbleTubeIface *tube,
   g_object_unref (self);
 }
 
+/* We tell the recipient in all our replies that it can negotiate pooled
+ * bytestreams */
 static void
 augment_si_accept_iq (WockyNode *si,
                       gpointer user_data)
 {
-  wocky_node_add_child_ns (si, "tube", NS_TUBES);
+  WockyNode *tube_node = wocky_node_add_child_ns (si, "tube", NS_TUBES);
+
+  wocky_node_set_attribute (tube_node, "pool", "true");
+}
+
+static void
+augment_si_accept_iq_multiplex (WockyNode *si,
+                                gpointer user_data)
+{
+  WockyNode *tube_node = wocky_node_add_child_ns (si, "tube", NS_TUBES);
+
+  wocky_node_set_attribute (tube_node, "multiplex", "true");
+  wocky_node_set_attribute (tube_node, "pool", "true");
+}
+
+static void
+tube_stream_got_first_connection (GabbleTubeStream *self)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+
+  if (priv->state != TP_TUBE_CHANNEL_STATE_REMOTE_PENDING)
+    return;
+
+  DEBUG ("Received first connection. Tube is now open");
+  priv->state = TP_TUBE_CHANNEL_STATE_OPEN;
+
+  tp_svc_channel_interface_tube_emit_tube_channel_state_changed (
+      self, TP_TUBE_CHANNEL_STATE_OPEN);
+
+  g_signal_emit (G_OBJECT (self), signals[OPENED], 0);
 }
 
 /**
@@ -1776,7 +2601,6 @@ gabble_tube_stream_add_bytestream (GabbleTubeIface *tube,
                                    GabbleBytestreamIface *bytestream)
 {
   GabbleTubeStream *self = GABBLE_TUBE_STREAM (tube);
-  GabbleTubeStreamPrivate *priv = self->priv;
   TpBaseChannel *base = TP_BASE_CHANNEL (self);
   TpHandle contact;
   GibberTransport *transport;
@@ -1796,16 +2620,7 @@ gabble_tube_stream_add_bytestream (GabbleTubeIface *tube,
   transport = new_connection_to_socket (self, bytestream, contact);
   if (transport != NULL)
     {
-      if (priv->state == TP_TUBE_CHANNEL_STATE_REMOTE_PENDING)
-        {
-          DEBUG ("Received first connection. Tube is now open");
-          priv->state = TP_TUBE_CHANNEL_STATE_OPEN;
-
-          tp_svc_channel_interface_tube_emit_tube_channel_state_changed (
-              self, TP_TUBE_CHANNEL_STATE_OPEN);
-
-          g_signal_emit (G_OBJECT (self), signals[OPENED], 0);
-        }
+      tube_stream_got_first_connection (self);
 
       DEBUG ("accept the extra bytestream");
 
@@ -1820,16 +2635,7 @@ gabble_tube_stream_add_bytestream (GabbleTubeIface *tube,
         }
       else
         {
-          /* NewConnection will be fired once the transport is connected.
-           * We can't get access_control_param (as the source port for example)
-           * until it's connected. */
-          transport_connected_data *data;
-
-          data = transport_connected_data_new (self, contact);
-
-          g_signal_connect_data (transport, "connected",
-              G_CALLBACK (transport_connected_cb), data,
-              (GClosureNotify) transport_connected_data_free, 0);
+          wait_for_transport_connected (self, transport, contact);
         }
     }
   else
@@ -1838,6 +2644,109 @@ gabble_tube_stream_add_bytestream (GabbleTubeIface *tube,
     }
 }
 
+static void
+mux_new_channel_cb (GabbleTubeStreamMux *mux,
+                    guint channel_id,
+                    GabbleTubeStream *self)
+{
+  GabbleBytestreamIface *bytestream;
+  GibberTransport *transport;
+  TpHandle contact;
+
+  g_object_get (mux, "bytestream", &bytestream, NULL);
+  g_object_get (bytestream, "peer-handle", &contact, NULL);
+  g_object_unref (bytestream);
+
+  DEBUG ("new multiplexed connection; connect to the socket");
+
+  transport = connect_to_local_socket (self);
+  generate_connection_id (self, transport);
+  gabble_tube_stream_mux_add_channel (mux, channel_id, transport);
+
+  g_signal_emit (G_OBJECT (self), signals[NEW_CONNECTION], 0, contact);
+
+  if (gibber_transport_get_state (transport) == GIBBER_TRANSPORT_CONNECTED)
+    fire_new_remote_connection (self, transport, contact);
+  else
+    wait_for_transport_connected (self, transport, contact);
+
+  g_object_unref (transport);
+}
+
+/*
+ * gabble_tube_stream_add_multiplexed_bytestream
+ *
+ * Accept a bytestream carrying all the connections made by the recipient to
+ * its local socket, see tube-stream-mux.c.
+ */
+void
+gabble_tube_stream_add_multiplexed_bytestream (GabbleTubeStream *self,
+    GabbleBytestreamIface *bytestream)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  TpBaseChannel *base = TP_BASE_CHANNEL (self);
+  GabbleTubeStreamMux *mux;
+
+  if (!tp_base_channel_is_requested (base))
+    {
+      DEBUG ("I'm not the initiator of this tube, can't accept "
+          "a multiplexed bytestream");
+
+      gabble_bytestream_iface_close (bytestream, NULL);
+      return;
+    }
+
+  mux = gabble_tube_stream_mux_new (bytestream);
+  priv->incoming_muxes = g_slist_prepend (priv->incoming_muxes, mux);
+
+  g_signal_connect (mux, "new-channel",
+      G_CALLBACK (mux_new_channel_cb), self);
+  g_signal_connect (mux, "channel-closed",
+      G_CALLBACK (mux_channel_closed_cb), self);
+  g_signal_connect (mux, "closed", G_CALLBACK (mux_closed_cb), self);
+
+  tube_stream_got_first_connection (self);
+
+  DEBUG ("accept the multiplexed bytestream");
+
+  gabble_bytestream_iface_accept (bytestream, augment_si_accept_iq_multiplex,
+      self);
+}
+
+/*
+ * gabble_tube_stream_add_pooled_bytestream
+ *
+ * Accept a bytestream negotiated in advance by the recipient. We connect to
+ * the socket once the recipient binds a connection to it.
+ */
+void
+gabble_tube_stream_add_pooled_bytestream (GabbleTubeStream *self,
+    GabbleBytestreamIface *bytestream)
+{
+  GabbleTubeStreamPrivate *priv = self->priv;
+  TpBaseChannel *base = TP_BASE_CHANNEL (self);
+
+  if (!tp_base_channel_is_requested (base))
+    {
+      DEBUG ("I'm not the initiator of this tube, can't accept "
+          "a pooled bytestream");
+
+      gabble_bytestream_iface_close (bytestream, NULL);
+      return;
+    }
+
+  DEBUG ("accept the pooled bytestream");
+
+  priv->pooled = g_slist_prepend (priv->pooled, g_object_ref (bytestream));
+
+  g_signal_connect (bytestream, "data-received",
+      G_CALLBACK (data_received_cb), self);
+  g_signal_connect (bytestream, "state-changed",
+      G_CALLBACK (pooled_bytestream_state_changed_cb), self);
+
+  gabble_bytestream_iface_accept (bytestream, augment_si_accept_iq, self);
+}
+
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
 static gboolean
 check_unix_params (TpSocketAddressType address_type,
@@ -2013,6 +2922,12 @@ check_ip_params (TpSocketAddressType address_type,
   return FALSE;
 }
 
+void
+gabble_tube_stream_set_pool_idle_timeout (guint timeout)
+{
+  pool_idle_timeout = timeout;
+}
+
 /* used to check access control parameters both for OfferStreamTube and
  * AcceptStreamTube. In case of AcceptStreamTube, address is NULL because we
  * listen on the socket after the parameters have been accepted
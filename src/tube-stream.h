@@ -25,6 +25,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 #include <telepathy-glib/telepathy-glib-dbus.h>
 
+#include "bytestream-iface.h"
 #include "connection.h"
 #include "extensions/extensions.h"
 #include "muc-channel.h"
@@ -76,10 +77,18 @@ gboolean gabble_tube_stream_check_params (TpSocketAddressType address_type,
 
 gboolean gabble_tube_stream_offer (GabbleTubeStream *self, GError **error);
 
+void gabble_tube_stream_add_multiplexed_bytestream (GabbleTubeStream *self,
+    GabbleBytestreamIface *bytestream);
+
+void gabble_tube_stream_add_pooled_bytestream (GabbleTubeStream *self,
+    GabbleBytestreamIface *bytestream);
+
 GHashTable *gabble_tube_stream_get_supported_socket_types (void);
 
 const gchar * const * gabble_tube_stream_channel_get_allowed_properties (void);
 
+void gabble_tube_stream_set_pool_idle_timeout (guint timeout);
+
 G_END_DECLS
 
 #endif /* #ifndef __GABBLE_TUBE_STREAM_H__ */
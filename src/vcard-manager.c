@@ -143,6 +143,7 @@ struct _GabbleVCardManagerRequest
   GabbleVCardCacheEntry *entry;
   guint timer_id;
   guint timeout;
+  GabbleRequestPipelinePriority priority;
 
   GabbleVCardManagerCb callback;
   gpointer user_data;
@@ -689,6 +690,7 @@ status_changed_cb (GObject *object,
       /* FIXME: we happen to know that synchronous errors can't happen */
       gabble_vcard_manager_request (self,
           tp_base_connection_get_self_handle (base), 0,
+          GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL,
           initial_request_cb, NULL, (GObject *) self);
     }
 }
@@ -1397,6 +1399,8 @@ request_send (GabbleVCardManagerRequest *request, guint timeout)
   if (entry->pipeline_item)
     {
       DEBUG ("adding to cache entry %p with <iq> already pending", entry);
+      gabble_request_pipeline_item_raise_priority (entry->pipeline_item,
+          request->priority);
     }
   else if (entry->suspended_timer_id != 0)
     {
@@ -1428,8 +1432,9 @@ request_send (GabbleVCardManagerRequest *request, guint timeout)
           ')',
           NULL);
 
-      entry->pipeline_item = gabble_request_pipeline_enqueue (
-          conn->req_pipeline, msg, timeout, pipeline_reply_cb, request);
+      entry->pipeline_item = gabble_request_pipeline_enqueue_with_priority (
+          conn->req_pipeline, msg, timeout, request->priority,
+          pipeline_reply_cb, request);
 
       g_object_unref (msg);
 
@@ -1440,6 +1445,9 @@ request_send (GabbleVCardManagerRequest *request, guint timeout)
 /* Request the vCard for the given handle. When it arrives, call the given
  * callback.
  *
+ * If the vCard was already requested with a lower priority, the pending
+ * request is moved ahead to @priority.
+ *
  * The callback may be NULL if you just want the side-effect of this
  * operation, which is to update the cached alias.
  *
@@ -1458,6 +1466,7 @@ GabbleVCardManagerRequest *
 gabble_vcard_manager_request (GabbleVCardManager *self,
                               TpHandle handle,
                               guint timeout,
+                              GabbleRequestPipelinePriority priority,
                               GabbleVCardManagerCb callback,
                               gpointer user_data,
                               GObject *object)
@@ -1480,6 +1489,7 @@ gabble_vcard_manager_request (GabbleVCardManager *self,
   request = g_slice_new0 (GabbleVCardManagerRequest);
   DEBUG ("Created request %p to retrieve <%u>'s vCard", request, handle);
   request->timeout = timeout;
+  request->priority = priority;
   request->manager = self;
   request->entry = entry;
   request->callback = callback;
@@ -1532,7 +1542,8 @@ gabble_vcard_manager_edit (GabbleVCardManager *self,
       DEBUG ("we don't, create one");
       /* create dummy GET request if neccessary */
       gabble_vcard_manager_request (self,
-          tp_base_connection_get_self_handle (base), 0, NULL, NULL, NULL);
+          tp_base_connection_get_self_handle (base), 0,
+          GABBLE_REQUEST_PIPELINE_PRIORITY_NORMAL, NULL, NULL, NULL);
     }
 
   priv->edits = g_list_concat (priv->edits, edits);
@@ -25,6 +25,7 @@
 #include <glib-object.h>
 #include <wocky/wocky.h>
 
+#include "request-pipeline.h"
 #include "types.h"
 
 G_BEGIN_DECLS
@@ -101,6 +102,7 @@ GQuark gabble_vcard_manager_cache_quark (void);
 GabbleVCardManagerRequest *gabble_vcard_manager_request (GabbleVCardManager *,
                                                        TpHandle,
                                                        guint timeout,
+                                                       GabbleRequestPipelinePriority,
                                                        GabbleVCardManagerCb,
                                                        gpointer user_data,
                                                        GObject *object);
@@ -0,0 +1,166 @@
+/*
+ * test-base64.c - Tests for the base64 codec
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "src/base64.h"
+
+static const gchar *implementations[] = { "scalar", "ssse3", "avx2", NULL };
+
+static void
+test_against_glib (const guchar *data,
+                   gsize len)
+{
+  gchar *expected = g_base64_encode (data, len);
+  gchar *encoded = gabble_base64_encode (data, len);
+  gchar *wrapped;
+  guchar *decoded;
+  gsize decoded_len;
+  gint state = 0, save = 0;
+  gsize wrapped_len;
+  /* See the documentation for g_base64_encode_step () */
+  gsize wrapped_size = (len / 3 + 1) * 4 + 4;
+
+  g_assert_cmpstr (encoded, ==, expected);
+  g_assert_cmpuint (strlen (encoded), ==, GABBLE_BASE64_ENCODED_LEN (len));
+
+  decoded = gabble_base64_decode (encoded, &decoded_len);
+  g_assert_cmpuint (decoded_len, ==, len);
+  g_assert (memcmp (decoded, data, len) == 0);
+  g_free (decoded);
+
+  /* vCard BINVALs are line-wrapped */
+  wrapped_size += wrapped_size / 76 + 1;
+  wrapped = g_malloc (wrapped_size + 1);
+  wrapped_len = g_base64_encode_step (data, len, TRUE, wrapped, &state,
+      &save);
+  wrapped_len += g_base64_encode_close (TRUE, wrapped + wrapped_len, &state,
+      &save);
+  wrapped[wrapped_len] = '\0';
+
+  decoded = gabble_base64_decode (wrapped, &decoded_len);
+  g_assert_cmpuint (decoded_len, ==, len);
+  g_assert (memcmp (decoded, data, len) == 0);
+  g_free (decoded);
+
+  g_free (wrapped);
+  g_free (encoded);
+  g_free (expected);
+}
+
+static void
+test_implementation (void)
+{
+  GRand *rand = g_rand_new_with_seed (0xba5e64);
+  guchar data[1024];
+  guint i;
+
+  for (i = 0; i < 2000; i++)
+    {
+      gsize len = g_rand_int_range (rand, 0, sizeof (data));
+      gsize j;
+
+      for (j = 0; j < len; j++)
+        data[j] = g_rand_int (rand);
+
+      test_against_glib (data, len);
+    }
+
+  g_rand_free (rand);
+}
+
+#define BENCHMARK_BLOCK (64 * 1024)
+#define BENCHMARK_ROUNDS 2000
+
+static gdouble
+mb_per_s (gint64 usec)
+{
+  return ((gdouble) BENCHMARK_BLOCK * BENCHMARK_ROUNDS) / MAX (usec, 1);
+}
+
+/* Compare our codec to GLib's one on blocks the size of a IBB stanza */
+static void
+benchmark (const gchar *name)
+{
+  guchar *data = g_malloc (BENCHMARK_BLOCK);
+  gchar *encoded;
+  gint64 start, glib_enc, glib_dec, enc, dec;
+  gsize len;
+  guint i;
+
+  for (i = 0; i < BENCHMARK_BLOCK; i++)
+    data[i] = i * 7;
+
+  encoded = gabble_base64_encode (data, BENCHMARK_BLOCK);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    g_free (g_base64_encode (data, BENCHMARK_BLOCK));
+  glib_enc = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    g_free (g_base64_decode (encoded, &len));
+  glib_dec = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    g_free (gabble_base64_encode (data, BENCHMARK_BLOCK));
+  enc = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    g_free (gabble_base64_decode (encoded, &len));
+  dec = g_get_monotonic_time () - start;
+
+  printf ("%-6s encode: %7.1f MB/s (GLib %7.1f MB/s)  "
+      "decode: %7.1f MB/s (GLib %7.1f MB/s)\n", name,
+      mb_per_s (enc), mb_per_s (glib_enc),
+      mb_per_s (dec), mb_per_s (glib_dec));
+
+  g_free (encoded);
+  g_free (data);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  gboolean bench = (argc > 1 && !strcmp (argv[1], "--benchmark"));
+  guint i;
+
+  for (i = 0; implementations[i] != NULL; i++)
+    {
+      if (!gabble_base64_set_implementation (implementations[i]))
+        continue;
+
+      test_implementation ();
+
+      if (bench)
+        benchmark (implementations[i]);
+    }
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * test-dtube-message-length.c - Tests for the D-Bus tube message parser
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <dbus/dbus.h>
+#include <glib.h>
+
+#include "src/tube-dbus.h"
+
+/* A 16-byte fixed header announcing a @body_length bytes body and a
+ * @params_length bytes header fields array */
+static void
+make_header (gchar *header,
+    gchar endianness,
+    guint32 body_length,
+    guint32 params_length)
+{
+  memset (header, 0, 16);
+  header[0] = endianness;
+
+  if (endianness == DBUS_BIG_ENDIAN)
+    {
+      body_length = GUINT32_TO_BE (body_length);
+      params_length = GUINT32_TO_BE (params_length);
+    }
+  else
+    {
+      body_length = GUINT32_TO_LE (body_length);
+      params_length = GUINT32_TO_LE (params_length);
+    }
+
+  memcpy (header + 4, &body_length, 4);
+  memcpy (header + 12, &params_length, 4);
+}
+
+static void
+test_endianness (void)
+{
+  gchar header[16];
+
+  /* every byte of the lengths matters: the header fields are padded to 8
+   * bytes, 258 -> 264 */
+  make_header (header, DBUS_LITTLE_ENDIAN, 0x10203, 258);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==,
+      16 + 264 + 0x10203);
+
+  make_header (header, DBUS_BIG_ENDIAN, 0x10203, 258);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==,
+      16 + 264 + 0x10203);
+
+  make_header (header, DBUS_BIG_ENDIAN, 0, 8);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==,
+      16 + 8);
+}
+
+static void
+test_invalid (void)
+{
+  gchar header[16];
+
+  make_header (header, DBUS_LITTLE_ENDIAN, 0, 8);
+  header[0] = 'x';
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==, 0);
+
+  make_header (header, DBUS_BIG_ENDIAN, DBUS_MAXIMUM_MESSAGE_LENGTH + 1, 8);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==, 0);
+
+  make_header (header, DBUS_LITTLE_ENDIAN, 8, DBUS_MAXIMUM_ARRAY_LENGTH + 1);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==, 0);
+
+  /* each length is fine, but not the whole message */
+  make_header (header, DBUS_BIG_ENDIAN, DBUS_MAXIMUM_MESSAGE_LENGTH,
+      DBUS_MAXIMUM_ARRAY_LENGTH);
+  g_assert_cmpuint (_gabble_tube_dbus_get_message_length (header), ==, 0);
+}
+
+/* The length of messages marshalled by libdbus itself */
+static void
+test_marshalled (void)
+{
+  guint sizes[] = { 0, 1, 255, 256, 257, 65536, 70000 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      DBusMessage *msg;
+      gchar *payload;
+      gchar *data;
+      int len;
+
+      msg = dbus_message_new_signal ("/org/example/Test", "org.example.Test",
+          "Payload");
+
+      payload = g_malloc (sizes[i] + 1);
+      memset (payload, 'a', sizes[i]);
+      payload[sizes[i]] = '\0';
+      g_assert (dbus_message_append_args (msg, DBUS_TYPE_STRING, &payload,
+            DBUS_TYPE_INVALID));
+
+      g_assert (dbus_message_marshal (msg, &data, &len));
+      g_assert_cmpint (len, >=, 16);
+      g_assert_cmpuint (_gabble_tube_dbus_get_message_length (data), ==, len);
+
+      dbus_free (data);
+      g_free (payload);
+      dbus_message_unref (msg);
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/dtube-message-length/endianness", test_endianness);
+  g_test_add_func ("/dtube-message-length/invalid", test_invalid);
+  g_test_add_func ("/dtube-message-length/marshalled", test_marshalled);
+
+  return g_test_run ();
+}
@@ -0,0 +1,361 @@
+/*
+ * test-fd-transport.c - Tests for GibberFdTransport's read path and relay
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "lib/gibber/gibber-fd-transport.h"
+
+typedef struct {
+    GibberTransport *transport;
+    /* the other end of the socket pair */
+    int peer;
+    GByteArray *received;
+    guint buffers;
+    gsize biggest_buffer;
+} Fixture;
+
+static void
+handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  g_byte_array_append (f->received, buffer->data, buffer->length);
+  f->buffers++;
+  f->biggest_buffer = MAX (f->biggest_buffer, buffer->length);
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  int fds[2];
+
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+  f->transport = g_object_new (GIBBER_TYPE_FD_TRANSPORT, NULL);
+  gibber_fd_transport_set_fd (GIBBER_FD_TRANSPORT (f->transport), fds[0],
+      TRUE);
+  gibber_transport_set_handler (f->transport, handler, f);
+
+  f->peer = fds[1];
+  f->received = g_byte_array_new ();
+  f->buffers = 0;
+  f->biggest_buffer = 0;
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data)
+{
+  if (f->transport != NULL)
+    g_object_unref (f->transport);
+
+  if (f->peer != -1)
+    close (f->peer);
+
+  g_byte_array_unref (f->received);
+}
+
+static void
+peer_write (Fixture *f,
+    gsize len)
+{
+  guint8 *data = g_malloc (len);
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    data[i] = i % 251;
+
+  g_assert_cmpint (write (f->peer, data, len), ==, len);
+  g_free (data);
+}
+
+static void
+wait_for (Fixture *f,
+    gsize len)
+{
+  while (f->received->len < len)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (f->received->len, ==, len);
+}
+
+static gsize
+buffer_size (Fixture *f)
+{
+  gsize size;
+
+  gibber_fd_transport_get_read_stats (GIBBER_FD_TRANSPORT (f->transport),
+      NULL, NULL, &size);
+
+  return size;
+}
+
+/* Whatever is pending is drained in one go, the buffer growing as needed */
+static void
+test_grow (Fixture *f,
+    gconstpointer data)
+{
+  guint64 wakeups, bytes;
+
+  peer_write (f, 32 * 1024);
+  wait_for (f, 32 * 1024);
+
+  g_assert_cmpuint (f->buffers, ==, 1);
+  g_assert_cmpuint (f->biggest_buffer, ==, 32 * 1024);
+  g_assert_cmpuint (buffer_size (f), >=, 32 * 1024);
+
+  gibber_fd_transport_get_read_stats (GIBBER_FD_TRANSPORT (f->transport),
+      &wakeups, &bytes, NULL);
+  g_assert_cmpuint (wakeups, ==, 1);
+  g_assert_cmpuint (bytes, ==, 32 * 1024);
+}
+
+/* The buffer never grows over the maximum read size */
+static void
+test_max_read_size (Fixture *f,
+    gconstpointer data)
+{
+  gibber_fd_transport_set_max_read_size (GIBBER_FD_TRANSPORT (f->transport),
+      8192);
+
+  peer_write (f, 32 * 1024);
+  wait_for (f, 32 * 1024);
+
+  g_assert_cmpuint (f->buffers, >=, 4);
+  g_assert_cmpuint (f->biggest_buffer, <=, 8192);
+  g_assert_cmpuint (buffer_size (f), ==, 8192);
+}
+
+/* A run of small reads halves the buffer, down to its minimum size */
+static void
+test_shrink (Fixture *f,
+    gconstpointer data)
+{
+  gsize expected = 0;
+  gsize grown;
+  guint i;
+
+  peer_write (f, 32 * 1024);
+  expected += 32 * 1024;
+  wait_for (f, expected);
+
+  grown = buffer_size (f);
+  g_assert_cmpuint (grown, >=, 32 * 1024);
+
+  /* under-used wakeups, but not enough of them to shrink it yet */
+  for (i = 0; i < 7; i++)
+    {
+      peer_write (f, 10);
+      expected += 10;
+      wait_for (f, expected);
+    }
+
+  g_assert_cmpuint (buffer_size (f), ==, grown);
+
+  peer_write (f, 10);
+  expected += 10;
+  wait_for (f, expected);
+
+  g_assert_cmpuint (buffer_size (f), ==, grown / 2);
+
+  /* a read using a good part of the buffer resets the count */
+  for (i = 0; i < 7; i++)
+    {
+      peer_write (f, 10);
+      expected += 10;
+      wait_for (f, expected);
+    }
+
+  peer_write (f, grown / 4);
+  expected += grown / 4;
+  wait_for (f, expected);
+
+  peer_write (f, 10);
+  expected += 10;
+  wait_for (f, expected);
+
+  g_assert_cmpuint (buffer_size (f), ==, grown / 2);
+
+  /* never goes under 4 KiB */
+  for (i = 0; i < 100; i++)
+    {
+      peer_write (f, 10);
+      expected += 10;
+      wait_for (f, expected);
+    }
+
+  g_assert_cmpuint (buffer_size (f), ==, 4096);
+}
+
+static void
+unref_handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  handler (transport, buffer, user_data);
+
+  /* like tubes and file transfers do when the other side goes away */
+  g_object_unref (f->transport);
+  f->transport = NULL;
+}
+
+/* The handler dropping the last reference to the transport when it gets
+ * the data read just before an EOF must not be a problem */
+static void
+test_unref_on_eof (Fixture *f,
+    gconstpointer data)
+{
+  gpointer weak;
+
+  gibber_transport_set_handler (f->transport, unref_handler, f);
+
+  weak = f->transport;
+  g_object_add_weak_pointer (G_OBJECT (f->transport), &weak);
+
+  /* exactly fills the initial buffer, so that the following read in the same
+   * wakeup hits the EOF */
+  peer_write (f, 4096);
+  close (f->peer);
+  f->peer = -1;
+
+  wait_for (f, 4096);
+  g_assert (weak == NULL);
+}
+
+static void
+splice_cb (GibberFdTransport *transport,
+    gsize written,
+    gpointer user_data)
+{
+  gsize *spliced = user_data;
+
+  *spliced += written;
+}
+
+/* Data relayed with splice () goes after what was already queued on the
+ * target, and all of it gets there */
+static void
+test_splice (Fixture *f,
+    gconstpointer data)
+{
+  GibberTransport *target;
+  int fds[2];
+  guint8 *queued, *relayed;
+  GByteArray *out;
+  gsize spliced = 0;
+  gsize i;
+  const gsize queued_len = 1024 * 1024;
+  const gsize relayed_len = 256 * 1024;
+
+  if (!gibber_fd_transport_splice_supported ())
+    return;
+
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  g_assert (fcntl (fds[1], F_SETFL, O_NONBLOCK) == 0);
+
+  target = g_object_new (GIBBER_TYPE_FD_TRANSPORT, NULL);
+  gibber_fd_transport_set_fd (GIBBER_FD_TRANSPORT (target), fds[0], TRUE);
+
+  /* more than the socket can take, so most of it stays in the target's
+   * output queue */
+  queued = g_malloc (queued_len);
+  memset (queued, 'q', queued_len);
+  g_assert (gibber_transport_send (target, queued, queued_len, NULL));
+  g_assert (!gibber_transport_buffer_is_empty (target));
+
+  g_assert (gibber_fd_transport_splice_to (GIBBER_FD_TRANSPORT (f->transport),
+        GIBBER_FD_TRANSPORT (target), splice_cb, &spliced));
+
+  relayed = g_malloc (relayed_len);
+  memset (relayed, 'r', relayed_len);
+  g_assert_cmpint (write (f->peer, relayed, 4096), ==, 4096);
+
+  out = g_byte_array_new ();
+  i = 4096;
+
+  while (out->len < queued_len + relayed_len)
+    {
+      guint8 buf[65536];
+      ssize_t ret;
+
+      g_main_context_iteration (NULL, FALSE);
+
+      ret = read (fds[1], buf, sizeof (buf));
+      if (ret > 0)
+        g_byte_array_append (out, buf, ret);
+      else
+        g_assert (ret == -1 && errno == EAGAIN);
+
+      /* keep the relay busy while the target flushes its queue */
+      if (i < relayed_len)
+        {
+          ret = write (f->peer, relayed + i, MIN (4096, relayed_len - i));
+          if (ret > 0)
+            i += ret;
+        }
+    }
+
+  g_assert (memcmp (out->data, queued, queued_len) == 0);
+  g_assert (memcmp (out->data + queued_len, relayed, relayed_len) == 0);
+  g_assert_cmpuint (spliced, ==, relayed_len);
+
+  /* the handler never saw the relayed data */
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  gibber_fd_transport_stop_splice (GIBBER_FD_TRANSPORT (f->transport));
+  g_object_unref (target);
+  close (fds[1]);
+  g_byte_array_unref (out);
+  g_free (relayed);
+  g_free (queued);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/fd-transport/grow", Fixture, NULL, setup, test_grow,
+      teardown);
+  g_test_add ("/fd-transport/max-read-size", Fixture, NULL, setup,
+      test_max_read_size, teardown);
+  g_test_add ("/fd-transport/shrink", Fixture, NULL, setup, test_shrink,
+      teardown);
+  g_test_add ("/fd-transport/unref-on-eof", Fixture, NULL, setup,
+      test_unref_on_eof, teardown);
+  g_test_add ("/fd-transport/splice", Fixture, NULL, setup, test_splice,
+      teardown);
+
+  return g_test_run ();
+}
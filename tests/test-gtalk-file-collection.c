@@ -0,0 +1,209 @@
+/*
+ * test-gtalk-file-collection.c - Tests for the Google Share request pipeline
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "src/gtalk-file-collection.h"
+
+/* MAX_PIPELINED_REQUESTS in src/gtalk-file-collection.c */
+#define PIPELINE_SIZE 4
+#define N_CHANNELS 6
+
+/* The channels are stand-ins, the pipeline never dereferences them */
+#define CHANNEL(i) GINT_TO_POINTER ((i) + 1)
+
+typedef struct {
+    GQueue requests;
+    GList *channels;
+    GHashTable *usable;
+    GHashTable *requested;
+} Fixture;
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  gint i;
+
+  g_queue_init (&f->requests);
+  f->usable = g_hash_table_new (NULL, NULL);
+  f->requested = g_hash_table_new (NULL, NULL);
+
+  for (i = N_CHANNELS - 1; i >= 0; i--)
+    f->channels = g_list_prepend (f->channels, CHANNEL (i));
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data)
+{
+  g_queue_clear (&f->requests);
+  g_list_free (f->channels);
+  g_hash_table_unref (f->usable);
+  g_hash_table_unref (f->requested);
+}
+
+static void
+accept_channel (Fixture *f,
+    gint i)
+{
+  g_hash_table_replace (f->usable, CHANNEL (i), GINT_TO_POINTER (TRUE));
+}
+
+static GList *
+fill (Fixture *f)
+{
+  return _gtalk_file_collection_fill_pipeline (&f->requests, f->channels,
+      f->usable, f->requested);
+}
+
+static void
+test_pipelined (Fixture *f,
+    gconstpointer data)
+{
+  GList *pushed;
+  gint i;
+
+  /* nothing has been accepted */
+  g_assert (fill (f) == NULL);
+
+  for (i = 0; i < N_CHANNELS; i++)
+    accept_channel (f, i);
+
+  /* as many requests as the pipeline holds go at once, in order */
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, PIPELINE_SIZE);
+  g_assert_cmpuint (f->requests.length, ==, PIPELINE_SIZE);
+
+  for (i = 0; i < PIPELINE_SIZE; i++)
+    {
+      g_assert (g_list_nth_data (pushed, i) == CHANNEL (i));
+      g_assert (g_queue_peek_nth (&f->requests, i) == CHANNEL (i));
+
+      /* requested files are still usable, so they can be accepted once
+       * the session is active */
+      g_assert (GPOINTER_TO_INT (g_hash_table_lookup (f->usable,
+              CHANNEL (i))));
+    }
+
+  g_list_free (pushed);
+
+  /* the pipeline is full */
+  g_assert (fill (f) == NULL);
+
+  /* the first response is over: the second one comes, and the fifth file
+   * is requested, not the first one again */
+  g_assert (_gtalk_file_collection_next_request (&f->requests) ==
+      CHANNEL (1));
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, 1);
+  g_assert (pushed->data == CHANNEL (4));
+  g_list_free (pushed);
+
+  g_assert (_gtalk_file_collection_next_request (&f->requests) ==
+      CHANNEL (2));
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, 1);
+  g_assert (pushed->data == CHANNEL (5));
+  g_list_free (pushed);
+
+  /* everything has been requested */
+  g_assert (_gtalk_file_collection_next_request (&f->requests) ==
+      CHANNEL (3));
+  g_assert (fill (f) == NULL);
+  g_assert_cmpuint (f->requests.length, ==, 3);
+}
+
+static void
+test_accepted_later (Fixture *f,
+    gconstpointer data)
+{
+  GList *pushed;
+
+  accept_channel (f, 3);
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, 1);
+  g_assert (pushed->data == CHANNEL (3));
+  g_list_free (pushed);
+
+  /* a file accepted while another one is being received is requested
+   * straight away */
+  accept_channel (f, 1);
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, 1);
+  g_assert (pushed->data == CHANNEL (1));
+  g_list_free (pushed);
+
+  g_assert (g_queue_peek_head (&f->requests) == CHANNEL (3));
+  g_assert (g_queue_peek_tail (&f->requests) == CHANNEL (1));
+}
+
+static void
+test_removed (Fixture *f,
+    gconstpointer data)
+{
+  GList *pushed;
+  gint i;
+
+  for (i = 0; i < 3; i++)
+    accept_channel (f, i);
+
+  pushed = fill (f);
+  g_assert_cmpuint (g_list_length (pushed), ==, 3);
+  g_list_free (pushed);
+
+  /* the second channel goes away while its request is in flight */
+  g_hash_table_remove (f->usable, CHANNEL (1));
+  g_hash_table_remove (f->requested, CHANNEL (1));
+  _gtalk_file_collection_forget_request (&f->requests, CHANNEL (1));
+
+  /* its response will still come, so it keeps its place */
+  g_assert_cmpuint (f->requests.length, ==, 3);
+
+  /* the next response is the one to skip */
+  g_assert (_gtalk_file_collection_next_request (&f->requests) == NULL);
+  g_assert_cmpuint (f->requests.length, ==, 2);
+
+  /* then the third file's */
+  g_assert (_gtalk_file_collection_next_request (&f->requests) ==
+      CHANNEL (2));
+  g_assert_cmpuint (f->requests.length, ==, 1);
+
+  g_assert (_gtalk_file_collection_next_request (&f->requests) == NULL);
+  g_assert_cmpuint (f->requests.length, ==, 0);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/gtalk-file-collection/pipelined", Fixture, NULL, setup,
+      test_pipelined, teardown);
+  g_test_add ("/gtalk-file-collection/accepted-later", Fixture, NULL, setup,
+      test_accepted_later, teardown);
+  g_test_add ("/gtalk-file-collection/removed", Fixture, NULL, setup,
+      test_removed, teardown);
+
+  return g_test_run ();
+}
@@ -0,0 +1,443 @@
+/*
+ * test-transfer-scheduler.c - Tests for GabbleTransferScheduler
+ * Copyright (C) 2026 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include "src/bytestream-iface.h"
+#include "src/transfer-scheduler.h"
+
+/* TICK_MS in src/transfer-scheduler.c */
+#define TICK_MS 100
+
+/* 2000 bytes per tick */
+#define RATE_LIMIT 20000
+#define SHARE (RATE_LIMIT * TICK_MS / 1000)
+
+#define FILE_SIZE (10 * SHARE)
+
+static GMainLoop *loop = NULL;
+
+/* A bytestream counting what it's given to send, standing in for the
+ * network */
+
+typedef struct {
+    GObject parent;
+
+    GabbleBytestreamState state;
+    gsize sent;
+    gboolean read_blocked;
+} TestBytestream;
+
+typedef struct {
+    GObjectClass parent_class;
+} TestBytestreamClass;
+
+static void test_bytestream_iface_init (gpointer g_iface, gpointer data);
+
+G_DEFINE_TYPE_WITH_CODE (TestBytestream, test_bytestream, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE (GABBLE_TYPE_BYTESTREAM_IFACE,
+      test_bytestream_iface_init));
+
+#define TEST_BYTESTREAM(o) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((o), test_bytestream_get_type (), \
+      TestBytestream))
+
+enum
+{
+  PROP_CONNECTION = 1,
+  PROP_PEER_HANDLE,
+  PROP_PEER_HANDLE_TYPE,
+  PROP_STREAM_ID,
+  PROP_PEER_JID,
+  PROP_STATE,
+  PROP_PROTOCOL
+};
+
+static void
+test_bytestream_init (TestBytestream *self)
+{
+  self->state = GABBLE_BYTESTREAM_STATE_OPEN;
+}
+
+static void
+test_bytestream_get_property (GObject *object,
+    guint property_id,
+    GValue *value,
+    GParamSpec *pspec)
+{
+  TestBytestream *self = TEST_BYTESTREAM (object);
+
+  switch (property_id)
+    {
+      case PROP_STATE:
+        g_value_set_uint (value, self->state);
+        break;
+      default:
+        /* The others keep their default values */
+        break;
+    }
+}
+
+static void
+test_bytestream_set_property (GObject *object,
+    guint property_id,
+    const GValue *value,
+    GParamSpec *pspec)
+{
+}
+
+static void
+test_bytestream_class_init (TestBytestreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->get_property = test_bytestream_get_property;
+  object_class->set_property = test_bytestream_set_property;
+
+  g_object_class_override_property (object_class, PROP_CONNECTION,
+      "connection");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE,
+      "peer-handle");
+  g_object_class_override_property (object_class, PROP_PEER_HANDLE_TYPE,
+      "peer-handle-type");
+  g_object_class_override_property (object_class, PROP_STREAM_ID,
+      "stream-id");
+  g_object_class_override_property (object_class, PROP_PEER_JID,
+      "peer-jid");
+  g_object_class_override_property (object_class, PROP_STATE,
+      "state");
+  g_object_class_override_property (object_class, PROP_PROTOCOL,
+      "protocol");
+}
+
+static gboolean
+test_bytestream_send (GabbleBytestreamIface *iface,
+    guint len,
+    const gchar *str)
+{
+  TestBytestream *self = TEST_BYTESTREAM (iface);
+
+  g_assert (self->state == GABBLE_BYTESTREAM_STATE_OPEN);
+
+  self->sent += len;
+
+  /* Stop at the first refill */
+  if (loop != NULL)
+    g_main_loop_quit (loop);
+
+  return TRUE;
+}
+
+static void
+test_bytestream_close (GabbleBytestreamIface *iface,
+    GError *error)
+{
+  TestBytestream *self = TEST_BYTESTREAM (iface);
+
+  if (self->state == GABBLE_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  self->state = GABBLE_BYTESTREAM_STATE_CLOSED;
+  g_signal_emit_by_name (self, "state-changed", self->state);
+}
+
+static void
+test_bytestream_block_reading (GabbleBytestreamIface *iface,
+    gboolean block)
+{
+  TEST_BYTESTREAM (iface)->read_blocked = block;
+}
+
+static void
+test_bytestream_iface_init (gpointer g_iface,
+    gpointer data)
+{
+  GabbleBytestreamIfaceClass *klass = g_iface;
+
+  klass->send = test_bytestream_send;
+  klass->close = test_bytestream_close;
+  klass->block_reading = test_bytestream_block_reading;
+}
+
+typedef struct {
+    GabbleTransferScheduler *scheduler;
+    TestBytestream *wrapped[2];
+    GabbleBytestreamIface *flow[2];
+    gboolean write_blocked[2];
+    gchar *data;
+} Fixture;
+
+static void
+write_blocked_cb (GabbleBytestreamIface *flow,
+    gboolean blocked,
+    gboolean *write_blocked)
+{
+  *write_blocked = blocked;
+}
+
+static void
+add_flow (Fixture *f,
+    guint i)
+{
+  f->wrapped[i] = g_object_new (test_bytestream_get_type (), NULL);
+  f->flow[i] = gabble_transfer_scheduler_add_bulk (f->scheduler,
+      GABBLE_BYTESTREAM_IFACE (f->wrapped[i]));
+
+  g_assert (f->flow[i] != GABBLE_BYTESTREAM_IFACE (f->wrapped[i]));
+  g_signal_connect (f->flow[i], "write-blocked",
+      G_CALLBACK (write_blocked_cb), &f->write_blocked[i]);
+}
+
+/* Run the main loop until the next tick refills the flows */
+static void
+wait_refill (void)
+{
+  loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+  loop = NULL;
+}
+
+static gboolean
+quit_cb (gpointer data)
+{
+  g_main_loop_quit (data);
+  return FALSE;
+}
+
+/* Run the main loop for @ms, whatever is sent in the meantime */
+static void
+wait_ms (guint ms)
+{
+  GMainLoop *timed_loop = g_main_loop_new (NULL, FALSE);
+
+  g_timeout_add (ms, quit_cb, timed_loop);
+  g_main_loop_run (timed_loop);
+  g_main_loop_unref (timed_loop);
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  f->data = g_malloc0 (FILE_SIZE);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (f->flow); i++)
+    {
+      if (f->flow[i] != NULL)
+        g_object_unref (f->flow[i]);
+
+      if (f->wrapped[i] != NULL)
+        g_object_unref (f->wrapped[i]);
+    }
+
+  if (f->scheduler != NULL)
+    g_object_unref (f->scheduler);
+
+  g_free (f->data);
+}
+
+static void
+test_unlimited (Fixture *f,
+    gconstpointer data)
+{
+  TestBytestream *wrapped = g_object_new (test_bytestream_get_type (), NULL);
+  GabbleBytestreamIface *flow;
+
+  f->scheduler = gabble_transfer_scheduler_new (0, 0);
+
+  /* Nothing to throttle */
+  flow = gabble_transfer_scheduler_add_bulk (f->scheduler,
+      GABBLE_BYTESTREAM_IFACE (wrapped));
+  g_assert (flow == GABBLE_BYTESTREAM_IFACE (wrapped));
+
+  g_object_unref (flow);
+  g_object_unref (wrapped);
+}
+
+static void
+test_flow_rate_limit (Fixture *f,
+    gconstpointer data)
+{
+  guint ticks = 0;
+
+  f->scheduler = gabble_transfer_scheduler_new (0, RATE_LIMIT);
+  add_flow (f, 0);
+
+  /* A single read of the whole file only gets its share through, and the
+   * user is told to stop reading */
+  g_assert (gabble_bytestream_iface_send (f->flow[0], FILE_SIZE, f->data));
+  g_assert_cmpuint (f->wrapped[0]->sent, ==, SHARE);
+  g_assert (f->write_blocked[0]);
+  g_assert (f->wrapped[0]->read_blocked);
+
+  /* The rest goes one share per tick */
+  while (f->wrapped[0]->sent < FILE_SIZE)
+    {
+      gsize before = f->wrapped[0]->sent;
+
+      wait_refill ();
+      ticks++;
+
+      g_assert_cmpuint (f->wrapped[0]->sent - before, ==, SHARE);
+    }
+
+  g_assert_cmpuint (ticks, ==, FILE_SIZE / SHARE - 1);
+
+  /* Once everything went out, the next refill unblocks the user */
+  g_assert (f->write_blocked[0]);
+  wait_ms (TICK_MS * 3 / 2);
+  g_assert (!f->write_blocked[0]);
+  g_assert (!f->wrapped[0]->read_blocked);
+  g_assert_cmpuint (f->wrapped[0]->sent, ==, FILE_SIZE);
+}
+
+static void
+test_fair_share (Fixture *f,
+    gconstpointer data)
+{
+  GError e = { TP_ERROR, TP_ERROR_CANCELLED, "cancelled" };
+  guint i;
+
+  f->scheduler = gabble_transfer_scheduler_new (RATE_LIMIT, 0);
+  add_flow (f, 0);
+  add_flow (f, 1);
+
+  /* The first flow was alone when it was added, the second one gets the
+   * share it will have from now on */
+  g_assert (gabble_bytestream_iface_send (f->flow[0], FILE_SIZE, f->data));
+  g_assert (gabble_bytestream_iface_send (f->flow[1], FILE_SIZE, f->data));
+  g_assert_cmpuint (f->wrapped[0]->sent, ==, SHARE);
+  g_assert_cmpuint (f->wrapped[1]->sent, ==, SHARE / 2);
+
+  /* Each refill splits the budget evenly */
+  for (i = 0; i < 4; i++)
+    {
+      gsize before[2] = { f->wrapped[0]->sent, f->wrapped[1]->sent };
+
+      wait_refill ();
+
+      g_assert_cmpuint (f->wrapped[0]->sent - before[0], ==, SHARE / 2);
+      g_assert_cmpuint (f->wrapped[1]->sent - before[1], ==, SHARE / 2);
+    }
+
+  /* Once a flow is over, the other one gets the whole budget */
+  gabble_bytestream_iface_close (f->flow[1], &e);
+  g_assert (f->wrapped[1]->state == GABBLE_BYTESTREAM_STATE_CLOSED);
+
+  for (i = 0; i < 2; i++)
+    {
+      gsize before = f->wrapped[0]->sent;
+
+      wait_refill ();
+
+      g_assert_cmpuint (f->wrapped[0]->sent - before, ==, SHARE);
+    }
+}
+
+static void
+test_interactive_charge (Fixture *f,
+    gconstpointer data)
+{
+  gsize before;
+  gint64 start;
+
+  f->scheduler = gabble_transfer_scheduler_new (RATE_LIMIT, 0);
+  add_flow (f, 0);
+
+  g_assert (gabble_bytestream_iface_send (f->flow[0], FILE_SIZE, f->data));
+  g_assert_cmpuint (f->wrapped[0]->sent, ==, SHARE);
+
+  /* What tubes used until the next tick is taken from the bulk budget */
+  gabble_transfer_scheduler_charge (f->scheduler, SHARE * 3 / 4);
+  before = f->wrapped[0]->sent;
+  wait_refill ();
+  g_assert_cmpuint (f->wrapped[0]->sent - before, ==, SHARE / 4);
+
+  /* But only for that tick */
+  before = f->wrapped[0]->sent;
+  wait_refill ();
+  g_assert_cmpuint (f->wrapped[0]->sent - before, ==, SHARE);
+
+  /* Tubes can use more than the whole budget; they are never slowed down,
+   * the bulk transfers skip a tick instead */
+  gabble_transfer_scheduler_charge (f->scheduler, SHARE * 2);
+  before = f->wrapped[0]->sent;
+  start = g_get_monotonic_time ();
+  wait_refill ();
+  g_assert_cmpint (g_get_monotonic_time () - start, >=,
+      TICK_MS * 3 / 2 * 1000);
+  g_assert_cmpuint (f->wrapped[0]->sent - before, ==, SHARE);
+}
+
+static void
+test_close_pending (Fixture *f,
+    gconstpointer data)
+{
+  f->scheduler = gabble_transfer_scheduler_new (0, RATE_LIMIT);
+  add_flow (f, 0);
+
+  g_assert (gabble_bytestream_iface_send (f->flow[0], SHARE * 3, f->data));
+
+  /* Closing cleanly waits for what was already given to us to be sent, even
+   * if our user forgot about us */
+  gabble_bytestream_iface_close (f->flow[0], NULL);
+  g_object_unref (f->flow[0]);
+  f->flow[0] = NULL;
+  g_assert (f->wrapped[0]->state == GABBLE_BYTESTREAM_STATE_OPEN);
+
+  wait_refill ();
+  g_assert (f->wrapped[0]->state == GABBLE_BYTESTREAM_STATE_OPEN);
+
+  wait_refill ();
+  g_assert_cmpuint (f->wrapped[0]->sent, ==, SHARE * 3);
+  g_assert (f->wrapped[0]->state == GABBLE_BYTESTREAM_STATE_CLOSED);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_type_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/transfer-scheduler/unlimited", Fixture, NULL, setup,
+      test_unlimited, teardown);
+  g_test_add ("/transfer-scheduler/flow-rate-limit", Fixture, NULL, setup,
+      test_flow_rate_limit, teardown);
+  g_test_add ("/transfer-scheduler/fair-share", Fixture, NULL, setup,
+      test_fair_share, teardown);
+  g_test_add ("/transfer-scheduler/interactive-charge", Fixture, NULL, setup,
+      test_interactive_charge, teardown);
+  g_test_add ("/transfer-scheduler/close-pending", Fixture, NULL, setup,
+      test_close_pending, teardown);
+
+  return g_test_run ();
+}
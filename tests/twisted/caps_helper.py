@@ -32,6 +32,7 @@ FIXED_CAPS = FIXED_JINGLE_CAPS + [
     ns.SI,
     ns.IBB,
     ns.BYTESTREAMS,
+    ns.TUBES_ZLIB,
     ]
 
 JINGLE_CAPS = [
@@ -28,6 +28,11 @@ def test(q, bus, conn, stream):
         b = proto_props[key]
         assertEquals(a, b)
 
+    # the file transfer bandwidth is unlimited by default
+    params = dict((p[0], p[1:]) for p in proto_props['Parameters'])
+    for name in ['transfer-rate-limit', 'transfer-channel-rate-limit']:
+        assertEquals((cs.PARAM_HAS_DEFAULT, 'u', 0), params[name])
+
     assertEquals('foo@mit.edu',
         unwrap(proto_iface.NormalizeContact('foo@MIT.Edu/Telepathy')))
 
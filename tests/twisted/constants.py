@@ -54,6 +54,7 @@ CHANNEL_IFACE_ROOM = CHANNEL + '.Interface.Room2'
 CHANNEL_IFACE_ROOM_CONFIG = CHANNEL + '.Interface.RoomConfig1'
 CHANNEL_IFACE_SUBJECT = CHANNEL + '.Interface.Subject2'
 CHANNEL_IFACE_FILE_TRANSFER_METADATA = CHANNEL + '.Interface.FileTransfer.Metadata'
+CHANNEL_IFACE_GABBLE_HASH_CHECK = CHANNEL + '.Interface.Gabble.HashCheck'
 CHANNEL_IFACE_SMS = CHANNEL + '.Interface.SMS'
 
 CHANNEL_TYPE_CALL = CHANNEL + ".Type.Call1"
@@ -309,6 +310,8 @@ SOCKET_ACCESS_CONTROL_LOCALHOST = 0
 SOCKET_ACCESS_CONTROL_PORT = 1
 SOCKET_ACCESS_CONTROL_NETMASK = 2
 SOCKET_ACCESS_CONTROL_CREDENTIALS = 3
+# Gabble-specific, see GABBLE_SOCKET_ACCESS_CONTROL_FD_PASSING
+SOCKET_ACCESS_CONTROL_FD_PASSING = 0x100
 
 TUBE_STATE_LOCAL_PENDING = 0
 TUBE_STATE_REMOTE_PENDING = 1
@@ -357,6 +360,11 @@ FILE_HASH_TYPE_MD5 = 1
 FILE_HASH_TYPE_SHA1 = 2
 FILE_HASH_TYPE_SHA256 = 3
 
+# Gabble-specific, see Channel_Interface_Gabble_Hash_Check.xml
+FILE_HASH_CHECK_RESULT_NOT_CHECKED = 0
+FILE_HASH_CHECK_RESULT_MATCH = 1
+FILE_HASH_CHECK_RESULT_MISMATCH = 2
+
 FT_STATE = CHANNEL_TYPE_FILE_TRANSFER + '.State'
 FT_CONTENT_TYPE = CHANNEL_TYPE_FILE_TRANSFER + '.ContentType'
 FT_FILENAME = CHANNEL_TYPE_FILE_TRANSFER + '.Filename'
@@ -372,6 +380,7 @@ FT_FILE_COLLECTION = CHANNEL_TYPE_FILE_TRANSFER + '.FileCollection'
 FT_URI = CHANNEL_TYPE_FILE_TRANSFER + '.URI'
 FT_SERVICE_NAME = CHANNEL_IFACE_FILE_TRANSFER_METADATA + '.ServiceName'
 FT_METADATA = CHANNEL_IFACE_FILE_TRANSFER_METADATA + '.Metadata'
+FT_HASH_CHECK_RESULT = CHANNEL_IFACE_GABBLE_HASH_CHECK + '.HashCheckResult'
 
 GF_CAN_ADD = 1
 GF_CAN_REMOVE = 2
@@ -4,6 +4,7 @@ import hashlib
 import time
 import datetime
 import os
+import ctypes
 
 from servicetest import EventPattern, assertEquals, assertSameSets, call_async
 from gabbletest import exec_test, sync_stream, make_result_iq
@@ -70,7 +71,8 @@ class FileTransferTest(object):
         if os.name == 'posix':
             # true on at least Linux
             assertEquals(sock_types.get(cs.SOCKET_ADDRESS_TYPE_UNIX),
-                    [cs.SOCKET_ACCESS_CONTROL_LOCALHOST])
+                    [cs.SOCKET_ACCESS_CONTROL_LOCALHOST,
+                     cs.SOCKET_ACCESS_CONTROL_FD_PASSING])
 
     def connect(self):
         vcard_event, roster_event, disco_event = self.q.expect_many(
@@ -194,9 +196,14 @@ class ReceiveFileTest(FileTransferTest):
             metadata_form = {ns.TP_FT_METADATA: self.metadata}
             add_data_forms(file_node, metadata_form)
 
+        self.augment_si_offer(si)
+
         # so... lunch?
         iq.send()
 
+    def augment_si_offer(self, si):
+        pass
+
     def check_new_channel(self):
         def is_ft_channel_event(event):
             channels, = event.args
@@ -220,6 +227,7 @@ class ReceiveFileTest(FileTransferTest):
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER
         assertSameSets(
             [ cs.CHANNEL_IFACE_FILE_TRANSFER_METADATA,
+              cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
             ], props[cs.INTERFACES])
         assert props[cs.TARGET_HANDLE] == self.handle
         assert props[cs.TARGET_ID] == self.contact_name
@@ -355,6 +363,15 @@ class ReceiveFileTest(FileTransferTest):
         assert state == cs.FT_STATE_COMPLETED
         assert reason == cs.FT_STATE_CHANGE_REASON_NONE
 
+        # the start of a resumed file doesn't go through Gabble
+        if self.file.offset == 0:
+            expected = cs.FILE_HASH_CHECK_RESULT_MATCH
+        else:
+            expected = cs.FILE_HASH_CHECK_RESULT_NOT_CHECKED
+
+        assertEquals(expected, self.ft_props.Get(
+            cs.CHANNEL_IFACE_GABBLE_HASH_CHECK, 'HashCheckResult'))
+
 class SendFileTest(FileTransferTest):
     def __init__(self, bytestream_cls, file, address_type, access_control, acces_control_param):
         FileTransferTest.__init__(self, bytestream_cls, file, address_type, access_control, acces_control_param)
@@ -411,6 +428,7 @@ class SendFileTest(FileTransferTest):
         assertEquals(cs.CHANNEL_TYPE_FILE_TRANSFER, props[cs.CHANNEL_TYPE])
         assertSameSets(
             [ cs.CHANNEL_IFACE_FILE_TRANSFER_METADATA,
+              cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
             ], props[cs.INTERFACES])
         assertEquals(self.handle, props[cs.TARGET_HANDLE])
         assertEquals(self.contact_name, props[cs.TARGET_ID])
@@ -507,10 +525,13 @@ class SendFileTest(FileTransferTest):
 
         self.bytestream.wait_bytestream_open()
 
+    def provide_data(self, s):
+        s.send(self.file.data[self.file.offset:])
+
     def send_file(self):
         s = self.create_socket()
         s.connect(self.address)
-        s.send(self.file.data[self.file.offset:])
+        self.provide_data(s)
 
         to_receive = self.file.size - self.file.offset
         self.count = 0
@@ -555,6 +576,49 @@ class SendFileTest(FileTransferTest):
             assert state == cs.FT_STATE_COMPLETED
             assert reason == cs.FT_STATE_CHANGE_REASON_NONE
 
+class _iovec(ctypes.Structure):
+    _fields_ = [('iov_base', ctypes.c_void_p), ('iov_len', ctypes.c_size_t)]
+
+class _cmsghdr(ctypes.Structure):
+    _fields_ = [('cmsg_len', ctypes.c_size_t), ('cmsg_level', ctypes.c_int),
+        ('cmsg_type', ctypes.c_int)]
+
+class _cmsghdr_fd(ctypes.Structure):
+    _fields_ = [('hdr', _cmsghdr), ('fd', ctypes.c_int)]
+
+class _msghdr(ctypes.Structure):
+    _fields_ = [('msg_name', ctypes.c_void_p),
+        ('msg_namelen', ctypes.c_uint),
+        ('msg_iov', ctypes.POINTER(_iovec)),
+        ('msg_iovlen', ctypes.c_size_t),
+        ('msg_control', ctypes.c_void_p),
+        ('msg_controllen', ctypes.c_size_t),
+        ('msg_flags', ctypes.c_int)]
+
+SCM_RIGHTS = 1
+
+def send_fd(s, fd):
+    """Send @fd over the Unix socket @s as SCM_RIGHTS, along with one byte,
+    as Python 2 has no socket.sendmsg()"""
+    payload = ctypes.create_string_buffer('\0', 1)
+    iov = _iovec(ctypes.cast(payload, ctypes.c_void_p), 1)
+
+    control = _cmsghdr_fd()
+    control.hdr.cmsg_len = ctypes.sizeof(_cmsghdr) + ctypes.sizeof(ctypes.c_int)
+    control.hdr.cmsg_level = socket.SOL_SOCKET
+    control.hdr.cmsg_type = SCM_RIGHTS
+    control.fd = fd
+
+    msg = _msghdr()
+    msg.msg_iov = ctypes.pointer(iov)
+    msg.msg_iovlen = 1
+    msg.msg_control = ctypes.addressof(control)
+    msg.msg_controllen = ctypes.sizeof(control)
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    ret = libc.sendmsg(s.fileno(), ctypes.byref(msg), 0)
+    assert ret == 1, os.strerror(ctypes.get_errno())
+
 def platform_impls():
     impls = [
         (cs.SOCKET_ADDRESS_TYPE_IPV4, cs.SOCKET_ACCESS_CONTROL_LOCALHOST, ""),
@@ -567,7 +631,18 @@ def platform_impls():
 
     return impls
 
-def exec_file_transfer_test(test_cls, one_run=False):
+def fd_passing_impls():
+    if os.name != 'posix':
+        return []
+
+    return [(cs.SOCKET_ADDRESS_TYPE_UNIX, cs.SOCKET_ACCESS_CONTROL_FD_PASSING,
+        "")]
+
+def exec_file_transfer_test(test_cls, one_run=False, impls=None,
+        params=None):
+    if impls is None:
+        impls = platform_impls()
+
     for bytestream_cls  in [
             bytestream.BytestreamIBBMsg,
             bytestream.BytestreamS5B,
@@ -576,15 +651,15 @@ def exec_file_transfer_test(test_cls, one_run=False):
             bytestream.BytestreamSIFallbackS5WrongHash,
             bytestream.BytestreamS5BRelay,
             bytestream.BytestreamS5BRelayBugged]:
-        for addr_type, access_control, access_control_param in platform_impls():
+        for addr_type, access_control, access_control_param in impls:
             file = File()
             test = test_cls(bytestream_cls, file, addr_type, access_control, access_control_param)
-            exec_test(test.test)
+            exec_test(test.test, params=params)
 
             # test resume
             file.offset = 5
             test = test_cls(bytestream_cls, file, addr_type, access_control, access_control_param)
-            exec_test(test.test)
+            exec_test(test.test, params=params)
 
             if one_run:
                 return
@@ -187,6 +187,7 @@ def advertise_caps(q, bus, conn, stream, filters, expected_features, unexpected_
     assertSameElements(expected_caps, signaled_caps[self_handle])
 
     assertContains(ns.TP_FT_METADATA, namespaces)
+    assertContains(ns.TP_FT_PARALLEL, namespaces)
 
     for var in expected_features:
         assertContains(var, namespaces)
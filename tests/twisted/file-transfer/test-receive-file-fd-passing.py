@@ -0,0 +1,44 @@
+import os
+import tempfile
+
+import constants as cs
+from file_transfer_helper import exec_file_transfer_test, ReceiveFileTest, \
+    fd_passing_impls, send_fd
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+class ReceiveFileFdPassingTest(ReceiveFileTest):
+    def receive_file(self):
+        # the beginning of the file is already there when resuming
+        f = tempfile.NamedTemporaryFile()
+        f.write(self.file.data[:self.file.offset])
+        f.flush()
+
+        # Gabble must only write to the file it is passed
+        fd = os.open(f.name, os.O_WRONLY)
+
+        s = self.create_socket()
+        s.connect(self.address)
+        send_fd(s, fd)
+        os.close(fd)
+
+        # send the rest of the file
+        i = self.file.offset + 2
+        self.bytestream.send_data(self.file.data[i:])
+
+        self.q.expect('dbus-signal', signal='FileTransferStateChanged',
+            args=[cs.FT_STATE_COMPLETED, cs.FT_STATE_CHANGE_REASON_NONE])
+
+        # Gabble closes the socket once it is done with the file
+        assert s.recv(1) == ''
+
+        assert open(f.name).read() == self.file.data
+        f.close()
+
+if __name__ == '__main__':
+    exec_file_transfer_test(ReceiveFileFdPassingTest,
+        impls=fd_passing_impls())
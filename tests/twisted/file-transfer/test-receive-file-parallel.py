@@ -0,0 +1,138 @@
+import struct
+
+from twisted.words.xish import xpath
+
+from servicetest import EventPattern, assertEquals
+import constants as cs
+import ns
+from bytestream import BytestreamIBBMsg
+from file_transfer_helper import exec_file_transfer_test, ReceiveFileTest, \
+    File
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+RANGE_SIZE = 20
+
+def frame(offset, data):
+    return struct.pack('>QI', offset, len(data)) + data
+
+class ReceiveFileParallelTest(ReceiveFileTest):
+    """The ranges are sent over two stripes, in the wrong order"""
+
+    def __init__(self, bytestream_cls, file, address_type, access_control,
+            access_control_param):
+        file = File(data='0123456789abcdefghij' * 6)
+
+        ReceiveFileTest.__init__(self, bytestream_cls, file, address_type,
+            access_control, access_control_param)
+
+    def augment_si_offer(self, si):
+        parallel = si.addElement((ns.TP_FT_PARALLEL, 'parallel'))
+        parallel['streams'] = '2'
+
+    def accept_file(self):
+        self.address = self.ft_channel.AcceptFile(self.address_type,
+            self.access_control, self.access_control_param, 0,
+            byte_arrays=True)
+
+        state_event, iq_event = self.q.expect_many(
+            EventPattern('dbus-signal', signal='FileTransferStateChanged'),
+            EventPattern('stream-iq', iq_type='result'))
+
+        assertEquals([cs.FT_STATE_ACCEPTED, cs.FT_STATE_CHANGE_REASON_REQUESTED],
+            state_event.args)
+
+        # Gabble agrees to use two stripes
+        self.bytestream.check_si_reply(iq_event.stanza)
+        parallel = xpath.queryForNodes('/iq/si/parallel', iq_event.stanza)[0]
+        assertEquals(ns.TP_FT_PARALLEL, parallel.uri)
+        assertEquals('2', parallel['streams'])
+
+        self.bytestream.open_bytestream([],
+            [EventPattern('dbus-signal', signal='FileTransferStateChanged',
+                args=[cs.FT_STATE_OPEN, cs.FT_STATE_CHANGE_REASON_NONE])])
+
+        # offer the second stripe
+        self.stripe = BytestreamIBBMsg(self.stream, self.q, 'beta',
+            self.contact_full_jid, 'test@localhost/Resource', True)
+
+        iq, si = self.stripe.create_si_offer(ns.FILE_TRANSFER)
+        stripe = si.addElement((ns.TP_FT_PARALLEL, 'stripe'))
+        stripe['sid'] = self.bytestream.stream_id
+        iq.send()
+
+        iq_event = self.q.expect('stream-iq', iq_type='result',
+            predicate=lambda e: e.stanza['id'] == iq['id'])
+        self.stripe.check_si_reply(iq_event.stanza)
+
+        self.stripe.open_bytestream([], [
+            EventPattern('stream-iq', iq_type='result')])
+
+    def ranges(self):
+        data = self.file.data
+        return [(i, data[i:i + RANGE_SIZE])
+            for i in range(0, len(data), RANGE_SIZE)]
+
+    def receive_file(self):
+        s = self.create_socket()
+        s.connect(self.address)
+
+        ranges = self.ranges()
+
+        # the odd ranges arrive first, backwards, on the main stripe
+        for offset, data in reversed(ranges[1::2]):
+            self.bytestream.send_data(frame(offset, data))
+
+        # then the even ones on the other stripe
+        for offset, data in ranges[0::2]:
+            self.stripe.send_data(frame(offset, data))
+
+        self._read_file_from_socket(s)
+
+class ReceiveFileParallelStripeLostTest(ReceiveFileParallelTest):
+    """The stripe carrying the first range is closed before sending it"""
+
+    def receive_file(self):
+        s = self.create_socket()
+        s.connect(self.address)
+
+        for offset, data in self.ranges()[1:]:
+            self.bytestream.send_data(frame(offset, data))
+
+        self.stripe.close()
+        self.bytestream.close()
+
+        self.q.expect('dbus-signal', signal='FileTransferStateChanged',
+            args=[cs.FT_STATE_CANCELLED,
+                cs.FT_STATE_CHANGE_REASON_LOCAL_ERROR])
+
+        self.close_channel()
+        return True
+
+class ReceiveFileParallelRangeTooBigTest(ReceiveFileParallelTest):
+    """A range bigger than 64 KiB closes the bytestream"""
+
+    def receive_file(self):
+        s = self.create_socket()
+        s.connect(self.address)
+
+        # only the header of the range is needed to tell
+        self.stripe.send_data(struct.pack('>QI', 0, 64 * 1024 + 1))
+
+        self.q.expect('dbus-signal', signal='FileTransferStateChanged',
+            args=[cs.FT_STATE_CANCELLED,
+                cs.FT_STATE_CHANGE_REASON_LOCAL_ERROR])
+
+        self.close_channel()
+        return True
+
+if __name__ == '__main__':
+    for test_cls in [ReceiveFileParallelTest,
+            ReceiveFileParallelStripeLostTest,
+            ReceiveFileParallelRangeTooBigTest]:
+        # IBB over messages, without resuming
+        exec_file_transfer_test(test_cls, one_run=True)
@@ -0,0 +1,30 @@
+import tempfile
+
+from file_transfer_helper import exec_file_transfer_test, SendFileTest, \
+    fd_passing_impls, send_fd
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+class SendFileFdPassingTest(SendFileTest):
+    def provide_data(self, s):
+        # pass the whole file, Gabble has to seek it to InitialOffset itself
+        self.passed_file = tempfile.TemporaryFile()
+        self.passed_file.write(self.file.data)
+        self.passed_file.flush()
+        self.passed_file.seek(0)
+
+        send_fd(s, self.passed_file.fileno())
+        self.socket = s
+
+    def close_channel(self):
+        # Gabble closes the socket once it is done with the file
+        assert self.socket.recv(1) == ''
+
+        SendFileTest.close_channel(self)
+
+if __name__ == '__main__':
+    exec_file_transfer_test(SendFileFdPassingTest, impls=fd_passing_impls())
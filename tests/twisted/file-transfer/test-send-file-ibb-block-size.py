@@ -0,0 +1,97 @@
+"""
+Test IBB block size negotiation when sending a file:
+- Gabble proposes the largest blocks it sends, 32 KiB
+- it halves the block size each time the receiver replies with
+  <resource-constraint/>, down to 1 KiB
+- the data stanzas are not bigger than the negotiated block size
+"""
+
+from twisted.words.xish import domish, xpath
+
+from servicetest import assertEquals
+from gabbletest import acknowledge_iq, send_error_reply
+import ns
+from file_transfer_helper import exec_file_transfer_test, SendFileTest, File
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+MAX_BLOCK_SIZE = 32 * 1024
+MIN_BLOCK_SIZE = 1024
+
+class SendFileIBBBlockSizeTest(SendFileTest):
+    # the receiver refuses that many block sizes
+    refusals = 0
+
+    def __init__(self, bytestream_cls, file, address_type, access_control,
+            access_control_param):
+        big_file = File(data='0123456789abcdef' * 4096)
+        big_file.offset = file.offset
+
+        SendFileTest.__init__(self, bytestream_cls, big_file, address_type,
+            access_control, access_control_param)
+
+    def wait_ibb_open(self, block_size):
+        event = self.q.expect('stream-iq', iq_type='set', query_ns=ns.IBB,
+            query_name='open')
+        open = xpath.queryForNodes('/iq/open', event.stanza)[0]
+        assertEquals(self.bytestream.stream_id, open['sid'])
+        assertEquals(str(block_size), open['block-size'])
+
+        return event.stanza
+
+    def client_accept_file(self):
+        result, si = self.bytestream.create_si_reply(self.iq)
+        file_node = si.addElement((ns.FILE_TRANSFER, 'file'))
+        range = file_node.addElement('range')
+        range['offset'] = str(self.file.offset)
+        self.stream.send(result)
+
+        block_size = MAX_BLOCK_SIZE
+
+        for i in range(self.refusals):
+            iq = self.wait_ibb_open(block_size)
+
+            error = domish.Element((None, 'error'))
+            error['type'] = 'modify'
+            error.addElement((ns.STANZA, 'resource-constraint'))
+            send_error_reply(self.stream, iq, error)
+
+            block_size /= 2
+
+        iq = self.wait_ibb_open(block_size)
+        acknowledge_iq(self.stream, iq)
+
+        self.block_size = block_size
+
+    def send_file(self):
+        get_data = self.bytestream.get_data
+
+        def checked_get_data(size=0):
+            data = get_data(size)
+            assert len(data) <= self.block_size, len(data)
+            return data
+
+        self.bytestream.get_data = checked_get_data
+
+        SendFileTest.send_file(self)
+
+class SendFileIBBBlockSizeFallbackTest(SendFileIBBBlockSizeTest):
+    refusals = 2
+
+class SendFileIBBBlockSizeMinimumTest(SendFileIBBBlockSizeTest):
+    refusals = 5
+
+    def client_accept_file(self):
+        SendFileIBBBlockSizeTest.client_accept_file(self)
+        assertEquals(MIN_BLOCK_SIZE, self.block_size)
+
+if __name__ == '__main__':
+    for test_cls in [SendFileIBBBlockSizeTest,
+            SendFileIBBBlockSizeFallbackTest,
+            SendFileIBBBlockSizeMinimumTest]:
+        # IBB only
+        exec_file_transfer_test(test_cls, one_run=True)
@@ -0,0 +1,69 @@
+"""
+Test sending a file with transfer-channel-rate-limit set:
+- the file doesn't go out at once, even though Gabble reads it from the
+  socket in one go, but one share of the limit per scheduler tick
+- the data received never exceeds what the limit allows
+"""
+
+import time
+
+import dbus
+
+from file_transfer_helper import exec_file_transfer_test, SendFileTest, File
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+# TICK_MS in src/transfer-scheduler.c
+TICK = 0.1
+
+RATE_LIMIT = 20000
+# What the transfer can send each tick
+SHARE = int(RATE_LIMIT * TICK)
+
+class SendFileThrottledTest(SendFileTest):
+    def __init__(self, bytestream_cls, file, address_type, access_control,
+            access_control_param):
+        big_file = File(data='abcdefghij' * 4000)
+        big_file.offset = file.offset
+
+        SendFileTest.__init__(self, bytestream_cls, big_file, address_type,
+            access_control, access_control_param)
+
+    def send_file(self):
+        get_data = self.bytestream.get_data
+        received = []
+
+        def timed_get_data(size=0):
+            data = get_data(size)
+            received.append((time.time(), len(data)))
+            return data
+
+        self.bytestream.get_data = timed_get_data
+
+        SendFileTest.send_file(self)
+
+        start = received[0][0]
+        total = 0
+
+        for t, length in received:
+            total += length
+
+            # The transfer got a share when it was accepted, then one more
+            # at each tick since the first data came
+            ticks = int((t - start) / TICK) + 1
+            assert total <= SHARE * (ticks + 1), (t - start, total)
+
+        # It took several ticks to send it all: the first share went out
+        # straight away, and the first tick can follow just after
+        n_shares = (total + SHARE - 1) / SHARE
+        duration = received[-1][0] - start
+        assert duration >= (n_shares - 2) * TICK, (duration, n_shares)
+
+if __name__ == '__main__':
+    # IBB only
+    exec_file_transfer_test(SendFileThrottledTest, one_run=True,
+        params={'transfer-channel-rate-limit': dbus.UInt32(RATE_LIMIT)})
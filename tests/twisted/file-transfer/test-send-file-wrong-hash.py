@@ -0,0 +1,44 @@
+from servicetest import assertEquals
+import constants as cs
+from file_transfer_helper import exec_file_transfer_test, SendFileTest
+
+from config import FILE_TRANSFER_ENABLED
+
+if not FILE_TRANSFER_ENABLED:
+    print "NOTE: built with --disable-file-transfer"
+    raise SystemExit(77)
+
+class SendFileWrongHash(SendFileTest):
+    def __init__(self, bytestream_cls, file, address_type, access_control, access_control_param):
+        # the client announces the MD5 of some other file
+        file.hash = 'd41d8cd98f00b204e9800998ecf8427e'
+
+        SendFileTest.__init__(self, bytestream_cls, file, address_type, access_control, access_control_param)
+
+    def send_file(self):
+        if self.file.offset != 0:
+            # we can't check the hash of what we didn't send
+            SendFileTest.send_file(self)
+
+            assertEquals(cs.FILE_HASH_CHECK_RESULT_NOT_CHECKED,
+                self.ft_props.Get(cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
+                    'HashCheckResult'))
+            return
+
+        s = self.create_socket()
+        s.connect(self.address)
+        s.send(self.file.data)
+
+        self.q.expect('dbus-signal', signal='FileTransferStateChanged',
+            args=[cs.FT_STATE_CANCELLED, cs.FT_STATE_CHANGE_REASON_LOCAL_ERROR])
+
+        assertEquals(cs.FILE_HASH_CHECK_RESULT_MISMATCH,
+            self.ft_props.Get(cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
+                'HashCheckResult'))
+
+        self.channel.Close()
+        self.q.expect('dbus-signal', signal='Closed')
+        return True
+
+if __name__ == '__main__':
+    exec_file_transfer_test(SendFileWrongHash)
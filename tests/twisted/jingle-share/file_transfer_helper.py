@@ -270,6 +270,7 @@ class ReceiveFileTest(FileTransferTest):
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER, props
         assertSameSets(
             [ cs.CHANNEL_IFACE_FILE_TRANSFER_METADATA,
+              cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
             ], props[cs.INTERFACES])
         assert props[cs.TARGET_HANDLE] == self.handle, props
         assert props[cs.TARGET_ID] == self.target, props
@@ -289,7 +290,8 @@ class ReceiveFileTest(FileTransferTest):
         assert props[cs.FT_DESCRIPTION] == '', props
         assert props[cs.FT_DATE] == 0, props
         assert props[cs.FT_AVAILABLE_SOCKET_TYPES] == \
-            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
+            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST,
+                cs.SOCKET_ACCESS_CONTROL_FD_PASSING],
             cs.SOCKET_ADDRESS_TYPE_IPV4: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
             cs.SOCKET_ADDRESS_TYPE_IPV6: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST]}, \
             props[cs.FT_AVAILABLE_SOCKET_TYPES]
@@ -424,6 +426,7 @@ class SendFileTest(FileTransferTest):
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER
         assertSameSets(
             [ cs.CHANNEL_IFACE_FILE_TRANSFER_METADATA,
+              cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
             ], props[cs.INTERFACES])
         assert props[cs.TARGET_HANDLE] == self.handle
         assert props[cs.TARGET_ID] == self.target
@@ -442,7 +445,8 @@ class SendFileTest(FileTransferTest):
         assert props[cs.FT_DESCRIPTION] == self.file.description
         assert props[cs.FT_DATE] == self.file.date
         assert props[cs.FT_AVAILABLE_SOCKET_TYPES] == \
-            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
+            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST,
+                cs.SOCKET_ACCESS_CONTROL_FD_PASSING],
             cs.SOCKET_ADDRESS_TYPE_IPV4: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
             cs.SOCKET_ADDRESS_TYPE_IPV6: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST]}, \
             props[cs.FT_AVAILABLE_SOCKET_TYPES]
@@ -118,6 +118,7 @@ def test(q, bus, conn, stream):
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER, props
         assertSameSets(
             [ cs.CHANNEL_IFACE_FILE_TRANSFER_METADATA,
+              cs.CHANNEL_IFACE_GABBLE_HASH_CHECK,
             ], props[cs.INTERFACES])
         assert props[cs.TARGET_HANDLE] == 2L, props
         assert props[cs.TARGET_ID] == contact.replace("/Resource", ""), props
@@ -133,7 +134,8 @@ def test(q, bus, conn, stream):
         assert props[cs.FT_DESCRIPTION] == '', props
         assert props[cs.FT_DATE] == 0, props
         assert props[cs.FT_AVAILABLE_SOCKET_TYPES] == \
-            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
+            {cs.SOCKET_ADDRESS_TYPE_UNIX: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST,
+                cs.SOCKET_ACCESS_CONTROL_FD_PASSING],
             cs.SOCKET_ADDRESS_TYPE_IPV4: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST],
             cs.SOCKET_ADDRESS_TYPE_IPV6: [cs.SOCKET_ACCESS_CONTROL_LOCALHOST]}, \
             props[cs.FT_AVAILABLE_SOCKET_TYPES]
@@ -30,6 +30,7 @@
 
 #include "gabble.h"
 #include "connection.h"
+#include "tube-stream.h"
 #include "vcard-manager.h"
 #ifdef ENABLE_JINGLE_FILE_TRANSFER
 #include "gtalk-file-collection.h"
@@ -84,6 +85,8 @@ main (int argc,
   /* needed for test-avatar-async.py */
   gabble_vcard_manager_set_suspend_reply_timeout (3);
   gabble_vcard_manager_set_default_request_timeout (3);
+  /* needed for tubes/accept-private-stream-tube-pool.py */
+  gabble_tube_stream_set_pool_idle_timeout (2);
 
   /* hook up the fake DNS resolver that lets us divert A and SRV queries *
    * into our local cache before asking the real DNS                     */
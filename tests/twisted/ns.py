@@ -67,6 +67,7 @@ STANZA = "urn:ietf:params:xml:ns:xmpp-stanzas"
 STREAMS = "urn:ietf:params:xml:ns:xmpp-streams"
 TEMPPRES = "urn:xmpp:temppres:0"
 TUBES = 'http://telepathy.freedesktop.org/xmpp/tubes'
+TUBES_ZLIB = TUBES + '#zlib'
 MUJI = 'http://telepathy.freedesktop.org/xmpp/muji'
 VCARD_TEMP = 'vcard-temp'
 VCARD_TEMP_UPDATE = 'vcard-temp:x:update'
@@ -82,3 +83,4 @@ GOOGLE_SHARED_STATUS = 'google:shared-status'
 VERSION = 'jabber:iq:version'
 TP_FT_METADATA_SERVICE = 'http://telepathy.freedesktop.org/xmpp/file-transfer-service'
 TP_FT_METADATA = 'http://telepathy.freedesktop.org/xmpp/file-transfer-metadata'
+TP_FT_PARALLEL = 'http://telepathy.freedesktop.org/xmpp/file-transfer-parallel'
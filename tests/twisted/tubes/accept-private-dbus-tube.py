@@ -138,6 +138,8 @@ def test(q, bus, conn, stream, bytestream_cls, access_control):
     bytestream.check_si_reply(iq_event.stanza)
     tube = xpath.queryForNodes('/iq/si/tube[@xmlns="%s"]' % ns.TUBES, iq_event.stanza)
     assert len(tube) == 1
+    # we can receive several D-Bus messages in one write
+    assert tube[0]['batching'] == 'true'
 
     return_event = events[1]
     addr = return_event.value[0]
@@ -0,0 +1,196 @@
+"""
+Test pooled bytestreams of accepted private stream tubes:
+- an initiator accepting pooled bytestreams but not multiplexing gets an idle
+  bytestream negotiated after the first connection
+- the next connection reuses it, sending the activation byte first
+- an idle pooled bytestream is closed when no connection has been made for
+  a while
+"""
+
+import base64
+
+import dbus
+
+from servicetest import call_async, EventPattern, sync_dbus, assertEquals
+from gabbletest import exec_test, acknowledge_iq, make_result_iq
+
+from twisted.words.xish import domish, xpath
+import ns
+import constants as cs
+from bytestream import create_from_si_offer, BytestreamIBBMsg
+import tubetestutil as t
+
+bob_jid = 'bob@localhost/Bob'
+self_jid = 'test@localhost/Resource'
+stream_tube_id = 49
+
+# Sent on a pooled bytestream to bind it to a new connection
+POOL_ACTIVATE = '\x01'
+
+def receive_tube_offer(q, bus, conn, stream):
+    message = domish.Element(('jabber:client', 'message'))
+    message['to'] = self_jid
+    message['from'] = bob_jid
+    tube_node = message.addElement((ns.TUBES, 'tube'))
+    tube_node['type'] = 'stream'
+    tube_node['service'] = 'http'
+    tube_node['id'] = str(stream_tube_id)
+    stream.send(message)
+
+    def new_chan_predicate(e):
+        path, props = e.args[0][0]
+        return props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_STREAM_TUBE
+
+    new_sig = q.expect('dbus-signal', signal='NewChannels',
+                       predicate=new_chan_predicate)
+
+    path, props = new_sig.args[0][0]
+    new_tube_chan = bus.get_object(conn.bus_name, path)
+    new_tube_iface = dbus.Interface(new_tube_chan, cs.CHANNEL_TYPE_STREAM_TUBE)
+
+    return (new_tube_chan, new_tube_iface)
+
+def get_stream_node(si_event):
+    return xpath.queryForNodes('/iq/si/stream[@xmlns="%s"]' % ns.TUBES,
+        si_event.stanza)[0]
+
+def accept_pooled_bytestream(q, stream, si_event):
+    stream_node = get_stream_node(si_event)
+    assertEquals(str(stream_tube_id), stream_node['tube'])
+    assertEquals('true', stream_node['pool'])
+    assert not stream_node.hasAttribute('multiplex')
+
+    bytestream, profile = create_from_si_offer(stream, q, BytestreamIBBMsg,
+        si_event.stanza, self_jid)
+    result, si = bytestream.create_si_reply(si_event.stanza)
+    stream.send(result)
+
+    bytestream.wait_bytestream_open()
+
+    return bytestream
+
+def ibb_data(stream, ibb_event):
+    data = xpath.queryForNodes('/iq/data[@xmlns="%s"]' % ns.IBB,
+        ibb_event.stanza)[0]
+    make_result_iq(stream, ibb_event.stanza).send()
+    return base64.b64decode(str(data))
+
+def test(q, bus, conn, stream):
+    vcard_event, roster_event = q.expect_many(
+        EventPattern('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard'),
+        EventPattern('stream-iq', query_ns=ns.ROSTER))
+
+    acknowledge_iq(stream, vcard_event.stanza)
+
+    roster = roster_event.stanza
+    roster['type'] = 'result'
+    item = roster_event.query.addElement('item')
+    item['jid'] = 'bob@localhost'
+    item['subscription'] = 'both'
+    stream.send(roster)
+
+    presence = domish.Element(('jabber:client', 'presence'))
+    presence['from'] = bob_jid
+    presence['to'] = self_jid
+    c = presence.addElement('c')
+    c['xmlns'] = 'http://jabber.org/protocol/caps'
+    c['node'] = 'http://example.com/IPoolTubes'
+    c['ver'] = '1.0'
+    stream.send(presence)
+
+    event = q.expect('stream-iq', iq_type='get',
+        query_ns='http://jabber.org/protocol/disco#info', to=bob_jid)
+    result = make_result_iq(stream, event.stanza)
+    query = result.firstChildElement()
+    feature = query.addElement('feature')
+    feature['var'] = ns.TUBES
+    stream.send(result)
+
+    sync_dbus(bus, q, conn)
+
+    (tube_chan, tube_iface) = receive_tube_offer(q, bus, conn, stream)
+
+    address_type = cs.SOCKET_ADDRESS_TYPE_IPV4
+    access_control = cs.SOCKET_ACCESS_CONTROL_LOCALHOST
+
+    call_async(q, tube_iface, 'Accept', address_type, access_control, "",
+        byte_arrays=True)
+
+    accept_return_event, _ = q.expect_many(
+        EventPattern('dbus-return', method='Accept'),
+        EventPattern('dbus-signal', signal='TubeChannelStateChanged',
+            args=[2]))
+
+    address = accept_return_event.value[0]
+
+    # The first connection asks for a multiplexed bytestream. The initiator
+    # only accepts pooled ones.
+    socket_event, si_event, conn_id = t.connect_to_cm_socket(q, bob_jid,
+        address_type, address, access_control, "")
+    protocol1 = socket_event.protocol
+
+    assertEquals('true', get_stream_node(si_event)['multiplex'])
+
+    bytestream1, profile = create_from_si_offer(stream, q, BytestreamIBBMsg,
+        si_event.stanza, self_jid)
+    result, si = bytestream1.create_si_reply(si_event.stanza)
+    tube = si.addElement((ns.TUBES, 'tube'))
+    tube['pool'] = 'true'
+    stream.send(result)
+
+    bytestream1.wait_bytestream_open()
+
+    # Gabble negotiates an idle bytestream for the next connection
+    si_event = q.expect('stream-iq', iq_type='set', to=bob_jid,
+        query_ns=ns.SI, query_name='si')
+    pooled = accept_pooled_bytestream(q, stream, si_event)
+
+    # the first connection's data doesn't start with the activation byte
+    protocol1.sendData('hello one')
+    assertEquals('hello one', bytestream1.get_data(len('hello one')))
+
+    # The second connection goes through the idle bytestream, without any
+    # SI of its own. Another one is negotiated to refill the pool.
+    t.connect_socket(q, address_type, address, access_control, "")
+
+    socket_event, conn_event, activate_event, si_event = q.expect_many(
+        EventPattern('socket-connected'),
+        EventPattern('dbus-signal', signal='NewLocalConnection'),
+        EventPattern('stream-iq', iq_type='set', to=bob_jid,
+            query_ns=ns.IBB, query_name='data'),
+        EventPattern('stream-iq', iq_type='set', to=bob_jid,
+            query_ns=ns.SI, query_name='si'))
+    protocol2 = socket_event.protocol
+    assert conn_event.args[0] != conn_id
+
+    # the initiator is told to connect to its socket before any data
+    assertEquals(pooled.stream_id, xpath.queryForNodes(
+        '/iq/data[@xmlns="%s"]' % ns.IBB, activate_event.stanza)[0]['sid'])
+    assertEquals(POOL_ACTIVATE, ibb_data(stream, activate_event))
+
+    refill = accept_pooled_bytestream(q, stream, si_event)
+
+    protocol2.sendData('hello two')
+    assertEquals('hello two', pooled.get_data(len('hello two')))
+
+    pooled.send_data('hi two')
+    q.expect('socket-data', protocol=protocol2, data='hi two')
+
+    # No connection is made for a while: the idle bytestream is closed, not
+    # the ones in use
+    refill.wait_bytestream_closed()
+
+    pooled.send_data('still there')
+    q.expect('socket-data', protocol=protocol2, data='still there')
+
+    bytestream1.send_data('hi one')
+    q.expect('socket-data', protocol=protocol1, data='hi one')
+
+    tube_chan.Close()
+    q.expect_many(
+        EventPattern('dbus-signal', signal='Closed'),
+        EventPattern('dbus-signal', signal='ChannelClosed'))
+
+if __name__ == '__main__':
+    exec_test(test)
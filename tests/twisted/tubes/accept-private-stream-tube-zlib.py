@@ -0,0 +1,202 @@
+"""
+Test compressed private stream tubes:
+- the bytestream is compressed if the initiator has the capability
+- deflate and raw frames are decompressed
+- a frame inflating to too much data closes the bytestream
+- a frame announcing too big a payload closes the bytestream
+"""
+
+import struct
+import zlib
+
+import dbus
+
+from servicetest import call_async, EventPattern, sync_dbus, assertEquals
+from gabbletest import acknowledge_iq, make_result_iq
+
+from twisted.words.xish import domish, xpath
+import ns
+import constants as cs
+from bytestream import create_from_si_offer, announce_socks5_proxy
+import tubetestutil as t
+
+bob_jid = 'bob@localhost/Bob'
+stream_tube_id = 49
+
+FRAME_RAW = 0
+FRAME_DEFLATE = 1
+
+class Frames(object):
+    """Both directions of a compressed bytestream"""
+
+    def __init__(self, bytestream):
+        self.bytestream = bytestream
+        self.buf = ''
+        self.inflate = zlib.decompressobj(-zlib.MAX_WBITS)
+        self.deflate = zlib.compressobj(6, zlib.DEFLATED, -zlib.MAX_WBITS)
+
+    def _fill(self, size):
+        while len(self.buf) < size:
+            self.buf += self.bytestream.get_data()
+
+    def read(self):
+        self._fill(5)
+        type, length = struct.unpack('>BI', self.buf[:5])
+        self._fill(5 + length)
+        payload = self.buf[5:5 + length]
+        self.buf = self.buf[5 + length:]
+
+        if type == FRAME_DEFLATE:
+            return self.inflate.decompress(payload)
+
+        assertEquals(FRAME_RAW, type)
+        return payload
+
+    def send(self, type, payload):
+        self.bytestream.send_data(struct.pack('>BI', type, len(payload)) +
+            payload)
+
+    def send_deflate(self, data):
+        self.send(FRAME_DEFLATE, self.deflate.compress(data) +
+            self.deflate.flush(zlib.Z_SYNC_FLUSH))
+
+def receive_tube_offer(q, bus, conn, stream):
+    global stream_tube_id
+    message = domish.Element(('jabber:client', 'message'))
+    message['to'] = 'test@localhost/Resource'
+    message['from'] = bob_jid
+    tube_node = message.addElement((ns.TUBES, 'tube'))
+    tube_node['type'] = 'stream'
+    tube_node['service'] = 'http'
+    stream_tube_id += 1
+    tube_node['id'] = str(stream_tube_id)
+    stream.send(message)
+
+    def new_chan_predicate(e):
+        path, props = e.args[0][0]
+        return props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_STREAM_TUBE
+
+    new_sig = q.expect('dbus-signal', signal='NewChannels',
+                       predicate=new_chan_predicate)
+
+    path, props = new_sig.args[0][0]
+    new_tube_chan = bus.get_object(conn.bus_name, path)
+    new_tube_iface = dbus.Interface(new_tube_chan, cs.CHANNEL_TYPE_STREAM_TUBE)
+
+    return (new_tube_chan, new_tube_iface)
+
+def open_compressed_bytestream(q, stream, bytestream_cls, address_type,
+        address, access_control, access_control_param):
+    event_socket, event_iq, conn_id = t.connect_to_cm_socket(q, bob_jid,
+        address_type, address, access_control, access_control_param)
+
+    bytestream, profile = create_from_si_offer(stream, q, bytestream_cls,
+        event_iq.stanza, 'test@localhost/Resource')
+
+    # Gabble asks for compression
+    stream_node = xpath.queryForNodes('/iq/si/stream[@xmlns="%s"]' %
+        ns.TUBES, event_iq.stanza)[0]
+    assertEquals('zlib', stream_node['compression'])
+
+    result, si = bytestream.create_si_reply(event_iq.stanza)
+    tube = si.addElement((ns.TUBES, 'tube'))
+    tube['compression'] = 'zlib'
+    stream.send(result)
+
+    bytestream.wait_bytestream_open()
+
+    return event_socket.protocol, Frames(bytestream), conn_id
+
+def test(q, bus, conn, stream, bytestream_cls,
+        address_type, access_control, access_control_param):
+    vcard_event, roster_event, disco_event = q.expect_many(
+        EventPattern('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard'),
+        EventPattern('stream-iq', query_ns=ns.ROSTER),
+        EventPattern('stream-iq', to='localhost', query_ns=ns.DISCO_ITEMS))
+
+    acknowledge_iq(stream, vcard_event.stanza)
+
+    announce_socks5_proxy(q, stream, disco_event.stanza)
+
+    roster = roster_event.stanza
+    roster['type'] = 'result'
+    item = roster_event.query.addElement('item')
+    item['jid'] = 'bob@localhost'
+    item['subscription'] = 'both'
+    stream.send(roster)
+
+    # Bob can do compressed tubes
+    presence = domish.Element(('jabber:client', 'presence'))
+    presence['from'] = bob_jid
+    presence['to'] = 'test@localhost/Resource'
+    c = presence.addElement('c')
+    c['xmlns'] = 'http://jabber.org/protocol/caps'
+    c['node'] = 'http://example.com/ICompressTubes'
+    c['ver'] = '1.0'
+    stream.send(presence)
+
+    event = q.expect('stream-iq', iq_type='get',
+        query_ns='http://jabber.org/protocol/disco#info', to=bob_jid)
+    result = make_result_iq(stream, event.stanza)
+    query = result.firstChildElement()
+    for var in [ns.TUBES, ns.TUBES_ZLIB]:
+        feature = query.addElement('feature')
+        feature['var'] = var
+    stream.send(result)
+
+    sync_dbus(bus, q, conn)
+
+    (tube_chan, tube_iface) = receive_tube_offer(q, bus, conn, stream)
+
+    call_async(q, tube_iface, 'Accept', address_type, access_control,
+        access_control_param, byte_arrays=True)
+
+    accept_return_event, _ = q.expect_many(
+        EventPattern('dbus-return', method='Accept'),
+        EventPattern('dbus-signal', signal='TubeChannelStateChanged',
+            args=[2]))
+
+    address = accept_return_event.value[0]
+
+    protocol, frames, conn_id = open_compressed_bytestream(q, stream,
+        bytestream_cls, address_type, address, access_control,
+        access_control_param)
+
+    # what Gabble sends is compressed
+    protocol.sendData('hello initiator')
+    data = ''
+    while len(data) < len('hello initiator'):
+        data += frames.read()
+    assertEquals('hello initiator', data)
+
+    frames.send_deflate('hello joiner')
+    e = q.expect('socket-data', protocol=protocol)
+    assertEquals('hello joiner', e.data)
+
+    frames.send(FRAME_RAW, 'not compressed')
+    e = q.expect('socket-data', protocol=protocol)
+    assertEquals('not compressed', e.data)
+
+    # a small frame inflating to 1 MiB
+    frames.send_deflate('\0' * (1024 * 1024))
+    e = q.expect('dbus-signal', signal='ConnectionClosed')
+    assertEquals(conn_id, e.args[0])
+
+    # another connection, announcing a frame bigger than 64 KiB
+    protocol, frames, conn_id = open_compressed_bytestream(q, stream,
+        bytestream_cls, address_type, address, access_control,
+        access_control_param)
+
+    frames.bytestream.send_data(struct.pack('>BI', FRAME_RAW, 64 * 1024 + 1))
+    e = q.expect('dbus-signal', signal='ConnectionClosed')
+    assertEquals(conn_id, e.args[0])
+
+    tube_chan.Close()
+    q.expect_many(
+        EventPattern('dbus-signal', signal='Closed'),
+        EventPattern('dbus-signal', signal='ChannelClosed'))
+
+if __name__ == '__main__':
+    t.exec_tube_test(test, cs.SOCKET_ADDRESS_TYPE_IPV4,
+        cs.SOCKET_ACCESS_CONTROL_LOCALHOST, "")
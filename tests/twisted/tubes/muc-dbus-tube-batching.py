@@ -0,0 +1,157 @@
+"""
+Test batching of D-Bus messages in MUC D-Bus tubes:
+- we announce that we can receive several D-Bus messages in a MUC message
+- a MUC message with several D-Bus messages is split before they're
+  delivered
+- a participant not announcing "batching" gets one D-Bus message per MUC
+  message
+"""
+
+import base64
+import struct
+
+from dbus.connection import Connection
+from dbus.lowlevel import SignalMessage
+
+from servicetest import call_async, EventPattern, assertEquals, \
+    watch_tube_signals, wrap_channel
+from gabbletest import exec_test, acknowledge_iq, elem
+import ns
+import constants as cs
+import tubetestutil as t
+
+from twisted.words.xish import xpath
+
+from mucutil import join_muc
+
+muc = 'chat2@conf.localhost'
+bob_bus_name = ':2.Ym9i'
+
+def pad(data, alignment):
+    return data + '\0' * (-len(data) % alignment)
+
+def marshal_signal(sender, serial, value):
+    """A little-endian foo.bar.baz signal with UInt32 @value as argument"""
+    fields = ''
+    for code, sig, s in [(1, 'o', '/'), (2, 's', 'foo.bar'), (3, 's', 'baz'),
+            (7, 's', sender), (8, 'g', 'u')]:
+        # the fields array starts 16 bytes in, so it's aligned like the
+        # message
+        fields = pad(fields, 8) + struct.pack('<BB', code, 1) + sig + '\0'
+        if sig == 'g':
+            fields += struct.pack('<B', len(s)) + s + '\0'
+        else:
+            fields = pad(fields, 4) + struct.pack('<I', len(s)) + s + '\0'
+
+    body = struct.pack('<I', value)
+    header = struct.pack('<cBBBIII', 'l', 4, 0, 1, len(body), serial,
+        len(fields)) + fields
+
+    return pad(header, 8) + body
+
+def split_messages(data):
+    """The D-Bus messages in @data"""
+    messages = []
+
+    while data:
+        if data[0] == 'l':
+            body_length, = struct.unpack('<I', data[4:8])
+            fields_length, = struct.unpack('<I', data[12:16])
+        else:
+            body_length, = struct.unpack('>I', data[4:8])
+            fields_length, = struct.unpack('>I', data[12:16])
+
+        length = 16 + fields_length + (-fields_length % 8) + body_length
+        assert length <= len(data), (length, len(data))
+        messages.append(data[:length])
+        data = data[length:]
+
+    return messages
+
+def test(q, bus, conn, stream):
+    iq_event = q.expect('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard')
+
+    acknowledge_iq(stream, iq_event.stanza)
+
+    request = {
+        cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_DBUS_TUBE,
+        cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+        cs.TARGET_ID: muc,
+        cs.DBUS_TUBE_SERVICE_NAME: 'com.example.TestCase',
+    }
+    join_muc(q, bus, conn, stream, muc, request=request)
+
+    e = q.expect('dbus-signal', signal='NewChannels')
+    path, _ = e.args[0][0]
+    tube_chan = wrap_channel(bus.get_object(conn.bus_name, path), 'DBusTube')
+
+    call_async(q, tube_chan.DBusTube, 'Offer', {},
+        cs.SOCKET_ACCESS_CONTROL_CREDENTIALS)
+
+    presence_event, return_event = q.expect_many(
+        EventPattern('stream-presence', to='%s/test' % muc,
+            predicate=lambda e: t.presence_contains_tube(e)),
+        EventPattern('dbus-return', method='Offer'))
+
+    tube_node = xpath.queryForNodes('/presence/tubes/tube',
+        presence_event.stanza)[0]
+    assertEquals('true', tube_node['batching'])
+    dbus_stream_id = tube_node['stream-id']
+    dbus_tube_id = tube_node['id']
+
+    tube = Connection(return_event.value[0])
+    watch_tube_signals(q, tube)
+
+    # Bob joins the tube, without saying he can receive batches
+    presence = elem('presence', from_='%s/bob' % muc, to=muc)(
+        elem('x', xmlns=ns.MUC_USER),
+        elem('tubes', xmlns=ns.TUBES)(
+            elem('tube', type='dbus', initiator='%s/test' % muc,
+                service='com.example.TestCase', id=str(dbus_tube_id))))
+    tube_node = xpath.queryForNodes('/presence/tubes/tube', presence)[0]
+    tube_node['stream-id'] = dbus_stream_id
+    tube_node['dbus-name'] = bob_bus_name
+    stream.send(presence)
+
+    q.expect('dbus-signal', signal='DBusNamesChanged',
+        interface=cs.CHANNEL_TYPE_DBUS_TUBE)
+
+    # Bob sends two signals in one MUC message
+    data = marshal_signal(bob_bus_name, 1, 1) + \
+        marshal_signal(bob_bus_name, 2, 2)
+    message = elem('message', from_='%s/bob' % muc, to=muc,
+        type='groupchat')(
+            elem('data', xmlns=ns.MUC_BYTESTREAM, sid=dbus_stream_id)(
+                unicode(base64.b64encode(data))))
+    stream.send(message)
+
+    e = q.expect('tube-signal', signal='baz')
+    assertEquals([1], e.args)
+    e = q.expect('tube-signal', signal='baz')
+    assertEquals([2], e.args)
+
+    # Signals sent in a row aren't batched for Bob
+    n_signals = 5
+    for i in range(n_signals):
+        signal = SignalMessage('/', 'foo.bar', 'baz')
+        signal.append(i, signature='u')
+        tube.send_message(signal)
+    tube.flush()
+
+    for i in range(n_signals):
+        e = q.expect('stream-message', to=muc, message_type='groupchat')
+        data_node = xpath.queryForNodes('/message/data[@xmlns="%s"]' %
+            ns.MUC_BYTESTREAM, e.stanza)[0]
+        assertEquals(dbus_stream_id, data_node['sid'])
+
+        messages = split_messages(base64.b64decode(str(data_node)))
+        assertEquals(1, len(messages))
+
+    tube_chan.Channel.Close()
+    q.expect_many(
+        EventPattern('dbus-signal', signal='Closed'),
+        EventPattern('dbus-signal', signal='ChannelClosed'))
+
+if __name__ == '__main__':
+    exec_test(test)
@@ -0,0 +1,90 @@
+"""
+Test that the data of a MUC D-Bus tube doesn't delay other stanzas:
+- the server stops reading while a big signal is sent through the tube
+- presence sent in the meantime arrives before the end of the signal
+"""
+
+import time
+
+from dbus.connection import Connection
+from dbus.lowlevel import SignalMessage
+
+from servicetest import call_async, EventPattern, wrap_channel
+from gabbletest import exec_test, acknowledge_iq
+import ns
+import constants as cs
+import tubetestutil as t
+
+from twisted.words.xish import xpath
+
+from mucutil import join_muc
+
+muc = 'chat2@conf.localhost'
+
+def test(q, bus, conn, stream):
+    iq_event = q.expect('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard')
+
+    acknowledge_iq(stream, iq_event.stanza)
+
+    request = {
+        cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_DBUS_TUBE,
+        cs.TARGET_HANDLE_TYPE: cs.HT_ROOM,
+        cs.TARGET_ID: muc,
+        cs.DBUS_TUBE_SERVICE_NAME: 'com.example.TestCase',
+    }
+    join_muc(q, bus, conn, stream, muc, request=request)
+
+    e = q.expect('dbus-signal', signal='NewChannels')
+    path, _ = e.args[0][0]
+    tube_chan = wrap_channel(bus.get_object(conn.bus_name, path), 'DBusTube')
+
+    call_async(q, tube_chan.DBusTube, 'Offer', {},
+        cs.SOCKET_ACCESS_CONTROL_CREDENTIALS)
+
+    _, return_event = q.expect_many(
+        EventPattern('stream-presence', to='%s/test' % muc,
+            predicate=lambda e: t.presence_contains_tube(e)),
+        EventPattern('dbus-return', method='Offer'))
+
+    tube = Connection(return_event.value[0])
+
+    # 2 MiB are split in 47 stanzas, much more than the socket buffers
+    # between Gabble and the server can hold while the server doesn't read
+    signal = SignalMessage('/', 'foo.bar', 'baz')
+    signal.append('a' * (2 * 1024 * 1024), signature='s')
+    tube.send_message(signal)
+    tube.flush()
+
+    # Blocking the reactor stops the server from reading, so Gabble has to
+    # queue up what it sends
+    time.sleep(2)
+
+    # the order in which the server reads the stanzas
+    received = []
+    stream.addObserver('/message/data[@xmlns="%s"]' % ns.MUC_BYTESTREAM,
+        lambda stanza: received.append(stanza.data['frag']))
+    stream.addObserver('/presence/show',
+        lambda stanza: received.append('presence'))
+
+    call_async(q, conn.SimplePresence, 'SetPresence', 'away', 'busy')
+    time.sleep(1)
+
+    def is_last(e):
+        data = xpath.queryForNodes('/message/data[@xmlns="%s"]' %
+            ns.MUC_BYTESTREAM, e.stanza)
+        return data is not None and data[0]['frag'] == 'last'
+
+    q.expect_many(
+        EventPattern('stream-presence', predicate=lambda e:
+            xpath.queryForNodes('/presence/show', e.stanza) is not None),
+        EventPattern('stream-message', to=muc, message_type='groupchat',
+            predicate=is_last))
+
+    # only the bulk stanzas already handed to the porter, or buffered by the
+    # kernel, went first
+    assert 'presence' in received, received
+    assert received.index('presence') < received.index('last'), received
+
+if __name__ == '__main__':
+    exec_test(test)
@@ -38,6 +38,8 @@ def alice_accepts_tube(q, stream, iq_event, dbus_tube_id, bytestream_cls):
     assert tube['initiator'] == 'test@localhost'
     assert tube['service'] == 'com.example.TestCase'
     assert tube['id'] == str(dbus_tube_id)
+    # we can receive several D-Bus messages in one write
+    assert tube['batching'] == 'true'
 
     params = {}
     parameter_nodes = xpath.queryForNodes('/tube/parameters/parameter', tube)
@@ -50,7 +52,7 @@ def alice_accepts_tube(q, stream, iq_event, dbus_tube_id, bytestream_cls):
                       'u': ('uint', '123'),
                      }
 
-    # Alice accepts the tube
+    # Alice accepts the tube, without asking for batching
     result, si = bytestream.create_si_reply(iq)
     si.addElement((ns.TUBES, 'tube'))
     stream.send(result)
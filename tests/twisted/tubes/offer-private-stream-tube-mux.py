@@ -0,0 +1,237 @@
+"""
+Test the connections to an offered private stream tube being multiplexed
+over one bytestream:
+- Gabble accepts the multiplexed bytestream
+- a connection is made to the local socket for each channel opened
+- the data of the channels can be interleaved
+- closing a channel, on either side, only closes its connection
+- a peer sending more than it has been granted on a channel gets the
+  bytestream closed
+"""
+
+import struct
+
+import dbus
+
+from servicetest import call_async, EventPattern, sync_dbus, assertEquals
+from gabbletest import exec_test, acknowledge_iq, sync_stream, make_result_iq
+import constants as cs
+import ns
+import tubetestutil as t
+from bytestream import BytestreamS5B
+
+from twisted.words.xish import domish, xpath
+
+FRAME_OPEN = 1
+FRAME_DATA = 2
+FRAME_CLOSE = 3
+FRAME_WINDOW = 4
+
+# what a side can send on a channel before being granted more
+CHANNEL_WINDOW = 256 * 1024
+
+bob_full_jid = 'bob@localhost/Bob'
+self_full_jid = 'test@localhost/Resource'
+
+class Mux(object):
+    """The frames of a multiplexed bytestream"""
+
+    def __init__(self, bytestream):
+        self.bytestream = bytestream
+        self.buf = ''
+
+    def _fill(self, size):
+        while len(self.buf) < size:
+            self.buf += self.bytestream.get_data()
+
+    def read(self):
+        """The next frame, other than WINDOW ones"""
+        while True:
+            self._fill(7)
+            type, id, length = struct.unpack('>BIH', self.buf[:7])
+            self._fill(7 + length)
+            payload = self.buf[7:7 + length]
+            self.buf = self.buf[7 + length:]
+
+            if type != FRAME_WINDOW:
+                return type, id, payload
+
+    def send(self, type, id, payload=''):
+        self.bytestream.send_data(struct.pack('>BIH', type, id,
+            len(payload)) + payload)
+
+def offer_tube(q, bus, conn, stream, address):
+    vcard_event, roster_event = q.expect_many(
+        EventPattern('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard'),
+        EventPattern('stream-iq', query_ns=ns.ROSTER))
+
+    acknowledge_iq(stream, vcard_event.stanza)
+
+    roster = roster_event.stanza
+    roster['type'] = 'result'
+    item = roster_event.query.addElement('item')
+    item['jid'] = 'bob@localhost'
+    item['subscription'] = 'both'
+    stream.send(roster)
+
+    presence = domish.Element(('jabber:client', 'presence'))
+    presence['from'] = bob_full_jid
+    presence['to'] = self_full_jid
+    c = presence.addElement('c')
+    c['xmlns'] = 'http://jabber.org/protocol/caps'
+    c['node'] = 'http://example.com/ICantBelieveItsNotTelepathy'
+    c['ver'] = '1.2.3'
+    stream.send(presence)
+
+    event = q.expect('stream-iq', iq_type='get',
+        query_ns='http://jabber.org/protocol/disco#info',
+        to=bob_full_jid)
+    result = make_result_iq(stream, event.stanza)
+    query = result.firstChildElement()
+    feature = query.addElement('feature')
+    feature['var'] = ns.TUBES
+    stream.send(result)
+
+    sync_stream(q, stream)
+    sync_dbus(bus, q, conn)
+
+    bob_handle = conn.get_contact_handle_sync('bob@localhost')
+
+    path, _ = conn.Requests.CreateChannel(
+            {cs.CHANNEL_TYPE: cs.CHANNEL_TYPE_STREAM_TUBE,
+             cs.TARGET_HANDLE_TYPE: cs.HT_CONTACT,
+             cs.TARGET_HANDLE: bob_handle,
+             cs.STREAM_TUBE_SERVICE: 'echo',
+            })
+    tube_chan = bus.get_object(conn.bus_name, path)
+    tube_iface = dbus.Interface(tube_chan, cs.CHANNEL_TYPE_STREAM_TUBE)
+
+    call_async(q, tube_iface, 'Offer', cs.SOCKET_ADDRESS_TYPE_IPV4, address,
+        cs.SOCKET_ACCESS_CONTROL_LOCALHOST, {})
+
+    msg_event = q.expect('stream-message', to=bob_full_jid)
+    tube = xpath.queryForNodes('/message/tube[@xmlns="%s"]' % ns.TUBES,
+        msg_event.stanza)[0]
+
+    return tube_chan, tube['id']
+
+def open_mux(q, stream, bytestream_cls, tube_id):
+    bytestream = bytestream_cls(stream, q, 'alpha', bob_full_jid,
+        self_full_jid, True)
+    iq, si = bytestream.create_si_offer(ns.TUBES)
+    stream_node = si.addElement((ns.TUBES, 'stream'))
+    stream_node['tube'] = tube_id
+    stream_node['multiplex'] = 'true'
+    stream.send(iq)
+
+    si_reply_event, _ = q.expect_many(
+        EventPattern('stream-iq', iq_type='result'),
+        EventPattern('dbus-signal', signal='TubeChannelStateChanged',
+            args=[cs.TUBE_STATE_OPEN]))
+
+    bytestream.check_si_reply(si_reply_event.stanza)
+    tube = xpath.queryForNodes('/iq/si/tube[@xmlns="%s"]' % ns.TUBES,
+        si_reply_event.stanza)[0]
+    assertEquals('true', tube['multiplex'])
+
+    bytestream.open_bytestream()
+
+    return Mux(bytestream)
+
+def open_channel(q, mux, id):
+    mux.send(FRAME_OPEN, id)
+
+    conn_event, socket_event = q.expect_many(
+        EventPattern('dbus-signal', signal='NewRemoteConnection'),
+        EventPattern('socket-connected'))
+
+    _, _, conn_id = conn_event.args
+    return socket_event.protocol, conn_id
+
+def test(q, bus, conn, stream, bytestream_cls):
+    address = t.set_up_echo(q, cs.SOCKET_ADDRESS_TYPE_IPV4)
+    tube_chan, tube_id = offer_tube(q, bus, conn, stream, address)
+    mux = open_mux(q, stream, bytestream_cls, tube_id)
+
+    # two connections over the same bytestream
+    protocol1, conn_id1 = open_channel(q, mux, 1)
+    protocol2, conn_id2 = open_channel(q, mux, 2)
+    assert conn_id1 != conn_id2
+
+    # their data is interleaved
+    mux.send(FRAME_DATA, 1, 'Hello One')
+    mux.send(FRAME_DATA, 2, 'Hello Two')
+    mux.send(FRAME_DATA, 1, ' Again')
+
+    q.expect('socket-data', protocol=protocol2, data='Hello Two')
+
+    # the echo service lowercases what it gets
+    received = {1: '', 2: ''}
+    while received[1] != 'hello one again' or received[2] != 'hello two':
+        type, id, payload = mux.read()
+        assertEquals(FRAME_DATA, type)
+        received[id] += payload
+
+    # the peer closes the first connection, the second one is still there
+    mux.send(FRAME_CLOSE, 1)
+    e = q.expect('dbus-signal', signal='ConnectionClosed')
+    assertEquals([conn_id1, cs.CONNECTION_LOST], e.args[:2])
+    q.expect('socket-disconnected', protocol=protocol1)
+
+    # data for the channel closed is dropped
+    mux.send(FRAME_DATA, 1, 'Too Late')
+    mux.send(FRAME_DATA, 2, 'Still There')
+    q.expect('socket-data', protocol=protocol2, data='Still There')
+    assertEquals((FRAME_DATA, 2, 'still there'), mux.read())
+
+    # a third connection, interleaved with the second one closing locally
+    protocol3, conn_id3 = open_channel(q, mux, 3)
+    protocol2.transport.loseConnection()
+
+    e = q.expect('dbus-signal', signal='ConnectionClosed')
+    assertEquals([conn_id2, cs.CANCELLED], e.args[:2])
+    assertEquals((FRAME_CLOSE, 2, ''), mux.read())
+
+    mux.send(FRAME_DATA, 3, 'Hello Three')
+    assertEquals((FRAME_DATA, 3, 'hello three'), mux.read())
+
+    tube_chan.Close(dbus_interface=cs.CHANNEL)
+    q.expect_many(
+        EventPattern('dbus-signal', signal='Closed'),
+        EventPattern('dbus-signal', signal='ChannelClosed'))
+
+    t.cleanup()
+
+def test_window_exceeded(q, bus, conn, stream):
+    # the service doesn't read, so Gabble can't grant any more
+    address = t.set_up_echo(q, cs.SOCKET_ADDRESS_TYPE_IPV4,
+        block_reading=True)
+    tube_chan, tube_id = offer_tube(q, bus, conn, stream, address)
+    mux = open_mux(q, stream, BytestreamS5B, tube_id)
+
+    protocol1, conn_id1 = open_channel(q, mux, 1)
+    protocol2, conn_id2 = open_channel(q, mux, 2)
+
+    # Much more than the window and the socket buffers, without waiting
+    # for WINDOW frames
+    chunk = 'x' * 60000
+    for i in range(64 * CHANNEL_WINDOW / len(chunk)):
+        mux.send(FRAME_DATA, 1, chunk)
+
+    # all the connections go with the bytestream
+    e1, e2 = q.expect_many(
+        EventPattern('dbus-signal', signal='ConnectionClosed',
+            predicate=lambda e: e.args[0] == conn_id1),
+        EventPattern('dbus-signal', signal='ConnectionClosed',
+            predicate=lambda e: e.args[0] == conn_id2))
+    assertEquals(cs.CONNECTION_LOST, e1.args[1])
+    assertEquals(cs.CONNECTION_LOST, e2.args[1])
+
+    mux.bytestream.wait_bytestream_closed()
+
+    t.cleanup()
+
+if __name__ == '__main__':
+    t.exec_tube_test(test)
+    exec_test(test_window_exceeded)
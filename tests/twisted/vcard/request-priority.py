@@ -0,0 +1,45 @@
+"""
+Test that a vCard a client is waiting for isn't queued behind background
+avatar requests.
+"""
+
+from servicetest import call_async, sync_dbus, assertEquals
+from gabbletest import exec_test, acknowledge_iq, make_result_iq
+
+def test(q, bus, conn, stream):
+    event = q.expect('stream-iq', to=None, query_ns='vcard-temp',
+            query_name='vCard')
+    acknowledge_iq(stream, event.stanza)
+
+    # Fill the pipeline with avatar requests, with more of them waiting
+    contacts = ['contact%d@example.com' % i for i in range(20)]
+    handles = conn.get_contact_handles_sync(contacts)
+    conn.Avatars.RequestAvatars(handles)
+
+    in_flight = []
+    for i in range(10):
+        event = q.expect('stream-iq', query_ns='vcard-temp',
+            query_name='vCard')
+        in_flight.append(event.stanza)
+
+    assertEquals(contacts[:10], [iq['to'] for iq in in_flight])
+
+    # A client now asks about a contact whose vCard is still waiting: it
+    # should be requested next rather than after the other avatars
+    call_async(q, conn.ContactInfo, 'RequestContactInfo', handles[15])
+    sync_dbus(bus, q, conn)
+
+    stream.send(make_result_iq(stream, in_flight[0]))
+
+    event = q.expect('stream-iq', query_ns='vcard-temp', query_name='vCard')
+    assertEquals(contacts[15], event.stanza['to'])
+
+    result = make_result_iq(stream, event.stanza)
+    result.firstChildElement().addElement('FN', content='Fifteen')
+    stream.send(result)
+
+    event = q.expect('dbus-return', method='RequestContactInfo')
+    assertEquals([(u'fn', [], [u'Fifteen'])], event.value[0])
+
+if __name__ == '__main__':
+    exec_test(test)